@@ -38,7 +38,33 @@ void stats::run(const arguments_t& args, proxy::server& server, command_service&
 
 void stats::print_stats(proxy::server& server) {
   out::user::stream("Connections:\t\t", server.num_connections(), out::manip::endl);
+  out::user::stream("Pending Connections:\t", server.num_pending_connections(), out::manip::endl);
+  out::user::stream("Rejected Connections:\t", server.num_rejected_connections(), out::manip::endl);
+  out::user::stream("Concurrency Limit:\t", server.concurrency_limit(), out::manip::endl);
   out::user::stream("SSL Certificates:\t", server.num_ssl_certificates(), out::manip::endl);
+  out::user::stream("Idle Upstream:\t\t", server.num_idle_upstream_connections(), out::manip::endl);
+  out::user::stream("Reused Upstream:\t", server.num_reused_upstream_connections(), out::manip::endl);
+  out::user::stream("DNS Cache Hits:\t\t", server.num_dns_cache_hits(), out::manip::endl);
+  out::user::stream("DNS Cache Misses:\t", server.num_dns_cache_misses(), out::manip::endl);
+  out::user::stream("HTTP/2 Upstream:\t", server.num_http2_upstream_sessions(), out::manip::endl);
+  out::user::stream("Multiplexed Upstream:\t", server.num_multiplexed_upstream_requests(), out::manip::endl);
+  out::user::stream("Cache Hits:\t\t", server.num_cache_hits(), out::manip::endl);
+  out::user::stream("Cache Misses:\t\t", server.num_cache_misses(), out::manip::endl);
+  out::user::stream("Cache Revalidations:\t", server.num_cache_revalidations(), out::manip::endl);
+  out::user::stream("Collapsed Requests:\t", server.num_collapsed_requests(), out::manip::endl);
+  out::user::stream("Buffer Pool Used:\t", server.buffer_pool_used_bytes(), " bytes", out::manip::endl);
+  out::user::stream("Buffer Pool Reserved:\t", server.buffer_pool_reserved_bytes(), " bytes", out::manip::endl);
+  out::user::stream("Memory Used:\t\t", server.memory_used_bytes(), " bytes", out::manip::endl);
+  out::user::stream("Memory Limit:\t\t", server.memory_limit(), " bytes", out::manip::endl);
+  out::user::stream("Shed Connections:\t", server.num_shed_connections(), out::manip::endl);
+  out::user::stream("Idle Connections:\t", server.num_idle_connections(), out::manip::endl);
+  out::user::stream("Evicted Idle:\t\t", server.num_evicted_idle_connections(), out::manip::endl);
+  for (std::size_t i = 0; i < server.num_threads(); ++i) {
+    proxy::concurrent::io_context_pool::context_stats thread = server.thread_stats(i);
+    out::user::stream("Thread ", i, ":\t\t", thread.connections, " connections, ", thread.handlers_run, " handlers, ",
+                      std::chrono::duration_cast<std::chrono::milliseconds>(thread.busy_time).count(), " ms busy, ",
+                      thread.lag.count(), " us lag", out::manip::endl);
+  }
 }
 
 }  // namespace input::commands
@@ -7,6 +7,8 @@
 
 #include "events.hpp"
 
+#include <string_view>
+
 #include "aether/util/console.hpp"
 
 namespace interceptors::examples::events {
@@ -48,6 +50,22 @@ void on_http_error(connection_flow& flow, http::exchange& exch) {
   out::safe_error::stream("HTTP error: ", flow.error, '\n');
 }
 
+void on_http_request_head(connection_flow& flow, http::exchange& exch) {
+  http::request& req = exch.request();
+  out::safe_console::stream("Streaming ", req.method(), " request body to ", req.target().absolute_string(), '\n');
+}
+
+void on_http_response_head(connection_flow& flow, http::exchange& exch) {
+  http::response& res = exch.response();
+  out::safe_console::stream("Streaming ", res.status(), " response body from ",
+                            exch.request().target().absolute_string(), '\n');
+}
+
+void on_http_body_chunk(connection_flow& flow, http::exchange& exch) {
+  std::string_view source = exch.body_chunk_from_response() ? "response" : "request";
+  out::safe_console::stream(exch.body_chunk().size(), " bytes of ", source, " body\n");
+}
+
 void on_tunnel_start(connection_flow& flow) {
   out::safe_console::stream("TCP tunnel initiated with ", flow.server.host(), " (", flow.server.endpoint(), ")\n");
 }
@@ -98,6 +116,9 @@ void attach_events(proxy::server& server) {
   server.interceptors().http.attach(intercept::http_event::websocket_handshake, on_http_websocket_handshake);
   server.interceptors().http.attach(intercept::http_event::response, on_http_response);
   server.interceptors().http.attach(intercept::http_event::error, on_http_error);
+  server.interceptors().http.attach(intercept::http_event::request_head, on_http_request_head);
+  server.interceptors().http.attach(intercept::http_event::response_head, on_http_response_head);
+  server.interceptors().http.attach(intercept::http_event::body_chunk, on_http_body_chunk);
 
   server.interceptors().tunnel.attach(intercept::tunnel_event::start, on_tunnel_start);
   server.interceptors().tunnel.attach(intercept::tunnel_event::stop, on_tunnel_stop);
@@ -40,6 +40,15 @@ void on_http_response(connection_flow& flow, http::exchange& exch);
 // Fires when an error occurs when handling an HTTP connection.
 void on_http_error(connection_flow& flow, http::exchange& exch);
 
+// Fires when an HTTP request head is received and its body is going to be streamed.
+void on_http_request_head(connection_flow& flow, http::exchange& exch);
+
+// Fires when an HTTP response head is received and its body is going to be streamed.
+void on_http_response_head(connection_flow& flow, http::exchange& exch);
+
+// Fires for every piece of a streamed HTTP body.
+void on_http_body_chunk(connection_flow& flow, http::exchange& exch);
+
 // Fires when a TCP tunnel is initiated on the connection.
 void on_tunnel_start(connection_flow& flow);
 
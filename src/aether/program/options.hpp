@@ -11,6 +11,7 @@
 #include <boost/asio/ssl.hpp>
 #include <string>
 
+#include "aether/proxy/concurrent/io_context_pool.hpp"
 #include "aether/proxy/types.hpp"
 #include "aether/util/console.hpp"
 
@@ -32,11 +33,43 @@ struct options {
   bool help;
   bool ipv6;
   int thread_pool_size;
+  proxy::concurrent::selection_policy io_context_selection;
+  bool pin_threads;
+  bool single_threaded_contexts;
   int connection_queue_limit;
+  bool reuse_port;
+  std::size_t accept_batch_size;
+  std::size_t flow_pool_size;
   std::size_t connection_service_limit;
+  bool adaptive_concurrency;
+  proxy::milliseconds connection_queue_timeout{0};
   proxy::milliseconds timeout{0};
   proxy::milliseconds tunnel_timeout{0};
+  bool splice_tunnels;
   std::size_t body_size_limit;
+  std::size_t header_size_limit;
+  bool buffer_pool;
+  bool buffer_pool_huge_pages;
+  std::size_t io_uring_registered_bytes;
+  std::size_t memory_limit;
+  std::size_t connection_memory_limit;
+  bool stream_bodies;
+  std::size_t upstream_max_idle_per_host;
+  proxy::milliseconds upstream_idle_timeout{0};
+  proxy::milliseconds dns_cache_ttl{0};
+  proxy::milliseconds dns_negative_ttl{0};
+  proxy::milliseconds dns_stale_ttl{0};
+  std::size_t dns_cache_size;
+  proxy::milliseconds connection_attempt_delay{0};
+  bool http2;
+  std::size_t http2_max_concurrent_streams;
+  bool http2_upstream;
+  bool collapsed_forwarding;
+  bool cache;
+  std::size_t cache_memory_size;
+  std::size_t cache_max_object_size;
+  std::string cache_dir;
+  std::size_t cache_disk_size;
 
   bool ssl_passthrough;
   bool ssl_passthrough_strict;
@@ -46,6 +79,7 @@ struct options {
   bool ssl_negotiate_ciphers;
   bool ssl_negotiate_alpn;
   bool ssl_supply_server_chain_to_client;
+  bool ssl_kernel_offload;
 
   std::string ssl_cert_store_properties;
   std::string ssl_cert_store_dir;
@@ -18,6 +18,8 @@
 #include <thread>
 #include <utility>
 
+#include "aether/proxy/concurrent/io_context_pool.hpp"
+#include "aether/proxy/connection/buffer_pools.hpp"
 #include "aether/proxy/tls/openssl/ssl_method.hpp"
 #include "aether/proxy/tls/x509/client_store.hpp"
 #include "aether/proxy/tls/x509/server_store.hpp"
@@ -78,6 +80,34 @@ util::result<void, util::generic_error> options_factory::add_options() {
       .validate = [](auto t) { return t > 0; },
   }));
 
+  RETURN_IF_ERROR(parser_.add_option(command_line_option<std::string, proxy::concurrent::selection_policy>{
+      .name = "thread-selection",
+      .destination = &options_.io_context_selection,
+      .required = false,
+      .default_value = std::string(
+          proxy::concurrent::selection_policy_to_string(proxy::concurrent::selection_policy::round_robin)),
+      .description = "How new connections are assigned to threads: round-robin, least-connections, or least-lag.",
+      .validate = [](const std::string& s) { return proxy::concurrent::string_to_selection_policy(s).is_ok(); },
+      .converter = [](const std::string& s) { return proxy::concurrent::string_to_selection_policy(s).ok(); },
+  }));
+
+  RETURN_IF_ERROR(parser_.add_option(command_line_option<bool>{
+      .name = "pin-threads",
+      .destination = &options_.pin_threads,
+      .required = false,
+      .default_value = false,
+      .description = "Bind each server thread to a single CPU.",
+  }));
+
+  RETURN_IF_ERROR(parser_.add_option(command_line_option<bool>{
+      .name = "single-threaded-contexts",
+      .destination = &options_.single_threaded_contexts,
+      .required = false,
+      .default_value = false,
+      .description = "Treat each thread's event loop as strictly single-threaded, dropping strands and calling I/O "
+                     "handlers as soon as operations complete.",
+  }));
+
   // TODO: max_listen_connections not linking.
   RETURN_IF_ERROR(parser_.add_option(command_line_option<int>{
       .name = "connection-limit",
@@ -88,6 +118,33 @@ util::result<void, util::generic_error> options_factory::add_options() {
       .validate = [](auto q) { return q > 0; },
   }));
 
+  RETURN_IF_ERROR(parser_.add_option(command_line_option<bool>{
+      .name = "reuse-port",
+      .destination = &options_.reuse_port,
+      .required = false,
+      .default_value = false,
+      .description = "Give every thread a listening socket of its own with SO_REUSEPORT, so the system spreads new "
+                     "connections across threads and each connection is handled on the thread that accepted it.",
+  }));
+
+  RETURN_IF_ERROR(parser_.add_option(command_line_option<std::size_t>{
+      .name = "accept-batch-size",
+      .destination = &options_.accept_batch_size,
+      .required = false,
+      .default_value = 16,
+      .description = "Maximum number of waiting connections accepted each time a listening socket becomes readable.",
+      .validate = [](auto b) { return b > 0; },
+  }));
+
+  RETURN_IF_ERROR(parser_.add_option(command_line_option<std::size_t>{
+      .name = "flow-pool-size",
+      .destination = &options_.flow_pool_size,
+      .required = false,
+      .default_value = 256,
+      .description = "Maximum number of finished connection flows kept on each thread to be reused for new "
+                     "connections. Use 0 to create every flow from scratch.",
+  }));
+
   RETURN_IF_ERROR(parser_.add_option(command_line_option<std::size_t>{
       .name = "connection-service-limit",
       .destination = &options_.connection_service_limit,
@@ -96,6 +153,25 @@ util::result<void, util::generic_error> options_factory::add_options() {
       .description = "Number of connections that can be serviced by the proxy at any given time.",
   }));
 
+  RETURN_IF_ERROR(parser_.add_option(command_line_option<bool>{
+      .name = "adaptive-concurrency",
+      .destination = &options_.adaptive_concurrency,
+      .required = false,
+      .default_value = false,
+      .description = "Adjust the number of connections serviced at once to the observed upstream latency and event "
+                     "loop lag, up to the connection service limit.",
+  }));
+
+  RETURN_IF_ERROR(parser_.add_option(command_line_option<std::size_t, proxy::milliseconds>{
+      .name = "connection-queue-timeout",
+      .destination = &options_.connection_queue_timeout,
+      .required = false,
+      .default_value = 5000,
+      .description = "Milliseconds a connection may wait for service before it is answered with 503 and closed. Set "
+                     "to 0 to let connections wait indefinitely.",
+      .converter = [](auto t) { return proxy::milliseconds(t); },
+  }));
+
   RETURN_IF_ERROR(parser_.add_option(command_line_option<std::size_t, proxy::milliseconds>{
       .name = "timeout",
       .destination = &options_.timeout,
@@ -116,6 +192,15 @@ util::result<void, util::generic_error> options_factory::add_options() {
       .converter = [](auto t) { return proxy::milliseconds(t); },
   }));
 
+  RETURN_IF_ERROR(parser_.add_option(command_line_option<bool>{
+      .name = "splice-tunnels",
+      .destination = &options_.splice_tunnels,
+      .required = false,
+      .default_value = true,
+      .description = "Relay tunnels that are not TLS-terminated inside the kernel with splice(), without copying bytes "
+                     "through the proxy. Only available on Linux.",
+  }));
+
   RETURN_IF_ERROR(parser_.add_option(command_line_option<std::size_t>{
       .name = "body-size-limit",
       .destination = &options_.body_size_limit,
@@ -125,6 +210,214 @@ util::result<void, util::generic_error> options_factory::add_options() {
       .validate = [](auto l) { return l > 4096; },
   }));
 
+  RETURN_IF_ERROR(parser_.add_option(command_line_option<std::size_t>{
+      .name = "header-size-limit",
+      .destination = &options_.header_size_limit,
+      .required = false,
+      .default_value = 65536,
+      .description = "Maximum size (in bytes) of a HTTP message's request or status line and headers.",
+      .validate = [](auto l) { return l > 0; },
+  }));
+
+  RETURN_IF_ERROR(parser_.add_option(command_line_option<bool>{
+      .name = "buffer-pool",
+      .destination = &options_.buffer_pool,
+      .required = false,
+      .default_value = true,
+      .description = "Take connection buffers from a pool of fixed-size chunks for each thread, rather than from the "
+                     "heap.",
+  }));
+
+  RETURN_IF_ERROR(parser_.add_option(command_line_option<bool>{
+      .name = "buffer-pool-huge-pages",
+      .destination = &options_.buffer_pool_huge_pages,
+      .required = false,
+      .default_value = false,
+      .description = "Back the connection buffer pools with huge pages when the system provides them.",
+  }));
+
+  RETURN_IF_ERROR(parser_.add_option(command_line_option<std::size_t>{
+      .name = "io-uring-registered-bytes",
+      .destination = &options_.io_uring_registered_bytes,
+      .required = false,
+      .default_value = 0,
+      .description = "Bytes of each thread's buffer pool to register with io_uring as fixed buffers. Requires a build "
+                     "with IO_URING=1 and the buffer pool.",
+      .validate = [](auto b) { return b == 0 || proxy::connection::buffer_pools::registered_buffers_supported; },
+  }));
+
+  RETURN_IF_ERROR(parser_.add_option(command_line_option<std::size_t>{
+      .name = "memory-limit",
+      .destination = &options_.memory_limit,
+      .required = false,
+      .default_value = 0,
+      .description = "Bytes that connection buffers, TLS sessions, and HTTP bodies may hold in total before new "
+                     "connections are turned away. 0 means no limit.",
+  }));
+
+  RETURN_IF_ERROR(parser_.add_option(command_line_option<std::size_t>{
+      .name = "connection-memory-limit",
+      .destination = &options_.connection_memory_limit,
+      .required = false,
+      .default_value = 1024 * 1024,
+      .description = "Bytes a connection may have buffered for its peer before reads are paused. Reads resume once "
+                     "half of them have been written.",
+      .validate = [](auto b) { return b > 0; },
+  }));
+
+  RETURN_IF_ERROR(parser_.add_option(command_line_option<bool>{
+      .name = "stream-bodies",
+      .destination = &options_.stream_bodies,
+      .required = false,
+      .default_value = false,
+      .description = "Forward HTTP bodies as they arrive, rather than buffering them in memory. Interceptors can still "
+                     "ask for a whole body to be buffered.",
+  }));
+
+  RETURN_IF_ERROR(parser_.add_option(command_line_option<std::size_t>{
+      .name = "upstream-max-idle-per-host",
+      .destination = &options_.upstream_max_idle_per_host,
+      .required = false,
+      .default_value = 8,
+      .description = "Maximum number of idle server connections kept for reuse for each host, port, and TLS "
+                     "configuration, per thread. Use 0 to disable connection reuse across clients.",
+  }));
+
+  RETURN_IF_ERROR(parser_.add_option(command_line_option<std::size_t, proxy::milliseconds>{
+      .name = "upstream-idle-timeout",
+      .destination = &options_.upstream_idle_timeout,
+      .required = false,
+      .default_value = 30000,
+      .description = "Milliseconds an idle server connection is kept for reuse before it is closed.",
+      .validate = [](auto t) { return t != 0; },
+      .converter = [](auto t) { return proxy::milliseconds(t); },
+  }));
+
+  RETURN_IF_ERROR(parser_.add_option(command_line_option<std::size_t, proxy::milliseconds>{
+      .name = "dns-cache-ttl",
+      .destination = &options_.dns_cache_ttl,
+      .required = false,
+      .default_value = 60000,
+      .description = "Milliseconds a DNS answer is cached for. Use 0 to disable the DNS cache.",
+      .converter = [](auto t) { return proxy::milliseconds(t); },
+  }));
+
+  RETURN_IF_ERROR(parser_.add_option(command_line_option<std::size_t, proxy::milliseconds>{
+      .name = "dns-negative-ttl",
+      .destination = &options_.dns_negative_ttl,
+      .required = false,
+      .default_value = 5000,
+      .description = "Milliseconds a failed DNS lookup is cached for. Use 0 to not cache failures.",
+      .converter = [](auto t) { return proxy::milliseconds(t); },
+  }));
+
+  RETURN_IF_ERROR(parser_.add_option(command_line_option<std::size_t, proxy::milliseconds>{
+      .name = "dns-stale-ttl",
+      .destination = &options_.dns_stale_ttl,
+      .required = false,
+      .default_value = 30000,
+      .description = "Milliseconds an expired DNS answer is still served for while it is refreshed in the background.",
+      .converter = [](auto t) { return proxy::milliseconds(t); },
+  }));
+
+  RETURN_IF_ERROR(parser_.add_option(command_line_option<std::size_t>{
+      .name = "dns-cache-size",
+      .destination = &options_.dns_cache_size,
+      .required = false,
+      .default_value = 4096,
+      .description = "Maximum number of hosts kept in the DNS cache.",
+      .validate = [](auto s) { return s > 0; },
+  }));
+
+  RETURN_IF_ERROR(parser_.add_option(command_line_option<std::size_t, proxy::milliseconds>{
+      .name = "connection-attempt-delay",
+      .destination = &options_.connection_attempt_delay,
+      .required = false,
+      .default_value = 250,
+      .description = "Milliseconds to wait for a connection attempt to a server address before racing it with an "
+                     "attempt to the next address.",
+      .validate = [](auto t) { return t != 0; },
+      .converter = [](auto t) { return proxy::milliseconds(t); },
+  }));
+
+  RETURN_IF_ERROR(parser_.add_option(command_line_option<bool>{
+      .name = "http2",
+      .destination = &options_.http2,
+      .required = false,
+      .default_value = false,
+      .description = "Speak HTTP/2 to intercepted TLS clients that offer it. Requests are forwarded to servers over "
+                     "HTTP/1.1.",
+  }));
+
+  RETURN_IF_ERROR(parser_.add_option(command_line_option<std::size_t>{
+      .name = "http2-max-concurrent-streams",
+      .destination = &options_.http2_max_concurrent_streams,
+      .required = false,
+      .default_value = 100,
+      .description = "Maximum number of requests an HTTP/2 client may have in progress at once on one connection.",
+      .validate = [](auto t) { return t > 0; },
+  }));
+
+  RETURN_IF_ERROR(parser_.add_option(command_line_option<bool>{
+      .name = "http2-upstream",
+      .destination = &options_.http2_upstream,
+      .required = false,
+      .default_value = false,
+      .description = "Send HTTPS requests to servers that support HTTP/2 as streams of a single shared connection per "
+                     "server and thread, rather than on a connection of their own.",
+  }));
+
+  RETURN_IF_ERROR(parser_.add_option(command_line_option<bool>{
+      .name = "collapsed-forwarding",
+      .destination = &options_.collapsed_forwarding,
+      .required = false,
+      .default_value = false,
+      .description = "Send only one of several identical GET or HEAD requests that are waiting on a server at the same "
+                     "time, and answer the others with its response if it may be shared.",
+  }));
+
+  RETURN_IF_ERROR(parser_.add_option(command_line_option<bool>{
+      .name = "cache",
+      .destination = &options_.cache,
+      .required = false,
+      .default_value = false,
+      .description = "Store cacheable responses to GET requests and answer later requests with them, as a shared cache "
+                     "following RFC 9111.",
+  }));
+
+  RETURN_IF_ERROR(parser_.add_option(command_line_option<std::size_t>{
+      .name = "cache-memory-size",
+      .destination = &options_.cache_memory_size,
+      .required = false,
+      .default_value = 64 * 1024 * 1024,
+      .description = "Maximum bytes of cached responses kept in memory.",
+  }));
+
+  RETURN_IF_ERROR(parser_.add_option(command_line_option<std::size_t>{
+      .name = "cache-max-object-size",
+      .destination = &options_.cache_max_object_size,
+      .required = false,
+      .default_value = 8 * 1024 * 1024,
+      .description = "Maximum body size (in bytes) of a response to cache.",
+  }));
+
+  RETURN_IF_ERROR(parser_.add_option(command_line_option<std::string>{
+      .name = "cache-dir",
+      .destination = &options_.cache_dir,
+      .required = false,
+      .default_value = "",
+      .description = "Folder for cached response bodies, so responses evicted from memory can still be served from "
+                     "disk. Responses are only cached in memory if empty. Files already in the folder are removed.",
+  }));
+
+  RETURN_IF_ERROR(parser_.add_option(command_line_option<std::size_t>{
+      .name = "cache-disk-size",
+      .destination = &options_.cache_disk_size,
+      .required = false,
+      .default_value = 1024 * 1024 * 1024,
+      .description = "Maximum bytes of cached response bodies kept in the cache folder.",
+  }));
+
   RETURN_IF_ERROR(parser_.add_option(command_line_option<bool>{
       .name = "ssl-passthrough-strict",
       .destination = &options_.ssl_passthrough_strict,
@@ -199,6 +492,16 @@ util::result<void, util::generic_error> options_factory::add_options() {
       .description = "Supply the upstream server's certificate chain to the proxy client.",
   }));
 
+  RETURN_IF_ERROR(parser_.add_option(command_line_option<bool>{
+      .name = "ssl-kernel-offload",
+      .destination = &options_.ssl_kernel_offload,
+      .required = false,
+      .default_value = false,
+      .description = "Let the kernel encrypt TLS records of intercepted connections (kTLS) when it supports the "
+                     "negotiated cipher, so TLS tunnels can also be relayed with splice(). Falls back to OpenSSL "
+                     "otherwise. Only available on Linux with OpenSSL 3.0 or later.",
+  }));
+
   RETURN_IF_ERROR(parser_.add_option(command_line_option<std::string>{
       .name = "ssl-certificate-properties",
       .destination = &options_.ssl_cert_store_properties,
@@ -7,6 +7,9 @@
 
 #include "acceptor.hpp"
 
+#include <sys/socket.h>
+
+#include <boost/asio.hpp>
 #include <boost/lexical_cast.hpp>
 #include <functional>
 #include <memory>
@@ -18,6 +21,20 @@
 
 namespace proxy {
 
+namespace {
+
+#ifdef SO_REUSEPORT
+using reuse_port = boost::asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>;
+#endif
+
+#ifdef SO_INCOMING_CPU
+using incoming_cpu = boost::asio::detail::socket_option::integer<SOL_SOCKET, SO_INCOMING_CPU>;
+#endif
+
+}  // namespace
+
+acceptor::listener::listener(boost::asio::io_context& ioc, bool local) : ioc(ioc), acc(ioc), local(local) {}
+
 result<std::unique_ptr<acceptor>> acceptor::create(server_components& components) {
   std::unique_ptr<acceptor> acc(new acceptor(components));
   RETURN_IF_ERROR(acc->initialize());
@@ -28,59 +45,120 @@ acceptor::acceptor(server_components& components)
     : options_(components.options),
       io_contexts_(components.io_contexts),
       connection_manager_(components.connection_manager),
+      idle_connections_(components.idle_connections),
       endpoint_(options_.ipv6 ? boost::asio::ip::tcp::v6() : boost::asio::ip::tcp::v4(), options_.port),
-      acc_(io_contexts_.get_io_context(), endpoint_),
       is_stopped_(false) {}
 
 result<void> acceptor::initialize() {
+  if (options_.reuse_port) {
+#ifndef SO_REUSEPORT
+    return error::acceptor_error("SO_REUSEPORT is not supported on this system. Use --reuse-port=false.");
+#endif
+    for (std::size_t i = 0; i < io_contexts_.size(); ++i) {
+      listeners_.push_back(std::make_unique<listener>(io_contexts_.get_io_context(i), true));
+      RETURN_IF_ERROR(open_listener(*listeners_.back(), i));
+    }
+  } else {
+    listeners_.push_back(std::make_unique<listener>(io_contexts_.get_io_context(), false));
+    RETURN_IF_ERROR(open_listener(*listeners_.back(), 0));
+  }
+  return util::ok;
+}
+
+result<void> acceptor::open_listener(listener& l, std::size_t index) {
   boost::system::error_code ec;
+  l.acc.open(endpoint_.protocol(), ec);
+  if (ec != boost::system::errc::success) {
+    return error::acceptor_error(out::string::stream("Could not open acceptor socket: ", ec.message()));
+  }
   if (options_.ipv6) {
-    acc_.set_option(boost::asio::ip::v6_only(false), ec);
-    acc_.set_option(boost::asio::socket_base::send_buffer_size(64 * 1024));
+    l.acc.set_option(boost::asio::ip::v6_only(false), ec);
+    l.acc.set_option(boost::asio::socket_base::send_buffer_size(64 * 1024));
     if (ec != boost::system::errc::success) {
       return error::ipv6_error(out::string::stream("Could not configure dual stack socket (error code = ", ec.value(),
                                                    "). Use --ipv6=false to disable IPv6."));
     }
   }
-  acc_.set_option(boost::asio::ip::tcp::acceptor::reuse_address(true), ec);
+  l.acc.set_option(boost::asio::ip::tcp::acceptor::reuse_address(true), ec);
   if (ec != boost::system::errc::success) {
     return error::acceptor_error("Could not configure socket option SO_REUSEADDR.");
   }
+#ifdef SO_REUSEPORT
+  if (options_.reuse_port) {
+    l.acc.set_option(reuse_port(true), ec);
+    if (ec != boost::system::errc::success) {
+      return error::acceptor_error("Could not configure socket option SO_REUSEPORT.");
+    }
+#ifdef SO_INCOMING_CPU
+    // Steers connections that arrive on a CPU to the listener of the same index, which keeps a connection's packets
+    // and its handling together when threads are pinned. It is only a hint, so failure is ignored.
+    l.acc.set_option(incoming_cpu(static_cast<int>(index)), ec);
+#endif
+  }
+#endif
+  l.acc.bind(endpoint_, ec);
+  if (ec != boost::system::errc::success) {
+    return error::acceptor_error(out::string::stream("Could not bind to port ", options_.port, ": ", ec.message()));
+  }
+  // Accepts are only attempted once the socket is readable, so they must never block.
+  l.acc.non_blocking(true, ec);
   return util::ok;
 }
 
 void acceptor::start() {
-  acc_.listen(options_.connection_queue_limit);
-  init_accept();
+  for (const std::unique_ptr<listener>& l : listeners_) {
+    l->acc.listen(options_.connection_queue_limit);
+    init_accept(*l);
+  }
 }
 
 void acceptor::stop() { is_stopped_.store(true); }
 
-void acceptor::init_accept() {
-  auto& new_connection = connection_manager_.new_connection(io_contexts_.get_io_context());
-  acc_.async_accept(new_connection.client.socket(), [this, &new_connection](const boost::system::error_code& error) {
-    if (result<void> res = on_accept(new_connection, error); res.is_err()) {
-      out::safe_error::log(res);
-    }
-  });
+void acceptor::init_accept(listener& l) {
+  l.acc.async_wait(boost::asio::ip::tcp::acceptor::wait_read,
+                   [this, &l](const boost::system::error_code& error) { on_accept_ready(l, error); });
 }
 
-result<void> acceptor::on_accept(connection::connection_flow& connection, const boost::system::error_code& error) {
+void acceptor::on_accept_ready(listener& l, const boost::system::error_code& error) {
+  if (error == boost::asio::error::operation_aborted) {
+    return;
+  }
   if (error != boost::system::errc::success) {
-    connection_manager_.destroy(connection);
-    init_accept();
-    return error::acceptor_error(out::string::stream(error.message(), " (", error.to_string(), ')'));
+    out::safe_error::log(error::acceptor_error(out::string::stream(error.message(), " (", error.value(), ')')));
+  } else if (boost::system::error_code accept_error = accept_batch(l);
+             accept_error != boost::system::errc::success && accept_error != boost::asio::error::would_block &&
+             accept_error != boost::asio::error::try_again) {
+    if (accept_error == boost::asio::error::no_descriptors ||
+        accept_error == boost::system::errc::too_many_files_open_in_system) {
+      // Idle keep-alive clients are the cheapest connections to lose, so the oldest make room for new ones.
+      out::safe_warn::log("Out of file descriptors, closing idle connections");
+      idle_connections_.close_oldest(options_.accept_batch_size);
+    }
+    out::safe_error::log(
+        error::acceptor_error(out::string::stream(accept_error.message(), " (", accept_error.value(), ')')));
   }
-  connection.client.set_connected();
-  connection_manager_.start(connection);
 
   if (!is_stopped_.load()) {
-    init_accept();
+    init_accept(l);
   } else {
-    acc_.close();
+    l.acc.close();
   }
+}
 
-  return util::ok;
+boost::system::error_code acceptor::accept_batch(listener& l) {
+  boost::system::error_code error;
+  for (std::size_t i = 0; i < options_.accept_batch_size; ++i) {
+    if (!l.spare) {
+      l.spare = connection_manager_.new_connection(l.local ? l.ioc : io_contexts_.get_io_context());
+    }
+    l.acc.accept(l.spare->client.socket(), error);
+    if (error != boost::system::errc::success) {
+      return error;
+    }
+    l.spare->client.set_connected();
+    connection_manager_.start(std::move(l.spare));
+  }
+  return error;
 }
 
 }  // namespace proxy
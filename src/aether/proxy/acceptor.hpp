@@ -10,6 +10,7 @@
 #include <atomic>
 #include <boost/asio.hpp>
 #include <memory>
+#include <vector>
 
 #include "aether/proxy/connection/connection_flow.hpp"
 #include "aether/proxy/error/error.hpp"
@@ -21,6 +22,13 @@ namespace proxy {
 // Wrapping class for boost::asio::ip::tcp::acceptor.
 //
 // Accepts new connections.
+//
+// By default, a single listening socket accepts every connection and hands them out to the io_contexts in turn. With
+// SO_REUSEPORT, every io_context has a listening socket of its own, so the kernel spreads connections across threads
+// and each connection stays on the thread that accepted it.
+//
+// Each time a listening socket becomes readable, all connections waiting on it are accepted at once, up to the batch
+// size.
 class acceptor {
  public:
   static result<std::unique_ptr<acceptor>> create(server_components& components);
@@ -29,12 +37,24 @@ class acceptor {
 
   void start();
   void stop();
-  void init_accept();
-  result<void> on_accept(connection::connection_flow& connection, const boost::system::error_code& error);
 
   inline boost::asio::ip::tcp::endpoint get_endpoint() const { return endpoint_; }
 
  private:
+  // A single listening socket.
+  struct listener {
+    boost::asio::io_context& ioc;
+    boost::asio::ip::tcp::acceptor acc;
+
+    // Accepted connections are handled on the listener's own io_context, rather than handed out in turn.
+    bool local;
+
+    // A flow created for an accept that found no waiting connection, kept for the next one.
+    std::unique_ptr<connection::connection_flow> spare;
+
+    listener(boost::asio::io_context& ioc, bool local);
+  };
+
   acceptor(server_components& components);
   acceptor(const acceptor& other) = delete;
   acceptor& operator=(const acceptor& other) = delete;
@@ -42,13 +62,21 @@ class acceptor {
   acceptor& operator=(acceptor&& other) noexcept = delete;
 
   result<void> initialize();
+  result<void> open_listener(listener& l, std::size_t index);
+
+  void init_accept(listener& l);
+  void on_accept_ready(listener& l, const boost::system::error_code& error);
+
+  // Accepts connections waiting on the listener, returning the error that ended the batch.
+  boost::system::error_code accept_batch(listener& l);
 
   program::options& options_;
   concurrent::io_context_pool& io_contexts_;
   connection::connection_manager& connection_manager_;
+  connection::idle_connections& idle_connections_;
 
   boost::asio::ip::tcp::endpoint endpoint_;
-  boost::asio::ip::tcp::acceptor acc_;
+  std::vector<std::unique_ptr<listener>> listeners_;
   std::atomic<bool> is_stopped_;
 };
 
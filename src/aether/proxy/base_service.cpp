@@ -21,6 +21,7 @@ namespace proxy {
 
 base_service::base_service(connection::connection_flow& flow, connection_handler& owner, server_components& components)
     : ioc_(flow.io_context()),
+      components_(components),
       options_(components.options),
       flow_(flow),
       owner_(owner),
@@ -34,16 +35,18 @@ result<void> base_service::set_server(std::string host, port_t port) {
     if (flow_.server.connected()) {
       interceptors_.server.run(intercept::server_event::disconnect, flow_);
     }
-    bool is_forbidden =
-        std::find(forbidden_hosts.begin(), forbidden_hosts.end(), flow_.target_host()) != forbidden_hosts.end() &&
-        flow_.target_port() == options_.port;
-    if (is_forbidden) {
+    if (is_self_connect(flow_.target_host(), flow_.target_port())) {
       return error::self_connect();
     }
   }
   return util::ok;
 }
 
+bool base_service::is_self_connect(std::string_view host, port_t port) const {
+  return std::find(forbidden_hosts.begin(), forbidden_hosts.end(), host) != forbidden_hosts.end() &&
+         port == options_.port;
+}
+
 void base_service::connect_server_async(err_callback_t handler) {
   flow_.connect_server_async([this, handler = std::move(handler)](const boost::system::error_code& error) mutable {
     on_connect_server(error, std::move(handler));
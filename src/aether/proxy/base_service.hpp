@@ -52,7 +52,11 @@ class base_service {
   // Connects to the server asynchronously.
   void connect_server_async(err_callback_t handler);
 
+  // Checks if connecting to the server would make the proxy connect to itself.
+  bool is_self_connect(std::string_view host, port_t port) const;
+
   boost::asio::io_context& ioc_;
+  server_components& components_;
   program::options& options_;
   connection::connection_flow& flow_;
   connection_handler& owner_;
@@ -7,10 +7,16 @@
 
 #include "io_context_pool.hpp"
 
+#include <pthread.h>
+#include <sched.h>
+
 #include <boost/asio.hpp>
+#include <chrono>
 #include <functional>
 #include <memory>
+#include <string_view>
 #include <thread>
+#include <tuple>
 #include <vector>
 
 #include "aether/proxy/error/error.hpp"
@@ -18,33 +24,90 @@
 
 namespace proxy::concurrent {
 
-result<io_context_pool> io_context_pool::create(std::size_t size) {
+result<selection_policy> string_to_selection_policy(std::string_view str) {
+  if (str == "round-robin") {
+    return selection_policy::round_robin;
+  }
+  if (str == "least-connections") {
+    return selection_policy::least_connections;
+  }
+  if (str == "least-lag") {
+    return selection_policy::least_lag;
+  }
+  return error::invalid_option(out::string::stream("Invalid io_context selection policy: ", str));
+}
+
+std::string_view selection_policy_to_string(selection_policy policy) {
+  switch (policy) {
+    case selection_policy::round_robin:
+      return "round-robin";
+    case selection_policy::least_connections:
+      return "least-connections";
+    case selection_policy::least_lag:
+      return "least-lag";
+  }
+  return "";
+}
+
+io_context_pool::context::context(int concurrency_hint)
+    : ioc(concurrency_hint),
+      guard(ioc.get_executor()), handlers_run(0), busy_ns(0), connections(0), lag_us(0) {}
+
+result<io_context_pool> io_context_pool::create(std::size_t size, selection_policy policy, bool pin_threads,
+                                                bool single_threaded) {
   if (size == 0) {
     return error::invalid_option("Number of threads cannot be 0");
   }
 
-  return io_context_pool(size);
+  return io_context_pool(size, policy, pin_threads, single_threaded);
 }
 
-io_context_pool::io_context_pool(std::size_t size) : next_(0), size_(size) {
+io_context_pool::io_context_pool(std::size_t size, selection_policy policy, bool pin_threads, bool single_threaded)
+    : policy_(policy), pin_threads_(pin_threads), next_(std::make_unique<std::atomic<std::size_t>>(0)), size_(size) {
+  int concurrency_hint = single_threaded ? 1 : BOOST_ASIO_CONCURRENCY_HINT_DEFAULT;
   for (std::size_t i = 0; i < size_; ++i) {
-    auto& new_service = io_contexts_.emplace_back(std::make_unique<boost::asio::io_context>());
-    guards_.emplace_back(new_service->get_executor());
+    context& new_context = *contexts_.emplace_back(std::make_unique<context>(concurrency_hint));
+    context_map_.emplace(&new_context.ioc, &new_context);
   }
 }
 
 void io_context_pool::run(const std::function<void(boost::asio::io_context& ioc)>& thread_fun) {
   for (std::size_t i = 0; i < size_; ++i) {
-    boost::asio::io_context& io_context = *io_contexts_[i];
-    std::unique_ptr<std::thread> thr =
-        std::make_unique<std::thread>([thread_fun, &io_context] { thread_fun(io_context); });
+    boost::asio::io_context& io_context = contexts_[i]->ioc;
+    std::unique_ptr<std::thread> thr = std::make_unique<std::thread>([this, i, thread_fun, &io_context] {
+      if (pin_threads_) {
+        pin_thread(i);
+      }
+      thread_fun(io_context);
+    });
     thread_pool_.push_back(std::move(thr));
   }
 }
 
+void io_context_pool::run_io_context(boost::asio::io_context& ioc) {
+  context* ctx = get_context(ioc);
+  if (ctx == nullptr) {
+    ioc.run();
+    return;
+  }
+
+  // Ready handlers are run in batches, which are timed as busy. When none are ready, the thread blocks for the next
+  // one, whose run time cannot be told apart from the wait and is not counted.
+  while (!ioc.stopped()) {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    if (std::size_t run = ioc.poll(); run > 0) {
+      std::chrono::nanoseconds busy = std::chrono::steady_clock::now() - start;
+      ctx->busy_ns.fetch_add(busy.count(), std::memory_order_relaxed);
+      ctx->handlers_run.fetch_add(run, std::memory_order_relaxed);
+    } else {
+      ctx->handlers_run.fetch_add(ioc.run_one(), std::memory_order_relaxed);
+    }
+  }
+}
+
 void io_context_pool::stop() {
   for (std::size_t i = 0; i < size_; ++i) {
-    io_contexts_[i]->stop();
+    contexts_[i]->ioc.stop();
   }
 
   if (!thread_pool_.empty()) {
@@ -55,12 +118,79 @@ void io_context_pool::stop() {
 }
 
 boost::asio::io_context& io_context_pool::get_io_context() {
-  boost::asio::io_context& out = *io_contexts_[next_];
-  ++next_;
-  if (next_ >= size_) {
-    next_ = 0;
+  std::size_t start = next_->fetch_add(1, std::memory_order_relaxed) % size_;
+  if (policy_ == selection_policy::round_robin) {
+    return contexts_[start]->ioc;
+  }
+
+  // Scanning starts at the round-robin position, so ties are spread evenly.
+  //
+  // Lag is only sampled periodically, so it is compared at millisecond granularity and ties are broken by connections.
+  // Otherwise, every connection accepted between samples would go to the same io_context.
+  auto load = [this](const context& ctx) {
+    std::size_t connections = ctx.connections.load(std::memory_order_relaxed);
+    std::int64_t lag_ms =
+        policy_ == selection_policy::least_lag ? ctx.lag_us.load(std::memory_order_relaxed) / 1000 : 0;
+    return std::make_tuple(lag_ms, connections);
+  };
+  context* best = contexts_[start].get();
+  auto best_load = load(*best);
+  for (std::size_t i = 1; i < size_; ++i) {
+    context* ctx = contexts_[(start + i) % size_].get();
+    if (auto ctx_load = load(*ctx); ctx_load < best_load) {
+      best = ctx;
+      best_load = ctx_load;
+    }
+  }
+  return best->ioc;
+}
+
+void io_context_pool::add_connection(boost::asio::io_context& ioc) {
+  if (context* ctx = get_context(ioc)) {
+    ctx->connections.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+void io_context_pool::remove_connections(boost::asio::io_context& ioc, std::size_t count) {
+  if (context* ctx = get_context(ioc)) {
+    ctx->connections.fetch_sub(count, std::memory_order_relaxed);
+  }
+}
+
+void io_context_pool::record_lag(boost::asio::io_context& ioc, std::chrono::steady_clock::duration lag) {
+  if (context* ctx = get_context(ioc)) {
+    ctx->lag_us.store(std::chrono::duration_cast<std::chrono::microseconds>(lag).count(), std::memory_order_relaxed);
+  }
+}
+
+io_context_pool::context_stats io_context_pool::stats(std::size_t index) const {
+  const context& ctx = *contexts_[index];
+  return {
+      .handlers_run = ctx.handlers_run.load(std::memory_order_relaxed),
+      .busy_time = std::chrono::nanoseconds(ctx.busy_ns.load(std::memory_order_relaxed)),
+      .connections = ctx.connections.load(std::memory_order_relaxed),
+      .lag = std::chrono::microseconds(ctx.lag_us.load(std::memory_order_relaxed)),
+  };
+}
+
+io_context_pool::context* io_context_pool::get_context(boost::asio::io_context& ioc) {
+  auto it = context_map_.find(&ioc);
+  return it == context_map_.end() ? nullptr : it->second;
+}
+
+void io_context_pool::pin_thread(std::size_t index) {
+#ifdef __linux__
+  unsigned int cpus = std::thread::hardware_concurrency();
+  if (cpus == 0) {
+    return;
+  }
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(index % cpus, &set);
+  if (int err = ::pthread_setaffinity_np(::pthread_self(), sizeof(set), &set); err != 0) {
+    out::safe_warn::log("Could not pin thread", index, "to CPU", index % cpus, "(error code =", err, ')');
   }
-  return out;
+#endif
 }
 
 }  // namespace proxy::concurrent
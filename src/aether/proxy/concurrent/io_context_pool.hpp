@@ -7,48 +7,132 @@
 
 #pragma once
 
+#include <atomic>
 #include <boost/asio.hpp>
+#include <chrono>
+#include <cstdint>
 #include <functional>
 #include <memory>
+#include <string_view>
 #include <thread>
+#include <unordered_map>
 #include <vector>
 
 #include "aether/proxy/error/error.hpp"
 
 namespace proxy::concurrent {
 
+// How the pool chooses the io_context for new work.
+enum class selection_policy {
+  // Each io_context in turn.
+  round_robin,
+  // The io_context that owns the fewest connections.
+  least_connections,
+  // The io_context whose event loop has lagged the least recently.
+  least_lag,
+};
+
+result<selection_policy> string_to_selection_policy(std::string_view str);
+std::string_view selection_policy_to_string(selection_policy policy);
+
 // Class for managing multiple io_context instances and running them with a thread pool.
+//
+// Each io_context keeps counters of its own load, which are used to choose where new work goes.
 class io_context_pool {
  public:
-  static result<io_context_pool> create(std::size_t size);
+  // A snapshot of the counters of a single io_context.
+  struct context_stats {
+    std::size_t handlers_run;
+    std::chrono::nanoseconds busy_time;
+    std::size_t connections;
+    std::chrono::microseconds lag;
+  };
+
+  // Single-threaded io_contexts are built with a concurrency hint of 1, which lets asio skip work meant for several
+  // threads running the same io_context. Posting from other threads is still safe.
+  static result<io_context_pool> create(std::size_t size, selection_policy policy = selection_policy::round_robin,
+                                        bool pin_threads = false, bool single_threaded = false);
 
   ~io_context_pool() = default;
   io_context_pool(io_context_pool&& other) noexcept = default;
   io_context_pool& operator=(io_context_pool&& other) noexcept = default;
 
   // Runs a single io_context in a thread that starts at the function given.
+  //
+  // If threads are pinned, each thread is bound to a single CPU before the function is called.
   void run(const std::function<void(boost::asio::io_context& ioc)>& thread_fun);
 
+  // Runs the io_context on the calling thread until it is stopped, counting the handlers it runs.
+  //
+  // Exceptions thrown by handlers are not caught.
+  void run_io_context(boost::asio::io_context& ioc);
+
   // Stops all io_contexts.
   void stop();
 
+  // Returns the io_context new work should go to, according to the selection policy.
+  //
+  // May be called from any thread.
   boost::asio::io_context& get_io_context();
 
+  // Returns the io_context at the given index, without advancing the round-robin position.
+  inline boost::asio::io_context& get_io_context(std::size_t index) { return contexts_[index]->ioc; }
+
+  // Returns the number of io_contexts.
+  inline std::size_t size() const { return size_; }
+
+  // Records a connection now owned by the io_context.
+  void add_connection(boost::asio::io_context& ioc);
+
+  // Records connections no longer owned by the io_context.
+  void remove_connections(boost::asio::io_context& ioc, std::size_t count = 1);
+
+  // Records the latest delay between when a timer on the io_context was due and when it ran.
+  void record_lag(boost::asio::io_context& ioc, std::chrono::steady_clock::duration lag);
+
+  // Returns the counters of the io_context at the given index.
+  context_stats stats(std::size_t index) const;
+
  private:
-  io_context_pool(std::size_t size);
+  // An io_context and the counters of its thread.
+  struct context {
+    boost::asio::io_context ioc;
+
+    // A work object keeps the io_context alive even when there is no work to do.
+    boost::asio::executor_work_guard<boost::asio::io_context::executor_type> guard;
+
+    std::atomic<std::size_t> handlers_run;
+    std::atomic<std::int64_t> busy_ns;
+    std::atomic<std::size_t> connections;
+    std::atomic<std::int64_t> lag_us;
+
+    context(int concurrency_hint);
+  };
+
+  io_context_pool(std::size_t size, selection_policy policy, bool pin_threads, bool single_threaded);
   io_context_pool() = delete;
   io_context_pool(const io_context_pool& other) = delete;
   io_context_pool& operator=(const io_context_pool& other) = delete;
 
-  std::vector<std::unique_ptr<boost::asio::io_context>> io_contexts_;
+  context* get_context(boost::asio::io_context& ioc);
+
+  // Binds the calling thread to the CPU for the io_context at the given index.
+  static void pin_thread(std::size_t index);
 
-  // Each io_context has an associated work object to keep the io_context alive even when there is no work to do.
-  std::vector<boost::asio::executor_work_guard<boost::asio::io_context::executor_type>> guards_;
+  std::vector<std::unique_ptr<context>> contexts_;
+
+  // Built once at construction and never modified, so lookups do not need a lock.
+  std::unordered_map<boost::asio::io_context*, context*> context_map_;
 
   std::vector<std::unique_ptr<std::thread>> thread_pool_;
 
-  // The index of the next io_context to give.
-  std::size_t next_;
+  selection_policy policy_;
+  bool pin_threads_;
+
+  // The round-robin position, which also decides where ties in load are broken.
+  //
+  // Held by pointer so the pool remains movable.
+  std::unique_ptr<std::atomic<std::size_t>> next_;
 
   // The number of io_contexts.
   std::size_t size_;
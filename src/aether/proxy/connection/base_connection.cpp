@@ -7,14 +7,19 @@
 
 #include "base_connection.hpp"
 
+#include <sys/socket.h>
+
 #include <algorithm>
 #include <boost/asio.hpp>
 #include <boost/asio/ssl.hpp>
+#include <cerrno>
 #include <functional>
 #include <iostream>
 #include <iterator>
 #include <memory>
+#include <optional>
 #include <string>
+#include <utility>
 
 #include "aether/proxy/connection/timeout_service.hpp"
 #include "aether/proxy/server_components.hpp"
@@ -26,22 +31,38 @@ namespace proxy::connection {
 
 base_connection::base_connection(boost::asio::io_context& ioc, server_components& components)
     : options_(components.options),
+      buffer_pools_(components.buffer_pools),
+      memory_budget_(components.memory_budget),
+      idle_connections_(components.idle_connections),
       ioc_(ioc),
       // TODO: boost::asio::detail::win_mutex leak.
-      strand_(boost::asio::make_strand(ioc)),
-      socket_(strand_),
-      timeout_(ioc),
+      executor_(options_.single_threaded_contexts ? boost::asio::any_io_executor(ioc.get_executor())
+                                                  : boost::asio::any_io_executor(boost::asio::make_strand(ioc))),
+      socket_(std::make_unique<boost::asio::ip::tcp::socket>(executor_)),
+      timeout_(ioc, components.timing_wheels.get(ioc)),
       mode_(io_mode::regular),
       connected_(false),
+      parked_(),
+      read_size_(default_buffer_size),
+      adaptive_read_(false),
       tls_established_(false),
       ssl_context_(),
       cert_(nullptr),
       secure_socket_(),
       read_state_(operation_state::free),
-      write_state_(operation_state::free) {}
+      write_state_(operation_state::free) {
+  std::shared_ptr<util::buffer::buffer_pool> pool = buffer_pools_.get(ioc);
+  input_.set_pool(pool);
+  output_.set_pool(std::move(pool));
+  input_.set_account(memory_budget_.account());
+  output_.set_account(memory_budget_.account());
+}
 
 base_connection::~base_connection() {
-  if (socket_.is_open()) {
+  if (parked_.has_value()) {
+    idle_connections_.unpark(ioc_, *parked_);
+  }
+  if (socket_->is_open()) {
     close();
   }
 }
@@ -59,20 +80,33 @@ void base_connection::set_timeout() {
   }
 }
 
-bool base_connection::has_been_closed() {
-  boost::system::error_code error;
-
-  socket_.non_blocking(true);
-  socket_.receive(input_.prepare_sequence(1), boost::asio::ip::tcp::socket::message_peek, error);
-  socket_.non_blocking(false);
+base_connection::peek_state base_connection::peek(boost::asio::ip::tcp::socket& socket) {
+  if (!socket.is_open()) {
+    return peek_state::closed;
+  }
 
-  if (error == boost::asio::error::eof) {
-    return true;
+  // MSG_DONTWAIT makes this one call non-blocking, so the socket does not need to be switched in and out of
+  // non-blocking mode around it.
+  char byte;
+  ssize_t received = ::recv(socket.native_handle(), &byte, 1, MSG_PEEK | MSG_DONTWAIT);
+  if (received > 0) {
+    return peek_state::readable;
   }
-  return false;
+  if (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+    return peek_state::empty;
+  }
+  return peek_state::closed;
 }
 
-std::size_t base_connection::read(boost::system::error_code& error) { return read(default_buffer_size, error); }
+bool base_connection::has_been_closed() { return peek(*socket_) == peek_state::closed; }
+
+std::size_t base_connection::read(boost::system::error_code& error) {
+  std::size_t bytes_read = read(read_size_, error);
+  if (error == boost::system::errc::success) {
+    adapt_read_size(bytes_read);
+  }
+  return bytes_read;
+}
 
 std::size_t base_connection::read(std::size_t buffer_size, boost::system::error_code& error) {
   set_reading();
@@ -82,7 +116,7 @@ std::size_t base_connection::read(std::size_t buffer_size, boost::system::error_
   if (tls_established_) {
     bytes_read = secure_socket_->read_some(input_.prepare_sequence(buffer_size), error);
   } else {
-    bytes_read = socket_.read_some(input_.prepare_sequence(buffer_size), error);
+    bytes_read = socket_->read_some(input_.prepare_sequence(buffer_size), error);
   }
 
   input_.commit(bytes_read);
@@ -93,11 +127,11 @@ std::size_t base_connection::read(std::size_t buffer_size, boost::system::error_
 
 std::size_t base_connection::read_available(boost::system::error_code& error) {
   set_reading();
-  socket_.non_blocking(true);
+  socket_->non_blocking(true);
 
   std::size_t bytes_read = 0;
   if (tls_established_) {
-    bytes_read = boost::asio::read(socket_, util::buffer::asio_dynamic_buffer_v1(input_), error);
+    bytes_read = boost::asio::read(*socket_, util::buffer::asio_dynamic_buffer_v1(input_), error);
   } else {
     bytes_read = boost::asio::read(*secure_socket_, util::buffer::asio_dynamic_buffer_v1(input_), error);
   }
@@ -105,28 +139,49 @@ std::size_t base_connection::read_available(boost::system::error_code& error) {
   if (error == boost::asio::error::would_block) {
     error = boost::system::errc::make_error_code(boost::system::errc::success);
   }
-  socket_.non_blocking(false);
+  socket_->non_blocking(false);
   finish_reading();
   return bytes_read;
 }
 
-void base_connection::read_async(io_callback_t handler) { read_async(default_buffer_size, std::move(handler)); }
+void base_connection::read_async(io_callback_t handler) {
+  adaptive_read_ = true;
+  read_some_async(read_size_, std::move(handler));
+}
 
 void base_connection::read_async(std::size_t buffer_size, io_callback_t handler) {
+  adaptive_read_ = false;
+  read_some_async(buffer_size, std::move(handler));
+}
+
+void base_connection::read_some_async(std::size_t buffer_size, io_callback_t handler) {
   set_reading();
   set_timeout();
   if (tls_established_) {
     secure_socket_->async_read_some(input_.prepare_sequence(buffer_size),
-                                    boost::asio::bind_executor(strand_, [this, handler = std::move(handler)](
-                                                                            const boost::system::error_code& error,
-                                                                            std::size_t bytes_transferred) mutable {
+                                    boost::asio::bind_executor(executor_, [this, handler = std::move(handler)](
+                                                                              const boost::system::error_code& error,
+                                                                              std::size_t bytes_transferred) mutable {
                                       on_read_need_to_commit(std::move(handler), error, bytes_transferred);
                                     }));
   } else {
-    socket_.async_read_some(input_.prepare_sequence(buffer_size),
+#ifdef BOOST_ASIO_HAS_IO_URING
+    // Reads into the registered arena use the io_context's fixed buffers.
+    if (std::optional<boost::asio::mutable_registered_buffer> registered =
+            buffer_pools_.registered(ioc_, input_.prepare(buffer_size))) {
+      socket_->async_read_some(*registered,
+                               boost::asio::bind_executor(executor_, [this, handler = std::move(handler)](
+                                                                         const boost::system::error_code& error,
+                                                                         std::size_t bytes_transferred) mutable {
+                                 on_read_need_to_commit(std::move(handler), error, bytes_transferred);
+                               }));
+      return;
+    }
+#endif
+    socket_->async_read_some(input_.prepare_sequence(buffer_size),
                             boost::asio::bind_executor(
-                                strand_, [this, handler = std::move(handler)](const boost::system::error_code& error,
-                                                                              std::size_t bytes_transferred) mutable {
+                                executor_, [this, handler = std::move(handler)](const boost::system::error_code& error,
+                                                                                std::size_t bytes_transferred) mutable {
                                   on_read_need_to_commit(std::move(handler), error, bytes_transferred);
                                 }));
   }
@@ -137,16 +192,16 @@ void base_connection::read_until_async(std::string_view delim, io_callback_t han
   set_timeout();
   if (tls_established_) {
     boost::asio::async_read_until(*secure_socket_, util::buffer::asio_dynamic_buffer_v1(input_), delim,
-                                  boost::asio::bind_executor(strand_, [this, handler = std::move(handler)](
-                                                                          const boost::system::error_code& error,
-                                                                          std::size_t bytes_transferred) mutable {
+                                  boost::asio::bind_executor(executor_, [this, handler = std::move(handler)](
+                                                                            const boost::system::error_code& error,
+                                                                            std::size_t bytes_transferred) mutable {
                                     on_read(std::move(handler), error, bytes_transferred);
                                   }));
   } else {
-    boost::asio::async_read_until(socket_, util::buffer::asio_dynamic_buffer_v1(input_), delim,
-                                  boost::asio::bind_executor(strand_, [this, handler = std::move(handler)](
-                                                                          const boost::system::error_code& error,
-                                                                          std::size_t bytes_transferred) mutable {
+    boost::asio::async_read_until(*socket_, util::buffer::asio_dynamic_buffer_v1(input_), delim,
+                                  boost::asio::bind_executor(executor_, [this, handler = std::move(handler)](
+                                                                            const boost::system::error_code& error,
+                                                                            std::size_t bytes_transferred) mutable {
                                     on_read(std::move(handler), error, bytes_transferred);
                                   }));
   }
@@ -159,16 +214,82 @@ void base_connection::on_read(io_callback_t handler, const boost::system::error_
   if (error != boost::system::errc::success) {
     set_connected(false);
   }
-  boost::asio::post(
-      ioc_, [handler = std::move(handler), error, bytes_transferred]() mutable { handler(error, bytes_transferred); });
+  complete_io(std::move(handler), error, bytes_transferred);
 }
 
 void base_connection::on_read_need_to_commit(io_callback_t handler, const boost::system::error_code& error,
                                              std::size_t bytes_transferred) {
   input_.commit(bytes_transferred);
+  if (std::exchange(adaptive_read_, false) && error == boost::system::errc::success) {
+    adapt_read_size(bytes_transferred);
+  }
   on_read(std::move(handler), error, bytes_transferred);
 }
 
+void base_connection::adapt_read_size(std::size_t bytes_transferred) {
+  std::size_t max_read_size = mode_ == io_mode::tunnel ? max_tunnel_read_size : max_regular_read_size;
+  if (bytes_transferred >= read_size_) {
+    // The read filled the buffer, so more was likely waiting.
+    read_size_ *= 2;
+  } else if (bytes_transferred < read_size_ / 4) {
+    read_size_ /= 2;
+  }
+  read_size_ = std::clamp(read_size_, min_read_size, max_read_size);
+}
+
+void base_connection::read_when_ready_async(io_callback_t handler, bool evictable) {
+  if (tls_established_ && !secure_socket_->input_in_socket()) {
+    read_async(std::move(handler));
+    return;
+  }
+
+  release_buffers();
+  if (evictable) {
+    parked_ = idle_connections_.park(ioc_, *this);
+  }
+  wait_readable_async([this, handler = std::move(handler)](const boost::system::error_code& error) mutable {
+    if (parked_.has_value()) {
+      idle_connections_.unpark(ioc_, *std::exchange(parked_, std::nullopt));
+    }
+    if (error != boost::system::errc::success) {
+      handler(error, 0);
+      return;
+    }
+    read_async(std::move(handler));
+  });
+}
+
+void base_connection::wait_readable_async(err_callback_t handler) {
+  set_reading();
+  set_timeout();
+  socket_->async_wait(boost::asio::ip::tcp::socket::wait_read,
+                      boost::asio::bind_executor(executor_, [this, handler = std::move(handler)](
+                                                                const boost::system::error_code& error) mutable {
+                        finish_reading();
+                        timeout_.cancel_timeout();
+                        on_wait(std::move(handler), error);
+                      }));
+}
+
+void base_connection::wait_writable_untimed_async(err_callback_t handler) {
+  set_writing();
+  socket_->async_wait(boost::asio::ip::tcp::socket::wait_write,
+                      boost::asio::bind_executor(executor_, [this, handler = std::move(handler)](
+                                                                const boost::system::error_code& error) mutable {
+                        finish_writing();
+                        on_wait(std::move(handler), error);
+                      }));
+}
+
+void base_connection::on_wait(err_callback_t handler, const boost::system::error_code& error) {
+  if (error != boost::system::errc::success) {
+    set_connected(false);
+  }
+  complete_io(
+      [handler = std::move(handler)](const boost::system::error_code& error, std::size_t) mutable { handler(error); },
+      error, 0);
+}
+
 std::size_t base_connection::write(boost::system::error_code& error) {
   set_writing();
   set_timeout();
@@ -177,7 +298,7 @@ std::size_t base_connection::write(boost::system::error_code& error) {
   if (tls_established_) {
     bytes_written = boost::asio::write(*secure_socket_, util::buffer::asio_dynamic_buffer_v1(output_), error);
   } else {
-    bytes_written = boost::asio::write(socket_, util::buffer::asio_dynamic_buffer_v1(output_), error);
+    bytes_written = boost::asio::write(*socket_, util::buffer::asio_dynamic_buffer_v1(output_), error);
   }
 
   timeout_.cancel_timeout();
@@ -191,18 +312,18 @@ void base_connection::write_async(io_callback_t handler) {
   set_timeout();
   if (tls_established_) {
     boost::asio::async_write(*secure_socket_, util::buffer::asio_dynamic_buffer_v1(output_),
-                             boost::asio::bind_executor(
-                                 strand_, [this, handler = std::move(handler)](const boost::system::error_code& error,
-                                                                               std::size_t bytes_transferred) mutable {
-                                   on_write(std::move(handler), false, error, bytes_transferred);
-                                 }));
+                             boost::asio::bind_executor(executor_, [this, handler = std::move(handler)](
+                                                                       const boost::system::error_code& error,
+                                                                       std::size_t bytes_transferred) mutable {
+                               on_write(std::move(handler), false, error, bytes_transferred);
+                             }));
   } else {
-    boost::asio::async_write(socket_, util::buffer::asio_dynamic_buffer_v1(output_),
-                             boost::asio::bind_executor(
-                                 strand_, [this, handler = std::move(handler)](const boost::system::error_code& error,
-                                                                               std::size_t bytes_transferred) mutable {
-                                   on_write(std::move(handler), false, error, bytes_transferred);
-                                 }));
+    boost::asio::async_write(*socket_, util::buffer::asio_dynamic_buffer_v1(output_),
+                             boost::asio::bind_executor(executor_, [this, handler = std::move(handler)](
+                                                                       const boost::system::error_code& error,
+                                                                       std::size_t bytes_transferred) mutable {
+                               on_write(std::move(handler), false, error, bytes_transferred);
+                             }));
   }
 }
 
@@ -210,18 +331,18 @@ void base_connection::write_untimed_async(io_callback_t handler) {
   set_writing();
   if (tls_established_) {
     boost::asio::async_write(*secure_socket_, util::buffer::asio_dynamic_buffer_v1(output_),
-                             boost::asio::bind_executor(
-                                 strand_, [this, handler = std::move(handler)](const boost::system::error_code& error,
-                                                                               std::size_t bytes_transferred) mutable {
-                                   on_write(std::move(handler), true, error, bytes_transferred);
-                                 }));
+                             boost::asio::bind_executor(executor_, [this, handler = std::move(handler)](
+                                                                       const boost::system::error_code& error,
+                                                                       std::size_t bytes_transferred) mutable {
+                               on_write(std::move(handler), true, error, bytes_transferred);
+                             }));
   } else {
-    boost::asio::async_write(socket_, util::buffer::asio_dynamic_buffer_v1(output_),
-                             boost::asio::bind_executor(
-                                 strand_, [this, handler = std::move(handler)](const boost::system::error_code& error,
-                                                                               std::size_t bytes_transferred) mutable {
-                                   on_write(std::move(handler), true, error, bytes_transferred);
-                                 }));
+    boost::asio::async_write(*socket_, util::buffer::asio_dynamic_buffer_v1(output_),
+                             boost::asio::bind_executor(executor_, [this, handler = std::move(handler)](
+                                                                       const boost::system::error_code& error,
+                                                                       std::size_t bytes_transferred) mutable {
+                               on_write(std::move(handler), true, error, bytes_transferred);
+                             }));
   }
 }
 
@@ -234,6 +355,16 @@ void base_connection::on_write(io_callback_t handler, bool untimed, const boost:
   if (error != boost::system::errc::success) {
     set_connected(false);
   }
+  complete_io(std::move(handler), error, bytes_transferred);
+}
+
+void base_connection::complete_io(io_callback_t handler, const boost::system::error_code& error,
+                                  std::size_t bytes_transferred) {
+  // With a single thread, the strand was never used, so there is nothing to leave.
+  if (options_.single_threaded_contexts) {
+    handler(error, bytes_transferred);
+    return;
+  }
   boost::asio::post(
       ioc_, [handler = std::move(handler), error, bytes_transferred]() mutable { handler(error, bytes_transferred); });
 }
@@ -256,7 +387,7 @@ void base_connection::shutdown() {
 
   out::safe_debug::log("Shutdown on connection", this);
   boost::system::error_code error;
-  socket_.shutdown(boost::asio::ip::tcp::socket::shutdown_both, error);
+  socket_->shutdown(boost::asio::ip::tcp::socket::shutdown_both, error);
   set_connected(false);
 
   switch (error.value()) {
@@ -270,7 +401,7 @@ void base_connection::shutdown() {
   }
 }
 
-void base_connection::close() { socket_.close(); }
+void base_connection::close() { socket_->close(); }
 
 void base_connection::disconnect() {
   // Cancel any pending timeouts.
@@ -279,6 +410,43 @@ void base_connection::disconnect() {
     shutdown();
   }
   close();
+  release_buffers();
+}
+
+void base_connection::release_buffers() {
+  input_.release_if_empty();
+  output_.release_if_empty();
+  // Whatever traffic comes after the connection goes idle starts over from small reads.
+  read_size_ = std::min(read_size_, default_buffer_size);
+}
+
+void base_connection::reset() {
+  timeout_.cancel_timeout();
+  if (socket_->is_open()) {
+    boost::system::error_code error;
+    socket_->close(error);
+  }
+  if (parked_.has_value()) {
+    idle_connections_.unpark(ioc_, *std::exchange(parked_, std::nullopt));
+  }
+
+  // The stream refers to the context, so it goes first.
+  secure_socket_.reset();
+  ssl_context_.reset();
+  tls_established_ = false;
+  cert_ = nullptr;
+  alpn_.clear();
+
+  input_.reset();
+  output_.reset();
+  release_buffers();
+  read_size_ = default_buffer_size;
+  adaptive_read_ = false;
+
+  mode_ = io_mode::regular;
+  connected_ = false;
+  read_state_ = operation_state::free;
+  write_state_ = operation_state::free;
 }
 
 base_connection& base_connection::operator<<(const byte_array_t& data) {
@@ -15,6 +15,10 @@
 #include <string>
 
 #include "aether/program/options.hpp"
+#include "aether/proxy/connection/buffer_pools.hpp"
+#include "aether/proxy/connection/idle_connections.hpp"
+#include "aether/proxy/connection/memory_budget.hpp"
+#include "aether/proxy/connection/secure_stream.hpp"
 #include "aether/proxy/connection/timeout_service.hpp"
 #include "aether/proxy/tls/openssl/ssl_context.hpp"
 #include "aether/proxy/tls/x509/certificate.hpp"
@@ -34,6 +38,13 @@ class base_connection {
  public:
   static constexpr std::size_t default_buffer_size = 8192;
 
+  // Bounds of the adaptive read size.
+  //
+  // Tunnels move bulk data, so they may read in larger pieces than connections carrying requests and responses.
+  static constexpr std::size_t min_read_size = 4 * 1024;
+  static constexpr std::size_t max_regular_read_size = 64 * 1024;
+  static constexpr std::size_t max_tunnel_read_size = 256 * 1024;
+
   // Enumeration type to represent operation mode.
   //
   // Changes the timeout for socket operations.
@@ -53,15 +64,37 @@ class base_connection {
 
   inline io_mode mode() const { return mode_; }
   inline void set_mode(io_mode new_mode) { mode_ = new_mode; }
+
+  // Returns the size of the next read that does not ask for a size.
+  inline std::size_t read_size() const { return read_size_; }
   inline bool secured() const { return tls_established_; }
 
-  inline boost::asio::ip::tcp::socket& socket() { return socket_; }
-  inline boost::asio::ip::tcp::endpoint endpoint() const { return socket_.remote_endpoint(); }
-  inline boost::asio::ip::address address() const { return socket_.remote_endpoint().address(); }
+  // Checks if bytes written to the socket reach the peer without being encrypted in user space, either because the
+  // connection is not secured or because the kernel encrypts its records.
+  inline bool kernel_writes() const { return !tls_established_ || secure_socket_->kernel_send(); }
+
+  inline boost::asio::ip::tcp::socket& socket() { return *socket_; }
+  inline boost::asio::ip::tcp::endpoint endpoint() const { return socket_->remote_endpoint(); }
+  inline boost::asio::ip::address address() const { return socket_->remote_endpoint().address(); }
   inline boost::asio::io_context& io_context() { return ioc_; }
   inline tls::x509::certificate& cert() { return cert_; }
   inline std::string_view alpn() const { return alpn_; }
 
+  // Enumeration type for what a non-blocking peek at a socket found.
+  enum class peek_state {
+    // Open, with nothing to read.
+    empty,
+    // Open, with data waiting to be read.
+    readable,
+    // Closed by the peer or failed.
+    closed,
+  };
+
+  // Peeks at a socket without blocking and without consuming any data.
+  //
+  // Makes a single system call, and never changes the socket's blocking mode.
+  static peek_state peek(boost::asio::ip::tcp::socket& socket);
+
   // Tests if the socket has been closed.
   //
   // Reads produce EOF error.
@@ -72,7 +105,7 @@ class base_connection {
   // Calls socket.read_some.
   std::size_t read(std::size_t buffer_size, boost::system::error_code& error);
 
-  // Reads from the socket synchronously.
+  // Reads from the socket synchronously with the adaptive read size.
   //
   // Calls socket.read_some.
   std::size_t read(boost::system::error_code& error);
@@ -89,7 +122,10 @@ class base_connection {
   // Calls socket.async_read_some.
   void read_async(std::size_t buffer_size, io_callback_t handler);
 
-  // Reads from the socket asynchronously.
+  // Reads from the socket asynchronously with the adaptive read size.
+  //
+  // Like receive window autotuning, the size doubles while reads keep filling it and halves while reads only use a
+  // small part of it, within the bounds of the connection's mode.
   //
   // Calls socket.async_read_some.
   void read_async(io_callback_t handler);
@@ -99,6 +135,27 @@ class base_connection {
   // Calls boost::asio::async_read_until.
   void read_until_async(std::string_view delim, io_callback_t handler);
 
+  // Reads from the socket asynchronously with the adaptive read size, once the socket becomes readable.
+  //
+  // No buffer is attached while waiting, and empty buffers are given back first, so a connection that stays idle for
+  // a long time holds almost no memory. An evictable connection is parked while it waits, making it one of the first
+  // to be closed if the proxy runs out of file descriptors.
+  //
+  // Falls back to a regular read if the TLS stream may hold input the socket does not show.
+  void read_when_ready_async(io_callback_t handler, bool evictable = false);
+
+  // Waits for the socket to become readable without reading anything.
+  //
+  // Calls socket.async_wait.
+  void wait_readable_async(err_callback_t handler);
+
+  // Waits for the socket to become writable without writing anything.
+  //
+  // Does not put a timeout on the operation.
+  //
+  // Calls socket.async_wait.
+  void wait_writable_untimed_async(err_callback_t handler);
+
   // Writes to the socket synchronously.
   //
   // This operation must be non-blocking.
@@ -115,7 +172,7 @@ class base_connection {
   void write_untimed_async(io_callback_t handler);
 
   // Returns the number of bytes that are available to be read without blocking.
-  inline std::size_t available_bytes() const { return socket_.available(); }
+  inline std::size_t available_bytes() const { return socket_->available(); }
 
   // Returns an input stream for reading from the input buffer.
   //
@@ -137,6 +194,12 @@ class base_connection {
   // The output buffer should then be written to the socket using connecion.write_async.
   inline streambuf& output_buffer() { return output_; }
 
+  // Returns the bytes the connection may have buffered for its peer before reads from the peer should pause.
+  inline std::size_t buffer_high_watermark() const { return memory_budget_.connection_high_watermark(); }
+
+  // Returns the bytes the connection must have buffered at most for paused reads from its peer to resume.
+  inline std::size_t buffer_low_watermark() const { return memory_budget_.connection_low_watermark(); }
+
   // Returns the input buffer wrapped as a const buffer.
   inline const_buffer const_input_buffer() const { return input_.data(); }
 
@@ -146,7 +209,16 @@ class base_connection {
   // Logically disconnects from the socket.
   void disconnect();
 
-  inline bool is_open() const { return socket_.is_open(); }
+  // Gives back the storage of empty buffers, so an idle connection holds as little memory as possible.
+  void release_buffers();
+
+  // Returns the connection to the state of a new one, so it can be used for another connection.
+  //
+  // The socket is closed, but the socket object, strand, and timer are kept. Must not be called while operations are
+  // pending.
+  void reset();
+
+  inline bool is_open() const { return socket_->is_open(); }
   inline bool connected() const { return connected_; }
   inline void set_connected(bool connected = true) { connected_ = connected; }
   inline bool can_be_shutdown() const { return is_open() && connected(); }
@@ -200,10 +272,24 @@ class base_connection {
   void on_read_need_to_commit(io_callback_t handler, const boost::system::error_code& error,
                               std::size_t bytes_transferred);
 
+  // Starts a read of the given size.
+  void read_some_async(std::size_t buffer_size, io_callback_t handler);
+
+  // Adapts the read size to the bytes a read of that size returned.
+  void adapt_read_size(std::size_t bytes_transferred);
+
   // Callback for write_async.
   void on_write(io_callback_t handler, bool untimed, const boost::system::error_code& error,
                 std::size_t bytes_transferred);
 
+  // Callback for wait_readable_async and wait_writable_untimed_async.
+  void on_wait(err_callback_t handler, const boost::system::error_code& error);
+
+  // Calls the handler of a finished read or write.
+  //
+  // Single-threaded io_contexts call it right away. Otherwise, it is posted back to the io_context, off the strand.
+  void complete_io(io_callback_t handler, const boost::system::error_code& error, std::size_t bytes_transferred);
+
   // Closes the socket.
   //
   // This method should likely never be called directly. Use `disconnect()` instead, as it works with some of the
@@ -214,17 +300,28 @@ class base_connection {
   streambuf output_;
 
   program::options& options_;
+  buffer_pools& buffer_pools_;
+  memory_budget& memory_budget_;
+  idle_connections& idle_connections_;
   boost::asio::io_context& ioc_;
-  boost::asio::strand<boost::asio::io_context::executor_type> strand_;
-  boost::asio::ip::tcp::socket socket_;
+  // Executor of every operation on the connection, which is a strand unless io_contexts are single-threaded.
+  boost::asio::any_io_executor executor_;
+  std::unique_ptr<boost::asio::ip::tcp::socket> socket_;
   timeout_service timeout_;
   io_mode mode_;
   bool connected_;
 
+  // Position among the parked connections while waiting as an evictable connection.
+  std::optional<idle_connections::position> parked_;
+
+  std::size_t read_size_;
+  // The pending read uses the adaptive read size, so its result adapts the size.
+  bool adaptive_read_;
+
   bool tls_established_;
   std::unique_ptr<boost::asio::ssl::context> ssl_context_;
   tls::x509::certificate cert_;
-  std::unique_ptr<boost::asio::ssl::stream<boost::asio::ip::tcp::socket&>> secure_socket_;
+  std::unique_ptr<secure_stream> secure_socket_;
   std::string alpn_;
 
   operation_state read_state_;
@@ -0,0 +1,76 @@
+/*********************************************
+
+  Copyright (c) Jackson Nestelroad 2020
+  jackson.nestelroad.com
+
+*********************************************/
+
+#include "buffer_pools.hpp"
+
+#include <boost/asio.hpp>
+#include <memory>
+#include <optional>
+#include <vector>
+
+#include "aether/program/options.hpp"
+#include "aether/proxy/concurrent/io_context_pool.hpp"
+#include "aether/util/buffer_pool.hpp"
+
+namespace proxy::connection {
+
+buffer_pools::buffer_pools(concurrent::io_context_pool& io_contexts, program::options& options) {
+  if (!options.buffer_pool) {
+    return;
+  }
+  for (std::size_t i = 0; i < io_contexts.size(); ++i) {
+    boost::asio::io_context& ioc = io_contexts.get_io_context(i);
+    auto pool = std::make_shared<util::buffer::buffer_pool>(options.buffer_pool_huge_pages,
+                                                            options.io_uring_registered_bytes);
+#ifdef BOOST_ASIO_HAS_IO_URING
+    if (util::buffer::buffer_pool::chunk arena = pool->arena(); arena.size > 0) {
+      std::vector<boost::asio::mutable_buffer> buffers = {boost::asio::buffer(arena.data, arena.size)};
+      registrations_.emplace(&ioc, boost::asio::register_buffers(ioc, std::move(buffers)));
+    }
+#endif
+    pools_.emplace(&ioc, std::move(pool));
+  }
+}
+
+std::shared_ptr<util::buffer::buffer_pool> buffer_pools::get(boost::asio::io_context& ioc) const {
+  auto it = pools_.find(&ioc);
+  return it == pools_.end() ? nullptr : it->second;
+}
+
+#ifdef BOOST_ASIO_HAS_IO_URING
+std::optional<boost::asio::mutable_registered_buffer> buffer_pools::registered(
+    boost::asio::io_context& ioc, boost::asio::mutable_buffer buffer) const {
+  auto registration = registrations_.find(&ioc);
+  if (registration == registrations_.end()) {
+    return std::nullopt;
+  }
+  const util::buffer::buffer_pool& pool = *pools_.at(&ioc);
+  if (!pool.in_arena(buffer.data())) {
+    return std::nullopt;
+  }
+  std::size_t offset = static_cast<const char*>(buffer.data()) - pool.arena().data;
+  return boost::asio::buffer(registration->second[0] + offset, buffer.size());
+}
+#endif
+
+std::size_t buffer_pools::reserved_bytes() const {
+  std::size_t bytes = 0;
+  for (const auto& [ioc, pool] : pools_) {
+    bytes += pool->reserved_bytes();
+  }
+  return bytes;
+}
+
+std::size_t buffer_pools::used_bytes() const {
+  std::size_t bytes = 0;
+  for (const auto& [ioc, pool] : pools_) {
+    bytes += pool->used_bytes();
+  }
+  return bytes;
+}
+
+}  // namespace proxy::connection
@@ -0,0 +1,73 @@
+/*********************************************
+
+  Copyright (c) Jackson Nestelroad 2020
+  jackson.nestelroad.com
+
+*********************************************/
+
+#pragma once
+
+#include <boost/asio.hpp>
+#include <memory>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+#include "aether/program/options.hpp"
+#include "aether/proxy/concurrent/io_context_pool.hpp"
+#include "aether/util/buffer_pool.hpp"
+
+namespace proxy::connection {
+
+// Buffer pools for connection buffers, one for each io_context.
+//
+// Connections take their buffers from the pool of their io_context, so a pool is almost only ever locked by the thread
+// running that io_context.
+//
+// When built for io_uring, each pool may set aside an arena that is registered with its io_context, so reads into
+// buffers from the arena use the kernel's fixed buffers instead of mapping the memory on every operation.
+class buffer_pools {
+ public:
+#ifdef BOOST_ASIO_HAS_IO_URING
+  static constexpr bool registered_buffers_supported = true;
+#else
+  static constexpr bool registered_buffers_supported = false;
+#endif
+
+  buffer_pools(concurrent::io_context_pool& io_contexts, program::options& options);
+  buffer_pools() = delete;
+  ~buffer_pools() = default;
+  buffer_pools(const buffer_pools& other) = delete;
+  buffer_pools& operator=(const buffer_pools& other) = delete;
+  buffer_pools(buffer_pools&& other) noexcept = delete;
+  buffer_pools& operator=(buffer_pools&& other) noexcept = delete;
+
+  // Returns the pool for the io_context, or nullptr if buffers should come from the heap.
+  std::shared_ptr<util::buffer::buffer_pool> get(boost::asio::io_context& ioc) const;
+
+  // Returns the bytes allocated by all pools, whether handed out or not.
+  std::size_t reserved_bytes() const;
+
+  // Returns the bytes currently handed out by all pools.
+  std::size_t used_bytes() const;
+
+#ifdef BOOST_ASIO_HAS_IO_URING
+  // Returns the buffer as a registered buffer of the io_context, or nothing if it lies outside the registered arena.
+  std::optional<boost::asio::mutable_registered_buffer> registered(boost::asio::io_context& ioc,
+                                                                   boost::asio::mutable_buffer buffer) const;
+#endif
+
+ private:
+  // Built once at construction and never modified, so lookups do not need a lock.
+  //
+  // Buffers keep their pool alive, so pools outlive connections that are destroyed after the server components.
+  std::unordered_map<boost::asio::io_context*, std::shared_ptr<util::buffer::buffer_pool>> pools_;
+
+#ifdef BOOST_ASIO_HAS_IO_URING
+  // Registration of each pool's arena with its io_context.
+  using registration_t = boost::asio::buffer_registration<std::vector<boost::asio::mutable_buffer>>;
+  std::unordered_map<boost::asio::io_context*, registration_t> registrations_;
+#endif
+};
+
+}  // namespace proxy::connection
@@ -21,6 +21,13 @@ namespace proxy::connection {
 client_connection::client_connection(boost::asio::io_context& ioc, server_components& components)
     : base_connection(ioc, components), ssl_method_(tls::openssl::ssl_method::sslv23) {}
 
+void client_connection::reset() {
+  base_connection::reset();
+  sni_.clear();
+  cipher_name_.clear();
+  ssl_method_ = tls::openssl::ssl_method::sslv23;
+}
+
 result<void> client_connection::establish_tls_async(tls::openssl::ssl_server_context_args& args,
                                                     err_callback_t handler) {
   ASSIGN_OR_RETURN(ssl_context_, tls::openssl::create_ssl_context(args.base_args));
@@ -56,13 +63,14 @@ result<void> client_connection::establish_tls_async(tls::openssl::ssl_server_con
     args.dhpkey.increment();
   }
 
-  secure_socket_ = std::make_unique<std::remove_reference_t<decltype(*secure_socket_)>>(socket_, *ssl_context_);
+  secure_socket_ = std::make_unique<secure_stream>(*socket_, *ssl_context_, options_.ssl_kernel_offload,
+                                                   memory_budget_.account());
   SSL_set_accept_state(secure_socket_->native_handle());
 
   secure_socket_->async_handshake(
       boost::asio::ssl::stream_base::handshake_type::server, input_.data_sequence(),
       boost::asio::bind_executor(
-          strand_, [this, handler = std::move(handler)](const boost::system::error_code& error, std::size_t) mutable {
+          executor_, [this, handler = std::move(handler)](const boost::system::error_code& error, std::size_t) mutable {
             if (result<void> res = on_handshake(std::move(handler), error); !res.is_ok()) {
               set_connected(false);
             }
@@ -24,6 +24,9 @@ class client_connection : public base_connection {
 
   result<void> establish_tls_async(tls::openssl::ssl_server_context_args& args, err_callback_t handler);
 
+  // Returns the connection to the state of a new one, so it can be used for another connection.
+  void reset();
+
  private:
   result<void> on_handshake(err_callback_t handler, const boost::system::error_code& error);
 
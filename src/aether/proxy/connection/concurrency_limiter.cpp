@@ -0,0 +1,88 @@
+/*********************************************
+
+  Copyright (c) Jackson Nestelroad 2020
+  jackson.nestelroad.com
+
+*********************************************/
+
+#include "concurrency_limiter.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <mutex>
+
+#include "aether/program/options.hpp"
+
+namespace proxy::connection {
+
+concurrency_limiter::concurrency_limiter(program::options& options)
+    : options_(options),
+      limit_(options.adaptive_concurrency ? std::min(initial_limit, options.connection_service_limit)
+                                          : options.connection_service_limit),
+      latency_sum_us_(0),
+      latency_count_(0),
+      max_lag_ms_(0),
+      last_lag_ms_(0),
+      estimated_limit_(static_cast<double>(limit_.load())) {}
+
+void concurrency_limiter::record_latency(std::chrono::steady_clock::duration latency) {
+  auto us = std::chrono::duration_cast<std::chrono::microseconds>(latency).count();
+  latency_sum_us_.fetch_add(static_cast<std::uint64_t>(std::max<decltype(us)>(us, 0)), std::memory_order_relaxed);
+  latency_count_.fetch_add(1, std::memory_order_relaxed);
+}
+
+void concurrency_limiter::record_lag(std::chrono::steady_clock::duration lag) {
+  auto ms = static_cast<std::uint64_t>(std::max<std::int64_t>(
+      std::chrono::duration_cast<std::chrono::milliseconds>(lag).count(), 0));
+  std::uint64_t current = max_lag_ms_.load(std::memory_order_relaxed);
+  while (ms > current && !max_lag_ms_.compare_exchange_weak(current, ms, std::memory_order_relaxed)) {
+  }
+}
+
+bool concurrency_limiter::update(std::size_t in_flight) {
+  std::uint64_t lag_ms = max_lag_ms_.exchange(0, std::memory_order_relaxed);
+  last_lag_ms_.store(lag_ms, std::memory_order_relaxed);
+  std::uint64_t latency_sum = latency_sum_us_.exchange(0, std::memory_order_relaxed);
+  std::uint64_t latency_count = latency_count_.exchange(0, std::memory_order_relaxed);
+  if (!options_.adaptive_concurrency) {
+    return false;
+  }
+
+  std::lock_guard<std::mutex> lock(update_mutex_);
+  double gradient = 1.0;
+  if (latency_count > 0) {
+    double latency_us = static_cast<double>(latency_sum) / static_cast<double>(latency_count);
+    if (long_term_latency_us_ == 0) {
+      long_term_latency_us_ = latency_us;
+    } else {
+      long_term_latency_us_ = (1 - long_term_weight) * long_term_latency_us_ + long_term_weight * latency_us;
+    }
+    // A long-term average far above the current latency is left over from an earlier overload, so it recovers
+    // faster than the average would on its own.
+    if (long_term_latency_us_ > 2 * latency_us) {
+      long_term_latency_us_ *= 0.9;
+    }
+    gradient = std::clamp(long_term_latency_us_ / std::max(latency_us, 1.0), 0.5, 1.0);
+  }
+  if (std::chrono::milliseconds(lag_ms) > lag_threshold) {
+    gradient = std::min(gradient, lag_backoff);
+  }
+
+  // The limit only grows while it is actually being used, so an idle proxy does not drift up to the maximum.
+  double queue_allowance = std::sqrt(estimated_limit_);
+  double target = estimated_limit_ * gradient;
+  if (gradient >= 1.0 && static_cast<double>(in_flight) >= estimated_limit_ / 2) {
+    target += queue_allowance;
+  }
+  estimated_limit_ = (1 - smoothing) * estimated_limit_ + smoothing * target;
+  double max_limit = static_cast<double>(options_.connection_service_limit);
+  estimated_limit_ = std::clamp(estimated_limit_, std::min(static_cast<double>(min_limit), max_limit), max_limit);
+
+  std::size_t new_limit = static_cast<std::size_t>(estimated_limit_);
+  std::size_t old_limit = limit_.exchange(new_limit, std::memory_order_relaxed);
+  return new_limit > old_limit;
+}
+
+}  // namespace proxy::connection
@@ -0,0 +1,86 @@
+/*********************************************
+
+  Copyright (c) Jackson Nestelroad 2020
+  jackson.nestelroad.com
+
+*********************************************/
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+
+#include "aether/program/options.hpp"
+
+namespace proxy::connection {
+
+// Adjusts the number of connections serviced at once to what the proxy and its servers can handle.
+//
+// Follows the gradient approach: the latency of upstream requests in each window is compared to its long-term
+// average, and the limit shrinks by their ratio when requests slow down and grows again while they stay fast. Lag of
+// the event loops, which means the proxy itself is saturated, shrinks the limit multiplicatively.
+//
+// Without adaptive concurrency, the limit is always the configured servicing limit.
+class concurrency_limiter {
+ public:
+  concurrency_limiter(program::options& options);
+  concurrency_limiter() = delete;
+  ~concurrency_limiter() = default;
+  concurrency_limiter(const concurrency_limiter& other) = delete;
+  concurrency_limiter& operator=(const concurrency_limiter& other) = delete;
+  concurrency_limiter(concurrency_limiter&& other) noexcept = delete;
+  concurrency_limiter& operator=(concurrency_limiter&& other) noexcept = delete;
+
+  // Returns the number of connections that may be serviced at once.
+  inline std::size_t limit() const { return limit_.load(std::memory_order_relaxed); }
+
+  // Records how long a request took to be answered by its server.
+  void record_latency(std::chrono::steady_clock::duration latency);
+
+  // Records how late a timer on an event loop fired.
+  void record_lag(std::chrono::steady_clock::duration lag);
+
+  // Recalculates the limit from the samples recorded since the last update.
+  //
+  // Returns if the limit grew.
+  bool update(std::size_t in_flight);
+
+  // Returns the largest event loop lag of the last window.
+  inline std::chrono::milliseconds event_loop_lag() const {
+    return std::chrono::milliseconds(last_lag_ms_.load(std::memory_order_relaxed));
+  }
+
+ private:
+  static constexpr std::size_t min_limit = 8;
+  static constexpr std::size_t initial_limit = 256;
+
+  // Event loop lag above which the proxy is considered saturated.
+  static constexpr std::chrono::milliseconds lag_threshold{50};
+
+  // Factor the limit is multiplied by when an event loop lags.
+  static constexpr double lag_backoff = 0.8;
+
+  // Weight of a window in the long-term latency average.
+  static constexpr double long_term_weight = 0.05;
+
+  // Weight of a newly calculated limit against the previous one.
+  static constexpr double smoothing = 0.2;
+
+  program::options& options_;
+  std::atomic<std::size_t> limit_;
+
+  // Samples of the current window.
+  std::atomic<std::uint64_t> latency_sum_us_;
+  std::atomic<std::uint64_t> latency_count_;
+  std::atomic<std::uint64_t> max_lag_ms_;
+  std::atomic<std::uint64_t> last_lag_ms_;
+
+  // Only accessed by update.
+  std::mutex update_mutex_;
+  double estimated_limit_;
+  double long_term_latency_us_ = 0;
+};
+
+}  // namespace proxy::connection
@@ -36,7 +36,7 @@ connection_flow::~connection_flow() { out::safe_debug::log("Deleting connection
 
 void connection_flow::set_server(std::string host, port_t port) {
   if (server.connected()) {
-    server.disconnect();
+    server.release();
   }
   target_host_ = std::move(host);
   target_port_ = port;
@@ -56,9 +56,21 @@ result<void> connection_flow::establish_tls_with_server_async(tls::openssl::ssl_
   return server.establish_tls_async(args, std::move(handler));
 }
 
+void connection_flow::reset(util::uuid_t id) {
+  id_ = id;
+  target_host_.clear();
+  target_port_ = {};
+  intercept_tls_ = false;
+  intercept_websocket_ = false;
+  client.reset();
+  server.reset();
+  error = {};
+  out::safe_debug::log("Reusing connection flow", id_);
+}
+
 void connection_flow::disconnect() {
   client.disconnect();
-  server.disconnect();
+  server.release();
 }
 
 }  // namespace proxy::connection
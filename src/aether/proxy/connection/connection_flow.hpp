@@ -54,7 +54,15 @@ class connection_flow {
   // Set server details using set_server.
   result<void> establish_tls_with_server_async(tls::openssl::ssl_context_args& args, err_callback_t handler);
 
+  // Returns the flow to the state of a new one with the given ID, so it can be used for another client.
+  //
+  // The connections keep their sockets, strands, and timers. Must not be called while operations are pending on
+  // either connection.
+  void reset(util::uuid_t id);
+
   // Disconnects both the client and server connections if applicable.
+  //
+  // The server connection is given to the server connection pool instead if it can be reused.
   void disconnect();
 
   // Returns if the connection flow should be intercepted using TLS.
@@ -7,81 +7,253 @@
 
 #include "connection_manager.hpp"
 
-#include <functional>
+#include <algorithm>
+#include <boost/asio.hpp>
+#include <cstdint>
 #include <memory>
 #include <mutex>
 #include <utility>
 
 #include "aether/proxy/server_components.hpp"
+#include "aether/util/console.hpp"
 
 namespace proxy::connection {
 
-connection_manager::connection_manager(server_components& components) : components_(components) {}
+connection_manager::shard::shard(boost::asio::io_context& ioc) : ioc(ioc), timer(ioc), pending_count(0) {}
 
-connection_flow& connection_manager::new_connection(boost::asio::io_context& ioc) {
-  auto ptr = std::make_unique<connection_flow>(ioc, components_);
-  std::lock_guard<std::mutex> lock(data_mutex_);
-  auto res = connections_.emplace(ptr->id(), std::move(ptr));
-  return *res.first->second;
+connection_manager::connection_manager(server_components& components)
+    : components_(components),
+      limiter_(components.options),
+      total_count_(0),
+      active_count_(0),
+      pending_count_(0),
+      rejected_count_(0) {
+  for (std::size_t i = 0; i < components_.io_contexts.size(); ++i) {
+    boost::asio::io_context& ioc = components_.io_contexts.get_io_context(i);
+    auto sh = std::make_unique<shard>(ioc);
+    shard_list_.push_back(sh.get());
+    schedule_tick(*sh);
+    shards_.emplace(&ioc, std::move(sh));
+  }
 }
 
-void connection_manager::start_service(connection_flow& flow) {
-  auto res = services_.emplace(std::make_unique<connection_handler>(flow, components_));
-  const std::unique_ptr<connection_handler>& service_ptr = *res.first;
-  connection_handler& new_handler = *res.first->get();
-  boost::asio::post(flow.io_context(), [this, &new_handler, service_ptr = std::cref(service_ptr)]() {
-    new_handler.start(std::bind_front(&connection_manager::stop, this, std::cref(service_ptr)));
-  });
+connection_manager::shard* connection_manager::get_shard(boost::asio::io_context& ioc) {
+  auto it = shards_.find(&ioc);
+  return it == shards_.end() ? nullptr : it->second.get();
 }
 
-void connection_manager::start(connection_flow& flow) {
-  std::lock_guard<std::mutex> lock(data_mutex_);
+std::unique_ptr<connection_flow> connection_manager::new_connection(boost::asio::io_context& ioc) {
+  if (shard* sh = get_shard(ioc)) {
+    std::unique_ptr<connection_flow> flow;
+    {
+      std::lock_guard<std::mutex> lock(sh->spare_mutex);
+      if (!sh->spare_flows.empty()) {
+        flow = std::move(sh->spare_flows.back());
+        sh->spare_flows.pop_back();
+      }
+    }
+    if (flow) {
+      flow->reset(components_.uuid_factory.v1());
+      return flow;
+    }
+  }
+  return std::make_unique<connection_flow>(ioc, components_);
+}
+
+void connection_manager::start(std::unique_ptr<connection_flow> flow) {
+  shard* sh = get_shard(flow->io_context());
+  if (sh == nullptr) {
+    out::safe_warn::log("Connection", flow->id(), "was started on an io_context the server does not own");
+    return;
+  }
+  total_count_.fetch_add(1, std::memory_order_relaxed);
+  components_.io_contexts.add_connection(sh->ioc);
+  boost::asio::post(sh->ioc, [this, sh, flow = std::move(flow)]() mutable { adopt(*sh, std::move(flow)); });
+}
+
+void connection_manager::adopt(shard& sh, std::unique_ptr<connection_flow> flow) {
+  std::uint32_t index;
+  if (!sh.free_slots.empty()) {
+    index = sh.free_slots.back();
+    sh.free_slots.pop_back();
+  } else {
+    index = static_cast<std::uint32_t>(sh.slots.size());
+    sh.slots.emplace_back();
+  }
+  sh.slots[index].flow = std::move(flow);
 
-  if (services_.size() < components_.options.connection_service_limit) {
-    start_service(flow);
+  if (components_.memory_budget.exhausted()) {
+    // Taking on more work could run the proxy out of memory.
+    components_.memory_budget.record_shed();
+    reject(sh, index);
+  } else if (try_admit()) {
+    start_service(sh, index);
+  } else if (pending_count_.load(std::memory_order_relaxed) >= limiter_.limit()) {
+    // The queue is as long as the limit, so the connection would not be serviced in reasonable time.
+    reject(sh, index);
   } else {
-    pending_connection_ids_.push(flow.id());
+    sh.pending.push_back({index, std::chrono::steady_clock::now()});
+    sh.pending_count.fetch_add(1, std::memory_order_relaxed);
+    pending_count_.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+bool connection_manager::try_admit() {
+  std::size_t limit = limiter_.limit();
+  std::size_t active = active_count_.load(std::memory_order_relaxed);
+  while (active < limit) {
+    if (active_count_.compare_exchange_weak(active, active + 1, std::memory_order_relaxed)) {
+      return true;
+    }
   }
+  return false;
 }
 
-void connection_manager::destroy(connection_flow& flow) {
-  std::lock_guard<std::mutex> lock(data_mutex_);
-  connections_.erase(flow.id());
+void connection_manager::start_service(shard& sh, std::uint32_t index) {
+  slot& s = sh.slots[index];
+  s.handler = std::make_unique<connection_handler>(*s.flow, components_);
+  connection_handler& new_handler = *s.handler;
+  boost::asio::post(sh.ioc, [this, &sh, index, &new_handler]() {
+    new_handler.start([this, &sh, index]() { stop(sh, index); });
+  });
 }
 
-void connection_manager::stop(const std::unique_ptr<connection_handler>& service_ptr) {
-  connection_flow& flow = service_ptr->connection_flow();
-  std::lock_guard<std::mutex> lock(data_mutex_);
-  services_.erase(service_ptr);
+void connection_manager::stop(shard& sh, std::uint32_t index) {
+  slot& s = sh.slots[index];
   // TODO: Make sure connection is safe for deletion?
-  connections_.erase(flow.id());
+  s.handler.reset();
+  recycle(sh, std::move(s.flow));
+  sh.free_slots.push_back(index);
+  total_count_.fetch_sub(1, std::memory_order_relaxed);
+  components_.io_contexts.remove_connections(sh.ioc);
+  active_count_.fetch_sub(1, std::memory_order_relaxed);
+
+  // Pending connections of this shard are preferred, since they can be started without leaving this thread.
+  if (!sh.pending.empty()) {
+    start_pending_connections(sh);
+  } else {
+    wake_pending_shard(sh);
+  }
+}
+
+void connection_manager::recycle(shard& sh, std::unique_ptr<connection_flow> flow) {
+  if (flow->client.operations_pending() || flow->server.operations_pending()) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(sh.spare_mutex);
+  if (sh.spare_flows.size() < components_.options.flow_pool_size) {
+    sh.spare_flows.push_back(std::move(flow));
+  }
+}
 
-  start_pending_connections();
+void connection_manager::start_pending_connections(shard& sh) {
+  while (!sh.pending.empty() && try_admit()) {
+    std::uint32_t index = sh.pending.front().index;
+    sh.pending.pop_front();
+    sh.pending_count.fetch_sub(1, std::memory_order_relaxed);
+    pending_count_.fetch_sub(1, std::memory_order_relaxed);
+    start_service(sh, index);
+  }
+  if (sh.pending.empty()) {
+    // Capacity may be left over, which another shard can use.
+    wake_pending_shard(sh);
+  }
 }
 
-void connection_manager::start_pending_connections() {
-  while (!pending_connection_ids_.empty() && services_.size() < components_.options.connection_service_limit) {
-    util::uuid_t next_connection_id = pending_connection_ids_.front();
-    pending_connection_ids_.pop();
-    auto next_connection_it = connections_.find(next_connection_id);
-    if (next_connection_it == connections_.end()) {
-      out::safe_warn::log("Connection id", next_connection_id,
-                          "was in pending connection queue but does not reference any known connection");
-      continue;
+void connection_manager::wake_pending_shard(const shard& from) {
+  if (pending_count_.load(std::memory_order_relaxed) == 0 ||
+      active_count_.load(std::memory_order_relaxed) >= limiter_.limit()) {
+    return;
+  }
+  auto it = std::find(shard_list_.begin(), shard_list_.end(), &from);
+  for (std::size_t i = 1; i <= shard_list_.size(); ++i) {
+    shard* next = shard_list_[(static_cast<std::size_t>(it - shard_list_.begin()) + i) % shard_list_.size()];
+    if (next != &from && next->pending_count.load(std::memory_order_relaxed) > 0) {
+      boost::asio::post(next->ioc, [this, next]() { start_pending_connections(*next); });
+      return;
     }
-    connection_flow& next_connection = *next_connection_it->second;
-    start_service(next_connection);
   }
 }
 
-void connection_manager::stop_all() {
-  std::lock_guard<std::mutex> lock(data_mutex_);
+void connection_manager::reject(shard& sh, std::uint32_t index) {
+  slot& s = sh.slots[index];
+  // The response is small enough for the socket's send buffer, so a single non-blocking write is enough. If it does
+  // not go through, the client only sees the connection close.
+  boost::asio::ip::tcp::socket& socket = s.flow->client.socket();
+  boost::system::error_code error;
+  socket.non_blocking(true, error);
+  socket.write_some(boost::asio::buffer(overloaded_response.data(), overloaded_response.size()), error);
+  s.flow->client.disconnect();
+
+  recycle(sh, std::move(s.flow));
+  sh.free_slots.push_back(index);
+  total_count_.fetch_sub(1, std::memory_order_relaxed);
+  components_.io_contexts.remove_connections(sh.ioc);
+  rejected_count_.fetch_add(1, std::memory_order_relaxed);
+}
+
+void connection_manager::schedule_tick(shard& sh) {
+  sh.next_tick = std::chrono::steady_clock::now() + tick_interval;
+  sh.timer.expires_at(sh.next_tick);
+  sh.timer.async_wait([this, &sh](const boost::system::error_code& error) { on_tick(sh, error); });
+}
 
-  for (const std::unique_ptr<connection_handler>& current_service : services_) {
-    current_service->stop();
+void connection_manager::on_tick(shard& sh, const boost::system::error_code& error) {
+  if (error == boost::asio::error::operation_aborted) {
+    return;
   }
 
-  pending_connection_ids_ = decltype(pending_connection_ids_)();
+  std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+  limiter_.record_lag(now - sh.next_tick);
+  components_.io_contexts.record_lag(sh.ioc, now - sh.next_tick);
+
+  // Connections that waited too long are turned away, since their clients have likely given up already.
+  std::chrono::milliseconds queue_timeout(components_.options.connection_queue_timeout.total_milliseconds());
+  if (queue_timeout.count() > 0) {
+    while (!sh.pending.empty() && now - sh.pending.front().since >= queue_timeout) {
+      std::uint32_t index = sh.pending.front().index;
+      sh.pending.pop_front();
+      sh.pending_count.fetch_sub(1, std::memory_order_relaxed);
+      pending_count_.fetch_sub(1, std::memory_order_relaxed);
+      reject(sh, index);
+    }
+  }
+
+  // A single shard updates the limit for all of them.
+  if (&sh == shard_list_.front() && ++sh.ticks % ticks_per_update == 0 &&
+      limiter_.update(active_count_.load(std::memory_order_relaxed))) {
+    start_pending_connections(sh);
+  }
+
+  schedule_tick(sh);
+}
+
+void connection_manager::stop_all() {
+  for (shard* sh : shard_list_) {
+    boost::asio::post(sh->ioc, [this, sh]() {
+      // Pending connections were never started, so they are simply dropped.
+      for (const pending_connection& pending : sh->pending) {
+        sh->slots[pending.index].flow.reset();
+        sh->free_slots.push_back(pending.index);
+        total_count_.fetch_sub(1, std::memory_order_relaxed);
+      }
+      pending_count_.fetch_sub(sh->pending.size(), std::memory_order_relaxed);
+      components_.io_contexts.remove_connections(sh->ioc, sh->pending.size());
+      sh->pending_count.store(0, std::memory_order_relaxed);
+      sh->pending.clear();
+
+      // Stopping a handler removes it from its slot, so the handlers to stop are collected first.
+      std::vector<connection_handler*> handlers;
+      for (slot& s : sh->slots) {
+        if (s.handler != nullptr) {
+          handlers.push_back(s.handler.get());
+        }
+      }
+      for (connection_handler* handler : handlers) {
+        handler->stop();
+      }
+    });
+  }
 }
 
 }  // namespace proxy::connection
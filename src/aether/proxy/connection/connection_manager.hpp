@@ -7,22 +7,38 @@
 
 #pragma once
 
+#include <atomic>
 #include <boost/asio.hpp>
+#include <chrono>
+#include <cstdint>
+#include <string_view>
+#include <deque>
+#include <memory>
 #include <mutex>
-#include <queue>
-#include <set>
 #include <unordered_map>
+#include <vector>
 
+#include "aether/proxy/connection/concurrency_limiter.hpp"
 #include "aether/proxy/connection/connection_flow.hpp"
 #include "aether/proxy/connection_handler.hpp"
 #include "aether/proxy/intercept/interceptor_services.hpp"
-#include "aether/util/uuid.hpp"
 
 namespace proxy::connection {
 
 // Small class to manage ongoing connection flows.
 //
 // Owns connection flows and connection handlers to assure they are not destroyed until their work is finished.
+//
+// Flows are kept in a shard for their io_context, which is only ever touched by the thread running that io_context,
+// so no locks are taken. The servicing limit is shared by all shards through atomic counters, and is adjusted to the
+// observed load by the concurrency limiter.
+//
+// Finished flows are kept in their shard to be reused for new connections, so connection storms do not pay for
+// creating every socket, strand, and timer from scratch.
+//
+// Connections over the limit wait in a queue no longer than the limit itself, and for no longer than the queue
+// timeout. Connections that cannot wait are answered with a 503 response and closed right away, as are all new
+// connections while the memory budget is exhausted.
 class connection_manager {
  public:
   connection_manager(server_components& components);
@@ -32,46 +48,124 @@ class connection_manager {
   connection_manager(connection_manager&& other) noexcept = delete;
   connection_manager& operator=(connection_manager&& other) noexcept = delete;
 
-  connection_flow& new_connection(boost::asio::io_context& ioc);
+  // Creates a connection flow on the io_context, or reuses a finished one, which is owned by the caller until it is
+  // started.
+  std::unique_ptr<connection_flow> new_connection(boost::asio::io_context& ioc);
 
   // Starts managing and handling a new connection flow.
   //
-  // This should be called after a client has connected.
-  void start(connection_flow& flow);
-
-  // Destroys a given connection, without regards to the service it is connected to.
-  //
-  // This method should only be called if the connection has not been given to a connection_handler instance.
-  void destroy(connection_flow& flow);
+  // This should be called after a client has connected. The flow is handed to the thread of its io_context, so it may
+  // be called from any thread.
+  void start(std::unique_ptr<connection_flow> flow);
 
   // Stop all connections immediately.
   void stop_all();
 
   // Returns the total number of connections to the proxy.
-  inline std::size_t total_connection_count() const { return connections_.size(); }
+  inline std::size_t total_connection_count() const { return total_count_.load(std::memory_order_relaxed); }
 
   // Returns the total number of connections being serviced.
-  inline std::size_t active_connection_count() const { return services_.size(); }
+  inline std::size_t active_connection_count() const { return active_count_.load(std::memory_order_relaxed); }
 
   // Returns the total number of connections awaiting service.
-  inline std::size_t pending_connection_count() const { return 0; }
+  inline std::size_t pending_connection_count() const { return pending_count_.load(std::memory_order_relaxed); }
+
+  // Returns the number of connections turned away because the proxy was overloaded.
+  inline std::size_t rejected_connection_count() const { return rejected_count_.load(std::memory_order_relaxed); }
+
+  inline concurrency_limiter& limiter() { return limiter_; }
+  inline const concurrency_limiter& limiter() const { return limiter_; }
 
  private:
-  // Starts servicing a connection.
-  void start_service(connection_flow& flow);
+  // A flow and the handler servicing it, if any.
+  struct slot {
+    std::unique_ptr<connection_flow> flow;
+    std::unique_ptr<connection_handler> handler;
+  };
+
+  // A connection waiting for the servicing limit to allow it in.
+  struct pending_connection {
+    std::uint32_t index;
+    std::chrono::steady_clock::time_point since;
+  };
+
+  // Connections of a single io_context.
+  struct shard {
+    boost::asio::io_context& ioc;
+
+    // Fires periodically to measure event loop lag and to expire pending connections.
+    boost::asio::steady_timer timer;
+    std::chrono::steady_clock::time_point next_tick;
+    std::size_t ticks = 0;
+
+    // Slots are reused through the free list, so a slot's index identifies its connection for as long as it lives.
+    std::vector<slot> slots;
+    std::vector<std::uint32_t> free_slots;
+
+    // Connections waiting for the servicing limit to allow them in, in arrival order.
+    std::deque<pending_connection> pending;
+
+    // Size of the pending queue, which other threads read when looking for a connection to start.
+    std::atomic<std::size_t> pending_count;
+
+    // Finished flows ready to be reused. New connections may be created from any thread, so these take a lock.
+    std::mutex spare_mutex;
+    std::vector<std::unique_ptr<connection_flow>> spare_flows;
+
+    shard(boost::asio::io_context& ioc);
+  };
+
+  shard* get_shard(boost::asio::io_context& ioc);
+
+  // Takes ownership of a flow on its shard's thread.
+  void adopt(shard& sh, std::unique_ptr<connection_flow> flow);
+
+  // Starts servicing the connection in a slot.
+  void start_service(shard& sh, std::uint32_t index);
 
   // Stops an existing service, deleting it from the records.
-  void stop(const std::unique_ptr<connection_handler>& service_ptr);
+  void stop(shard& sh, std::uint32_t index);
+
+  // Keeps a finished flow for reuse if the shard has room for it, destroying it otherwise.
+  //
+  // Flows with operations still pending are always destroyed, since their handlers have yet to run.
+  void recycle(shard& sh, std::unique_ptr<connection_flow> flow);
+
+  // Claims a place under the servicing limit, returning false if the limit has been reached.
+  bool try_admit();
 
-  // Starts as many pending connections as possible based on the servicing limit.
-  void start_pending_connections();
+  // Starts as many pending connections of the shard as the servicing limit allows.
+  void start_pending_connections(shard& sh);
 
-  std::mutex data_mutex_;
-  std::unordered_map<util::uuid_t, std::unique_ptr<connection_flow>> connections_;
-  std::queue<util::uuid_t> pending_connection_ids_;
-  std::set<std::unique_ptr<connection_handler>> services_;
+  // Hands free servicing capacity to another shard with pending connections, if there is one.
+  void wake_pending_shard(const shard& from);
+
+  // Answers a connection that cannot be serviced with 503 and closes it.
+  void reject(shard& sh, std::uint32_t index);
+
+  void schedule_tick(shard& sh);
+  void on_tick(shard& sh, const boost::system::error_code& error);
+
+  // Pre-serialized response for connections that are turned away.
+  static constexpr std::string_view overloaded_response =
+      "HTTP/1.1 503 Service Unavailable\r\nContent-Length: 0\r\nConnection: close\r\nRetry-After: 1\r\n\r\n";
+
+  static constexpr std::chrono::milliseconds tick_interval{100};
+
+  // Number of ticks between updates of the concurrency limit.
+  static constexpr std::size_t ticks_per_update = 10;
 
   server_components& components_;
+  concurrency_limiter limiter_;
+
+  // Built once at construction and never modified, so lookups do not need a lock.
+  std::unordered_map<boost::asio::io_context*, std::unique_ptr<shard>> shards_;
+  std::vector<shard*> shard_list_;
+
+  std::atomic<std::size_t> total_count_;
+  std::atomic<std::size_t> active_count_;
+  std::atomic<std::size_t> pending_count_;
+  std::atomic<std::size_t> rejected_count_;
 };
 
 }  // namespace proxy::connection
@@ -0,0 +1,189 @@
+/*********************************************
+
+  Copyright (c) Jackson Nestelroad 2020
+  jackson.nestelroad.com
+
+*********************************************/
+
+#include "dns_cache.hpp"
+
+#include <algorithm>
+#include <boost/asio.hpp>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "aether/program/options.hpp"
+
+namespace proxy::connection {
+
+void system_dns_resolver::resolve_async(boost::asio::any_io_executor executor, const std::string& host, port_t port,
+                                        resolve_callback_t handler) {
+  // The resolver must live until its handler runs.
+  auto resolver = std::make_shared<boost::asio::ip::tcp::resolver>(executor);
+  resolver->async_resolve(
+      host, std::to_string(port),
+      [resolver, handler = std::move(handler)](const boost::system::error_code& error,
+                                               boost::asio::ip::tcp::resolver::results_type results) mutable {
+        auto endpoints = std::make_shared<endpoint_list>();
+        if (error == boost::system::errc::success) {
+          endpoints->reserve(results.size());
+          for (const auto& result : results) {
+            endpoints->push_back(result.endpoint());
+          }
+        }
+        handler(error, std::move(endpoints));
+      });
+}
+
+dns_cache::dns_cache(program::options& options)
+    : options_(options), resolver_(std::make_unique<system_dns_resolver>()), hits_(0), stale_hits_(0), misses_(0) {}
+
+void dns_cache::set_resolver(std::unique_ptr<dns_resolver> resolver) { resolver_ = std::move(resolver); }
+
+std::string dns_cache::make_key(const std::string& host, port_t port) { return host + ':' + std::to_string(port); }
+
+dns_cache::shard& dns_cache::get_shard(const std::string& key) {
+  return shards_[std::hash<std::string>{}(key) % num_shards];
+}
+
+void dns_cache::resolve_async(boost::asio::any_io_executor executor, const std::string& host, port_t port,
+                              resolve_callback_t handler) {
+  if (options_.dns_cache_ttl.total_milliseconds() == 0) {
+    misses_.fetch_add(1, std::memory_order_relaxed);
+    resolver_->resolve_async(std::move(executor), host, port, std::move(handler));
+    return;
+  }
+
+  std::string key = make_key(host, port);
+  shard& sh = get_shard(key);
+  boost::posix_time::ptime now = boost::asio::deadline_timer::traits_type::now();
+
+  std::unique_lock<std::mutex> lock(sh.mutex);
+  auto it = sh.entries.find(key);
+  if (it == sh.entries.end()) {
+    evict(sh, now);
+    it = sh.entries.emplace(key, entry{}).first;
+  }
+  entry& e = it->second;
+
+  bool fresh = e.answered && now < e.expiry;
+  // Only successful answers are served stale, since a failed lookup is likely to succeed soon.
+  bool stale = e.answered && !fresh && e.error == boost::system::errc::success &&
+               now < e.expiry + options_.dns_stale_ttl;
+
+  if (fresh || stale) {
+    (fresh ? hits_ : stale_hits_).fetch_add(1, std::memory_order_relaxed);
+    bool refresh = stale && !e.resolving;
+    if (refresh) {
+      e.resolving = true;
+    }
+    boost::system::error_code error = e.error;
+    std::shared_ptr<const endpoint_list> endpoints = e.endpoints;
+    lock.unlock();
+
+    boost::asio::post(executor,
+                      [handler = std::move(handler), error, endpoints = std::move(endpoints)]() mutable {
+                        handler(error, std::move(endpoints));
+                      });
+    if (refresh) {
+      start_lookup(std::move(executor), std::move(key), host, port);
+    }
+    return;
+  }
+
+  misses_.fetch_add(1, std::memory_order_relaxed);
+  e.waiters.push_back({executor, std::move(handler)});
+  if (e.resolving) {
+    // Another lookup is already in flight, so wait for its answer.
+    return;
+  }
+  e.resolving = true;
+  lock.unlock();
+
+  start_lookup(std::move(executor), std::move(key), host, port);
+}
+
+void dns_cache::start_lookup(boost::asio::any_io_executor executor, std::string key, const std::string& host,
+                             port_t port) {
+  resolver_->resolve_async(std::move(executor), host, port,
+                           [this, key = std::move(key)](const boost::system::error_code& error,
+                                                        std::shared_ptr<const endpoint_list> endpoints) mutable {
+                             on_lookup(key, error, std::move(endpoints));
+                           });
+}
+
+void dns_cache::on_lookup(const std::string& key, const boost::system::error_code& error,
+                          std::shared_ptr<const endpoint_list> endpoints) {
+  boost::system::error_code result_error = error;
+  if (result_error == boost::system::errc::success && (!endpoints || endpoints->empty())) {
+    result_error = boost::system::errc::make_error_code(boost::system::errc::host_unreachable);
+  }
+
+  shard& sh = get_shard(key);
+  boost::posix_time::ptime now = boost::asio::deadline_timer::traits_type::now();
+
+  std::unique_lock<std::mutex> lock(sh.mutex);
+  auto it = sh.entries.find(key);
+  if (it == sh.entries.end()) {
+    return;
+  }
+  entry& e = it->second;
+  e.resolving = false;
+  std::vector<waiter> waiters = std::exchange(e.waiters, {});
+
+  bool succeeded = result_error == boost::system::errc::success;
+  // A failed refresh keeps the stale answer, which is served until the stale TTL runs out.
+  bool keep_stale = !succeeded && e.endpoints && waiters.empty();
+  if (!succeeded && !keep_stale && options_.dns_negative_ttl.total_milliseconds() == 0) {
+    sh.entries.erase(it);
+  } else if (!keep_stale) {
+    e.answered = true;
+    e.error = result_error;
+    e.endpoints = succeeded ? std::move(endpoints) : nullptr;
+    e.expiry = now + (succeeded ? options_.dns_cache_ttl : options_.dns_negative_ttl);
+    endpoints = e.endpoints;
+  }
+  lock.unlock();
+
+  for (waiter& w : waiters) {
+    boost::asio::post(w.executor, [handler = std::move(w.handler), result_error, endpoints]() mutable {
+      handler(result_error, std::move(endpoints));
+    });
+  }
+}
+
+void dns_cache::evict(shard& sh, boost::posix_time::ptime now) {
+  std::size_t capacity = std::max<std::size_t>(options_.dns_cache_size / num_shards, 1);
+  if (sh.entries.size() < capacity) {
+    return;
+  }
+
+  // Entries too old to be served are dropped first.
+  std::erase_if(sh.entries, [&](const auto& pair) {
+    const entry& e = pair.second;
+    return !e.resolving && e.answered && now >= e.expiry + options_.dns_stale_ttl;
+  });
+  if (sh.entries.size() < capacity) {
+    return;
+  }
+
+  for (auto it = sh.entries.begin(); it != sh.entries.end(); ++it) {
+    if (!it->second.resolving) {
+      sh.entries.erase(it);
+      return;
+    }
+  }
+}
+
+void dns_cache::clear() {
+  for (shard& sh : shards_) {
+    std::lock_guard<std::mutex> lock(sh.mutex);
+    std::erase_if(sh.entries, [](const auto& pair) { return !pair.second.resolving; });
+  }
+}
+
+}  // namespace proxy::connection
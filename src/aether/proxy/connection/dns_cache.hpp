@@ -0,0 +1,133 @@
+/*********************************************
+
+  Copyright (c) Jackson Nestelroad 2020
+  jackson.nestelroad.com
+
+*********************************************/
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <boost/asio.hpp>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "aether/program/options.hpp"
+#include "aether/proxy/types.hpp"
+#include "aether/util/any_invocable.hpp"
+
+namespace proxy::connection {
+
+using endpoint_list = std::vector<boost::asio::ip::tcp::endpoint>;
+using resolve_callback_t =
+    util::any_invocable<void(const boost::system::error_code&, std::shared_ptr<const endpoint_list>)>;
+
+// Interface for looking up the endpoints of a host.
+//
+// The DNS cache uses the system resolver by default, but can be given any other implementation, such as a stub that
+// answers from a fixed table.
+class dns_resolver {
+ public:
+  virtual ~dns_resolver() = default;
+
+  // Resolves the host and port, calling the handler on the given executor when done.
+  virtual void resolve_async(boost::asio::any_io_executor executor, const std::string& host, port_t port,
+                             resolve_callback_t handler) = 0;
+};
+
+// Resolver that uses the operating system's name lookup (getaddrinfo).
+class system_dns_resolver : public dns_resolver {
+ public:
+  void resolve_async(boost::asio::any_io_executor executor, const std::string& host, port_t port,
+                     resolve_callback_t handler) override;
+};
+
+// Process-wide cache of DNS lookups.
+//
+// Answers are kept for the DNS cache TTL, and failed lookups for the negative TTL. Once an answer expires, it is still
+// served for the stale TTL while a single background lookup refreshes it. Concurrent lookups for the same host share
+// one query.
+//
+// Entries are split across shards by host so that threads rarely contend on the same lock.
+class dns_cache {
+ public:
+  dns_cache(program::options& options);
+  dns_cache() = delete;
+  ~dns_cache() = default;
+  dns_cache(const dns_cache& other) = delete;
+  dns_cache& operator=(const dns_cache& other) = delete;
+  dns_cache(dns_cache&& other) noexcept = delete;
+  dns_cache& operator=(dns_cache&& other) noexcept = delete;
+
+  // Replaces the resolver used for lookups.
+  //
+  // Must be called before the server starts.
+  void set_resolver(std::unique_ptr<dns_resolver> resolver);
+
+  // Resolves the host and port, calling the handler on the given executor when done.
+  void resolve_async(boost::asio::any_io_executor executor, const std::string& host, port_t port,
+                     resolve_callback_t handler);
+
+  // Removes all entries that are not waiting on a lookup.
+  void clear();
+
+  inline std::size_t hit_count() const { return hits_.load(std::memory_order_relaxed); }
+  inline std::size_t stale_hit_count() const { return stale_hits_.load(std::memory_order_relaxed); }
+  inline std::size_t miss_count() const { return misses_.load(std::memory_order_relaxed); }
+
+ private:
+  static constexpr std::size_t num_shards = 16;
+
+  struct waiter {
+    boost::asio::any_io_executor executor;
+    resolve_callback_t handler;
+  };
+
+  struct entry {
+    std::shared_ptr<const endpoint_list> endpoints;
+    boost::system::error_code error;
+    boost::posix_time::ptime expiry;
+    // Set once a lookup for the entry has completed.
+    bool answered = false;
+    // Set while a lookup for the entry is in flight.
+    bool resolving = false;
+    // Handlers waiting on the in-flight lookup, since there was no answer to serve them.
+    std::vector<waiter> waiters;
+  };
+
+  struct shard {
+    std::mutex mutex;
+    std::unordered_map<std::string, entry> entries;
+  };
+
+  static std::string make_key(const std::string& host, port_t port);
+
+  shard& get_shard(const std::string& key);
+
+  // Starts a lookup for the entry under the key.
+  //
+  // The entry must already be marked as resolving.
+  void start_lookup(boost::asio::any_io_executor executor, std::string key, const std::string& host, port_t port);
+
+  void on_lookup(const std::string& key, const boost::system::error_code& error,
+                 std::shared_ptr<const endpoint_list> endpoints);
+
+  // Makes room for a new entry if the shard is full.
+  //
+  // The shard's mutex must be held.
+  void evict(shard& sh, boost::posix_time::ptime now);
+
+  program::options& options_;
+  std::unique_ptr<dns_resolver> resolver_;
+  std::array<shard, num_shards> shards_;
+
+  std::atomic<std::size_t> hits_;
+  std::atomic<std::size_t> stale_hits_;
+  std::atomic<std::size_t> misses_;
+};
+
+}  // namespace proxy::connection
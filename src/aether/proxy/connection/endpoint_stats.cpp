@@ -0,0 +1,120 @@
+/*********************************************
+
+  Copyright (c) Jackson Nestelroad 2020
+  jackson.nestelroad.com
+
+*********************************************/
+
+#include "endpoint_stats.hpp"
+
+#include <algorithm>
+#include <boost/asio.hpp>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "aether/program/options.hpp"
+#include "aether/proxy/types.hpp"
+
+namespace proxy::connection {
+
+std::size_t endpoint_stats::endpoint_hash::operator()(const boost::asio::ip::tcp::endpoint& endpoint) const {
+  const boost::asio::ip::address& address = endpoint.address();
+  std::size_t hash;
+  if (address.is_v4()) {
+    hash = std::hash<unsigned long>{}(address.to_v4().to_ulong());
+  } else {
+    boost::asio::ip::address_v6::bytes_type bytes = address.to_v6().to_bytes();
+    hash = std::hash<std::string_view>{}(
+        std::string_view(reinterpret_cast<const char*>(bytes.data()), bytes.size()));
+  }
+  return hash ^ (std::hash<unsigned short>{}(endpoint.port()) << 1);
+}
+
+endpoint_stats::endpoint_stats(program::options& options) : options_(options) {}
+
+endpoint_stats::shard& endpoint_stats::get_shard(const boost::asio::ip::tcp::endpoint& endpoint) {
+  return shards_[endpoint_hash{}(endpoint) % num_shards];
+}
+
+void endpoint_stats::record_success(const boost::asio::ip::tcp::endpoint& endpoint,
+                                    boost::posix_time::time_duration latency) {
+  record_sample(endpoint, static_cast<double>(latency.total_milliseconds()), 0);
+}
+
+void endpoint_stats::record_failure(const boost::asio::ip::tcp::endpoint& endpoint) {
+  // A failure counts as taking the whole timeout, so the latency average reflects it too.
+  record_sample(endpoint, static_cast<double>(options_.timeout.total_milliseconds()), 1);
+}
+
+void endpoint_stats::record_sample(const boost::asio::ip::tcp::endpoint& endpoint, double latency_ms,
+                                   double failed) {
+  shard& sh = get_shard(endpoint);
+  std::lock_guard<std::mutex> lock(sh.mutex);
+  auto it = sh.records.find(endpoint);
+  if (it == sh.records.end()) {
+    if (sh.records.size() >= max_records_per_shard) {
+      // Endpoints are only a hint for ordering, so forgetting an arbitrary one is harmless.
+      sh.records.erase(sh.records.begin());
+    }
+    sh.records.emplace(endpoint, record{latency_ms, failed});
+    return;
+  }
+
+  record& rec = it->second;
+  rec.latency_ms += smoothing_factor * (latency_ms - rec.latency_ms);
+  rec.failure_rate += smoothing_factor * (failed - rec.failure_rate);
+}
+
+double endpoint_stats::score(const boost::asio::ip::tcp::endpoint& endpoint) {
+  shard& sh = get_shard(endpoint);
+  std::lock_guard<std::mutex> lock(sh.mutex);
+  auto it = sh.records.find(endpoint);
+  if (it == sh.records.end()) {
+    return static_cast<double>(options_.connection_attempt_delay.total_milliseconds());
+  }
+  const record& rec = it->second;
+  return rec.latency_ms + rec.failure_rate * static_cast<double>(options_.timeout.total_milliseconds());
+}
+
+std::vector<boost::asio::ip::tcp::endpoint> endpoint_stats::order(
+    const std::vector<boost::asio::ip::tcp::endpoint>& endpoints) {
+  std::vector<std::pair<double, boost::asio::ip::tcp::endpoint>> scored;
+  scored.reserve(endpoints.size());
+  for (const boost::asio::ip::tcp::endpoint& endpoint : endpoints) {
+    scored.emplace_back(score(endpoint), endpoint);
+  }
+  // Stable, so endpoints with equal scores keep the resolver's order.
+  std::stable_sort(scored.begin(), scored.end(),
+                   [](const auto& lhs, const auto& rhs) { return lhs.first < rhs.first; });
+
+  std::vector<boost::asio::ip::tcp::endpoint> ordered;
+  ordered.reserve(scored.size());
+  if (scored.empty()) {
+    return ordered;
+  }
+
+  bool first_is_v6 = scored.front().second.address().is_v6();
+  std::deque<boost::asio::ip::tcp::endpoint> first_family;
+  std::deque<boost::asio::ip::tcp::endpoint> other_family;
+  for (const auto& [endpoint_score, endpoint] : scored) {
+    (endpoint.address().is_v6() == first_is_v6 ? first_family : other_family).push_back(endpoint);
+  }
+
+  while (!first_family.empty() || !other_family.empty()) {
+    if (!first_family.empty()) {
+      ordered.push_back(first_family.front());
+      first_family.pop_front();
+    }
+    if (!other_family.empty()) {
+      ordered.push_back(other_family.front());
+      other_family.pop_front();
+    }
+  }
+  return ordered;
+}
+
+}  // namespace proxy::connection
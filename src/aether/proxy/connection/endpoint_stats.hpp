@@ -0,0 +1,81 @@
+/*********************************************
+
+  Copyright (c) Jackson Nestelroad 2020
+  jackson.nestelroad.com
+
+*********************************************/
+
+#pragma once
+
+#include <array>
+#include <boost/asio.hpp>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "aether/program/options.hpp"
+#include "aether/proxy/types.hpp"
+
+namespace proxy::connection {
+
+// Process-wide history of connection attempts to server endpoints.
+//
+// Tracks an exponentially weighted moving average of the connect latency and failure rate of each endpoint, so that
+// later connections to a host try its fastest healthy addresses first.
+class endpoint_stats {
+ public:
+  endpoint_stats(program::options& options);
+  endpoint_stats() = delete;
+  ~endpoint_stats() = default;
+  endpoint_stats(const endpoint_stats& other) = delete;
+  endpoint_stats& operator=(const endpoint_stats& other) = delete;
+  endpoint_stats(endpoint_stats&& other) noexcept = delete;
+  endpoint_stats& operator=(endpoint_stats&& other) noexcept = delete;
+
+  // Records a successful connection that took the given time to establish.
+  void record_success(const boost::asio::ip::tcp::endpoint& endpoint, boost::posix_time::time_duration latency);
+
+  // Records a failed connection attempt.
+  void record_failure(const boost::asio::ip::tcp::endpoint& endpoint);
+
+  // Orders endpoints for connection attempts.
+  //
+  // Endpoints are sorted by their history, with untried endpoints assumed to connect within the connection attempt
+  // delay. Address families are then interleaved, starting with the family of the best endpoint, as described in RFC
+  // 8305.
+  std::vector<boost::asio::ip::tcp::endpoint> order(const std::vector<boost::asio::ip::tcp::endpoint>& endpoints);
+
+ private:
+  static constexpr std::size_t num_shards = 16;
+  static constexpr std::size_t max_records_per_shard = 256;
+
+  // Weight given to each new sample.
+  static constexpr double smoothing_factor = 0.25;
+
+  struct endpoint_hash {
+    std::size_t operator()(const boost::asio::ip::tcp::endpoint& endpoint) const;
+  };
+
+  struct record {
+    double latency_ms;
+    double failure_rate;
+  };
+
+  struct shard {
+    std::mutex mutex;
+    std::unordered_map<boost::asio::ip::tcp::endpoint, record, endpoint_hash> records;
+  };
+
+  shard& get_shard(const boost::asio::ip::tcp::endpoint& endpoint);
+
+  // Updates the record for the endpoint with a new sample.
+  void record_sample(const boost::asio::ip::tcp::endpoint& endpoint, double latency_ms, double failed);
+
+  // Returns the expected cost of connecting to the endpoint, where lower is better.
+  double score(const boost::asio::ip::tcp::endpoint& endpoint);
+
+  program::options& options_;
+  std::array<shard, num_shards> shards_;
+};
+
+}  // namespace proxy::connection
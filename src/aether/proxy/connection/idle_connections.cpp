@@ -0,0 +1,49 @@
+/*********************************************
+
+  Copyright (c) Jackson Nestelroad 2020
+  jackson.nestelroad.com
+
+*********************************************/
+
+#include "idle_connections.hpp"
+
+#include <boost/asio.hpp>
+#include <list>
+#include <memory>
+
+#include "aether/proxy/concurrent/io_context_pool.hpp"
+#include "aether/proxy/connection/base_connection.hpp"
+
+namespace proxy::connection {
+
+idle_connections::idle_connections(concurrent::io_context_pool& io_contexts) : size_(0), closed_count_(0) {
+  for (std::size_t i = 0; i < io_contexts.size(); ++i) {
+    lists_.emplace(&io_contexts.get_io_context(i), std::make_unique<std::list<base_connection*>>());
+  }
+}
+
+idle_connections::position idle_connections::park(boost::asio::io_context& ioc, base_connection& connection) {
+  std::list<base_connection*>& list = *lists_.at(&ioc);
+  size_.fetch_add(1, std::memory_order_relaxed);
+  return list.insert(list.end(), &connection);
+}
+
+void idle_connections::unpark(boost::asio::io_context& ioc, position pos) {
+  lists_.at(&ioc)->erase(pos);
+  size_.fetch_sub(1, std::memory_order_relaxed);
+}
+
+void idle_connections::close_oldest(std::size_t count) {
+  for (auto& [ioc, list] : lists_) {
+    boost::asio::post(*ioc, [this, list = list.get(), count]() {
+      std::size_t closed = 0;
+      for (auto it = list->begin(); it != list->end() && closed < count; ++it, ++closed) {
+        boost::system::error_code error;
+        (*it)->socket().cancel(error);
+      }
+      closed_count_.fetch_add(closed, std::memory_order_relaxed);
+    });
+  }
+}
+
+}  // namespace proxy::connection
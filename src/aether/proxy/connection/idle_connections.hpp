@@ -0,0 +1,69 @@
+/*********************************************
+
+  Copyright (c) Jackson Nestelroad 2020
+  jackson.nestelroad.com
+
+*********************************************/
+
+#pragma once
+
+#include <atomic>
+#include <boost/asio.hpp>
+#include <list>
+#include <memory>
+#include <unordered_map>
+
+#include "aether/proxy/concurrent/io_context_pool.hpp"
+
+namespace proxy::connection {
+
+class base_connection;
+
+// Connections parked while waiting for their next request, one list for each io_context in least recently parked
+// order.
+//
+// A list is only ever touched by the thread running its io_context. When the proxy runs out of file descriptors, the
+// connections parked the longest are closed first to make room for new ones.
+class idle_connections {
+ public:
+  using position = std::list<base_connection*>::iterator;
+
+  idle_connections(concurrent::io_context_pool& io_contexts);
+  idle_connections() = delete;
+  ~idle_connections() = default;
+  idle_connections(const idle_connections& other) = delete;
+  idle_connections& operator=(const idle_connections& other) = delete;
+  idle_connections(idle_connections&& other) noexcept = delete;
+  idle_connections& operator=(idle_connections&& other) noexcept = delete;
+
+  // Parks the connection at the back of its io_context's list.
+  //
+  // Must be called on the thread running the io_context.
+  position park(boost::asio::io_context& ioc, base_connection& connection);
+
+  // Removes a parked connection from its io_context's list.
+  //
+  // Must be called on the thread running the io_context.
+  void unpark(boost::asio::io_context& ioc, position pos);
+
+  // Closes up to the given number of the oldest parked connections on every io_context.
+  //
+  // The connections are only canceled, so they are unparked and finished by their own handlers. May be called from
+  // any thread.
+  void close_oldest(std::size_t count);
+
+  // Returns the number of parked connections.
+  inline std::size_t size() const { return size_.load(std::memory_order_relaxed); }
+
+  // Returns the number of parked connections closed to make room for new ones.
+  inline std::size_t closed_count() const { return closed_count_.load(std::memory_order_relaxed); }
+
+ private:
+  // Built once at construction and never modified, so lookups do not need a lock.
+  std::unordered_map<boost::asio::io_context*, std::unique_ptr<std::list<base_connection*>>> lists_;
+
+  std::atomic<std::size_t> size_;
+  std::atomic<std::size_t> closed_count_;
+};
+
+}  // namespace proxy::connection
@@ -0,0 +1,20 @@
+/*********************************************
+
+  Copyright (c) Jackson Nestelroad 2020
+  jackson.nestelroad.com
+
+*********************************************/
+
+#include "memory_budget.hpp"
+
+#include <memory>
+
+#include "aether/program/options.hpp"
+#include "aether/util/memory_account.hpp"
+
+namespace proxy::connection {
+
+memory_budget::memory_budget(program::options& options)
+    : options_(options), account_(std::make_shared<util::buffer::memory_account>()), shed_count_(0) {}
+
+}  // namespace proxy::connection
@@ -0,0 +1,70 @@
+/*********************************************
+
+  Copyright (c) Jackson Nestelroad 2020
+  jackson.nestelroad.com
+
+*********************************************/
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+
+#include "aether/program/options.hpp"
+#include "aether/util/memory_account.hpp"
+
+namespace proxy::connection {
+
+// Accounting of the memory held on behalf of connections.
+//
+// Connection buffers, TLS sessions, and HTTP bodies are charged to a single account shared by every thread. Once the
+// account passes the global limit, new connections are shed instead of taking on more memory.
+//
+// Each connection also has its own budget for bytes buffered for its peer. Relays stop reading from one side when the
+// other side has buffered up to the high watermark, and continue once it has written down to the low watermark.
+class memory_budget {
+ public:
+  // OpenSSL does not report the memory held by a session, so each is charged an estimate of its read and write record
+  // buffers and handshake state.
+  static constexpr std::size_t tls_session_size = 48 * 1024;
+
+  memory_budget(program::options& options);
+  memory_budget() = delete;
+  ~memory_budget() = default;
+  memory_budget(const memory_budget& other) = delete;
+  memory_budget& operator=(const memory_budget& other) = delete;
+  memory_budget(memory_budget&& other) noexcept = delete;
+  memory_budget& operator=(memory_budget&& other) noexcept = delete;
+
+  // Returns the account memory held on behalf of connections is charged to.
+  inline const std::shared_ptr<util::buffer::memory_account>& account() const { return account_; }
+
+  // Returns the bytes currently charged.
+  inline std::size_t used_bytes() const { return account_->bytes(); }
+
+  // Returns the global limit, which is 0 if there is none.
+  inline std::size_t limit() const { return options_.memory_limit; }
+
+  // Checks if the global limit has been reached, in which case new work should be shed.
+  inline bool exhausted() const { return limit() > 0 && used_bytes() >= limit(); }
+
+  // Returns the bytes a connection may buffer for its peer before reads are paused.
+  inline std::size_t connection_high_watermark() const { return options_.connection_memory_limit; }
+
+  // Returns the bytes a connection must buffer at most for paused reads to resume.
+  inline std::size_t connection_low_watermark() const { return options_.connection_memory_limit / 2; }
+
+  // Records a connection that was turned away because the global limit was reached.
+  inline void record_shed() { shed_count_.fetch_add(1, std::memory_order_relaxed); }
+
+  // Returns the number of connections turned away because the global limit was reached.
+  inline std::size_t shed_count() const { return shed_count_.load(std::memory_order_relaxed); }
+
+ private:
+  const program::options& options_;
+  std::shared_ptr<util::buffer::memory_account> account_;
+  std::atomic<std::size_t> shed_count_;
+};
+
+}  // namespace proxy::connection
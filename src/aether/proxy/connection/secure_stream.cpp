@@ -0,0 +1,237 @@
+/*********************************************
+
+  Copyright (c) Jackson Nestelroad 2020
+  jackson.nestelroad.com
+
+*********************************************/
+
+#include "secure_stream.hpp"
+
+#include <openssl/bio.h>
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+#include <sys/socket.h>
+
+#include <algorithm>
+#include <boost/asio.hpp>
+#include <boost/asio/ssl.hpp>
+#include <cerrno>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <utility>
+
+#include "aether/proxy/connection/memory_budget.hpp"
+#include "aether/util/memory_account.hpp"
+
+namespace proxy::connection {
+
+namespace {
+
+// State of a BIO that reads pre-read bytes before reading from the socket.
+struct pre_read_state {
+  int fd;
+  const std::string* pre_read;
+  std::size_t offset;
+};
+
+int pre_read_bio_read(BIO* bio, char* data, int size) {
+  auto* state = static_cast<pre_read_state*>(BIO_get_data(bio));
+  BIO_clear_retry_flags(bio);
+  if (state->offset < state->pre_read->size()) {
+    std::size_t count = std::min(static_cast<std::size_t>(size), state->pre_read->size() - state->offset);
+    std::memcpy(data, state->pre_read->data() + state->offset, count);
+    state->offset += count;
+    return static_cast<int>(count);
+  }
+
+  ssize_t received = ::recv(state->fd, data, static_cast<std::size_t>(size), 0);
+  if (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+    BIO_set_retry_read(bio);
+  }
+  return static_cast<int>(received);
+}
+
+long pre_read_bio_ctrl(BIO* bio, int cmd, long, void*) {
+  auto* state = static_cast<pre_read_state*>(BIO_get_data(bio));
+  switch (cmd) {
+    case BIO_CTRL_FLUSH:
+      return 1;
+    case BIO_CTRL_PENDING:
+      return static_cast<long>(state->pre_read->size() - state->offset);
+    default:
+      // Anything else, including enabling kTLS, is unsupported.
+      return 0;
+  }
+}
+
+int pre_read_bio_destroy(BIO* bio) {
+  delete static_cast<pre_read_state*>(BIO_get_data(bio));
+  BIO_set_data(bio, nullptr);
+  return 1;
+}
+
+// Read-only BIO method for the socket of a handshake that has bytes read ahead of OpenSSL.
+//
+// The kernel cannot decrypt records read through this BIO, so only outgoing records are offloaded.
+BIO_METHOD* pre_read_bio_method() {
+  static BIO_METHOD* method = [] {
+    BIO_METHOD* m = BIO_meth_new(BIO_get_new_index() | BIO_TYPE_SOURCE_SINK, "pre-read socket");
+    BIO_meth_set_read(m, pre_read_bio_read);
+    BIO_meth_set_ctrl(m, pre_read_bio_ctrl);
+    BIO_meth_set_destroy(m, pre_read_bio_destroy);
+    return m;
+  }();
+  return method;
+}
+
+}  // namespace
+
+secure_stream::secure_stream(boost::asio::ip::tcp::socket& socket, boost::asio::ssl::context& context, bool kernel,
+                             std::shared_ptr<util::buffer::memory_account> account)
+    : socket_(socket), stream_(), ssl_(nullptr), memory_(std::move(account), memory_budget::tls_session_size) {
+  if (!kernel) {
+    stream_.emplace(socket_, context);
+    return;
+  }
+
+  ssl_ = SSL_new(context.native_handle());
+#ifdef SSL_OP_ENABLE_KTLS
+  SSL_set_options(ssl_, SSL_OP_ENABLE_KTLS);
+#endif
+}
+
+secure_stream::~secure_stream() {
+  if (ssl_ != nullptr) {
+    SSL_free(ssl_);
+  }
+}
+
+bool secure_stream::kernel_send() {
+#ifdef SSL_OP_ENABLE_KTLS
+  return ssl_ != nullptr && SSL_is_init_finished(ssl_) && BIO_get_ktls_send(SSL_get_wbio(ssl_));
+#else
+  return false;
+#endif
+}
+
+bool secure_stream::kernel_receive() {
+#ifdef SSL_OP_ENABLE_KTLS
+  return ssl_ != nullptr && SSL_is_init_finished(ssl_) && BIO_get_ktls_recv(SSL_get_rbio(ssl_));
+#else
+  return false;
+#endif
+}
+
+bool secure_stream::input_in_socket() {
+  if (ssl_ == nullptr) {
+    return false;
+  }
+  return SSL_has_pending(ssl_) == 0 && BIO_pending(SSL_get_rbio(ssl_)) == 0;
+}
+
+void secure_stream::set_pre_read(std::string pre_read) { pre_read_ = std::move(pre_read); }
+
+void secure_stream::set_handshake_state(boost::asio::ssl::stream_base::handshake_type type) {
+  // OpenSSL never blocks on the socket, so waits always go through the io_context.
+  boost::system::error_code error;
+  socket_.native_non_blocking(true, error);
+
+  int fd = socket_.native_handle();
+  BIO* wbio = BIO_new_socket(fd, BIO_NOCLOSE);
+  if (pre_read_.empty()) {
+    SSL_set_bio(ssl_, wbio, wbio);
+  } else {
+    BIO* rbio = BIO_new(pre_read_bio_method());
+    BIO_set_data(rbio, new pre_read_state{fd, &pre_read_, 0});
+    BIO_set_init(rbio, 1);
+    SSL_set_bio(ssl_, rbio, wbio);
+  }
+
+  if (type == boost::asio::ssl::stream_base::handshake_type::client) {
+    SSL_set_connect_state(ssl_);
+  } else {
+    SSL_set_accept_state(ssl_);
+  }
+}
+
+secure_stream::step secure_stream::attempt(operation op, void* data, std::size_t size, std::size_t& transferred,
+                                           boost::system::error_code& error) {
+  transferred = 0;
+  if (op != operation::handshake && size == 0) {
+    return step::done;
+  }
+
+  ERR_clear_error();
+  errno = 0;
+  int result = 0;
+  std::size_t bytes = 0;
+  switch (op) {
+    case operation::handshake:
+      result = SSL_do_handshake(ssl_);
+      break;
+    case operation::read:
+      result = SSL_read_ex(ssl_, data, size, &bytes);
+      break;
+    case operation::write:
+      result = SSL_write_ex(ssl_, data, size, &bytes);
+      break;
+  }
+  if (result == 1) {
+    transferred = bytes;
+    return step::done;
+  }
+
+  switch (SSL_get_error(ssl_, result)) {
+    case SSL_ERROR_WANT_READ:
+      return step::want_read;
+    case SSL_ERROR_WANT_WRITE:
+      return step::want_write;
+    case SSL_ERROR_ZERO_RETURN:
+      error = boost::asio::error::eof;
+      break;
+    case SSL_ERROR_SYSCALL:
+      if (errno != 0) {
+        error = boost::system::error_code(errno, boost::system::system_category());
+      } else {
+        error = boost::asio::ssl::error::stream_truncated;
+      }
+      break;
+    default: {
+      unsigned long code = ERR_get_error();
+#ifdef SSL_R_UNEXPECTED_EOF_WHILE_READING
+      if (ERR_GET_REASON(code) == SSL_R_UNEXPECTED_EOF_WHILE_READING) {
+        error = boost::asio::ssl::error::stream_truncated;
+        break;
+      }
+#endif
+      error = boost::system::error_code(static_cast<int>(code), boost::asio::error::get_ssl_category());
+      break;
+    }
+  }
+  return step::done;
+}
+
+std::size_t secure_stream::run_native(operation op, void* data, std::size_t size, boost::system::error_code& error) {
+  error = {};
+  std::size_t transferred = 0;
+  while (true) {
+    step next = attempt(op, data, size, transferred, error);
+    if (next == step::done) {
+      return transferred;
+    }
+    // The caller asked for the operation not to block.
+    if (socket_.non_blocking()) {
+      error = boost::asio::error::would_block;
+      return 0;
+    }
+    socket_.wait(next == step::want_read ? boost::asio::ip::tcp::socket::wait_read
+                                         : boost::asio::ip::tcp::socket::wait_write,
+                 error);
+    if (error) {
+      return 0;
+    }
+  }
+}
+
+}  // namespace proxy::connection
@@ -0,0 +1,230 @@
+/*********************************************
+
+  Copyright (c) Jackson Nestelroad 2020
+  jackson.nestelroad.com
+
+*********************************************/
+
+#pragma once
+
+#include <openssl/ssl.h>
+
+#include <boost/asio.hpp>
+#include <boost/asio/ssl.hpp>
+#include <cstddef>
+#include <memory>
+#include <optional>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+#include "aether/util/memory_account.hpp"
+
+namespace proxy::connection {
+
+// TLS stream over a TCP socket, with the same interface as boost::asio::ssl::stream.
+//
+// By default, the stream is a regular boost::asio::ssl::stream, which moves encrypted records between OpenSSL and the
+// socket through memory buffers. OpenSSL can only hand record encryption to the kernel (kTLS) if it owns the socket,
+// so a kernel stream binds the SSL object to the socket's file descriptor and drives it without blocking, waiting on
+// the socket whenever OpenSSL wants to read or write.
+//
+// OpenSSL enables kTLS on its own if the kernel supports the negotiated cipher, and falls back to encrypting in user
+// space otherwise. Once the kernel encrypts outgoing records, writes go straight to the socket.
+class secure_stream {
+ public:
+  using executor_type = boost::asio::ip::tcp::socket::executor_type;
+  using lowest_layer_type = boost::asio::ip::tcp::socket;
+
+  // The session is charged to the memory account for as long as the stream lives.
+  secure_stream(boost::asio::ip::tcp::socket& socket, boost::asio::ssl::context& context, bool kernel,
+                std::shared_ptr<util::buffer::memory_account> account = nullptr);
+  ~secure_stream();
+  secure_stream(const secure_stream& other) = delete;
+  secure_stream& operator=(const secure_stream& other) = delete;
+  secure_stream(secure_stream&& other) noexcept = delete;
+  secure_stream& operator=(secure_stream&& other) noexcept = delete;
+
+  inline executor_type get_executor() { return socket_.get_executor(); }
+  inline lowest_layer_type& lowest_layer() { return socket_; }
+  inline SSL* native_handle() { return stream_.has_value() ? stream_->native_handle() : ssl_; }
+
+  // Checks if the kernel encrypts records written to the socket.
+  bool kernel_send();
+
+  // Checks if the kernel decrypts records read from the socket.
+  bool kernel_receive();
+
+  // Checks if every byte the stream has not yet read is still waiting in the socket, so the socket becoming readable
+  // is a reliable sign that there is something to read.
+  //
+  // A regular stream keeps records it has read from the socket in buffers it does not expose, so it never is.
+  bool input_in_socket();
+
+  template <typename Handler>
+  void async_handshake(boost::asio::ssl::stream_base::handshake_type type, Handler&& handler) {
+    if (stream_.has_value()) {
+      stream_->async_handshake(type, std::forward<Handler>(handler));
+      return;
+    }
+    set_handshake_state(type);
+    boost::asio::async_compose<std::decay_t<Handler>, void(boost::system::error_code)>(
+        native_op<false>{*this, operation::handshake, nullptr, 0}, handler, socket_);
+  }
+
+  // Performs the handshake with bytes that were already read from the socket.
+  template <typename ConstBufferSequence, typename Handler>
+  void async_handshake(boost::asio::ssl::stream_base::handshake_type type, const ConstBufferSequence& buffers,
+                       Handler&& handler) {
+    if (stream_.has_value()) {
+      stream_->async_handshake(type, buffers, std::forward<Handler>(handler));
+      return;
+    }
+    std::string pre_read(boost::asio::buffer_size(buffers), '\0');
+    std::size_t size = boost::asio::buffer_copy(boost::asio::buffer(pre_read), buffers);
+    set_pre_read(std::move(pre_read));
+    set_handshake_state(type);
+    boost::asio::async_compose<std::decay_t<Handler>, void(boost::system::error_code, std::size_t)>(
+        native_op<true>{*this, operation::handshake, nullptr, size}, handler, socket_);
+  }
+
+  template <typename MutableBufferSequence>
+  std::size_t read_some(const MutableBufferSequence& buffers, boost::system::error_code& error) {
+    if (stream_.has_value()) {
+      return stream_->read_some(buffers, error);
+    }
+    boost::asio::mutable_buffer buffer = first_buffer<boost::asio::mutable_buffer>(buffers);
+    return run_native(operation::read, buffer.data(), buffer.size(), error);
+  }
+
+  template <typename ConstBufferSequence>
+  std::size_t write_some(const ConstBufferSequence& buffers, boost::system::error_code& error) {
+    if (stream_.has_value()) {
+      return stream_->write_some(buffers, error);
+    }
+    if (kernel_send()) {
+      return socket_.write_some(buffers, error);
+    }
+    boost::asio::const_buffer buffer = first_buffer<boost::asio::const_buffer>(buffers);
+    return run_native(operation::write, const_cast<void*>(buffer.data()), buffer.size(), error);
+  }
+
+  template <typename MutableBufferSequence, typename Handler>
+  void async_read_some(const MutableBufferSequence& buffers, Handler&& handler) {
+    if (stream_.has_value()) {
+      stream_->async_read_some(buffers, std::forward<Handler>(handler));
+      return;
+    }
+    // Records are always read through OpenSSL, since the kernel fails plain reads of records that are not data.
+    boost::asio::mutable_buffer buffer = first_buffer<boost::asio::mutable_buffer>(buffers);
+    boost::asio::async_compose<std::decay_t<Handler>, void(boost::system::error_code, std::size_t)>(
+        native_op<true>{*this, operation::read, buffer.data(), buffer.size()}, handler, socket_);
+  }
+
+  template <typename ConstBufferSequence, typename Handler>
+  void async_write_some(const ConstBufferSequence& buffers, Handler&& handler) {
+    if (stream_.has_value()) {
+      stream_->async_write_some(buffers, std::forward<Handler>(handler));
+      return;
+    }
+    if (kernel_send()) {
+      socket_.async_write_some(buffers, std::forward<Handler>(handler));
+      return;
+    }
+    boost::asio::const_buffer buffer = first_buffer<boost::asio::const_buffer>(buffers);
+    boost::asio::async_compose<std::decay_t<Handler>, void(boost::system::error_code, std::size_t)>(
+        native_op<true>{*this, operation::write, const_cast<void*>(buffer.data()), buffer.size()}, handler, socket_);
+  }
+
+ private:
+  enum class operation {
+    handshake,
+    read,
+    write,
+  };
+
+  // What a single non-blocking attempt at an operation needs before it can go on.
+  enum class step {
+    done,
+    want_read,
+    want_write,
+  };
+
+  // Asynchronous operation on a kernel stream, which waits on the socket until OpenSSL can make progress.
+  //
+  // Handshakes without pre-read bytes complete without a size.
+  template <bool WithSize>
+  struct native_op {
+    secure_stream& stream;
+    operation op;
+    void* data;
+    std::size_t size;
+    bool started = false;
+    std::optional<std::pair<boost::system::error_code, std::size_t>> result = std::nullopt;
+
+    template <typename Self>
+    void operator()(Self& self, boost::system::error_code error = {}) {
+      if (!result.has_value()) {
+        std::size_t transferred = 0;
+        if (!error) {
+          switch (stream.attempt(op, data, size, transferred, error)) {
+            case step::want_read:
+              started = true;
+              stream.socket_.async_wait(boost::asio::ip::tcp::socket::wait_read, std::move(self));
+              return;
+            case step::want_write:
+              started = true;
+              stream.socket_.async_wait(boost::asio::ip::tcp::socket::wait_write, std::move(self));
+              return;
+            case step::done:
+              break;
+          }
+        }
+        result.emplace(error, op == operation::handshake ? size : transferred);
+        // The handler may not be called before the operation is started.
+        if (!started) {
+          boost::asio::post(stream.socket_.get_executor(), std::move(self));
+          return;
+        }
+      }
+      if constexpr (WithSize) {
+        self.complete(result->first, result->second);
+      } else {
+        self.complete(result->first);
+      }
+    }
+  };
+
+  template <typename Buffer, typename BufferSequence>
+  static Buffer first_buffer(const BufferSequence& buffers) {
+    for (auto it = boost::asio::buffer_sequence_begin(buffers); it != boost::asio::buffer_sequence_end(buffers);
+         ++it) {
+      Buffer buffer(*it);
+      if (buffer.size() > 0) {
+        return buffer;
+      }
+    }
+    return Buffer();
+  }
+
+  // Binds the SSL object to the socket and puts it in the right state for the handshake.
+  void set_handshake_state(boost::asio::ssl::stream_base::handshake_type type);
+
+  // Saves bytes of the handshake that were already read from the socket, which OpenSSL reads before the socket.
+  void set_pre_read(std::string pre_read);
+
+  // Makes a single non-blocking attempt at an operation on a kernel stream.
+  step attempt(operation op, void* data, std::size_t size, std::size_t& transferred,
+               boost::system::error_code& error);
+
+  // Runs an operation on a kernel stream synchronously.
+  std::size_t run_native(operation op, void* data, std::size_t size, boost::system::error_code& error);
+
+  boost::asio::ip::tcp::socket& socket_;
+  std::optional<boost::asio::ssl::stream<boost::asio::ip::tcp::socket&>> stream_;
+  SSL* ssl_;
+  std::string pre_read_;
+  util::buffer::memory_account::reservation memory_;
+};
+
+}  // namespace proxy::connection
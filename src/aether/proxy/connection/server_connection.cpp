@@ -8,12 +8,18 @@
 #include "server_connection.hpp"
 
 #include <boost/asio.hpp>
-#include <boost/lexical_cast.hpp>
 #include <functional>
+#include <memory>
+#include <optional>
+#include <sstream>
 #include <string>
 #include <string_view>
+#include <utility>
 
+#include "aether/proxy/connection/server_connection_pool.hpp"
 #include "aether/proxy/error/error.hpp"
+#include "aether/proxy/server_components.hpp"
+#include "aether/proxy/tls/handshake/handshake_types.hpp"
 #include "aether/proxy/tls/openssl/openssl_ptrs.hpp"
 #include "aether/proxy/tls/x509/certificate.hpp"
 #include "aether/proxy/types.hpp"
@@ -21,81 +27,244 @@
 
 namespace proxy::connection {
 
+namespace {
+
+// Builds a string that is equal for two sets of TLS settings only if they secure a connection the same way.
+std::string tls_fingerprint(const tls::openssl::ssl_context_args& args) {
+  std::stringstream out;
+  out << static_cast<int>(args.method) << ';' << args.verify << ';' << args.options << ';' << args.verify_file << ';';
+  for (const std::string& protocol : args.alpn_protos) {
+    out << protocol << ',';
+  }
+  out << ';';
+  for (tls::handshake::cipher_suite_name cipher : args.cipher_suites) {
+    out << static_cast<int>(cipher) << ',';
+  }
+  return out.str();
+}
+
+}  // namespace
+
+server_connection::connect_race::connect_race(const boost::asio::any_io_executor& executor) : delay_timer(executor) {}
+
+bool server_connection::transport::is_idle() { return socket && peek(*socket) == peek_state::empty; }
+
+void server_connection::transport::close() {
+  if (socket && socket->is_open()) {
+    boost::system::error_code error;
+    socket->close(error);
+  }
+}
+
 server_connection::server_connection(boost::asio::io_context& ioc, server_components& components)
-    : base_connection(ioc, components), resolver_(ioc), port_() {}
+    : base_connection(ioc, components),
+      dns_cache_(components.dns_cache),
+      endpoint_stats_(components.endpoint_stats),
+      port_(),
+      reusable_(false),
+      reused_(false),
+      pool_(components.server_connection_pool) {}
 
-void server_connection::connect_async(std::string host, port_t port, err_callback_t handler) {
+void server_connection::connect_async(std::string host, port_t port, err_callback_t handler, bool allow_reuse) {
   // Already have an open connection.
-  if (is_connected_to(host, port) && !has_been_closed()) {
+  if (allow_reuse && is_connected_to(host, port) && !has_been_closed()) {
+    reused_ = true;
     boost::asio::post(ioc_, [handler = std::move(handler)]() mutable {
       handler(boost::system::errc::make_error_code(boost::system::errc::success));
     });
     return;
   } else if (connected()) {
     // Need a new connection.
-    disconnect();
+    release();
   }
 
   host_ = std::move(host);
   port_ = std::move(port);
 
+  if (allow_reuse) {
+    if (std::optional<transport> pooled = pool_.acquire(ioc_, {host_, port_, ""}); pooled.has_value()) {
+      adopt_transport(std::move(pooled).value());
+      boost::asio::post(ioc_, [handler = std::move(handler)]() mutable {
+        handler(boost::system::errc::make_error_code(boost::system::errc::success));
+      });
+      return;
+    }
+  }
+
+  reused_ = false;
   set_timeout();
-  boost::asio::ip::tcp::resolver::query query(host_, boost::lexical_cast<std::string>(port_));
-  resolver_.async_resolve(query, boost::asio::bind_executor(
-                                     strand_, [this, handler = std::move(handler)](
-                                                  const boost::system::error_code& err,
-                                                  boost::asio::ip::tcp::resolver::iterator endpoint_iterator) mutable {
-                                       on_resolve(err, std::move(endpoint_iterator), std::move(handler));
-                                     }));
+  dns_cache_.resolve_async(executor_, host_, port_,
+                           [this, handler = std::move(handler)](
+                               const boost::system::error_code& err,
+                               std::shared_ptr<const endpoint_list> endpoints) mutable {
+                             on_resolve(err, std::move(endpoints), std::move(handler));
+                           });
 }
 
 void server_connection::on_resolve(const boost::system::error_code& err,
-                                   boost::asio::ip::tcp::resolver::iterator endpoint_iterator, err_callback_t handler) {
+                                   std::shared_ptr<const endpoint_list> endpoints, err_callback_t handler) {
   timeout_.cancel_timeout();
   if (err != boost::system::errc::success) {
     boost::asio::post(ioc_, [handler = std::move(handler), err]() mutable { handler(err); });
-  } else if (endpoint_iterator == boost::asio::ip::tcp::resolver::iterator()) {
+  } else if (!endpoints || endpoints->empty()) {
     // No endpoints found.
     boost::asio::post(ioc_, [handler = std::move(handler)]() mutable {
       handler(boost::system::errc::make_error_code(boost::system::errc::host_unreachable));
     });
   } else {
-    set_timeout();
-    endpoint_ = endpoint_iterator->endpoint();
-    const boost::asio::ip::basic_resolver_entry<boost::asio::ip::tcp>& curr = *endpoint_iterator;
-    socket_.async_connect(
-        curr, boost::asio::bind_executor(strand_, [this, handler = std::move(handler), it = ++endpoint_iterator](
-                                                      const boost::system::error_code& error) mutable {
-          on_connect(error, std::move(it), std::move(handler));
+    start_race(std::move(endpoints), std::move(handler));
+  }
+}
+
+void server_connection::start_race(std::shared_ptr<const endpoint_list> endpoints, err_callback_t handler) {
+  auto race = std::make_shared<connect_race>(executor_);
+  race->endpoints = endpoint_stats_.order(*endpoints);
+  race->attempts.resize(race->endpoints.size());
+  race->handler = std::move(handler);
+
+  // The whole race shares one timeout, rather than one for each attempt.
+  timeout_.set_timeout(options_.timeout, [this, race]() {
+    boost::asio::post(executor_, [this, race]() {
+      finish_race(race, std::nullopt, boost::system::errc::make_error_code(boost::system::errc::timed_out));
+    });
+  });
+  start_attempt(race);
+}
+
+void server_connection::start_attempt(std::shared_ptr<connect_race> race) {
+  if (race->finished || race->next >= race->endpoints.size()) {
+    return;
+  }
+
+  std::size_t index = race->next++;
+  connect_race::attempt& attempt = race->attempts[index];
+  attempt.socket = std::make_unique<boost::asio::ip::tcp::socket>(executor_);
+  attempt.started = boost::asio::deadline_timer::traits_type::now();
+  ++race->in_flight;
+  attempt.socket->async_connect(race->endpoints[index],
+                                boost::asio::bind_executor(executor_, [this, race, index](
+                                                                          const boost::system::error_code& error) {
+                                  on_attempt(race, index, error);
+                                }));
+
+  // The next attempt starts if this one has not finished by the attempt delay.
+  if (race->next < race->endpoints.size()) {
+    race->delay_timer.expires_from_now(options_.connection_attempt_delay);
+    race->delay_timer.async_wait(
+        boost::asio::bind_executor(executor_, [this, race](const boost::system::error_code& error) {
+          if (error != boost::asio::error::operation_aborted) {
+            start_attempt(race);
+          }
         }));
   }
 }
 
-void server_connection::on_connect(const boost::system::error_code& err,
-                                   boost::asio::ip::tcp::resolver::iterator endpoint_iterator, err_callback_t handler) {
+void server_connection::on_attempt(std::shared_ptr<connect_race> race, std::size_t index,
+                                   const boost::system::error_code& error) {
+  --race->in_flight;
+  if (race->finished) {
+    return;
+  }
+
+  const boost::asio::ip::tcp::endpoint& endpoint = race->endpoints[index];
+  connect_race::attempt& attempt = race->attempts[index];
+  if (error == boost::system::errc::success) {
+    endpoint_stats_.record_success(endpoint, boost::asio::deadline_timer::traits_type::now() - attempt.started);
+    finish_race(race, index, error);
+    return;
+  }
+
+  endpoint_stats_.record_failure(endpoint);
+  race->last_error = error;
+  boost::system::error_code close_error;
+  attempt.socket->close(close_error);
+
+  if (race->next < race->endpoints.size()) {
+    // No need to wait out the attempt delay when an attempt fails.
+    race->delay_timer.cancel();
+    start_attempt(race);
+  } else if (race->in_flight == 0) {
+    finish_race(race, std::nullopt, race->last_error);
+  }
+}
+
+void server_connection::finish_race(std::shared_ptr<connect_race> race, std::optional<std::size_t> winner,
+                                    const boost::system::error_code& error) {
+  if (race->finished) {
+    return;
+  }
+  race->finished = true;
   timeout_.cancel_timeout();
-  if (err == boost::system::errc::success) {
+  race->delay_timer.cancel();
+
+  // Closing the losing sockets aborts their pending connects.
+  for (std::size_t i = 0; i < race->attempts.size(); ++i) {
+    if (i != winner && race->attempts[i].socket) {
+      boost::system::error_code close_error;
+      race->attempts[i].socket->close(close_error);
+    }
+  }
+
+  if (winner.has_value()) {
+    socket_ = std::move(race->attempts[winner.value()].socket);
+    endpoint_ = race->endpoints[winner.value()];
     set_connected();
-    boost::asio::post(ioc_, [handler = std::move(handler), err]() mutable { handler(err); });
-  } else if (endpoint_iterator != boost::asio::ip::tcp::resolver::iterator()) {
-    // Didn't connect, but other endpoints to try.
-    set_timeout();
-    endpoint_ = endpoint_iterator->endpoint();
-    const boost::asio::ip::basic_resolver_entry<boost::asio::ip::tcp>& curr = *endpoint_iterator;
-    socket_.async_connect(
-        curr, boost::asio::bind_executor(strand_, [this, handler = std::move(handler), it = ++endpoint_iterator](
-                                                      const boost::system::error_code& err) mutable {
-          on_connect(err, std::move(it), std::move(handler));
-        }));
-  } else {
-    // Failed to connect.
-    boost::asio::post(ioc_, [handler = std::move(handler), err]() mutable { handler(err); });
   }
+  boost::asio::post(ioc_, [handler = std::move(race->handler), error]() mutable { handler(error); });
+}
+
+void server_connection::reconnect_async(err_callback_t handler) {
+  // Anything left in the buffers belongs to the failed attempt.
+  timeout_.cancel_timeout();
+  transport old = take_transport();
+  old.close();
+  input_.reset();
+  output_.reset();
+  reusable_ = false;
+
+  connect_async(
+      host_, port_,
+      [this, tls_args = std::move(old.tls_args), handler = std::move(handler)](
+          const boost::system::error_code& err) mutable { on_reconnect(err, std::move(tls_args), std::move(handler)); },
+      false);
+}
+
+void server_connection::on_reconnect(const boost::system::error_code& err,
+                                     std::optional<tls::openssl::ssl_context_args> tls_args, err_callback_t handler) {
+  if (err != boost::system::errc::success || !tls_args.has_value()) {
+    handler(err);
+    return;
+  }
+
+  tls_args_ = std::move(tls_args);
+  if (result<void> res = prepare_tls(); res.is_err()) {
+    boost::asio::post(ioc_, [handler = std::move(handler)]() mutable {
+      handler(boost::system::errc::make_error_code(boost::system::errc::protocol_error));
+    });
+    return;
+  }
+  start_handshake(std::move(handler));
 }
 
 result<void> server_connection::establish_tls_async(tls::openssl::ssl_context_args& args, err_callback_t handler) {
-  ASSIGN_OR_RETURN(ssl_context_, tls::openssl::create_ssl_context(args));
-  secure_socket_ = std::make_unique<std::remove_reference_t<decltype(*secure_socket_)>>(socket_, *ssl_context_);
+  // An idle connection already secured with the same settings saves the handshake.
+  if (adopt_pooled_tls_connection(args)) {
+    boost::asio::post(ioc_, [handler = std::move(handler)]() mutable {
+      handler(boost::system::errc::make_error_code(boost::system::errc::success));
+    });
+    return util::ok;
+  }
+
+  tls_args_ = args;
+  RETURN_IF_ERROR(prepare_tls());
+  start_handshake(std::move(handler));
+  return util::ok;
+}
+
+result<void> server_connection::prepare_tls() {
+  ASSIGN_OR_RETURN(ssl_context_, tls::openssl::create_ssl_context(*tls_args_));
+  secure_socket_ = std::make_unique<secure_stream>(*socket_, *ssl_context_, options_.ssl_kernel_offload,
+                                                   memory_budget_.account());
 
   SSL_set_connect_state(secure_socket_->native_handle());
 
@@ -104,15 +273,16 @@ result<void> server_connection::establish_tls_async(tls::openssl::ssl_context_ar
   }
 
   RETURN_IF_ERROR(tls::openssl::enable_hostname_verification(*ssl_context_, host_));
+  return util::ok;
+}
 
+void server_connection::start_handshake(err_callback_t handler) {
   secure_socket_->async_handshake(
       boost::asio::ssl::stream_base::handshake_type::client,
-      boost::asio::bind_executor(strand_,
+      boost::asio::bind_executor(executor_,
                                  [this, handler = std::move(handler)](const boost::system::error_code& err) mutable {
                                    on_handshake(err, std::move(handler));
                                  }));
-
-  return util::ok;
 }
 
 void server_connection::on_handshake(const boost::system::error_code& err, err_callback_t handler) {
@@ -142,4 +312,77 @@ void server_connection::on_handshake(const boost::system::error_code& err, err_c
   boost::asio::post(ioc_, [handler = std::move(handler), err]() mutable { handler(err); });
 }
 
+bool server_connection::adopt_pooled_tls_connection(const tls::openssl::ssl_context_args& args) {
+  std::optional<transport> pooled = pool_.acquire(ioc_, {host_, port_, tls_fingerprint(args)});
+  if (!pooled.has_value()) {
+    return false;
+  }
+
+  // The plain connection that was just opened has not carried anything, so another flow can still use it.
+  reusable_ = true;
+  release();
+  adopt_transport(std::move(pooled).value());
+  return true;
+}
+
+void server_connection::release() {
+  // Only a connection with nothing in flight and nothing unread can be handed to another flow.
+  bool can_pool = reusable_ && connected() && !operations_pending() && input_.size() == 0 && output_.size() == 0 &&
+                  peek(*socket_) == peek_state::empty;
+  reusable_ = false;
+  if (!can_pool) {
+    disconnect();
+    return;
+  }
+
+  timeout_.cancel_timeout();
+  std::string tls = tls_established_ && tls_args_.has_value() ? tls_fingerprint(*tls_args_) : "";
+  server_connection_key key = {host_, port_, std::move(tls)};
+  transport idle = take_transport();
+  release_buffers();
+  if (!pool_.release(ioc_, std::move(key), idle)) {
+    idle.close();
+  }
+}
+
+void server_connection::reset() {
+  base_connection::reset();
+  endpoint_ = {};
+  host_.clear();
+  port_ = {};
+  cert_chain_.clear();
+  tls_args_.reset();
+  reusable_ = false;
+  reused_ = false;
+}
+
+server_connection::transport server_connection::take_transport() {
+  transport out;
+  out.socket = std::exchange(socket_, std::make_unique<boost::asio::ip::tcp::socket>(executor_));
+  out.ssl_context = std::move(ssl_context_);
+  out.secure_socket = std::move(secure_socket_);
+  out.cert = std::exchange(cert_, nullptr);
+  out.cert_chain = std::exchange(cert_chain_, {});
+  out.alpn = std::exchange(alpn_, {});
+  out.tls_args = std::exchange(tls_args_, std::nullopt);
+  out.endpoint = endpoint_;
+  out.tls_established = std::exchange(tls_established_, false);
+  set_connected(false);
+  return out;
+}
+
+void server_connection::adopt_transport(transport&& transport) {
+  socket_ = std::move(transport.socket);
+  ssl_context_ = std::move(transport.ssl_context);
+  secure_socket_ = std::move(transport.secure_socket);
+  cert_ = std::move(transport.cert);
+  cert_chain_ = std::move(transport.cert_chain);
+  alpn_ = std::move(transport.alpn);
+  tls_args_ = std::move(transport.tls_args);
+  endpoint_ = transport.endpoint;
+  tls_established_ = transport.tls_established;
+  reused_ = true;
+  set_connected();
+}
+
 }  // namespace proxy::connection
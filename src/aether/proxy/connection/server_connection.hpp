@@ -8,24 +8,73 @@
 #pragma once
 
 #include <boost/asio.hpp>
+#include <boost/asio/ssl.hpp>
+#include <memory>
+#include <optional>
 #include <string>
 #include <string_view>
+#include <vector>
 
 #include "aether/proxy/connection/base_connection.hpp"
+#include "aether/proxy/connection/dns_cache.hpp"
+#include "aether/proxy/connection/endpoint_stats.hpp"
+#include "aether/proxy/connection/secure_stream.hpp"
 #include "aether/proxy/error/error.hpp"
+#include "aether/proxy/tls/openssl/ssl_context.hpp"
 #include "aether/proxy/tls/x509/certificate.hpp"
 #include "aether/proxy/types.hpp"
 
 namespace proxy::connection {
 
+class server_connection_pool;
+
 // A connection to the server (wherever the client specifies).
+//
+// Connections that are left in a reusable state are handed to the server connection pool when released, so later
+// connection flows to the same server can skip the TCP and TLS handshakes.
 class server_connection : public base_connection {
  public:
+  // The open socket and TLS state of a server connection, which can be moved between server connection objects.
+  struct transport {
+    std::unique_ptr<boost::asio::ip::tcp::socket> socket;
+    std::unique_ptr<boost::asio::ssl::context> ssl_context;
+    std::unique_ptr<secure_stream> secure_socket;
+    tls::x509::certificate cert{nullptr};
+    std::vector<tls::x509::certificate> cert_chain;
+    std::string alpn;
+    std::optional<tls::openssl::ssl_context_args> tls_args;
+    boost::asio::ip::tcp::endpoint endpoint;
+    bool tls_established = false;
+
+    // Tests if the transport is still open with no unexpected data waiting on it.
+    bool is_idle();
+
+    // Closes the socket without a graceful shutdown.
+    void close();
+  };
+
   server_connection(boost::asio::io_context& ioc, server_components& components);
 
-  void connect_async(std::string host, port_t port, err_callback_t handler);
+  // Connects to the server.
+  //
+  // Reuses the current connection or an idle pooled connection if possible, unless allow_reuse is false.
+  void connect_async(std::string host, port_t port, err_callback_t handler, bool allow_reuse = true);
   result<void> establish_tls_async(tls::openssl::ssl_context_args& args, err_callback_t handler);
 
+  // Replaces the connection with a new one to the same server, repeating the TLS handshake if the old connection was
+  // secured.
+  //
+  // Used to retry a request after a reused connection turns out to have been closed by the server.
+  void reconnect_async(err_callback_t handler);
+
+  // Gives the connection to the pool if it can be reused, or disconnects it otherwise.
+  void release();
+
+  // Returns the connection to the state of a new one, so it can be used for another connection flow.
+  //
+  // Unlike release, the connection is never given to the pool.
+  void reset();
+
   inline std::string_view host() const { return host_; }
   inline port_t port() const { return port_; }
 
@@ -35,20 +84,82 @@ class server_connection : public base_connection {
 
   inline const std::vector<tls::x509::certificate>& get_cert_chain() const { return cert_chain_; }
 
+  // Returns the settings TLS was established with, if the connection is secured.
+  inline const std::optional<tls::openssl::ssl_context_args>& tls_args() const { return tls_args_; }
+
+  // Marks if the connection is in a state where it can carry another request.
+  inline void set_reusable(bool val) { reusable_ = val; }
+
+  // Returns if the connection carried an earlier request, so the server may have closed it while it was idle.
+  inline bool reused() const { return reused_; }
+
  private:
-  void on_resolve(const boost::system::error_code& err, boost::asio::ip::tcp::resolver::iterator endpoint_iterator,
-                  err_callback_t handler);
-  void on_connect(const boost::system::error_code& err, boost::asio::ip::tcp::resolver::iterator endpoint_iterator,
+  // Connection attempts racing to connect to the server, as described by Happy Eyeballs (RFC 8305).
+  //
+  // Attempts start one connection attempt delay apart, or as soon as the previous attempt fails, and the first to
+  // connect wins.
+  struct connect_race {
+    struct attempt {
+      std::unique_ptr<boost::asio::ip::tcp::socket> socket;
+      boost::posix_time::ptime started;
+    };
+
+    connect_race(const boost::asio::any_io_executor& executor);
+
+    std::vector<boost::asio::ip::tcp::endpoint> endpoints;
+    std::vector<attempt> attempts;
+    std::size_t next = 0;
+    std::size_t in_flight = 0;
+    bool finished = false;
+    boost::system::error_code last_error;
+    boost::asio::deadline_timer delay_timer;
+    err_callback_t handler;
+  };
+
+  void on_resolve(const boost::system::error_code& err, std::shared_ptr<const endpoint_list> endpoints,
                   err_callback_t handler);
+  void start_race(std::shared_ptr<const endpoint_list> endpoints, err_callback_t handler);
+  void start_attempt(std::shared_ptr<connect_race> race);
+  void on_attempt(std::shared_ptr<connect_race> race, std::size_t index, const boost::system::error_code& error);
+
+  // Ends the race, keeping the socket of the winning attempt, if any, and closing all others.
+  void finish_race(std::shared_ptr<connect_race> race, std::optional<std::size_t> winner,
+                   const boost::system::error_code& error);
   void on_handshake(const boost::system::error_code& err, err_callback_t handler);
+  void on_reconnect(const boost::system::error_code& err, std::optional<tls::openssl::ssl_context_args> tls_args,
+                    err_callback_t handler);
+
+  // Creates the TLS stream for the current socket using the stored TLS settings.
+  result<void> prepare_tls();
+
+  // Starts the TLS handshake on the stream created by prepare_tls.
+  void start_handshake(err_callback_t handler);
+
+  // Tries to continue with an idle pooled connection secured with the same TLS settings.
+  bool adopt_pooled_tls_connection(const tls::openssl::ssl_context_args& args);
+
+  // Moves the open socket and TLS state out of the connection, leaving it disconnected.
+  transport take_transport();
 
-  boost::asio::ip::tcp::resolver resolver_;
+  // Replaces the socket and TLS state of the connection with an open transport.
+  void adopt_transport(transport&& transport);
+
+  dns_cache& dns_cache_;
+  endpoint_stats& endpoint_stats_;
   boost::asio::ip::tcp::endpoint endpoint_;
 
   std::string host_;
   port_t port_;
 
   std::vector<tls::x509::certificate> cert_chain_;
+
+  // The settings TLS was established with, kept for reconnecting and for matching pooled connections.
+  std::optional<tls::openssl::ssl_context_args> tls_args_;
+
+  bool reusable_;
+  bool reused_;
+
+  server_connection_pool& pool_;
 };
 
 }  // namespace proxy::connection
@@ -0,0 +1,173 @@
+/*********************************************
+
+  Copyright (c) Jackson Nestelroad 2020
+  jackson.nestelroad.com
+
+*********************************************/
+
+#include "server_connection_pool.hpp"
+
+#include <boost/asio.hpp>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <utility>
+
+#include "aether/program/options.hpp"
+#include "aether/proxy/concurrent/io_context_pool.hpp"
+#include "aether/proxy/connection/server_connection.hpp"
+
+namespace {
+
+template <typename T, typename... Rest>
+void hash_combine(std::size_t& seed, const T& v, const Rest&... rest) {
+  seed ^= std::hash<T>{}(v) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+  (hash_combine(seed, rest), ...);
+}
+
+}  // namespace
+
+std::size_t std::hash<proxy::connection::server_connection_key>::operator()(
+    const proxy::connection::server_connection_key& key) const noexcept {
+  std::size_t hash = 0;
+  hash_combine(hash, key.host, key.port, key.tls);
+  return hash;
+}
+
+namespace proxy::connection {
+
+server_connection_pool::shard::shard(boost::asio::io_context& ioc) : timer(ioc) {}
+
+server_connection_pool::server_connection_pool(concurrent::io_context_pool& io_contexts, program::options& options)
+    : options_(options), reused_count_(0), stale_count_(0) {
+  for (std::size_t i = 0; i < io_contexts.size(); ++i) {
+    boost::asio::io_context& ioc = io_contexts.get_io_context(i);
+    shards_.emplace(&ioc, std::make_unique<shard>(ioc));
+  }
+}
+
+server_connection_pool::shard* server_connection_pool::get_shard(boost::asio::io_context& ioc) {
+  auto it = shards_.find(&ioc);
+  return it == shards_.end() ? nullptr : it->second.get();
+}
+
+std::optional<server_connection::transport> server_connection_pool::acquire(boost::asio::io_context& ioc,
+                                                                            const server_connection_key& key) {
+  shard* sh = get_shard(ioc);
+  if (sh == nullptr) {
+    return std::nullopt;
+  }
+
+  std::lock_guard<std::mutex> lock(sh->mutex);
+  auto it = sh->idle.find(key);
+  if (it == sh->idle.end()) {
+    return std::nullopt;
+  }
+
+  // The most recently used connection is the least likely to have been closed by the server.
+  std::optional<server_connection::transport> found;
+  std::deque<shard::idle_connection>& connections = it->second;
+  while (!found.has_value() && !connections.empty()) {
+    server_connection::transport transport = std::move(connections.back().transport);
+    connections.pop_back();
+    --sh->idle_count;
+    if (transport.is_idle()) {
+      found = std::move(transport);
+    } else {
+      transport.close();
+      stale_count_.fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+
+  if (connections.empty()) {
+    sh->idle.erase(it);
+  }
+  if (found.has_value()) {
+    reused_count_.fetch_add(1, std::memory_order_relaxed);
+  }
+  return found;
+}
+
+bool server_connection_pool::release(boost::asio::io_context& ioc, server_connection_key key,
+                                     server_connection::transport& transport) {
+  std::size_t max_idle = options_.upstream_max_idle_per_host;
+  if (max_idle == 0) {
+    return false;
+  }
+
+  shard* sh = get_shard(ioc);
+  if (sh == nullptr) {
+    return false;
+  }
+
+  boost::posix_time::ptime expiry = boost::asio::deadline_timer::traits_type::now() + options_.upstream_idle_timeout;
+
+  std::lock_guard<std::mutex> lock(sh->mutex);
+  std::deque<shard::idle_connection>& connections = sh->idle[std::move(key)];
+  if (connections.size() >= max_idle) {
+    // Make room by closing the connection that has been idle the longest.
+    connections.front().transport.close();
+    connections.pop_front();
+    --sh->idle_count;
+  }
+  connections.push_back({std::move(transport), expiry});
+  ++sh->idle_count;
+
+  if (!sh->timer_running) {
+    schedule_sweep(*sh, expiry);
+  }
+  return true;
+}
+
+std::size_t server_connection_pool::idle_connection_count() const {
+  std::size_t count = 0;
+  for (const auto& [ioc, sh] : shards_) {
+    std::lock_guard<std::mutex> lock(sh->mutex);
+    count += sh->idle_count;
+  }
+  return count;
+}
+
+void server_connection_pool::schedule_sweep(shard& sh, boost::posix_time::ptime at) {
+  sh.timer_running = true;
+  sh.timer.expires_at(at);
+  sh.timer.async_wait(std::bind_front(&server_connection_pool::sweep, this, std::ref(sh)));
+}
+
+void server_connection_pool::sweep(shard& sh, const boost::system::error_code& error) {
+  if (error == boost::asio::error::operation_aborted) {
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(sh.mutex);
+  sh.timer_running = false;
+
+  // Every connection gets the same timeout, so each list is ordered by expiry.
+  boost::posix_time::ptime now = boost::asio::deadline_timer::traits_type::now();
+  std::optional<boost::posix_time::ptime> next_expiry;
+  for (auto it = sh.idle.begin(); it != sh.idle.end();) {
+    std::deque<shard::idle_connection>& connections = it->second;
+    while (!connections.empty() && connections.front().expiry <= now) {
+      connections.front().transport.close();
+      connections.pop_front();
+      --sh.idle_count;
+    }
+
+    if (connections.empty()) {
+      it = sh.idle.erase(it);
+    } else {
+      if (!next_expiry.has_value() || connections.front().expiry < next_expiry.value()) {
+        next_expiry = connections.front().expiry;
+      }
+      ++it;
+    }
+  }
+
+  if (next_expiry.has_value()) {
+    schedule_sweep(sh, next_expiry.value());
+  }
+}
+
+}  // namespace proxy::connection
@@ -0,0 +1,115 @@
+/*********************************************
+
+  Copyright (c) Jackson Nestelroad 2020
+  jackson.nestelroad.com
+
+*********************************************/
+
+#pragma once
+
+#include <atomic>
+#include <boost/asio.hpp>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+
+#include "aether/program/options.hpp"
+#include "aether/proxy/concurrent/io_context_pool.hpp"
+#include "aether/proxy/connection/server_connection.hpp"
+#include "aether/proxy/types.hpp"
+
+namespace proxy::connection {
+
+// Identifies which idle server connections can be used interchangeably.
+struct server_connection_key {
+  std::string host;
+  port_t port;
+  // Fingerprint of the TLS settings the connection was secured with, or empty for a plain connection.
+  std::string tls;
+
+  bool operator==(const server_connection_key& other) const = default;
+};
+
+}  // namespace proxy::connection
+
+template <>
+struct std::hash<proxy::connection::server_connection_key> {
+  std::size_t operator()(const proxy::connection::server_connection_key& key) const noexcept;
+};
+
+namespace proxy::connection {
+
+// Pool of idle server connections that can be reused across connection flows.
+//
+// Each io_context has its own set of idle connections, since a socket can only be used by the io_context it was created
+// on. Idle connections are closed after the upstream idle timeout, and only a limited number are kept for each key.
+class server_connection_pool {
+ public:
+  server_connection_pool(concurrent::io_context_pool& io_contexts, program::options& options);
+  server_connection_pool() = delete;
+  ~server_connection_pool() = default;
+  server_connection_pool(const server_connection_pool& other) = delete;
+  server_connection_pool& operator=(const server_connection_pool& other) = delete;
+  server_connection_pool(server_connection_pool&& other) noexcept = delete;
+  server_connection_pool& operator=(server_connection_pool&& other) noexcept = delete;
+
+  // Takes the most recently used idle connection for the key that is still open.
+  //
+  // Idle connections found to be closed by the server are discarded along the way.
+  std::optional<server_connection::transport> acquire(boost::asio::io_context& ioc, const server_connection_key& key);
+
+  // Keeps an idle connection for later use.
+  //
+  // Returns false if the connection was not kept, in which case the caller still owns it.
+  bool release(boost::asio::io_context& ioc, server_connection_key key, server_connection::transport& transport);
+
+  // Returns the number of idle connections across all io_contexts.
+  std::size_t idle_connection_count() const;
+
+  // Returns the number of times an idle connection was reused.
+  inline std::size_t reused_connection_count() const { return reused_count_.load(std::memory_order_relaxed); }
+
+  // Returns the number of idle connections discarded because the server closed them.
+  inline std::size_t stale_connection_count() const { return stale_count_.load(std::memory_order_relaxed); }
+
+ private:
+  // Idle connections for a single io_context.
+  class shard {
+   public:
+    shard(boost::asio::io_context& ioc);
+
+    struct idle_connection {
+      server_connection::transport transport;
+      boost::posix_time::ptime expiry;
+    };
+
+    mutable std::mutex mutex;
+    std::unordered_map<server_connection_key, std::deque<idle_connection>> idle;
+    std::size_t idle_count = 0;
+    boost::asio::deadline_timer timer;
+    bool timer_running = false;
+  };
+
+  shard* get_shard(boost::asio::io_context& ioc);
+
+  // Schedules the next sweep of expired connections.
+  //
+  // The shard's mutex must be held.
+  void schedule_sweep(shard& sh, boost::posix_time::ptime at);
+
+  // Closes all expired connections in the shard.
+  void sweep(shard& sh, const boost::system::error_code& error);
+
+  program::options& options_;
+
+  // Built once at construction and never modified, so lookups do not need a lock.
+  std::unordered_map<boost::asio::io_context*, std::unique_ptr<shard>> shards_;
+
+  std::atomic<std::size_t> reused_count_;
+  std::atomic<std::size_t> stale_count_;
+};
+
+}  // namespace proxy::connection
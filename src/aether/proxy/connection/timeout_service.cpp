@@ -8,32 +8,23 @@
 #include "timeout_service.hpp"
 
 #include <boost/asio.hpp>
-#include <functional>
+#include <chrono>
+#include <memory>
 
+#include "aether/proxy/connection/timing_wheels.hpp"
 #include "aether/proxy/types.hpp"
+#include "aether/util/timing_wheel.hpp"
 
 namespace proxy::connection {
 
-timeout_service::timeout_service(boost::asio::io_context& ioc) : timer_(ioc) {}
-
-void timeout_service::reset_timer() { timer_.expires_from_now(boost::posix_time::pos_infin); }
-
-void timeout_service::on_timeout(callback_t handler, const boost::system::error_code& error) {
-  // Timer was not canceled.
-  if (error != boost::asio::error::operation_aborted) {
-    reset_timer();
-    handler();
-  }
-}
+timeout_service::timeout_service(boost::asio::io_context& ioc, std::shared_ptr<util::timing_wheel> wheel)
+    : wheel_(wheel != nullptr ? std::move(wheel)
+                              : std::make_shared<util::timing_wheel>(ioc, timing_wheels::resolution)) {}
 
 void timeout_service::set_timeout(const milliseconds& time, callback_t handler) {
-  timer_.expires_from_now(time);
-  timer_.async_wait(std::bind_front(&timeout_service::on_timeout, this, std::move(handler)));
+  wheel_->schedule(entry_, std::chrono::milliseconds(time.total_milliseconds()), std::move(handler));
 }
 
-void timeout_service::cancel_timeout() {
-  timer_.cancel();
-  reset_timer();
-}
+void timeout_service::cancel_timeout() { wheel_->cancel(entry_); }
 
 }  // namespace proxy::connection
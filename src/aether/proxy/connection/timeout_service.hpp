@@ -8,15 +8,21 @@
 #pragma once
 
 #include <boost/asio.hpp>
+#include <memory>
 
 #include "aether/proxy/types.hpp"
+#include "aether/util/timing_wheel.hpp"
 
 namespace proxy::connection {
 
 // Service to timeout connect, read, and write requests on the connection class.
+//
+// Timeouts are kept on a timing wheel shared by every connection on the io_context, so setting and canceling one
+// never touches the io_context's timer queue.
 class timeout_service {
  public:
-  timeout_service(boost::asio::io_context& ioc);
+  // Uses its own wheel if none is given.
+  timeout_service(boost::asio::io_context& ioc, std::shared_ptr<util::timing_wheel> wheel);
   timeout_service() = delete;
   ~timeout_service() = default;
   timeout_service(const timeout_service& other) = delete;
@@ -31,14 +37,9 @@ class timeout_service {
   void cancel_timeout();
 
  private:
-  // Resets the timer to infinity.
-  void reset_timer();
-
-  // Callback for the timer function.
-  // Will call if the timer is met or if the timer is cancelled.
-  void on_timeout(callback_t handler, const boost::system::error_code& error);
-
-  boost::asio::deadline_timer timer_;
+  // Declared before the entry, so the wheel outlives it.
+  std::shared_ptr<util::timing_wheel> wheel_;
+  util::timing_wheel::entry entry_;
 };
 
 }  // namespace proxy::connection
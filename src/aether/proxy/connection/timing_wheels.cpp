@@ -0,0 +1,30 @@
+/*********************************************
+
+  Copyright (c) Jackson Nestelroad 2020
+  jackson.nestelroad.com
+
+*********************************************/
+
+#include "timing_wheels.hpp"
+
+#include <boost/asio.hpp>
+#include <memory>
+
+#include "aether/proxy/concurrent/io_context_pool.hpp"
+#include "aether/util/timing_wheel.hpp"
+
+namespace proxy::connection {
+
+timing_wheels::timing_wheels(concurrent::io_context_pool& io_contexts) {
+  for (std::size_t i = 0; i < io_contexts.size(); ++i) {
+    boost::asio::io_context& ioc = io_contexts.get_io_context(i);
+    wheels_.emplace(&ioc, std::make_shared<util::timing_wheel>(ioc, resolution));
+  }
+}
+
+std::shared_ptr<util::timing_wheel> timing_wheels::get(boost::asio::io_context& ioc) const {
+  auto it = wheels_.find(&ioc);
+  return it == wheels_.end() ? nullptr : it->second;
+}
+
+}  // namespace proxy::connection
@@ -0,0 +1,47 @@
+/*********************************************
+
+  Copyright (c) Jackson Nestelroad 2020
+  jackson.nestelroad.com
+
+*********************************************/
+
+#pragma once
+
+#include <boost/asio.hpp>
+#include <chrono>
+#include <memory>
+#include <unordered_map>
+
+#include "aether/proxy/concurrent/io_context_pool.hpp"
+#include "aether/util/timing_wheel.hpp"
+
+namespace proxy::connection {
+
+// Timing wheels for connection timeouts, one for each io_context.
+//
+// Every connection on an io_context shares its wheel, so arming and canceling a timeout around each operation only
+// touches a list in memory owned by that thread.
+class timing_wheels {
+ public:
+  // Resolution of connection timeouts.
+  static constexpr std::chrono::milliseconds resolution{100};
+
+  timing_wheels(concurrent::io_context_pool& io_contexts);
+  timing_wheels() = delete;
+  ~timing_wheels() = default;
+  timing_wheels(const timing_wheels& other) = delete;
+  timing_wheels& operator=(const timing_wheels& other) = delete;
+  timing_wheels(timing_wheels&& other) noexcept = delete;
+  timing_wheels& operator=(timing_wheels&& other) noexcept = delete;
+
+  // Returns the wheel for the io_context, or nullptr if the pool does not own it.
+  std::shared_ptr<util::timing_wheel> get(boost::asio::io_context& ioc) const;
+
+ private:
+  // Built once at construction and never modified, so lookups do not need a lock.
+  //
+  // Timeouts keep their wheel alive, so wheels outlive connections that are destroyed after the server components.
+  std::unordered_map<boost::asio::io_context*, std::shared_ptr<util::timing_wheel>> wheels_;
+};
+
+}  // namespace proxy::connection
@@ -20,21 +20,29 @@
   X(7, asio_error, "ASIO error", other)                        \
   X(8, self_connect, "Proxy cannot connect to itself", other)
 
-#define HTTP_ERRORS(X, other)                                           \
-  X(1, invalid_method, "Invalid HTTP method", other)                    \
-  X(2, invalid_status, "Invalid HTTP status", other)                    \
-  X(3, invalid_version, "Invalid HTTP version", other)                  \
-  X(4, invalid_target_host, "Invalid target host", other)               \
-  X(5, invalid_target_port, "Invalid target port", other)               \
-  X(6, invalid_request_line, "Invalid HTTP request line", other)        \
-  X(7, invalid_header, "Invalid HTTP header", other)                    \
-  X(8, header_not_found, "Header was not found", other)                 \
-  X(9, invalid_body_size, "Invalid HTTP body size", other)              \
-  X(10, body_size_too_large, "Given body size exceeds limit", other)    \
-  X(11, invalid_chunked_body, "Malformed chunked-encoding body", other) \
-  X(12, no_response, "HTTP exchange has no response", other)            \
-  X(13, invalid_response_line, "Invalid HTTP response line", other)     \
-  X(14, malformed_response_body, "Malformed response body", other)
+#define HTTP_ERRORS(X, other)                                            \
+  X(1, invalid_method, "Invalid HTTP method", other)                     \
+  X(2, invalid_status, "Invalid HTTP status", other)                     \
+  X(3, invalid_version, "Invalid HTTP version", other)                   \
+  X(4, invalid_target_host, "Invalid target host", other)                \
+  X(5, invalid_target_port, "Invalid target port", other)                \
+  X(6, invalid_request_line, "Invalid HTTP request line", other)         \
+  X(7, invalid_header, "Invalid HTTP header", other)                     \
+  X(8, header_not_found, "Header was not found", other)                  \
+  X(9, invalid_body_size, "Invalid HTTP body size", other)               \
+  X(10, body_size_too_large, "Given body size exceeds limit", other)     \
+  X(11, invalid_chunked_body, "Malformed chunked-encoding body", other)  \
+  X(12, no_response, "HTTP exchange has no response", other)             \
+  X(13, invalid_response_line, "Invalid HTTP response line", other)      \
+  X(14, malformed_response_body, "Malformed response body", other)       \
+  X(15, header_size_too_large, "Header block size exceeds limit", other) \
+  X(16, http2_protocol_error, "HTTP/2 protocol error", other)            \
+  X(17, http2_frame_size_error, "HTTP/2 frame size error", other)        \
+  X(18, http2_flow_control_error, "HTTP/2 flow control error", other)    \
+  X(19, hpack_decoding_error, "HPACK decoding error", other)             \
+  X(20, http2_not_negotiated, "Server did not negotiate HTTP/2", other)  \
+  X(21, http2_stream_refused, "HTTP/2 stream was refused", other)        \
+  X(22, http2_stream_reset, "HTTP/2 stream was reset", other)
 
 #define TLS_ERRORS(X, other)                                                                                          \
   X(1, invalid_client_hello, "Invalid Client Hello message", other)                                                   \
@@ -0,0 +1,188 @@
+/*********************************************
+
+  Copyright (c) Jackson Nestelroad 2020
+  jackson.nestelroad.com
+
+*********************************************/
+
+#include "cache_control.hpp"
+
+#include <array>
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "aether/proxy/http/message/message.hpp"
+#include "aether/util/string.hpp"
+
+namespace proxy::http::cache {
+
+namespace {
+
+constexpr std::array<std::string_view, 12> month_names = {"jan", "feb", "mar", "apr", "may", "jun",
+                                                          "jul", "aug", "sep", "oct", "nov", "dec"};
+
+std::optional<std::int64_t> parse_integer(std::string_view str) {
+  std::int64_t value = 0;
+  auto [end, error] = std::from_chars(str.data(), str.data() + str.size(), value);
+  if (error != std::errc() || end != str.data() + str.size() || value < 0) {
+    return std::nullopt;
+  }
+  return value;
+}
+
+std::optional<unsigned> parse_month(std::string_view str) {
+  std::string name = util::string::lowercase(str);
+  for (std::size_t i = 0; i < month_names.size(); ++i) {
+    if (name == month_names[i]) {
+      return static_cast<unsigned>(i + 1);
+    }
+  }
+  return std::nullopt;
+}
+
+// Parses a delta-seconds argument, which saturates instead of overflowing.
+std::chrono::seconds parse_delta_seconds(std::string_view str) {
+  if (str.size() >= 2 && str.front() == '"' && str.back() == '"') {
+    str = str.substr(1, str.size() - 2);
+  }
+  if (str.empty() || str.find_first_not_of("0123456789") != std::string_view::npos) {
+    return std::chrono::seconds(0);
+  }
+  std::optional<std::int64_t> value = parse_integer(str);
+  return std::chrono::seconds(value.value_or(std::numeric_limits<std::int32_t>::max()));
+}
+
+// Splits a Cache-Control value into its directives, keeping commas inside quoted arguments.
+std::vector<std::string_view> split_directives(std::string_view value) {
+  std::vector<std::string_view> directives;
+  bool quoted = false;
+  std::size_t start = 0;
+  for (std::size_t i = 0; i <= value.size(); ++i) {
+    if (i < value.size() && value[i] == '"') {
+      quoted = !quoted;
+    } else if (i == value.size() || (value[i] == ',' && !quoted)) {
+      std::string_view directive = util::string::trim(value.substr(start, i - start));
+      if (!directive.empty()) {
+        directives.push_back(directive);
+      }
+      start = i + 1;
+    }
+  }
+  return directives;
+}
+
+}  // namespace
+
+cache_control cache_control::parse(const message& msg) {
+  cache_control directives;
+  for (std::string_view header : msg.get_all_of_header(header_id::cache_control)) {
+    for (std::string_view directive : split_directives(header)) {
+      std::string_view name = directive;
+      std::optional<std::string_view> argument;
+      if (std::size_t equals = directive.find('='); equals != std::string_view::npos) {
+        name = util::string::trim(directive.substr(0, equals));
+        argument = util::string::trim(directive.substr(equals + 1));
+      }
+
+      if (util::string::iequals_fn(name, "no-store")) {
+        directives.no_store = true;
+      } else if (util::string::iequals_fn(name, "no-cache")) {
+        // A list of field names only restricts those fields, but the whole response is revalidated instead.
+        directives.no_cache = true;
+      } else if (util::string::iequals_fn(name, "only-if-cached")) {
+        directives.only_if_cached = true;
+      } else if (util::string::iequals_fn(name, "must-revalidate")) {
+        directives.must_revalidate = true;
+      } else if (util::string::iequals_fn(name, "proxy-revalidate")) {
+        directives.proxy_revalidate = true;
+      } else if (util::string::iequals_fn(name, "public")) {
+        directives.is_public = true;
+      } else if (util::string::iequals_fn(name, "private")) {
+        // A list of field names only restricts those fields, but a shared cache does not store the response at all.
+        directives.is_private = true;
+      } else if (util::string::iequals_fn(name, "max-age")) {
+        directives.max_age = parse_delta_seconds(argument.value_or(""));
+      } else if (util::string::iequals_fn(name, "s-maxage")) {
+        directives.s_maxage = parse_delta_seconds(argument.value_or(""));
+      } else if (util::string::iequals_fn(name, "min-fresh")) {
+        directives.min_fresh = parse_delta_seconds(argument.value_or(""));
+      } else if (util::string::iequals_fn(name, "max-stale")) {
+        directives.max_stale = argument.has_value() ? parse_delta_seconds(argument.value())
+                                                    : std::chrono::seconds(std::numeric_limits<std::int32_t>::max());
+      }
+    }
+  }
+  return directives;
+}
+
+std::optional<clock::time_point> parse_http_date(std::string_view str) {
+  // IMF-fixdate:  Sun, 06 Nov 1994 08:49:37 GMT
+  // RFC 850:      Sunday, 06-Nov-94 08:49:37 GMT
+  // asctime:      Sun Nov  6 08:49:37 1994
+  //
+  // Splitting on every separator leaves the same fields in all three, only in a different order for asctime.
+  std::vector<std::string_view> fields;
+  std::size_t start = std::string_view::npos;
+  for (std::size_t i = 0; i <= str.size(); ++i) {
+    bool separator = i == str.size() || str[i] == ' ' || str[i] == ',' || str[i] == '-' || str[i] == ':';
+    if (separator && start != std::string_view::npos) {
+      fields.push_back(str.substr(start, i - start));
+      start = std::string_view::npos;
+    } else if (!separator && start == std::string_view::npos) {
+      start = i;
+    }
+  }
+
+  std::string_view day_field;
+  std::string_view month_field;
+  std::string_view year_field;
+  std::string_view time_fields[3];
+  if (fields.size() == 8 && fields[7] == "GMT") {
+    day_field = fields[1];
+    month_field = fields[2];
+    year_field = fields[3];
+    time_fields[0] = fields[4];
+    time_fields[1] = fields[5];
+    time_fields[2] = fields[6];
+  } else if (fields.size() == 7) {
+    month_field = fields[1];
+    day_field = fields[2];
+    time_fields[0] = fields[3];
+    time_fields[1] = fields[4];
+    time_fields[2] = fields[5];
+    year_field = fields[6];
+  } else {
+    return std::nullopt;
+  }
+
+  std::optional<std::int64_t> day = parse_integer(day_field);
+  std::optional<unsigned> month = parse_month(month_field);
+  std::optional<std::int64_t> year = parse_integer(year_field);
+  std::optional<std::int64_t> hours = parse_integer(time_fields[0]);
+  std::optional<std::int64_t> minutes = parse_integer(time_fields[1]);
+  std::optional<std::int64_t> seconds = parse_integer(time_fields[2]);
+  if (!day.has_value() || !month.has_value() || !year.has_value() || !hours.has_value() || !minutes.has_value() ||
+      !seconds.has_value() || hours.value() > 23 || minutes.value() > 59 || seconds.value() > 60) {
+    return std::nullopt;
+  }
+  if (year_field.size() == 2) {
+    // Two-digit years of RFC 850 dates are placed between 1970 and 2069.
+    year = year.value() + (year.value() < 70 ? 2000 : 1900);
+  }
+
+  std::chrono::year_month_day date{std::chrono::year(static_cast<int>(year.value())), std::chrono::month(month.value()),
+                                   std::chrono::day(static_cast<unsigned>(day.value()))};
+  if (!date.ok()) {
+    return std::nullopt;
+  }
+  return clock::time_point(std::chrono::sys_days(date)) + std::chrono::hours(hours.value()) +
+         std::chrono::minutes(minutes.value()) + std::chrono::seconds(seconds.value());
+}
+
+}  // namespace proxy::http::cache
@@ -0,0 +1,49 @@
+/*********************************************
+
+  Copyright (c) Jackson Nestelroad 2020
+  jackson.nestelroad.com
+
+*********************************************/
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <string_view>
+
+#include "aether/proxy/http/message/message.hpp"
+
+namespace proxy::http::cache {
+
+using clock = std::chrono::system_clock;
+
+// Directives of a message's Cache-Control headers, as described by RFC 9111.
+//
+// Only directives that matter to a shared cache are kept, and unknown directives are ignored.
+struct cache_control {
+  bool no_store = false;
+  bool no_cache = false;
+  bool only_if_cached = false;
+  bool must_revalidate = false;
+  bool proxy_revalidate = false;
+  bool is_public = false;
+  bool is_private = false;
+
+  std::optional<std::chrono::seconds> max_age;
+  std::optional<std::chrono::seconds> s_maxage;
+  std::optional<std::chrono::seconds> min_fresh;
+
+  // A max-stale directive with no argument accepts a response of any staleness.
+  std::optional<std::chrono::seconds> max_stale;
+
+  // Parses all Cache-Control headers of the message.
+  //
+  // A delta-seconds argument that cannot be parsed is taken as 0, which leaves the response stale rather than fresh.
+  static cache_control parse(const message& msg);
+};
+
+// Parses an HTTP-date in any of the formats recipients must accept (RFC 9110, Section 5.6.7).
+std::optional<clock::time_point> parse_http_date(std::string_view str);
+
+}  // namespace proxy::http::cache
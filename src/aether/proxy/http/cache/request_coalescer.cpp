@@ -0,0 +1,154 @@
+/*********************************************
+
+  Copyright (c) Jackson Nestelroad 2020
+  jackson.nestelroad.com
+
+*********************************************/
+
+#include "request_coalescer.hpp"
+
+#include <algorithm>
+#include <array>
+#include <boost/asio.hpp>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "aether/proxy/http/cache/cache_control.hpp"
+#include "aether/proxy/http/message/method.hpp"
+#include "aether/proxy/http/message/status.hpp"
+#include "aether/util/string.hpp"
+
+namespace proxy::http::cache {
+
+namespace {
+
+// Request headers servers commonly vary their responses on, which are part of the key.
+//
+// A response that varies on any other header is not shared, since the waiters' values were never compared.
+constexpr std::array<std::string_view, 3> key_headers = {"accept", "accept-encoding", "accept-language"};
+
+// Request headers that make a request unsuitable for collapsing.
+constexpr std::array<std::string_view, 8> bypass_headers = {
+    "authorization", "proxy-authorization", "cookie", "range", "if-match", "if-none-match", "if-modified-since",
+    "if-unmodified-since",
+};
+
+}  // namespace
+
+request_coalescer::request_coalescer() : collapsed_count_(0) {}
+
+std::optional<std::string> request_coalescer::make_key(const request& req) {
+  if (req.method() != method::GET && req.method() != method::HEAD) {
+    return std::nullopt;
+  }
+  if (std::any_of(bypass_headers.begin(), bypass_headers.end(),
+                  [&req](std::string_view name) { return req.has_header(name); })) {
+    return std::nullopt;
+  }
+  cache_control directives = cache_control::parse(req);
+  if (directives.no_cache || directives.no_store || directives.max_age == std::chrono::seconds(0) ||
+      (!req.has_header(header_id::cache_control) && req.header_has_token(header_id::pragma, "no-cache", true))) {
+    return std::nullopt;
+  }
+
+  std::string key = req.method() == method::HEAD ? "HEAD " : "GET ";
+  key += req.target().absolute_string();
+  for (std::string_view name : key_headers) {
+    key += '\n';
+    key += util::string::join(req.get_all_of_header(name), ", ");
+  }
+  return key;
+}
+
+request_coalescer::join_result request_coalescer::join(boost::asio::io_context& ioc, const std::string& key,
+                                                       response_handler_t handler) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = in_flight_.find(key);
+  if (it == in_flight_.end()) {
+    in_flight_.emplace(key, std::vector<waiter>{});
+    return {.joined = role::leader};
+  }
+  std::uint64_t id = next_waiter_id_++;
+  it->second.push_back({id, &ioc, std::move(handler)});
+  return {.joined = role::waiter, .waiter_id = id};
+}
+
+void request_coalescer::complete(const std::string& key, const response* res) {
+  std::vector<waiter> waiters;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = in_flight_.find(key);
+    if (it == in_flight_.end()) {
+      return;
+    }
+    waiters = std::move(it->second);
+    in_flight_.erase(it);
+    for (waiter& w : waiters) {
+      delivering_.emplace(w.id, std::move(w.handler));
+    }
+  }
+  if (waiters.empty()) {
+    return;
+  }
+
+  // Every waiter gets its own copy, since interceptors modify responses in place.
+  std::shared_ptr<const response> shared;
+  if (res != nullptr && is_shareable(*res)) {
+    shared = std::make_shared<const response>(*res);
+    collapsed_count_.fetch_add(waiters.size(), std::memory_order_relaxed);
+  }
+  for (const waiter& w : waiters) {
+    boost::asio::post(*w.ioc, [this, id = w.id, shared]() {
+      response_handler_t handler;
+      {
+        // The waiter may have been canceled in the meantime.
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto node = delivering_.extract(id);
+        if (node.empty()) {
+          return;
+        }
+        handler = std::move(node.mapped());
+      }
+      handler(shared != nullptr ? std::optional<response>(*shared) : std::nullopt);
+    });
+  }
+}
+
+void request_coalescer::cancel(const std::string& key, std::uint64_t waiter_id) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (delivering_.erase(waiter_id) > 0) {
+    return;
+  }
+  if (auto it = in_flight_.find(key); it != in_flight_.end()) {
+    std::erase_if(it->second, [waiter_id](const waiter& w) { return w.id == waiter_id; });
+  }
+}
+
+bool request_coalescer::is_shareable(const response& res) {
+  if (res.status() == status::partial_content || res.status() == status::not_modified || res.is_1xx() ||
+      res.has_header(header_id::set_cookie)) {
+    return false;
+  }
+  cache_control directives = cache_control::parse(res);
+  if (directives.no_store || directives.no_cache || directives.is_private) {
+    return false;
+  }
+  for (std::string_view value : res.get_all_of_header(header_id::vary)) {
+    for (std::string_view name : util::string::split_trim<std::string_view>(value, ',')) {
+      std::string lowercase = util::string::lowercase(name);
+      if (!name.empty() &&
+          std::find(key_headers.begin(), key_headers.end(), std::string_view(lowercase)) == key_headers.end()) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+}  // namespace proxy::http::cache
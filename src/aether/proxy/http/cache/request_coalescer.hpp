@@ -0,0 +1,99 @@
+/*********************************************
+
+  Copyright (c) Jackson Nestelroad 2020
+  jackson.nestelroad.com
+
+*********************************************/
+
+#pragma once
+
+#include <atomic>
+#include <boost/asio.hpp>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "aether/proxy/http/message/request.hpp"
+#include "aether/proxy/http/message/response.hpp"
+#include "aether/util/any_invocable.hpp"
+
+namespace proxy::http::cache {
+
+// Collapses identical requests that are waiting on the server at the same time into a single upstream request.
+//
+// The first request for a key is the leader and goes to the server. Requests that arrive while it is in flight wait
+// for its response, which is copied to each of them on their own io_context. If the response may not be shared, the
+// waiting requests are released to go to the server themselves.
+class request_coalescer {
+ public:
+  // Called with the shared response, or with nothing if the request must go to the server itself.
+  using response_handler_t = util::any_invocable<void(std::optional<response>)>;
+
+  enum class role {
+    // The request cannot be collapsed with others.
+    bypass,
+    // The request must go to the server, and others may wait on it.
+    leader,
+    // The request waits for the leader's response.
+    waiter,
+  };
+
+  struct join_result {
+    role joined = role::bypass;
+    std::uint64_t waiter_id = 0;
+  };
+
+  request_coalescer();
+  ~request_coalescer() = default;
+  request_coalescer(const request_coalescer& other) = delete;
+  request_coalescer& operator=(const request_coalescer& other) = delete;
+  request_coalescer(request_coalescer&& other) noexcept = delete;
+  request_coalescer& operator=(request_coalescer&& other) noexcept = delete;
+
+  // Builds the key requests are collapsed on, or returns nothing if the request must not be collapsed.
+  //
+  // Requests with credentials, conditionals, ranges, or that ask to bypass caches are never collapsed.
+  static std::optional<std::string> make_key(const request& req);
+
+  // Joins the request for the key, either as the leader or as a waiter.
+  //
+  // A waiter's handler is called on the given io_context, and never before this method returns.
+  join_result join(boost::asio::io_context& ioc, const std::string& key, response_handler_t handler);
+
+  // Ends the leader's request, sharing its response with every waiter if it may be shared.
+  //
+  // Passing nothing releases the waiters to go to the server themselves.
+  void complete(const std::string& key, const response* res);
+
+  // Cancels a waiter, so its handler is never called.
+  void cancel(const std::string& key, std::uint64_t waiter_id);
+
+  // Returns the number of requests answered with another request's response.
+  inline std::size_t collapsed_count() const { return collapsed_count_.load(std::memory_order_relaxed); }
+
+ private:
+  struct waiter {
+    std::uint64_t id;
+    boost::asio::io_context* ioc;
+    response_handler_t handler;
+  };
+
+  // Checks if a response to the leader may be given to requests that only share its key.
+  static bool is_shareable(const response& res);
+
+  std::mutex mutex_;
+
+  // Waiters of each request in flight.
+  std::unordered_map<std::string, std::vector<waiter>> in_flight_;
+
+  // Waiters whose handler has been posted to their io_context, but not yet called.
+  std::unordered_map<std::uint64_t, response_handler_t> delivering_;
+
+  std::uint64_t next_waiter_id_ = 1;
+  std::atomic<std::size_t> collapsed_count_;
+};
+
+}  // namespace proxy::http::cache
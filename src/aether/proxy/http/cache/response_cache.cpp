@@ -0,0 +1,645 @@
+/*********************************************
+
+  Copyright (c) Jackson Nestelroad 2020
+  jackson.nestelroad.com
+
+*********************************************/
+
+#include "response_cache.hpp"
+
+#include <algorithm>
+#include <array>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <chrono>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include "aether/proxy/http/message/method.hpp"
+#include "aether/proxy/http/message/status.hpp"
+#include "aether/util/console.hpp"
+#include "aether/util/string.hpp"
+
+namespace proxy::http::cache {
+
+namespace {
+
+// Headers that describe a single connection, which are never stored.
+constexpr std::array<header_id, 7> hop_by_hop_headers = {
+    header_id::connection, header_id::keep_alive, header_id::proxy_connection, header_id::transfer_encoding,
+    header_id::te,         header_id::trailer,    header_id::upgrade,
+};
+
+// Responses with these statuses may be stored without explicit freshness (RFC 9110, Section 15.1).
+constexpr std::array<status, 11> heuristically_cacheable_statuses = {
+    status::ok,
+    status::non_authoritative_information,
+    status::no_content,
+    status::multiple_choices,
+    status::moved_permanently,
+    status::permanent_redirect,
+    status::not_found,
+    status::method_not_allowed,
+    status::gone,
+    status::uri_too_long,
+    status::not_implemented,
+};
+
+// Upper bound on freshness derived from Last-Modified, which the server never asked for.
+constexpr std::chrono::seconds max_heuristic_lifetime = std::chrono::hours(24);
+
+// Approximate bytes used by a stored response besides its body.
+constexpr std::size_t node_overhead = 512;
+
+bool is_safe(method m) { return m == method::GET || m == method::HEAD || m == method::OPTIONS || m == method::TRACE; }
+
+std::chrono::seconds to_seconds(clock::duration duration) {
+  return std::max(std::chrono::duration_cast<std::chrono::seconds>(duration), std::chrono::seconds(0));
+}
+
+std::optional<clock::time_point> header_date(const message& msg, header_id id) {
+  std::optional<std::string_view> value = msg.get_optional_header(id);
+  return value.has_value() ? parse_http_date(value.value()) : std::nullopt;
+}
+
+// Strips the weak indicator from an entity tag, since If-None-Match uses the weak comparison.
+std::string_view opaque_tag(std::string_view tag) {
+  tag = util::string::trim(tag);
+  if (tag.size() >= 2 && tag.substr(0, 2) == "W/") {
+    tag.remove_prefix(2);
+  }
+  return tag;
+}
+
+// Checks if the client already has the stored response, according to its conditional headers (RFC 9110, Section 13).
+bool client_has_response(const request& req, const response& head) {
+  std::vector<std::string_view> if_none_match = req.get_all_of_header(header_id::if_none_match);
+  if (!if_none_match.empty()) {
+    std::optional<std::string_view> etag = head.get_optional_header(header_id::etag);
+    for (std::string_view value : if_none_match) {
+      for (std::string_view tag : util::string::split_trim<std::string_view>(value, ',')) {
+        if (tag == "*" || (etag.has_value() && opaque_tag(tag) == opaque_tag(etag.value()))) {
+          return true;
+        }
+      }
+    }
+    // If-Modified-Since is ignored when If-None-Match is present.
+    return false;
+  }
+
+  std::optional<clock::time_point> since = header_date(req, header_id::if_modified_since);
+  std::optional<clock::time_point> last_modified = header_date(head, header_id::last_modified);
+  if (!last_modified.has_value()) {
+    last_modified = header_date(head, header_id::date);
+  }
+  return since.has_value() && last_modified.has_value() && last_modified.value() <= since.value();
+}
+
+}  // namespace
+
+std::chrono::seconds cache_entry::current_age(clock::time_point now) const {
+  return corrected_initial_age + to_seconds(now - response_time);
+}
+
+response_cache::response_cache(program::options& options)
+    : options_(options), next_file_(0), hit_count_(0), miss_count_(0), revalidation_count_(0) {
+  if (!options_.cache || options_.cache_dir.empty()) {
+    return;
+  }
+
+  // Files left by an earlier run cannot be matched to requests, so they are removed.
+  std::error_code error;
+  std::filesystem::path directory = options_.cache_dir;
+  std::filesystem::create_directories(directory, error);
+  if (!error) {
+    for (const auto& file : std::filesystem::directory_iterator(directory, error)) {
+      if (file.path().extension() == ".body") {
+        std::filesystem::remove(file.path(), error);
+      }
+    }
+  }
+  if (error) {
+    out::error::log("Cache directory", directory.string(), "cannot be used, so responses are only cached in memory:",
+                    error.message());
+    return;
+  }
+  directory_ = std::move(directory);
+}
+
+response_cache::~response_cache() {
+  std::error_code error;
+  for (node* n : disk_lru_) {
+    std::filesystem::remove(n->file, error);
+  }
+}
+
+response_cache::lookup_result response_cache::lookup(request& req) {
+  if ((req.method() != method::GET && req.method() != method::HEAD) || req.has_header("Range") ||
+      req.has_header(header_id::authorization)) {
+    return {};
+  }
+
+  cache_control request_directives = cache_control::parse(req);
+  if (!req.has_header(header_id::cache_control) && req.header_has_token(header_id::pragma, "no-cache", true)) {
+    request_directives.no_cache = true;
+  }
+
+  std::string key = make_key(req);
+  clock::time_point now = clock::now();
+  std::unique_lock<std::mutex> lock(mutex_);
+  std::shared_ptr<node> found = find(key, req);
+  if (!found) {
+    lock.unlock();
+    miss_count_.fetch_add(1, std::memory_order_relaxed);
+    return {.status = request_directives.only_if_cached ? lookup_status::unsatisfiable : lookup_status::miss};
+  }
+
+  std::shared_ptr<const cache_entry> entry = found->entry;
+  std::chrono::seconds age = entry->current_age(now);
+  std::chrono::seconds lifetime = entry->freshness_lifetime;
+  if (request_directives.max_age.has_value()) {
+    lifetime = std::min(lifetime, request_directives.max_age.value());
+  }
+  std::chrono::seconds required_age = age + request_directives.min_fresh.value_or(std::chrono::seconds(0));
+  bool usable = required_age < lifetime;
+  if (!usable && !entry->must_revalidate && request_directives.max_stale.has_value() &&
+      !request_directives.max_age.has_value()) {
+    // Clients may accept stale responses, unless the server forbids it.
+    usable = age < entry->freshness_lifetime + request_directives.max_stale.value();
+  }
+
+  bool has_validators = entry->head.has_header(header_id::etag) || entry->head.has_header(header_id::last_modified);
+  bool client_conditional = req.has_header(header_id::if_none_match) || req.has_header(header_id::if_modified_since);
+
+  if (usable && !entry->no_cache && !request_directives.no_cache) {
+    std::shared_ptr<const std::string> body = load_body(lock, found);
+    if (body) {
+      lock.unlock();
+      hit_count_.fetch_add(1, std::memory_order_relaxed);
+      return {.status = lookup_status::hit, .res = make_response(req, *entry, *body, now, true)};
+    }
+  } else if (request_directives.only_if_cached) {
+    lock.unlock();
+    miss_count_.fetch_add(1, std::memory_order_relaxed);
+    return {.status = lookup_status::unsatisfiable};
+  } else if (has_validators && !client_conditional) {
+    // The body is loaded now, so a 304 from the server can be answered even if the node is evicted in the meantime.
+    std::shared_ptr<const std::string> body = load_body(lock, found);
+    if (body) {
+      lock.unlock();
+      if (std::optional<std::string_view> etag = entry->head.get_optional_header(header_id::etag)) {
+        req.set_header_to_value(header_id::if_none_match, etag.value());
+      }
+      if (std::optional<std::string_view> last_modified = entry->head.get_optional_header(header_id::last_modified)) {
+        req.set_header_to_value(header_id::if_modified_since, last_modified.value());
+      }
+      return {.status = lookup_status::revalidate,
+              .stale = stale_response{.key = std::move(key), .entry = std::move(entry), .body = std::move(body)}};
+    }
+  }
+
+  if (lock.owns_lock()) {
+    lock.unlock();
+  }
+  miss_count_.fetch_add(1, std::memory_order_relaxed);
+  return {};
+}
+
+void response_cache::handle_response(const request& req, response& res, bool body_complete,
+                                     const std::optional<stale_response>& stale, clock::time_point request_time) {
+  if (!is_safe(req.method()) && (res.is_2xx() || res.is_3xx())) {
+    // A successful unsafe request may change the resource (RFC 9111, Section 4.4).
+    invalidate(make_key(req));
+    return;
+  }
+
+  if (stale.has_value()) {
+    if (res.status() == status::not_modified) {
+      revalidated(req, res, stale.value(), request_time);
+      return;
+    }
+    miss_count_.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  if (req.method() != method::GET || !body_complete) {
+    return;
+  }
+
+  cache_control request_directives = cache_control::parse(req);
+  cache_control response_directives = cache_control::parse(res);
+  if (!is_storable(req, res, request_directives, response_directives)) {
+    // A stored response the server replaced with one that may not be stored is out of date.
+    if (stale.has_value()) {
+      invalidate(stale->key);
+    }
+    return;
+  }
+
+  std::optional<std::vector<std::pair<std::string, std::string>>> vary = make_vary(req, res);
+  if (!vary.has_value()) {
+    return;
+  }
+  store(req, res, std::move(vary).value(), request_time);
+}
+
+std::size_t response_cache::entry_count() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return entry_count_;
+}
+
+std::pair<std::size_t, std::size_t> response_cache::size() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return {memory_size_, disk_size_};
+}
+
+std::string response_cache::make_key(const request& req) {
+  // HEAD requests are answered from GET responses, so both use the same key.
+  return "GET " + req.target().absolute_string();
+}
+
+std::optional<std::vector<std::pair<std::string, std::string>>> response_cache::make_vary(const request& req,
+                                                                                           const response& res) {
+  std::vector<std::pair<std::string, std::string>> vary;
+  for (std::string_view value : res.get_all_of_header(header_id::vary)) {
+    for (std::string_view name : util::string::split_trim<std::string_view>(value, ',')) {
+      if (name == "*") {
+        return std::nullopt;
+      }
+      if (name.empty()) {
+        continue;
+      }
+      vary.emplace_back(util::string::lowercase(name), util::string::join(req.get_all_of_header(name), ", "));
+    }
+  }
+  return vary;
+}
+
+bool response_cache::matches_vary(const request& req, const cache_entry& entry) {
+  return std::all_of(entry.vary.begin(), entry.vary.end(), [&req](const auto& field) {
+    return util::string::join(req.get_all_of_header(field.first), ", ") == field.second;
+  });
+}
+
+bool response_cache::is_storable(const request& req, const response& res, const cache_control& request_directives,
+                                 const cache_control& response_directives) const {
+  if (request_directives.no_store || response_directives.no_store || response_directives.is_private) {
+    return false;
+  }
+  if (res.status() == status::partial_content || res.status() == status::not_modified ||
+      res.has_header("Content-Range") || res.has_header(header_id::set_cookie)) {
+    return false;
+  }
+
+  bool explicit_freshness = response_directives.max_age.has_value() || response_directives.s_maxage.has_value() ||
+                            res.has_header(header_id::expires);
+  bool default_cacheable = std::find(heuristically_cacheable_statuses.begin(), heuristically_cacheable_statuses.end(),
+                                     res.status()) != heuristically_cacheable_statuses.end();
+  if (!default_cacheable && !explicit_freshness && !response_directives.is_public) {
+    return false;
+  }
+
+  if (req.has_header(header_id::authorization) && !response_directives.is_public &&
+      !response_directives.must_revalidate && !response_directives.s_maxage.has_value()) {
+    return false;
+  }
+
+  return res.body().size() <= options_.cache_max_object_size;
+}
+
+std::shared_ptr<cache_entry> response_cache::make_entry(const request& req, const response& res,
+                                                        std::vector<std::pair<std::string, std::string>> vary,
+                                                        clock::time_point request_time,
+                                                        clock::time_point response_time) const {
+  auto entry = std::make_shared<cache_entry>();
+  entry->head = res;
+  entry->head.set_body("");
+  for (header_id id : hop_by_hop_headers) {
+    entry->head.remove_header(id);
+  }
+  entry->vary = std::move(vary);
+  entry->response_time = response_time;
+  entry->body_size = res.body().size();
+
+  cache_control directives = cache_control::parse(res);
+  entry->no_cache = directives.no_cache;
+  entry->must_revalidate = directives.must_revalidate || directives.proxy_revalidate || directives.s_maxage.has_value();
+
+  // Calculates the age of the response when it was received (RFC 9111, Section 4.2.3).
+  std::optional<clock::time_point> date = header_date(res, header_id::date);
+  std::chrono::seconds apparent_age =
+      date.has_value() ? to_seconds(response_time - date.value()) : std::chrono::seconds(0);
+  std::chrono::seconds age_value(0);
+  if (std::optional<std::string_view> age = res.get_optional_header(header_id::age)) {
+    std::string digits(util::string::trim(age.value()));
+    if (!digits.empty() && digits.find_first_not_of("0123456789") == std::string::npos) {
+      try {
+        age_value = std::chrono::seconds(std::stoll(digits));
+      } catch (const std::exception&) {
+        age_value = std::chrono::seconds(0);
+      }
+    }
+  }
+  entry->corrected_initial_age = std::max(apparent_age, age_value + to_seconds(response_time - request_time));
+
+  // Calculates the freshness lifetime (RFC 9111, Section 4.2.1).
+  if (directives.s_maxage.has_value()) {
+    entry->freshness_lifetime = directives.s_maxage.value();
+  } else if (directives.max_age.has_value()) {
+    entry->freshness_lifetime = directives.max_age.value();
+  } else if (res.has_header(header_id::expires)) {
+    // An invalid Expires date means the response is already stale.
+    std::optional<clock::time_point> expires = header_date(res, header_id::expires);
+    clock::time_point generated = date.value_or(response_time);
+    entry->freshness_lifetime = expires.has_value() ? to_seconds(expires.value() - generated) : std::chrono::seconds(0);
+  } else if (std::optional<clock::time_point> last_modified = header_date(res, header_id::last_modified)) {
+    clock::time_point generated = date.value_or(response_time);
+    entry->freshness_lifetime = std::min(to_seconds(generated - last_modified.value()) / 10, max_heuristic_lifetime);
+  }
+
+  return entry;
+}
+
+response response_cache::make_response(const request& req, const cache_entry& entry, const std::string& body,
+                                       clock::time_point now, bool evaluate_conditionals) {
+  response res = entry.head;
+  res.set_version(req.version());
+  res.set_header_to_value(header_id::age, std::to_string(entry.current_age(now).count()));
+
+  if (evaluate_conditionals && client_has_response(req, entry.head)) {
+    res.set_status(status::not_modified);
+    res.remove_header(header_id::content_length);
+    return res;
+  }
+
+  if (req.method() != method::HEAD) {
+    res.set_body(body);
+  }
+  // HEAD responses keep the length of the body they leave out.
+  res.set_header_to_value(header_id::content_length, std::to_string(entry.body_size));
+  return res;
+}
+
+std::shared_ptr<const std::string> response_cache::load_body(std::unique_lock<std::mutex>& lock,
+                                                             const std::shared_ptr<node>& n) {
+  if (n->body) {
+    touch(*n);
+    return n->body;
+  }
+  if (n->file.empty()) {
+    return nullptr;
+  }
+
+  std::filesystem::path file = n->file;
+  std::size_t size = n->entry->body_size;
+  lock.unlock();
+
+  // The file is mapped rather than read through a stream, which copies it once instead of twice.
+  std::shared_ptr<std::string> body;
+  try {
+    if (size == 0) {
+      body = std::make_shared<std::string>();
+    } else {
+      boost::interprocess::file_mapping mapping(file.c_str(), boost::interprocess::read_only);
+      boost::interprocess::mapped_region region(mapping, boost::interprocess::read_only, 0, size);
+      body = std::make_shared<std::string>(static_cast<const char*>(region.get_address()), region.get_size());
+    }
+  } catch (const std::exception&) {
+    body = nullptr;
+  }
+
+  lock.lock();
+  if (n->removed) {
+    return body;
+  }
+  if (!body) {
+    // The file is unusable, so the node is only kept if it has its body in memory again.
+    drop_file(*n);
+    if (!n->body) {
+      remove(*n);
+    }
+    return nullptr;
+  }
+  if (!n->body) {
+    n->body = body;
+    n->memory_size = body->size() + node_overhead;
+    memory_size_ += n->memory_size;
+    n->memory_position = memory_lru_.insert(memory_lru_.end(), n.get());
+  }
+  touch(*n);
+  enforce_budgets();
+  return n->body;
+}
+
+void response_cache::store(const request& req, const response& res,
+                           std::vector<std::pair<std::string, std::string>> vary, clock::time_point request_time) {
+  clock::time_point response_time = clock::now();
+  std::shared_ptr<cache_entry> entry = make_entry(req, res, std::move(vary), request_time, response_time);
+  bool has_validators = entry->head.has_header(header_id::etag) || entry->head.has_header(header_id::last_modified);
+  if (entry->freshness_lifetime.count() == 0 && !has_validators) {
+    // The response could never be used again.
+    return;
+  }
+
+  auto n = std::make_shared<node>();
+  n->key = make_key(req);
+  n->entry = std::move(entry);
+  n->body = std::make_shared<const std::string>(res.body());
+  n->memory_size = res.body().size() + node_overhead;
+  if (!directory_.empty()) {
+    n->file = write_body(*n->body);
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  insert(std::move(n));
+}
+
+void response_cache::revalidated(const request& req, response& res, const stale_response& stale,
+                                 clock::time_point request_time) {
+  // Headers from the 304 replace the stored ones, except those that describe the body (RFC 9111, Section 3.2).
+  response updated = stale.entry->head;
+  for (const auto& header : res.all_headers()) {
+    if (header.id() == header_id::content_length ||
+        std::find(hop_by_hop_headers.begin(), hop_by_hop_headers.end(), header.id()) != hop_by_hop_headers.end()) {
+      continue;
+    }
+    updated.remove_header(header.name());
+  }
+  for (const auto& header : res.all_headers()) {
+    if (header.id() == header_id::content_length ||
+        std::find(hop_by_hop_headers.begin(), hop_by_hop_headers.end(), header.id()) != hop_by_hop_headers.end()) {
+      continue;
+    }
+    updated.add_header(header.name(), header.value());
+  }
+  updated.set_body(*stale.body);
+
+  clock::time_point now = clock::now();
+  std::shared_ptr<cache_entry> entry = make_entry(req, updated, stale.entry->vary, request_time, now);
+  res = make_response(req, *entry, *stale.body, now, false);
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = index_.find(stale.key);
+    if (it != index_.end()) {
+      for (const std::shared_ptr<node>& n : it->second) {
+        if (n->entry == stale.entry) {
+          n->entry = std::move(entry);
+          break;
+        }
+      }
+    }
+  }
+
+  revalidation_count_.fetch_add(1, std::memory_order_relaxed);
+  hit_count_.fetch_add(1, std::memory_order_relaxed);
+}
+
+void response_cache::invalidate(const std::string& key) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = index_.find(key);
+  if (it == index_.end()) {
+    return;
+  }
+  std::vector<std::shared_ptr<node>> nodes = it->second;
+  for (const std::shared_ptr<node>& n : nodes) {
+    remove(*n);
+  }
+}
+
+std::filesystem::path response_cache::write_body(const std::string& body) {
+  std::filesystem::path file =
+      directory_ / (std::to_string(next_file_.fetch_add(1, std::memory_order_relaxed)) + ".body");
+  std::ofstream out(file, std::ios::binary | std::ios::trunc);
+  out.write(body.data(), static_cast<std::streamsize>(body.size()));
+  out.close();
+  if (!out) {
+    std::error_code error;
+    std::filesystem::remove(file, error);
+    return {};
+  }
+  return file;
+}
+
+std::shared_ptr<response_cache::node> response_cache::find(const std::string& key, const request& req) const {
+  auto it = index_.find(key);
+  if (it == index_.end()) {
+    return nullptr;
+  }
+  // Later responses are preferred, since they replaced earlier ones with the same Vary values.
+  for (auto n = it->second.rbegin(); n != it->second.rend(); ++n) {
+    if (matches_vary(req, *(*n)->entry)) {
+      return *n;
+    }
+  }
+  return nullptr;
+}
+
+void response_cache::insert(std::shared_ptr<node> n) {
+  std::vector<std::shared_ptr<node>>& nodes = index_[n->key];
+
+  // A new response replaces any stored response it would be selected over.
+  std::vector<std::shared_ptr<node>> replaced;
+  for (const std::shared_ptr<node>& existing : nodes) {
+    if (existing->entry->vary == n->entry->vary) {
+      replaced.push_back(existing);
+    }
+  }
+  for (const std::shared_ptr<node>& existing : replaced) {
+    remove(*existing);
+  }
+
+  node& inserted = *index_[n->key].emplace_back(std::move(n));
+  ++entry_count_;
+  memory_size_ += inserted.memory_size;
+  inserted.memory_position = memory_lru_.insert(memory_lru_.end(), &inserted);
+  if (!inserted.file.empty()) {
+    disk_size_ += inserted.entry->body_size;
+    inserted.disk_position = disk_lru_.insert(disk_lru_.end(), &inserted);
+  }
+  enforce_budgets();
+}
+
+void response_cache::remove(node& n) {
+  if (n.removed) {
+    return;
+  }
+  n.removed = true;
+  drop_body(n);
+  drop_file(n);
+  --entry_count_;
+
+  auto it = index_.find(n.key);
+  if (it != index_.end()) {
+    std::erase_if(it->second, [&n](const std::shared_ptr<node>& other) { return other.get() == &n; });
+    if (it->second.empty()) {
+      index_.erase(it);
+    }
+  }
+}
+
+void response_cache::touch(node& n) {
+  if (n.body) {
+    memory_lru_.splice(memory_lru_.end(), memory_lru_, n.memory_position);
+  }
+  if (!n.file.empty()) {
+    disk_lru_.splice(disk_lru_.end(), disk_lru_, n.disk_position);
+  }
+}
+
+void response_cache::drop_body(node& n) {
+  if (!n.body) {
+    return;
+  }
+  memory_lru_.erase(n.memory_position);
+  memory_size_ -= n.memory_size;
+  n.memory_size = 0;
+  n.body = nullptr;
+}
+
+void response_cache::drop_file(node& n) {
+  if (n.file.empty()) {
+    return;
+  }
+  disk_lru_.erase(n.disk_position);
+  disk_size_ -= n.entry->body_size;
+  std::error_code error;
+  std::filesystem::remove(n.file, error);
+  n.file.clear();
+}
+
+void response_cache::enforce_budgets() {
+  // Removing a node drops its last reference in the index, so it is kept alive until it is fully removed.
+  while (memory_size_ > options_.cache_memory_size && !memory_lru_.empty()) {
+    node& n = *memory_lru_.front();
+    std::shared_ptr<node> keep_alive;
+    if (n.file.empty()) {
+      keep_alive = *std::find_if(index_[n.key].begin(), index_[n.key].end(),
+                                 [&n](const std::shared_ptr<node>& other) { return other.get() == &n; });
+      remove(n);
+    } else {
+      drop_body(n);
+    }
+  }
+  while (disk_size_ > options_.cache_disk_size && !disk_lru_.empty()) {
+    node& n = *disk_lru_.front();
+    std::shared_ptr<node> keep_alive;
+    if (!n.body) {
+      keep_alive = *std::find_if(index_[n.key].begin(), index_[n.key].end(),
+                                 [&n](const std::shared_ptr<node>& other) { return other.get() == &n; });
+      remove(n);
+    } else {
+      drop_file(n);
+    }
+  }
+}
+
+}  // namespace proxy::http::cache
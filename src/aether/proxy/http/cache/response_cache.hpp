@@ -0,0 +1,212 @@
+/*********************************************
+
+  Copyright (c) Jackson Nestelroad 2020
+  jackson.nestelroad.com
+
+*********************************************/
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "aether/program/options.hpp"
+#include "aether/proxy/http/cache/cache_control.hpp"
+#include "aether/proxy/http/message/request.hpp"
+#include "aether/proxy/http/message/response.hpp"
+
+namespace proxy::http::cache {
+
+// A response stored in the cache, without its body.
+struct cache_entry {
+  // The response head.
+  response head;
+
+  // Values of the request headers named by the response's Vary header, which a request must match to use the entry.
+  std::vector<std::pair<std::string, std::string>> vary;
+
+  // When the response was received.
+  clock::time_point response_time;
+
+  // Age of the response when it was received (RFC 9111, Section 4.2.3).
+  std::chrono::seconds corrected_initial_age{0};
+
+  // How long the response is fresh for, counted from when it was generated.
+  std::chrono::seconds freshness_lifetime{0};
+
+  // The response must be revalidated before every use.
+  bool no_cache = false;
+
+  // The response must not be used once stale, even if the client would accept it.
+  bool must_revalidate = false;
+
+  std::size_t body_size = 0;
+
+  // Returns the current age of the response.
+  std::chrono::seconds current_age(clock::time_point now) const;
+};
+
+// A stored response that must be revalidated with the server before it can be used again.
+struct stale_response {
+  std::string key;
+  std::shared_ptr<const cache_entry> entry;
+  std::shared_ptr<const std::string> body;
+};
+
+// Shared HTTP response cache, as described by RFC 9111.
+//
+// Stored responses are kept in memory up to a byte budget, evicting the least recently used first. If a cache
+// directory is configured, bodies are also written to disk as they are stored, so a response evicted from memory can
+// still be served from its file, which is mapped back into memory on its next use. The disk tier has a byte budget of
+// its own.
+//
+// Only complete responses to GET requests are stored. HEAD requests are answered from stored GET responses.
+class response_cache {
+ public:
+  // Outcome of looking up a request.
+  enum class lookup_status {
+    // Nothing usable is stored, so the request must go to the server.
+    miss,
+    // A stored response can be sent as is.
+    hit,
+    // A stored response must be revalidated, so conditional headers were added to the request.
+    revalidate,
+    // Nothing usable is stored, but the client only accepts stored responses.
+    unsatisfiable,
+  };
+
+  struct lookup_result {
+    lookup_status status = lookup_status::miss;
+    std::optional<response> res;
+    std::optional<stale_response> stale;
+  };
+
+  response_cache(program::options& options);
+  response_cache() = delete;
+  ~response_cache();
+  response_cache(const response_cache& other) = delete;
+  response_cache& operator=(const response_cache& other) = delete;
+  response_cache(response_cache&& other) noexcept = delete;
+  response_cache& operator=(response_cache&& other) noexcept = delete;
+
+  // Looks up a stored response for the request.
+  lookup_result lookup(request& req);
+
+  // Handles a response from the server to a request that was looked up.
+  //
+  // The response is stored if it may be, and stored responses it invalidates are removed. A 304 response to a
+  // revalidation is replaced with the updated stored response.
+  //
+  // A response whose body is still being streamed is never stored.
+  void handle_response(const request& req, response& res, bool body_complete,
+                       const std::optional<stale_response>& stale, clock::time_point request_time);
+
+  // Returns the number of requests answered with a stored response, including revalidated ones.
+  inline std::size_t hit_count() const { return hit_count_.load(std::memory_order_relaxed); }
+
+  // Returns the number of requests that could not be answered with a stored response.
+  inline std::size_t miss_count() const { return miss_count_.load(std::memory_order_relaxed); }
+
+  // Returns the number of stored responses the server confirmed were still valid.
+  inline std::size_t revalidation_count() const { return revalidation_count_.load(std::memory_order_relaxed); }
+
+  // Returns the number of stored responses.
+  std::size_t entry_count() const;
+
+  // Returns the bytes used by the memory and disk tiers.
+  std::pair<std::size_t, std::size_t> size() const;
+
+ private:
+  struct node {
+    std::string key;
+    std::shared_ptr<const cache_entry> entry;
+
+    // The body, if it is held in memory.
+    std::shared_ptr<const std::string> body;
+
+    // The file holding the body, if it is on disk.
+    std::filesystem::path file;
+
+    // Bytes counted against the memory budget while the body is in memory.
+    std::size_t memory_size = 0;
+
+    bool removed = false;
+    std::list<node*>::iterator memory_position;
+    std::list<node*>::iterator disk_position;
+  };
+
+  // Builds the primary cache key of a request.
+  static std::string make_key(const request& req);
+
+  // Collects the request headers named by a Vary header, or returns nothing if the response can never be matched.
+  static std::optional<std::vector<std::pair<std::string, std::string>>> make_vary(const request& req,
+                                                                                    const response& res);
+
+  // Checks if the request matches the Vary values of a stored response.
+  static bool matches_vary(const request& req, const cache_entry& entry);
+
+  // Checks if a response may be stored for the request (RFC 9111, Section 3).
+  bool is_storable(const request& req, const response& res, const cache_control& request_directives,
+                   const cache_control& response_directives) const;
+
+  // Builds the entry for a response.
+  std::shared_ptr<cache_entry> make_entry(const request& req, const response& res,
+                                          std::vector<std::pair<std::string, std::string>> vary,
+                                          clock::time_point request_time, clock::time_point response_time) const;
+
+  // Builds the response sent to the client from a stored response.
+  //
+  // Conditional headers from the client are answered with 304 if they match the stored response.
+  static response make_response(const request& req, const cache_entry& entry, const std::string& body,
+                                clock::time_point now, bool evaluate_conditionals);
+
+  // Makes sure the body of a node is in memory, reading it from disk if needed.
+  //
+  // Returns nullptr if the body could not be read. The lock is released while the file is read.
+  std::shared_ptr<const std::string> load_body(std::unique_lock<std::mutex>& lock, const std::shared_ptr<node>& n);
+
+  void store(const request& req, const response& res, std::vector<std::pair<std::string, std::string>> vary,
+             clock::time_point request_time);
+  void revalidated(const request& req, response& res, const stale_response& stale, clock::time_point request_time);
+  void invalidate(const std::string& key);
+
+  // Writes a body to a new file in the cache directory, returning an empty path on failure.
+  std::filesystem::path write_body(const std::string& body);
+
+  // The following methods must be called with the lock held.
+
+  std::shared_ptr<node> find(const std::string& key, const request& req) const;
+  void insert(std::shared_ptr<node> n);
+  void remove(node& n);
+  void touch(node& n);
+  void drop_body(node& n);
+  void drop_file(node& n);
+  void enforce_budgets();
+
+  program::options& options_;
+  std::filesystem::path directory_;
+  std::atomic<std::size_t> next_file_;
+
+  mutable std::mutex mutex_;
+  std::unordered_map<std::string, std::vector<std::shared_ptr<node>>> index_;
+  std::list<node*> memory_lru_;
+  std::list<node*> disk_lru_;
+  std::size_t memory_size_ = 0;
+  std::size_t disk_size_ = 0;
+  std::size_t entry_count_ = 0;
+
+  std::atomic<std::size_t> hit_count_;
+  std::atomic<std::size_t> miss_count_;
+  std::atomic<std::size_t> revalidation_count_;
+};
+
+}  // namespace proxy::http::cache
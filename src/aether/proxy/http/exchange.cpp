@@ -25,4 +25,12 @@ const http::response& exchange::response() const {
   return res_.value();
 }
 
+void exchange::account_bodies() {
+  std::size_t bytes = req_.body().size() + body_chunk_.capacity();
+  if (res_.has_value()) {
+    bytes += res_->body().size();
+  }
+  body_memory_.set(bytes);
+}
+
 }  // namespace proxy::http
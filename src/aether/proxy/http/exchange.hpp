@@ -7,11 +7,14 @@
 
 #pragma once
 
+#include <memory>
 #include <optional>
+#include <string>
 #include <string_view>
 
 #include "aether/proxy/http/message/request.hpp"
 #include "aether/proxy/http/message/response.hpp"
+#include "aether/util/memory_account.hpp"
 
 namespace proxy::http {
 
@@ -49,6 +52,45 @@ class exchange {
   // Returns if the exchange should mask a CONNECT request, treating it like a normal HTTP request.
   inline bool mask_connect() const { return mask_connect_; }
 
+  // Sets if the request body should be fully buffered before the request is handled.
+  //
+  // Only meaningful when the proxy streams bodies. Interceptors that need to read or replace the whole request body
+  // should set this during http_event::request_head.
+  inline void set_buffer_request_body(bool val) { buffer_request_body_ = val; }
+
+  // Returns if the request body should be fully buffered before the request is handled.
+  inline bool buffer_request_body() const { return buffer_request_body_; }
+
+  // Sets if the response body should be fully buffered before the response is handled.
+  //
+  // Only meaningful when the proxy streams bodies. Interceptors that need to read or replace the whole response body
+  // should set this during http_event::response_head.
+  inline void set_buffer_response_body(bool val) { buffer_response_body_ = val; }
+
+  // Returns if the response body should be fully buffered before the response is handled.
+  inline bool buffer_response_body() const { return buffer_response_body_; }
+
+  // Returns the piece of a streamed body currently being forwarded.
+  //
+  // Interceptors of http_event::body_chunk may inspect or rewrite it. A chunk's size can only change if the message
+  // uses chunked encoding.
+  inline std::string& body_chunk() { return body_chunk_; }
+  inline const std::string& body_chunk() const { return body_chunk_; }
+
+  // Returns if the current body chunk belongs to the response, as opposed to the request.
+  inline bool body_chunk_from_response() const { return body_chunk_from_response_; }
+
+  // Sets which message the current body chunk belongs to.
+  inline void set_body_chunk_from_response(bool val) { body_chunk_from_response_ = val; }
+
+  // Sets the account the bodies held by the exchange are charged to.
+  inline void set_memory_account(std::shared_ptr<util::buffer::memory_account> account) {
+    body_memory_ = util::buffer::memory_account::reservation(std::move(account));
+  }
+
+  // Charges the memory account for the bodies currently held, which are refunded when the exchange is destroyed.
+  void account_bodies();
+
  private:
   static constexpr char no_response_error_message[] =
       "No response object in the HTTP exchange. Assure exchange::make_response or exchange::set_response is called "
@@ -57,6 +99,11 @@ class exchange {
   http::request req_;
   mutable std::optional<http::response> res_;
   bool mask_connect_ = false;
+  bool buffer_request_body_ = false;
+  bool buffer_response_body_ = false;
+  std::string body_chunk_;
+  bool body_chunk_from_response_ = false;
+  util::buffer::memory_account::reservation body_memory_;
 };
 
 }  // namespace proxy::http
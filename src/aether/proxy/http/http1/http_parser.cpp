@@ -7,6 +7,11 @@
 
 #include "http_parser.hpp"
 
+#include <algorithm>
+#include <optional>
+#include <string>
+#include <string_view>
+
 #include "aether/program/options.hpp"
 #include "aether/proxy/error/error.hpp"
 #include "aether/proxy/http/exchange.hpp"
@@ -17,6 +22,7 @@
 #include "aether/util/generic_error.hpp"
 #include "aether/util/result.hpp"
 #include "aether/util/result_macros.hpp"
+#include "aether/util/string.hpp"
 
 namespace proxy::http::http1 {
 
@@ -32,6 +38,23 @@ result<void> assert_not_unknown(http_parser::message_mode mode) {
   return util::ok;
 }
 
+// Finds the next complete line in the input.
+//
+// Returns the line without its line ending, and sets line_size to the number of bytes the line and its line ending
+// occupy. Returns std::nullopt if the input does not contain a complete line.
+std::optional<std::string_view> next_line(std::string_view input, std::size_t& line_size) {
+  std::size_t line_end = input.find('\n');
+  if (line_end == std::string_view::npos) {
+    return std::nullopt;
+  }
+  line_size = line_end + 1;
+  std::string_view line = input.substr(0, line_end);
+  if (!line.empty() && line.back() == '\r') {
+    line.remove_suffix(1);
+  }
+  return line;
+}
+
 }  // namespace
 
 result<message*> http_parser::get_data_for_mode(message_mode mode) {
@@ -42,71 +65,123 @@ result<message*> http_parser::get_data_for_mode(message_mode mode) {
   return &exchange_.response();
 }
 
-result<void> http_parser::read_request_line(std::istream& in) {
-  if (!request_method_buf_.read_until(in, message::SP) || !request_target_buf_.read_until(in, message::SP) ||
-      !request_version_buf_.read_until(in, message::CRLF)) {
+result<bool> http_parser::read_request_head(streambuf& in) { return read_head(in, message_mode::request); }
+
+result<bool> http_parser::read_response_head(streambuf& in) { return read_head(in, message_mode::response); }
+
+result<bool> http_parser::read_head(streambuf& in, message_mode mode) {
+  ASSIGN_OR_RETURN(message* msg, get_data_for_mode(mode));
+  std::size_t header_size_limit = options_.header_size_limit;
+
+  while (true) {
+    // The input area may have moved since the last call, so only offsets are kept between calls.
+    std::string_view input = in.string_view();
+    std::size_t line_end = input.find('\n', head_state_.scan_offset);
+    if (line_end == std::string_view::npos) {
+      // Incomplete line, so there is no reason to scan these bytes again on the next call.
+      head_state_.scan_offset = input.size();
+      if (head_state_.head_size + input.size() > header_size_limit) {
+        return error::http::header_size_too_large();
+      }
+      return false;
+    }
+
+    std::size_t line_size = line_end + 1;
+    head_state_.head_size += line_size;
+    if (head_state_.head_size > header_size_limit) {
+      return error::http::header_size_too_large();
+    }
+
+    // Lines end in CRLF, but a bare LF is tolerated.
+    std::string_view line = input.substr(0, line_end);
+    if (!line.empty() && line.back() == '\r') {
+      line.remove_suffix(1);
+    }
+
+    bool finished = false;
+    switch (head_state_.stage) {
+      case head_parsing_stage::start_line:
+        // Empty lines before the request line are ignored.
+        if (line.empty() && mode == message_mode::request) {
+          break;
+        }
+        if (mode == message_mode::request) {
+          RETURN_IF_ERROR(parse_request_line(line));
+        } else {
+          RETURN_IF_ERROR(parse_response_line(line));
+        }
+        head_state_.stage = head_parsing_stage::headers;
+        break;
+      case head_parsing_stage::headers:
+        if (line.empty()) {
+          finished = true;
+        } else {
+          RETURN_IF_ERROR(parse_header(line, *msg));
+        }
+        break;
+    }
+
+    // The line has been copied into the message, so it can be released from the buffer.
+    in.consume(line_size);
+    head_state_.scan_offset = 0;
+
+    if (finished) {
+      reset_head_parsing_state();
+      return true;
+    }
+  }
+}
+
+result<void> http_parser::parse_request_line(std::string_view line) {
+  std::size_t first_space = line.find(message::SP);
+  std::size_t last_space = line.rfind(message::SP);
+  if (first_space == std::string_view::npos || first_space == last_space) {
     return error::http::invalid_request_line("Could not read request line");
   }
 
-  // Exceptions will propogate.
+  std::string_view method_str = line.substr(0, first_space);
+  std::string_view target_str = line.substr(first_space + 1, last_space - first_space - 1);
+  std::string_view version_str = line.substr(last_space + 1);
+
   request& req = exchange_.request();
-  ASSIGN_OR_RETURN(method verb, string_to_method(request_method_buf_.string_view()));
+  ASSIGN_OR_RETURN(method verb, string_to_method(method_str));
   req.set_method(verb);
-  ASSIGN_OR_RETURN(version vers, string_to_version(request_version_buf_.string_view()));
+  ASSIGN_OR_RETURN(version vers, string_to_version(version_str));
   req.set_version(vers);
-  ASSIGN_OR_RETURN(url target, url::parse_target(request_target_buf_.string_view(), verb));
+  ASSIGN_OR_RETURN(url target, url::parse_target(target_str, verb));
   req.set_target(target);
 
-  request_method_buf_.reset();
-  request_target_buf_.reset();
-  request_version_buf_.reset();
-
   return util::ok;
 }
 
-result<void> http_parser::read_response_line(std::istream& in) {
-  if (!response_version_buf_.read_until(in, message::SP) || !response_code_buf_.read_until(in, message::SP) ||
-      !response_msg_buf_.read_until(in, message::CRLF)) {
+result<void> http_parser::parse_response_line(std::string_view line) {
+  std::size_t version_end = line.find(message::SP);
+  if (version_end == std::string_view::npos) {
     return error::http::invalid_response_line("Could not read response line");
   }
 
-  // Exceptions will propogate.
-  ASSIGN_OR_RETURN(version vers, string_to_version(response_version_buf_.string_view()));
-  exchange_.response().set_version(vers);
-  exchange_.response().set_status(string_to_status(response_code_buf_.string_view()));
-  // Message is discarded, we generate it ourselves when we need it.
+  std::string_view version_str = line.substr(0, version_end);
+  std::string_view code_str = line.substr(version_end + 1);
+  // The reason phrase is optional, and it is discarded anyway, since we generate it ourselves when we need it.
+  if (std::size_t code_end = code_str.find(message::SP); code_end != std::string_view::npos) {
+    code_str = code_str.substr(0, code_end);
+  }
 
-  response_version_buf_.reset();
-  response_code_buf_.reset();
-  response_msg_buf_.reset();
+  ASSIGN_OR_RETURN(version vers, string_to_version(version_str));
+  exchange_.response().set_version(vers);
+  exchange_.response().set_status(string_to_status(code_str));
 
   return util::ok;
 }
 
-result<void> http_parser::read_headers(std::istream& in, message_mode mode) {
-  ASSIGN_OR_RETURN(message* msg, get_data_for_mode(mode));
-  while (true) {
-    if (!header_buf_.read_until(in, message::CRLF)) {
-      return error::http::invalid_header("Error when reading header");
-    }
-
-    auto next_line = header_buf_.string_view();
-
-    if (next_line.empty()) {
-      header_buf_.reset();
-      break;
-    }
-    std::size_t delim = next_line.find(':');
-    if (delim == std::string::npos) {
-      return error::http::invalid_header(out::string::stream("No value set for header \"", next_line, "\""));
-    }
-    std::string_view name = next_line.substr(0, delim);
-    std::string_view value = next_line.substr(delim + 1);
-    value = util::string::trim(value);
-    msg->add_header(name, value);
-
-    header_buf_.reset();
+result<void> http_parser::parse_header(std::string_view line, message& msg) {
+  std::size_t delim = line.find(':');
+  if (delim == std::string_view::npos) {
+    return error::http::invalid_header(out::string::stream("No value set for header \"", line, "\""));
   }
+  std::string_view name = line.substr(0, delim);
+  std::string_view value = util::string::trim(line.substr(delim + 1));
+  msg.add_header(name, value);
   return util::ok;
 }
 
@@ -115,7 +190,8 @@ result<std::pair<http_parser::body_size_type, std::size_t>> http_parser::expecte
   bool for_request = mode == message_mode::request;
   request& req = exchange_.request();
   if (for_request) {
-    if (result<std::string_view> header = req.get_header("Expect"); header.is_ok() && header.ok() == "100-continue") {
+    if (result<std::string_view> header = req.get_header(header_id::expect);
+        header.is_ok() && header.ok() == "100-continue") {
       return none;
     }
   } else if (exchange_.has_response()) {
@@ -138,12 +214,12 @@ result<std::pair<http_parser::body_size_type, std::size_t>> http_parser::expecte
   }
   ASSIGN_OR_RETURN(message* msg, get_data_for_mode(mode));
 
-  if (msg->header_has_token("Transfer-Encoding", "chunked")) {
+  if (msg->header_has_token(header_id::transfer_encoding, "chunked")) {
     return {body_size_type::chunked, 0};
   }
 
-  if (msg->has_header("Content-Length")) {
-    auto sizes = msg->get_all_of_header("Content-Length");
+  if (msg->has_header(header_id::content_length)) {
+    auto sizes = msg->get_all_of_header(header_id::content_length);
     bool different_sizes = std::adjacent_find(sizes.begin(), sizes.end(), std::not_equal_to<>()) != sizes.end();
     if (different_sizes) {
       return error::http::invalid_body_size("Conflicting Content-Length headers");
@@ -290,4 +366,109 @@ result<bool> http_parser::read_body(std::istream& in, message_mode mode) {
   return false;
 }
 
+result<http_parser::body_size_type> http_parser::expected_body_type(message_mode mode) {
+  ASSIGN_OR_RETURN((std::pair<body_size_type, std::size_t> pair), expected_body_size(mode));
+  return pair.first;
+}
+
+result<bool> http_parser::read_body_chunk(streambuf& in, message_mode mode, std::string& out, bool eof) {
+  // Initial read, set up state.
+  if (state_.mode == message_mode::unknown) {
+    ASSIGN_OR_RETURN((std::pair<body_size_type, std::size_t> pair), expected_body_size(mode));
+    // No body to read at all, already successful.
+    if (pair.first == body_size_type::none) {
+      return true;
+    }
+    state_ = {mode, pair.first, pair.second, 0};
+  }
+
+  switch (state_.type) {
+    case body_size_type::chunked:
+      RETURN_IF_ERROR(read_chunked_body_chunk(in, out));
+      break;
+    case body_size_type::given: {
+      std::size_t available = std::min(in.size(), state_.expected_size - state_.read);
+      out.append(in.string_view().substr(0, available));
+      in.consume(available);
+      state_.read += available;
+      state_.finished = state_.read == state_.expected_size;
+    } break;
+    default: {
+      // Read until EOF, so everything in the buffer belongs to the body.
+      std::size_t available = in.size();
+      out.append(in.string_view());
+      in.consume(available);
+      state_.read += available;
+      state_.finished = eof;
+    } break;
+  }
+
+  if (state_.finished) {
+    reset_body_parsing_state();
+    return true;
+  }
+  return false;
+}
+
+result<void> http_parser::read_chunked_body_chunk(streambuf& in, std::string& out) {
+  std::size_t line_size_limit = options_.header_size_limit;
+  while (true) {
+    std::size_t line_size = 0;
+    std::optional<std::string_view> line;
+    if (state_.stage != chunk_stage::data) {
+      line = next_line(in.string_view(), line_size);
+      if (!line.has_value()) {
+        // Need more data from the socket.
+        if (in.size() > line_size_limit) {
+          return error::http::invalid_chunked_body();
+        }
+        return util::ok;
+      }
+    }
+
+    switch (state_.stage) {
+      case chunk_stage::size_line: {
+        // Chunk extensions are allowed after the size, but they carry nothing the proxy uses.
+        std::string_view size_str = util::string::trim(line->substr(0, line->find(';')));
+        util::result<std::size_t, util::generic_error> res = util::string::parse_hexadecimal(size_str);
+        if (res.is_err()) {
+          return error::http::invalid_chunked_body();
+        }
+        state_.expected_size = res.ok();
+        state_.stage = state_.expected_size == 0 ? chunk_stage::trailers : chunk_stage::data;
+      } break;
+      case chunk_stage::data: {
+        std::size_t available = std::min(in.size(), state_.expected_size);
+        out.append(in.string_view().substr(0, available));
+        in.consume(available);
+        state_.read += available;
+        state_.expected_size -= available;
+        if (state_.expected_size > 0) {
+          // Need more data from the socket.
+          return util::ok;
+        }
+        state_.stage = chunk_stage::data_end;
+      } break;
+      case chunk_stage::data_end:
+        // Chunk data must be followed by an empty line.
+        if (!line->empty()) {
+          return error::http::invalid_chunked_body();
+        }
+        state_.stage = chunk_stage::size_line;
+        break;
+      case chunk_stage::trailers:
+        // Trailers are dropped, since the head has already been forwarded.
+        if (line->empty()) {
+          state_.finished = true;
+        }
+        break;
+    }
+
+    in.consume(line_size);
+    if (state_.finished) {
+      return util::ok;
+    }
+  }
+}
+
 }  // namespace proxy::http::http1
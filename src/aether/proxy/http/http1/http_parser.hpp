@@ -10,6 +10,8 @@
 #include <boost/asio.hpp>
 #include <boost/blank.hpp>
 #include <iostream>
+#include <string>
+#include <string_view>
 #include <utility>
 
 #include "aether/program/options.hpp"
@@ -28,6 +30,9 @@ namespace proxy::http::http1 {
 // Class for parsing a HTTP/1.x request from an input stream.
 //
 // Can parse a request and response at the same time.
+//
+// Message heads are parsed directly from a connection's input buffer. Parsing is resumable, so a head split across
+// multiple socket reads is picked up where the last call left off without rescanning the buffer.
 class http_parser {
  public:
   // Enum for passing in which HTTP message object to send parsed data to.
@@ -45,6 +50,28 @@ class http_parser {
     all,
   };
 
+  // Enumeration type for which part of the message head is being parsed.
+  enum class head_parsing_stage {
+    start_line,
+    headers,
+  };
+
+  struct head_parsing_state {
+    head_parsing_stage stage = head_parsing_stage::start_line;
+    // Offset into the unconsumed input where the search for the next line ending resumes.
+    std::size_t scan_offset = 0;
+    // Number of bytes of the message head consumed so far.
+    std::size_t head_size = 0;
+  };
+
+  // Enumeration type for which part of a chunked body is being streamed.
+  enum class chunk_stage {
+    size_line,
+    data,
+    data_end,
+    trailers,
+  };
+
   struct body_parsing_state {
     message_mode mode = message_mode::unknown;
     body_size_type type = body_size_type::none;
@@ -52,6 +79,7 @@ class http_parser {
     std::size_t read = 0;
     bool finished = false;
     bool next_chunk_size_known = false;
+    chunk_stage stage = chunk_stage::size_line;
   };
 
   http_parser(exchange& exch, server_components& components);
@@ -62,14 +90,22 @@ class http_parser {
   http_parser(http_parser&& parser) = delete;
   http_parser& operator=(http_parser&& parser) = delete;
 
-  // Parses the request line from the stream.
-  result<void> read_request_line(std::istream& in);
+  // Parses the request line and headers from the buffer.
+  //
+  // This method is stateful, and it returns a boolean indicating if the head was completely read. Each complete line is
+  // consumed from the buffer as it is parsed, so the caller should read more data into the same buffer and call again
+  // if the head is incomplete.
+  //
+  // State is automatically reset when the head is completely read.
+  result<bool> read_request_head(streambuf& in);
 
-  // Parses the response line from the stream.
-  result<void> read_response_line(std::istream& in);
+  // Parses the response line and headers from the buffer.
+  //
+  // Behaves exactly like read_request_head.
+  result<bool> read_response_head(streambuf& in);
 
-  // Reads the headers from the stream.
-  result<void> read_headers(std::istream& in, message_mode mode);
+  // Returns if any part of a message head has been seen by the parser.
+  inline bool head_started() const { return head_state_.head_size > 0 || head_state_.scan_offset > 0; }
 
   // Reads the message body from the stream.
   //
@@ -80,13 +116,43 @@ class http_parser {
   // Do not switch message mode between reads.
   result<bool> read_body(std::istream& in, message_mode mode);
 
+  // Reads as much of the message body as is available in the buffer, appending the decoded body data to out.
+  //
+  // Behaves like read_body, but the body is never collected in the message, so it is not subject to the body size
+  // limit. Chunked encoding is removed, and any trailers are discarded. Each byte is consumed from the buffer as it is
+  // parsed.
+  //
+  // eof signals that no more data will arrive, which is how a body read until the end of the stream finishes.
+  result<bool> read_body_chunk(streambuf& in, message_mode mode, std::string& out, bool eof);
+
+  // Checks how the body of the message for the given mode will be delimited.
+  result<body_size_type> expected_body_type(message_mode mode);
+
  private:
   // Gets the reference for where to save the parsed data.
   result<message*> get_data_for_mode(message_mode mode);
 
+  // Parses a message head for the given mode, line by line.
+  result<bool> read_head(streambuf& in, message_mode mode);
+
+  // Parses a single request line, without its line ending.
+  result<void> parse_request_line(std::string_view line);
+
+  // Parses a single response line, without its line ending.
+  result<void> parse_response_line(std::string_view line);
+
+  // Parses a single header line, without its line ending.
+  result<void> parse_header(std::string_view line, message& msg);
+
+  // Streams as much of a chunked body as is available in the buffer.
+  result<void> read_chunked_body_chunk(streambuf& in, std::string& out);
+
   // Checks the expected body size based on the request and response data currently in the parser.
   result<std::pair<body_size_type, std::size_t>> expected_body_size(message_mode mode);
 
+  // Resets the head parsing status.
+  inline void reset_head_parsing_state() { head_state_ = {}; }
+
   // Resets the body parsing status.
   inline void reset_body_parsing_state() { state_ = {}; }
 
@@ -95,18 +161,14 @@ class http_parser {
   // The data the parser writes to is managed by an exchange.
   exchange& exchange_;
 
+  // Internal state for parsing a HTTP message head, since it can span multiple calls.
+  head_parsing_state head_state_;
+
   // Internal state for parsing a HTTP body, since it can span multiple calls.
   body_parsing_state state_;
 
   // Buffer segments for managing compound reads.
 
-  util::buffer::buffer_segment request_method_buf_;
-  util::buffer::buffer_segment request_target_buf_;
-  util::buffer::buffer_segment request_version_buf_;
-  util::buffer::buffer_segment response_version_buf_;
-  util::buffer::buffer_segment response_code_buf_;
-  util::buffer::buffer_segment response_msg_buf_;
-  util::buffer::buffer_segment header_buf_;
   util::buffer::buffer_segment chunk_header_buf_;
   util::buffer::buffer_segment chunk_suffix_buf_;
   util::buffer::buffer_segment body_buf_;
@@ -8,6 +8,7 @@
 #include "http_service.hpp"
 
 #include <boost/asio.hpp>
+#include <boost/asio/ssl.hpp>
 #include <functional>
 #include <iostream>
 #include <memory>
@@ -26,11 +27,34 @@
 
 namespace proxy::http::http1 {
 
+namespace {
+
+// Checks if an error on a reused server connection means the server closed it while it was idle.
+bool is_stale_connection_error(const boost::system::error_code& error) {
+  return error == boost::asio::error::eof || error == boost::asio::error::connection_reset ||
+         error == boost::asio::error::broken_pipe || error == boost::asio::ssl::error::stream_truncated;
+}
+
+}  // namespace
+
 const response http_service::continue_response = {version::http1_1, status::continue_, {}, ""};
 const response http_service::connect_response = {version::http1_1, status::ok, {}, ""};
 
 http_service::http_service(connection::connection_flow& flow, connection_handler& owner, server_components& components)
-    : base_service(flow, owner, components), exchange_(), parser_(exchange_, components) {}
+    : base_service(flow, owner, components), exchange_(), parser_(exchange_, components) {
+  exchange_.set_memory_account(components.memory_budget.account());
+}
+
+http_service::~http_service() {
+  // A response still pending on a shared session must not call back into a destroyed service.
+  if (upstream_session_ != nullptr) {
+    upstream_session_->cancel(upstream_request_id_);
+  }
+  if (collapse_key_.has_value() && !collapse_leader_) {
+    components_.request_coalescer.cancel(collapse_key_.value(), collapse_waiter_id_);
+  }
+  finish_collapsed_request(nullptr);
+}
 
 void http_service::start() {
   // Errors may be stored up to be sent over HTTP.
@@ -44,14 +68,42 @@ void http_service::start() {
 }
 
 void http_service::read_request_head() {
-  // Read until the end of headers delimiter is found.
-  flow_.client.read_until_async(message::CRLF_CRLF, std::bind_front(&http_service::on_read_request_head, this));
+  // The client's input buffer may already hold some or all of the next request, so parse before reading.
+  if (result<void> res = read_request_head_impl(); !res.is_ok()) {
+    flow_.error = std::move(res).err();
+    status response_status = flow_.error.proxy_error() == errc::header_size_too_large
+                                 ? status::request_header_fields_too_large
+                                 : status::bad_request;
+    send_error_response(response_status, flow_.error.message());
+  }
+}
+
+result<void> http_service::read_request_head_impl() {
+  ASSIGN_OR_RETURN(bool done, parser_.read_request_head(flow_.client.input_buffer()));
+  if (done) {
+    ASSIGN_OR_RETURN(request_body_pending_, should_stream_body(http_parser::message_mode::request));
+    if (request_body_pending_) {
+      // The body is forwarded once the server is connected.
+      handle_request();
+    } else {
+      read_request_body(std::bind_front(&http_service::handle_request, this));
+    }
+  } else {
+    // Need more data from the socket.
+    if (!parser_.head_started() && flow_.client.input_buffer().size() == 0) {
+      // Keep-alive connection between requests, which may stay idle for a long time.
+      flow_.client.read_when_ready_async(std::bind_front(&http_service::on_read_request_head, this), true);
+    } else {
+      flow_.client.read_async(std::bind_front(&http_service::on_read_request_head, this));
+    }
+  }
+  return util::ok;
 }
 
 void http_service::on_read_request_head(const boost::system::error_code& error, std::size_t bytes_transferred) {
   if (error != boost::system::errc::success) {
     // No new request started.
-    if (bytes_transferred == 0) {
+    if (!parser_.head_started()) {
       stop();
       return;
     }
@@ -63,18 +115,8 @@ void http_service::on_read_request_head(const boost::system::error_code& error,
       send_error_response(status::bad_request, error.message());
     }
   } else {
-    std::istream input = flow_.client.input_stream();
-    if (result<void> res = parser_.read_request_line(input); !res.is_ok()) {
-      flow_.error = res.err();
-      send_error_response(status::bad_request, res.err().message());
-      return;
-    }
-    if (result<void> res = parser_.read_headers(input, http_parser::message_mode::request); !res.is_ok()) {
-      flow_.error = res.err();
-      send_error_response(status::bad_request, res.err().message());
-      return;
-    }
-    read_request_body(std::bind_front(&http_service::handle_request, this));
+    // Go back to parsing the head with the new data.
+    read_request_head();
   }
 }
 
@@ -127,6 +169,7 @@ void http_service::on_read_request_body(callback_t handler, const boost::system:
 }
 
 void http_service::handle_request() {
+  exchange_.account_bodies();
   if (result<void> res = handle_request_impl(); !res.is_ok()) {
     flow_.error = std::move(res).err();
     send_error_response(status::bad_request, flow_.error.message());
@@ -141,7 +184,7 @@ result<void> http_service::handle_request_impl() {
   interceptors_.http.run(intercept::http_event::any_request, flow_, exchange_);
 
   // Insert Via header.
-  req.add_header("Via", out::string::stream("1.1 ", constants::lowercase_name));
+  req.add_header(header_id::via, out::string::stream("1.1 ", constants::lowercase_name));
 
   // This is a CONNECT request.
   if (req.target().form == url::target_form::authority) {
@@ -168,7 +211,7 @@ result<void> http_service::handle_request_impl() {
       stop();
       return util::ok;
     }
-    req.remove_header("Expect");
+    req.remove_header(header_id::expect);
     return util::ok;
   }
 
@@ -182,6 +225,16 @@ result<void> http_service::handle_request_impl() {
     // Must get the response from the server.
     if (websocket::handshake::is_handshake(req)) {
       interceptors_.http.run(intercept::http_event::websocket_handshake, flow_, exchange_);
+    } else {
+      // The key is taken before the cache adds conditional headers of its own.
+      std::optional<std::string> collapse_key =
+          options_.collapsed_forwarding ? cache::request_coalescer::make_key(req) : std::nullopt;
+      if (options_.cache && serve_from_cache()) {
+        return util::ok;
+      }
+      if (collapse_key.has_value() && join_collapsed_request(std::move(collapse_key).value())) {
+        return util::ok;
+      }
     }
     connect_server();
   }
@@ -197,8 +250,8 @@ result<void> http_service::validate_target() {
   // This form is when the client knows it is talking to a proxy.
   if (target.form == url::target_form::absolute) {
     // Add missing host header.
-    if (!req.has_header("Host")) {
-      req.set_header_to_value("Host", target.netloc.to_host_string());
+    if (!req.has_header(header_id::host)) {
+      req.set_header_to_value(header_id::host, target.netloc.to_host_string());
     }
 
     // Convert absolute form to origin form to forward the request.
@@ -207,20 +260,23 @@ result<void> http_service::validate_target() {
     target.form = url::target_form::origin;
   } else if (target.form == url::target_form::origin && !target.netloc.has_hostname()) {
     // This form occurs when the client does not know it is talking to the proxy, so it sends an origin-form request.
-    if (!req.has_header("Host")) {
+    if (!req.has_header(header_id::host)) {
       // No host information in target, so we need to parse it and set it to keep things uniform.
       //
       // Absolutely no way to get the intended host.
       return error::http::invalid_target_host("No host given.");
     }
     // Parse host header, and set the host.
-    ASSIGN_OR_RETURN(std::string_view host_header, req.get_header("Host"));
+    ASSIGN_OR_RETURN(std::string_view host_header, req.get_header(header_id::host));
     target.netloc = url::parse_netloc(host_header);
   }
 
   // Set scheme based on server connection.
+  //
+  // An intercepted TLS connection may have handed its server connection to the pool, but its requests are still for
+  // the secure server.
   if (target.form != url::target_form::authority && target.scheme.empty()) {
-    target.scheme = flow_.server.secured() ? "https" : "http";
+    target.scheme = flow_.server.secured() || flow_.client.secured() ? "https" : "http";
   }
 
   // Set default port.
@@ -232,7 +288,64 @@ result<void> http_service::validate_target() {
   return util::ok;
 }
 
-void http_service::connect_server() { connect_server_async(std::bind_front(&http_service::on_connect_server, this)); }
+bool http_service::serve_from_cache() {
+  cache_stale_.reset();
+  cache::response_cache::lookup_result cached = components_.response_cache.lookup(exchange_.request());
+  switch (cached.status) {
+    case cache::response_cache::lookup_status::hit:
+      exchange_.make_response() = std::move(cached.res).value();
+      modify_response();
+      return true;
+    case cache::response_cache::lookup_status::unsatisfiable:
+      send_error_response(status::gateway_timeout, "No cached response is available.");
+      return true;
+    case cache::response_cache::lookup_status::revalidate:
+      cache_stale_ = std::move(cached.stale);
+      return false;
+    case cache::response_cache::lookup_status::miss:
+      return false;
+  }
+  return false;
+}
+
+bool http_service::join_collapsed_request(std::string key) {
+  cache::request_coalescer::join_result joined = components_.request_coalescer.join(
+      ioc_, key, std::bind_front(&http_service::on_collapsed_response, this));
+  collapse_key_ = std::move(key);
+  collapse_leader_ = joined.joined == cache::request_coalescer::role::leader;
+  collapse_waiter_id_ = joined.waiter_id;
+  return joined.joined == cache::request_coalescer::role::waiter;
+}
+
+void http_service::on_collapsed_response(std::optional<response> res) {
+  collapse_key_.reset();
+  if (res.has_value()) {
+    // The stale response was revalidated by the other request, if it needed to be.
+    cache_stale_.reset();
+    exchange_.make_response() = std::move(res).value();
+    modify_response();
+  } else {
+    connect_server();
+  }
+}
+
+void http_service::finish_collapsed_request(const response* res) {
+  if (collapse_key_.has_value() && collapse_leader_) {
+    components_.request_coalescer.complete(collapse_key_.value(), res);
+    collapse_key_.reset();
+    collapse_leader_ = false;
+  }
+}
+
+void http_service::connect_server() {
+  request_time_ = cache::clock::now();
+  upstream_start_ = std::chrono::steady_clock::now();
+  if (should_use_upstream_session()) {
+    send_request_on_session();
+  } else {
+    connect_server_async(std::bind_front(&http_service::on_connect_server, this));
+  }
+}
 
 void http_service::on_connect_server(const boost::system::error_code& error) {
   if (error != boost::system::errc::success) {
@@ -242,44 +355,161 @@ void http_service::on_connect_server(const boost::system::error_code& error) {
     } else {
       send_error_response(status::bad_gateway, error.message());
     }
+  } else if (flow_.client.secured() && !flow_.server.secured() && exchange_.request().target().scheme == "https") {
+    // The server connection was handed to the pool while requests went through a shared session, so the new one has to
+    // be secured again.
+    server_tls_args_ = tls::tls_service::make_server_context_args(options_, components_.client_store());
+    server_tls_args_.alpn_protos.emplace_back(tls::tls_service::default_alpn);
+    if (result<void> res =
+            flow_.server.establish_tls_async(server_tls_args_, std::bind_front(&http_service::on_secure_server, this));
+        !res.is_ok()) {
+      flow_.error = std::move(res).err();
+      send_error_response(status::bad_gateway, flow_.error.message());
+    }
+  } else {
+    forward_request();
+  }
+}
+
+void http_service::on_secure_server(const boost::system::error_code& error) {
+  if (error != boost::system::errc::success) {
+    flow_.error.set_boost_error(error);
+    flow_.error.set_proxy_error(errc::upstream_handshake_failed);
+    send_error_response(status::bad_gateway, error.message());
   } else {
     forward_request();
   }
 }
 
+bool http_service::should_use_upstream_session() const {
+  // Sessions carry whole requests, so streamed bodies and protocol upgrades stay on the flow's own connection.
+  const request& req = exchange_.request();
+  return options_.http2_upstream && flow_.client.secured() && req.target().scheme == "https" &&
+         !request_body_pending_ && !req.has_header(header_id::upgrade) && !websocket::handshake::is_handshake(req);
+}
+
+void http_service::send_request_on_session() {
+  const request& req = exchange_.request();
+  upstream_session_ = components_.http2_sessions.acquire(ioc_, components_, std::string(req.host_name()),
+                                                         req.host_port());
+  if (upstream_session_ == nullptr) {
+    // The server is known to only speak HTTP/1.1.
+    connect_server_async(std::bind_front(&http_service::on_connect_server, this));
+    return;
+  }
+  upstream_request_id_ =
+      upstream_session_->send_request(req, std::bind_front(&http_service::on_session_response, this));
+}
+
+void http_service::on_session_response(result<response> res) {
+  upstream_session_.reset();
+  if (res.is_ok()) {
+    exchange_.make_response() = std::move(res).ok();
+    // The session carries every request to this server now, so the flow's own connection can serve another flow.
+    if (flow_.server.connected()) {
+      flow_.server.set_reusable(true);
+      flow_.server.release();
+    }
+    handle_server_response();
+    return;
+  }
+
+  error::error_state error = std::move(res).err();
+  if (error.proxy_error() == errc::http2_not_negotiated) {
+    connect_server_async(std::bind_front(&http_service::on_connect_server, this));
+    return;
+  }
+  if (error.proxy_error() == errc::http2_stream_refused && !retried_) {
+    // The server did not process the request, so it is safe to send again on a new session.
+    retried_ = true;
+    send_request_on_session();
+    return;
+  }
+
+  flow_.error = std::move(error);
+  if (flow_.error.boost_error() == boost::asio::error::operation_aborted) {
+    send_error_response(status::gateway_timeout, flow_.error.message());
+  } else {
+    send_error_response(status::bad_gateway, flow_.error.message());
+  }
+}
+
 void http_service::forward_request() {
+  // The connection is in use until the response is fully read.
+  flow_.server.set_reusable(false);
   flow_.server << exchange_.request();
   flow_.server.write_async(std::bind_front(&http_service::on_forward_request, this));
 }
 
 void http_service::on_forward_request(const boost::system::error_code& error, std::size_t bytes_transferred) {
-  if (error != boost::system::errc::success) {
+  if (error != boost::system::errc::success && should_retry_request(error)) {
+    retry_request();
+  } else if (error != boost::system::errc::success) {
     flow_.error.set_boost_error(error);
     if (error == boost::asio::error::operation_aborted) {
       send_error_response(status::gateway_timeout, error.message());
     } else {
       send_error_response(status::internal_server_error, error.message());
     }
+  } else if (request_body_pending_) {
+    stream_body(http_parser::message_mode::request, std::bind_front(&http_service::on_stream_request_body, this));
   } else {
     read_response_head();
   }
 }
 
+void http_service::on_stream_request_body() {
+  request_body_pending_ = false;
+  read_response_head();
+}
+
+bool http_service::should_retry_request(const boost::system::error_code& error) const {
+  // A request is only sent again if it is safe to repeat, it can be sent again in full, and the failure looks like the
+  // server closed a connection that had been sitting idle.
+  return !retried_ && flow_.server.reused() && !request_body_pending_ && is_idempotent(exchange_.request().method()) &&
+         is_stale_connection_error(error);
+}
+
+void http_service::retry_request() {
+  retried_ = true;
+  flow_.server.reconnect_async(std::bind_front(&http_service::on_connect_server, this));
+}
+
 void http_service::read_response_head() {
-  // Read until the end of headers delimiter is found.
-  flow_.server.read_until_async(message::CRLF_CRLF, std::bind_front(&http_service::on_read_response_head, this));
+  exchange_.make_response();
+  parse_response_head();
 }
 
-void http_service::on_read_response_head(const boost::system::error_code& error, std::size_t bytes_transferred) {
-  if (result<void> res = on_read_response_head_impl(error, bytes_transferred); !res.is_ok()) {
+void http_service::parse_response_head() {
+  if (result<void> res = parse_response_head_impl(); !res.is_ok()) {
     flow_.error = std::move(res).err();
     send_error_response(status::internal_server_error, flow_.error.message());
   }
 }
 
-result<void> http_service::on_read_response_head_impl(const boost::system::error_code& error,
-                                                      std::size_t bytes_transferred) {
-  if (error != boost::system::errc::success) {
+result<void> http_service::parse_response_head_impl() {
+  ASSIGN_OR_RETURN(bool done, parser_.read_response_head(flow_.server.input_buffer()));
+  if (done) {
+    ASSIGN_OR_RETURN(response_body_pending_, should_stream_body(http_parser::message_mode::response));
+    if (response_body_pending_) {
+      ASSIGN_OR_RETURN(http_parser::body_size_type body_type,
+                       parser_.expected_body_type(http_parser::message_mode::response));
+      close_after_response_ = body_type == http_parser::body_size_type::all;
+      handle_server_response();
+    } else {
+      read_response_body(std::bind_front(&http_service::handle_server_response, this));
+    }
+  } else {
+    // Need more data from the socket.
+    flow_.server.read_async(std::bind_front(&http_service::on_read_response_head, this));
+  }
+  return util::ok;
+}
+
+void http_service::on_read_response_head(const boost::system::error_code& error, std::size_t bytes_transferred) {
+  if (error != boost::system::errc::success && !parser_.head_started() && should_retry_request(error)) {
+    retry_request();
+  } else if (error != boost::system::errc::success) {
     flow_.error.set_boost_error(error);
     if (error == boost::asio::error::operation_aborted) {
       send_error_response(status::gateway_timeout, error.message());
@@ -288,13 +518,9 @@ result<void> http_service::on_read_response_head_impl(const boost::system::error
       send_error_response(status::internal_server_error, error.message());
     }
   } else {
-    std::istream input = flow_.server.input_stream();
-    exchange_.make_response();
-    RETURN_IF_ERROR(parser_.read_response_line(input));
-    RETURN_IF_ERROR(parser_.read_headers(input, http_parser::message_mode::response));
-    read_response_body(std::bind_front(&http_service::modify_response, this));
+    // Go back to parsing the head with the new data.
+    parse_response_head();
   }
-  return util::ok;
 }
 
 void http_service::read_response_body(callback_t handler, bool eof) {
@@ -351,11 +577,28 @@ void http_service::on_read_response_body(callback_t handler, const boost::system
   }
 }
 
+void http_service::handle_server_response() {
+  exchange_.account_bodies();
+  components_.connection_manager.limiter().record_latency(std::chrono::steady_clock::now() - upstream_start_);
+  if (options_.cache) {
+    components_.response_cache.handle_response(exchange_.request(), exchange_.response(), !response_body_pending_,
+                                               cache_stale_, request_time_);
+    cache_stale_.reset();
+  }
+  // A streamed body is written to the client as it arrives, so it cannot be shared.
+  finish_collapsed_request(response_body_pending_ ? nullptr : &exchange_.response());
+  modify_response();
+}
+
 void http_service::modify_response() {
   exchange_.response().set_header_to_value(out::string::stream(proxy::constants::server_name, "-Connection-Id"),
                                            flow_.id().to_string());
   interceptors_.http.run(intercept::http_event::response, flow_, exchange_);
-  forward_response();
+  if (response_body_pending_) {
+    forward_response_head();
+  } else {
+    forward_response();
+  }
 }
 
 void http_service::forward_response() {
@@ -372,14 +615,41 @@ void http_service::on_forward_response(const boost::system::error_code& error, s
   }
 }
 
+void http_service::forward_response_head() {
+  std::ostream output = flow_.client.output_stream();
+  exchange_.response().write_head(output);
+  flow_.client.write_async(std::bind_front(&http_service::on_forward_response_head, this));
+}
+
+void http_service::on_forward_response_head(const boost::system::error_code& error, std::size_t bytes_transferred) {
+  if (error != boost::system::errc::success) {
+    flow_.error.set_boost_error(error);
+    stop();
+  } else {
+    stream_body(http_parser::message_mode::response, std::bind_front(&http_service::on_stream_response_body, this));
+  }
+}
+
+void http_service::on_stream_response_body() {
+  response_body_pending_ = false;
+  handle_response();
+}
+
 void http_service::handle_response() {
-  bool should_close = exchange_.request().should_close_connection() || exchange_.response().should_close_connection();
+  // A request body that was never forwarded is still sitting on the client connection, so it cannot be reused.
+  bool should_close = exchange_.request().should_close_connection() || exchange_.response().should_close_connection() ||
+                      request_body_pending_ || close_after_response_;
   if (should_close) {
     // TODO: Set client or server to disconnected.
     stop();
     return;
   }
 
+  // The server connection can carry another request, from this client or from another flow.
+  if (exchange_.response().status() != status::switching_protocols) {
+    flow_.server.set_reusable(true);
+  }
+
   if (exchange_.response().status() == status::switching_protocols) {
     if (!options_.websocket_passthrough_strict &&
         (!options_.websocket_passthrough || flow_.should_intercept_websocket()) &&
@@ -394,6 +664,148 @@ void http_service::handle_response() {
   }
 }
 
+result<bool> http_service::should_stream_body(http_parser::message_mode mode) {
+  if (!options_.stream_bodies) {
+    return false;
+  }
+  ASSIGN_OR_RETURN(http_parser::body_size_type body_type, parser_.expected_body_type(mode));
+  if (body_type == http_parser::body_size_type::none) {
+    return false;
+  }
+
+  if (mode == http_parser::message_mode::request) {
+    interceptors_.http.run(intercept::http_event::request_head, flow_, exchange_);
+    return !exchange_.buffer_request_body();
+  }
+  interceptors_.http.run(intercept::http_event::response_head, flow_, exchange_);
+  return !exchange_.buffer_response_body();
+}
+
+void http_service::stream_body(http_parser::message_mode mode, callback_t handler, bool eof) {
+  if (result<void> res = stream_body_impl(mode, std::move(handler), eof); !res.is_ok()) {
+    flow_.error = std::move(res).err();
+    on_stream_body_error(mode);
+  }
+}
+
+result<void> http_service::stream_body_impl(http_parser::message_mode mode, callback_t handler, bool eof) {
+  // The flow for streaming a HTTP body is the following:
+  //  1. Parse whatever is in the source's input buffer, removing any chunked encoding.
+  //  2. Let interceptors see the decoded piece.
+  //  3. Re-encode the piece if needed and write it to the destination.
+  //  4. If the body is not complete, read from the source and return to step 1.
+  //  5. Body is complete, call handler.
+  //
+  // Only one piece is held in memory at a time, no matter how large the body is.
+  bool for_request = mode == http_parser::message_mode::request;
+  connection::base_connection& source = for_request ? static_cast<connection::base_connection&>(flow_.client)
+                                                    : static_cast<connection::base_connection&>(flow_.server);
+  connection::base_connection& destination = for_request ? static_cast<connection::base_connection&>(flow_.server)
+                                                         : static_cast<connection::base_connection&>(flow_.client);
+  const message& msg = for_request ? static_cast<const message&>(exchange_.request())
+                                   : static_cast<const message&>(exchange_.response());
+  bool chunked = msg.header_has_token(header_id::transfer_encoding, "chunked");
+
+  std::string& chunk = exchange_.body_chunk();
+  chunk.clear();
+  ASSIGN_OR_RETURN(bool done, parser_.read_body_chunk(source.input_buffer(), mode, chunk, eof));
+
+  if (!chunk.empty()) {
+    std::size_t original_size = chunk.size();
+    exchange_.set_body_chunk_from_response(!for_request);
+    interceptors_.http.run(intercept::http_event::body_chunk, flow_, exchange_);
+
+    std::ostream output = destination.output_stream();
+    if (chunked) {
+      // An empty chunk would end the body early.
+      if (!chunk.empty()) {
+        output << std::hex << chunk.size() << message::CRLF << chunk << message::CRLF;
+      }
+    } else if (chunk.size() != original_size) {
+      // The length of the body has already been sent.
+      return error::http::invalid_body_size("Body chunk size changed without chunked encoding");
+    } else {
+      output << chunk;
+    }
+  }
+
+  if (done) {
+    if (chunked) {
+      std::ostream output = destination.output_stream();
+      output << '0' << message::CRLF_CRLF;
+    }
+  } else if (eof) {
+    // Body is not finished, and nothing more to read.
+    error::error_state err;
+    err.set_boost_error(boost::asio::error::eof);
+    err.set_proxy_error(for_request ? errc::invalid_body_size : errc::malformed_response_body);
+    return err;
+  }
+
+  if (destination.output_buffer().size() > 0) {
+    destination.write_async([this, mode, done, handler = std::move(handler)](const boost::system::error_code& error,
+                                                                             std::size_t bytes_transferred) mutable {
+      on_stream_body_write(mode, std::move(handler), done, error, bytes_transferred);
+    });
+  } else if (done) {
+    handler();
+  } else {
+    // Need more data from the socket.
+    source.read_async([this, mode, handler = std::move(handler)](const boost::system::error_code& error,
+                                                                 std::size_t bytes_transferred) mutable {
+      on_stream_body_read(mode, std::move(handler), error, bytes_transferred);
+    });
+  }
+  return util::ok;
+}
+
+void http_service::on_stream_body_read(http_parser::message_mode mode, callback_t handler,
+                                       const boost::system::error_code& error, std::size_t bytes_transferred) {
+  if (error != boost::system::errc::success) {
+    // Connection was closed by the source.
+    //
+    // This may be desired if reading body until end of stream.
+    if (error == boost::asio::error::eof) {
+      stream_body(mode, std::move(handler), true);
+    } else {
+      flow_.error.set_boost_error(error);
+      on_stream_body_error(mode);
+    }
+  } else {
+    stream_body(mode, std::move(handler), bytes_transferred == 0);
+  }
+}
+
+void http_service::on_stream_body_write(http_parser::message_mode mode, callback_t handler, bool done,
+                                        const boost::system::error_code& error, std::size_t bytes_transferred) {
+  if (error != boost::system::errc::success) {
+    flow_.error.set_boost_error(error);
+    on_stream_body_error(mode);
+  } else if (done) {
+    handler();
+  } else {
+    // Parse anything that arrived while writing before reading again.
+    stream_body(mode, std::move(handler));
+  }
+}
+
+void http_service::on_stream_body_error(http_parser::message_mode mode) {
+  if (mode == http_parser::message_mode::request) {
+    // Nothing has been sent to the client yet, so it can still be told what happened.
+    if (flow_.error.boost_error() == boost::asio::error::operation_aborted) {
+      send_error_response(status::request_timeout, flow_.error.message());
+    } else if (flow_.error.has_proxy_error()) {
+      send_error_response(status::bad_request, flow_.error.message());
+    } else {
+      send_error_response(status::bad_gateway, flow_.error.message());
+    }
+  } else {
+    // The response head has already been sent, so the only option is to cut the response short.
+    interceptors_.http.run(intercept::http_event::error, flow_, exchange_);
+    stop();
+  }
+}
+
 void http_service::send_connect_response() {
   flow_.client << exchange_.response();
   flow_.client.write_async(std::bind_front(&http_service::on_send_connect_response, this));
@@ -423,6 +835,8 @@ void http_service::on_send_connect_response(const boost::system::error_code& err
 }
 
 void http_service::send_error_response(status response_status, std::string_view msg) {
+  finish_collapsed_request(nullptr);
+
   response& res = exchange_.make_response();
   res.set_status(response_status);
 
@@ -441,9 +855,9 @@ void http_service::send_error_response(status response_status, std::string_view
   content << "</body></html>";
   res.set_body(content.str());
 
-  res.add_header("Server", constants::full_server_name.data());
-  res.add_header("Connection", "close");
-  res.add_header("Content-Type", "text/html");
+  res.add_header(header_id::server, constants::full_server_name.data());
+  res.add_header(header_id::connection, "close");
+  res.add_header(header_id::content_type, "text/html");
   res.set_content_length();
 
   flow_.client << res;
@@ -8,12 +8,20 @@
 #pragma once
 
 #include <boost/asio.hpp>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
 #include <string_view>
 
 #include "aether/proxy/base_service.hpp"
 #include "aether/proxy/connection/connection_flow.hpp"
+#include "aether/proxy/http/cache/response_cache.hpp"
 #include "aether/proxy/http/exchange.hpp"
 #include "aether/proxy/http/http1/http_parser.hpp"
+#include "aether/proxy/http/http2/client_session.hpp"
+#include "aether/proxy/tls/openssl/ssl_context.hpp"
 #include "aether/proxy/types.hpp"
 
 namespace proxy::http::http1 {
@@ -22,6 +30,7 @@ namespace proxy::http::http1 {
 class http_service : public base_service {
  public:
   http_service(connection::connection_flow& flow, connection_handler& owner, server_components& components);
+  ~http_service() override;
   void start() override;
   inline http::exchange& exchange() { return exchange_; }
 
@@ -29,6 +38,7 @@ class http_service : public base_service {
   // Methods are quite split up because socket operations are asynchronous.
 
   void read_request_head();
+  result<void> read_request_head_impl();
   void on_read_request_head(const boost::system::error_code& error, std::size_t bytes_transferred);
   void read_request_body(callback_t handler);
   result<void> read_request_body_impl(callback_t handler);
@@ -37,19 +47,67 @@ class http_service : public base_service {
   result<void> handle_request_impl();
   void connect_server();
   void on_connect_server(const boost::system::error_code& error);
+  void on_secure_server(const boost::system::error_code& error);
   void forward_request();
   void on_forward_request(const boost::system::error_code& error, std::size_t bytes_transferred);
   void read_response_head();
+  void parse_response_head();
+  result<void> parse_response_head_impl();
   void on_read_response_head(const boost::system::error_code& error, std::size_t bytes_transferred);
-  result<void> on_read_response_head_impl(const boost::system::error_code& error, std::size_t bytes_transferred);
   void read_response_body(callback_t handler, bool eof = false);
   result<void> read_response_body_impl(callback_t handler, bool eof = false);
   void on_read_response_body(callback_t handler, const boost::system::error_code& error, std::size_t bytes_transferred);
+  void handle_server_response();
   void modify_response();
   void forward_response();
   void on_forward_response(const boost::system::error_code& error, std::size_t bytes_transferred);
+  void forward_response_head();
+  void on_forward_response_head(const boost::system::error_code& error, std::size_t bytes_transferred);
   void handle_response();
 
+  // Checks if the body of the message for the given mode should be streamed rather than buffered.
+  //
+  // Runs the head interceptors, which may ask for the body to be buffered.
+  result<bool> should_stream_body(http_parser::message_mode mode);
+
+  // Streams a message body from its source connection to its destination connection, piece by piece.
+  //
+  // The handler is called once the whole body has been written.
+  void stream_body(http_parser::message_mode mode, callback_t handler, bool eof = false);
+  result<void> stream_body_impl(http_parser::message_mode mode, callback_t handler, bool eof);
+  void on_stream_body_read(http_parser::message_mode mode, callback_t handler, const boost::system::error_code& error,
+                           std::size_t bytes_transferred);
+  void on_stream_body_write(http_parser::message_mode mode, callback_t handler, bool done,
+                            const boost::system::error_code& error, std::size_t bytes_transferred);
+  void on_stream_body_error(http_parser::message_mode mode);
+  void on_stream_request_body();
+  void on_stream_response_body();
+
+  // Checks if a request that failed on the server connection should be sent again on a new connection.
+  bool should_retry_request(const boost::system::error_code& error) const;
+  void retry_request();
+
+  // Checks if the request can be sent as a stream of a shared HTTP/2 session instead of on the flow's own server
+  // connection.
+  bool should_use_upstream_session() const;
+  void send_request_on_session();
+  void on_session_response(result<response> res);
+
+  // Answers the request from the response cache if possible.
+  //
+  // Returns if the request was answered, which may be with an error if the client only accepts cached responses.
+  bool serve_from_cache();
+
+  // Waits for an identical request already sent to the server, if there is one.
+  //
+  // Returns if the request is waiting, in which case it is answered with the other request's response or sent to the
+  // server once that response is known not to be shareable.
+  bool join_collapsed_request(std::string key);
+  void on_collapsed_response(std::optional<response> res);
+
+  // Ends the request other requests may be waiting on, sharing the response if one was received in full.
+  void finish_collapsed_request(const response* res);
+
   void send_connect_response();
   void on_send_connect_response(const boost::system::error_code& error, std::size_t bytes_transferred);
 
@@ -72,6 +130,39 @@ class http_service : public base_service {
 
   http::exchange exchange_;
   http_parser parser_;
+
+  // The request head has been handled, but its streamed body has not yet been forwarded.
+  bool request_body_pending_ = false;
+
+  // The response head has been handled, but its streamed body has not yet been forwarded.
+  bool response_body_pending_ = false;
+
+  // The streamed response body ends with the server's connection, so the client must be closed to end it too.
+  bool close_after_response_ = false;
+
+  // The request has already been sent again after a reused server connection turned out to be closed.
+  bool retried_ = false;
+
+  // The shared HTTP/2 session the request is waiting on, if any.
+  std::shared_ptr<http2::client_session> upstream_session_;
+  std::uint64_t upstream_request_id_ = 0;
+
+  // Settings for securing the server connection again after it was handed to the pool.
+  tls::openssl::ssl_context_args server_tls_args_;
+
+  // The cached response being revalidated with the server, if any.
+  std::optional<cache::stale_response> cache_stale_;
+
+  // When the request was sent to the server, which is needed to calculate the age of its response.
+  cache::clock::time_point request_time_;
+
+  // When the request was sent to the server, on a clock that is only used for measuring latency.
+  std::chrono::steady_clock::time_point upstream_start_;
+
+  // Key of the collapsed request the service leads or waits on, if any.
+  std::optional<std::string> collapse_key_;
+  bool collapse_leader_ = false;
+  std::uint64_t collapse_waiter_id_ = 0;
 };
 
 }  // namespace proxy::http::http1
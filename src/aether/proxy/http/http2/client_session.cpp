@@ -0,0 +1,819 @@
+/*********************************************
+
+  Copyright (c) Jackson Nestelroad 2020
+  jackson.nestelroad.com
+
+*********************************************/
+
+#include "client_session.hpp"
+
+#include <algorithm>
+#include <boost/asio.hpp>
+#include <charconv>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "aether/proxy/error/error.hpp"
+#include "aether/proxy/server_components.hpp"
+#include "aether/proxy/tls/tls_service.hpp"
+#include "aether/util/result_macros.hpp"
+#include "aether/util/string.hpp"
+
+namespace proxy::http::http2 {
+
+namespace {
+
+// Picks the HTTP/2 error code sent in GOAWAY for an error that ends the connection.
+error_code to_http2_error(const error::error_state& error) {
+  if (error.proxy_error() == errc::http2_frame_size_error) {
+    return error_code::frame_size_error;
+  } else if (error.proxy_error() == errc::http2_flow_control_error) {
+    return error_code::flow_control_error;
+  } else if (error.proxy_error() == errc::hpack_decoding_error) {
+    return error_code::compression_error;
+  }
+  return error_code::protocol_error;
+}
+
+error::error_state from_boost_error(const boost::system::error_code& error) {
+  error::error_state state;
+  state.set_boost_error(error);
+  return state;
+}
+
+}  // namespace
+
+client_session::client_session(boost::asio::io_context& ioc, server_components& components, std::string key,
+                               std::string host, port_t port)
+    : ioc_(ioc),
+      components_(components),
+      key_(std::move(key)),
+      host_(std::move(host)),
+      port_(port),
+      server_(ioc, components),
+      decoder_(),
+      encoder_(),
+      timer_(ioc) {}
+
+void client_session::start() {
+  tls_args_ = tls::tls_service::make_server_context_args(components_.options, components_.client_store());
+  tls_args_.alpn_protos = {"h2", std::string(tls::tls_service::default_alpn)};
+
+  server_.connect_async(host_, port_, [self = shared_from_this()](const boost::system::error_code& error) {
+    self->on_connect(error);
+  });
+}
+
+void client_session::on_connect(const boost::system::error_code& error) {
+  if (state_ == state::closed) {
+    return;
+  }
+  if (error != boost::system::errc::success) {
+    close(from_boost_error(error));
+    return;
+  }
+  if (result<void> res = server_.establish_tls_async(
+          tls_args_,
+          [self = shared_from_this()](const boost::system::error_code& error) { self->on_establish_tls(error); });
+      !res.is_ok()) {
+    close(std::move(res).err());
+  }
+}
+
+void client_session::on_establish_tls(const boost::system::error_code& error) {
+  if (state_ == state::closed) {
+    return;
+  }
+  if (error != boost::system::errc::success) {
+    close(from_boost_error(error));
+    return;
+  }
+  if (server_.alpn() != "h2") {
+    // Requests for this server go back to connections of their own for a while.
+    components_.http2_sessions.mark_unsupported(ioc_, key_);
+    close(error::http::http2_not_negotiated());
+    return;
+  }
+
+  // The session outlives any single request, so it is timed by its own timer instead.
+  server_.set_mode(connection::base_connection::io_mode::no_timeout);
+  state_ = state::ready;
+
+  send_buffer_.append(connection_preface);
+  write_settings(send_buffer_,
+                 {
+                     {setting_id::enable_push, 0},
+                     {setting_id::initial_window_size, local_stream_window_size},
+                     {setting_id::max_header_list_size,
+                      static_cast<std::uint32_t>(
+                          std::min<std::size_t>(components_.options.header_size_limit, max_window_size))},
+                 });
+  write_window_update(send_buffer_, 0, local_connection_window_size - default_initial_window_size);
+
+  open_streams();
+  read_frames();
+}
+
+std::uint64_t client_session::send_request(const request& req, response_handler_t handler) {
+  std::uint64_t request_id = next_request_id_++;
+  if (!usable()) {
+    fail_later(request_id, std::move(handler), error::http::http2_stream_refused());
+    return request_id;
+  }
+  waiting_.push_back({request_id, req, std::move(handler)});
+  if (state_ == state::ready) {
+    open_streams();
+  }
+  return request_id;
+}
+
+void client_session::cancel(std::uint64_t request_id) {
+  if (failing_.erase(request_id) > 0) {
+    return;
+  }
+  if (auto it = std::find_if(waiting_.begin(), waiting_.end(),
+                             [request_id](const waiting_request& waiting) { return waiting.id == request_id; });
+      it != waiting_.end()) {
+    waiting_.erase(it);
+    return;
+  }
+
+  auto it = std::find_if(streams_.begin(), streams_.end(),
+                         [request_id](const auto& entry) { return entry.second.request_id == request_id; });
+  if (it == streams_.end()) {
+    return;
+  }
+  if (state_ != state::closed) {
+    write_rst_stream(send_buffer_, it->first, error_code::cancel);
+  }
+  streams_.erase(it);
+  on_stream_closed();
+  flush();
+}
+
+void client_session::fail_later(std::uint64_t request_id, response_handler_t handler, error::error_state error) {
+  failing_.emplace(request_id, std::move(handler));
+  boost::asio::post(ioc_, [self = shared_from_this(), request_id, error = std::move(error)]() {
+    // The request may have been canceled in the meantime.
+    if (auto node = self->failing_.extract(request_id); !node.empty()) {
+      node.mapped()(error);
+    }
+  });
+}
+
+void client_session::open_streams() {
+  while (state_ == state::ready && !waiting_.empty() && streams_.size() < peer_max_concurrent_streams_) {
+    if (next_stream_id_ > max_stream_id) {
+      // Stream identifiers cannot be reused, so the session has to be replaced.
+      drain();
+      break;
+    }
+    waiting_request waiting = std::move(waiting_.front());
+    waiting_.pop_front();
+    open_stream(std::move(waiting));
+  }
+  send_data();
+  flush();
+  update_timer();
+}
+
+void client_session::open_stream(waiting_request waiting) {
+  const request& req = waiting.req;
+  result<std::string_view> method_name = method_to_string(req.method());
+  if (!method_name.is_ok()) {
+    fail_later(waiting.id, std::move(waiting.handler), std::move(method_name).err());
+    return;
+  }
+
+  std::uint32_t stream_id = next_stream_id_;
+  next_stream_id_ += 2;
+
+  std::string authority;
+  if (std::optional<std::string_view> host = req.get_optional_header(header_id::host); host.has_value()) {
+    authority = std::string(host.value());
+  } else {
+    authority = req.target().netloc.to_host_string();
+  }
+  std::string path = req.target().full_path();
+  if (path.empty()) {
+    path = "/";
+  }
+
+  std::string block;
+  encoder_.begin_block(block);
+  encoder_.encode(":method", method_name.ok(), block);
+  encoder_.encode(":scheme", "https", block);
+  encoder_.encode(":authority", authority, block);
+  encoder_.encode(":path", path, block);
+  for (const header_collection::entry& header : req.all_headers()) {
+    std::string name = util::string::lowercase(header.name());
+    if (name == "host" || std::find(connection_specific_headers.begin(), connection_specific_headers.end(), name) !=
+                              connection_specific_headers.end()) {
+      continue;
+    }
+    if (name == "te" && header.value() != "trailers") {
+      continue;
+    }
+    encoder_.encode(name, header.value(), block,
+                    header.id() == header_id::authorization || header.id() == header_id::proxy_authorization);
+  }
+
+  std::string_view body = req.body();
+  write_headers(send_buffer_, stream_id, block, body.empty(), peer_max_frame_size_);
+
+  stream& s = streams_[stream_id];
+  s.request_id = waiting.id;
+  s.id = stream_id;
+  s.head_request = req.method() == method::HEAD;
+  s.handler = std::move(waiting.handler);
+  s.send_window = peer_initial_window_size_;
+  if (!body.empty()) {
+    s.pending_data = std::string(body);
+    queue_data(s);
+  }
+}
+
+void client_session::read_frames() {
+  if (result<void> res = read_frames_impl(); !res.is_ok()) {
+    connection_error(std::move(res).err());
+  }
+}
+
+result<void> client_session::read_frames_impl() {
+  streambuf& input = server_.input_buffer();
+
+  // Frames are handled straight out of the input buffer, and each one is consumed once it is handled.
+  while (state_ != state::closed && input.size() >= frame_header_size) {
+    std::string_view data = input.string_view();
+    frame_header header = parse_frame_header(data.data());
+    if (header.length > default_max_frame_size) {
+      return error::http::http2_frame_size_error("Frame is larger than the maximum frame size");
+    }
+    if (data.size() < frame_header_size + header.length) {
+      break;
+    }
+    RETURN_IF_ERROR(handle_frame(header, data.substr(frame_header_size, header.length)));
+    input.consume(frame_header_size + header.length);
+  }
+
+  if (state_ != state::closed) {
+    flush();
+    update_timer();
+    server_.read_async(std::bind_front(&client_session::on_read_frames, shared_from_this()));
+  }
+  return util::ok;
+}
+
+void client_session::on_read_frames(const boost::system::error_code& error, std::size_t bytes_transferred) {
+  if (state_ == state::closed) {
+    return;
+  }
+  if (error != boost::system::errc::success) {
+    // The server closed the connection, which ends all of its streams.
+    close(from_boost_error(error));
+  } else {
+    read_frames();
+  }
+}
+
+result<void> client_session::handle_frame(const frame_header& header, std::string_view payload) {
+  // A header block must arrive in one piece, with no other frames in between.
+  if (continuation_stream_id_ != 0 && header.type != frame_type::continuation) {
+    return error::http::http2_protocol_error("Expected CONTINUATION frame");
+  }
+
+  switch (header.type) {
+    case frame_type::data:
+      return handle_data(header, payload);
+    case frame_type::headers:
+      return handle_headers(header, payload);
+    case frame_type::continuation:
+      return handle_continuation(header, payload);
+    case frame_type::rst_stream:
+      return handle_rst_stream(header, payload);
+    case frame_type::settings:
+      return handle_settings(header, payload);
+    case frame_type::ping:
+      return handle_ping(header, payload);
+    case frame_type::goaway:
+      return handle_goaway(header, payload);
+    case frame_type::window_update:
+      return handle_window_update(header, payload);
+    case frame_type::push_promise:
+      return error::http::http2_protocol_error("Server push was disabled");
+    default:
+      // PRIORITY frames are only advisory, and frames of unknown types must be ignored.
+      return util::ok;
+  }
+}
+
+result<void> client_session::handle_data(const frame_header& header, std::string_view payload) {
+  if (header.stream_id == 0) {
+    return error::http::http2_protocol_error("DATA frame on stream 0");
+  }
+  if (header.stream_id >= next_stream_id_) {
+    return error::http::http2_protocol_error("DATA frame on an idle stream");
+  }
+  ASSIGN_OR_RETURN(std::string_view data, remove_padding(header, payload));
+
+  // The whole frame counts against the connection window, which is given back right away.
+  if (header.length > 0) {
+    write_window_update(send_buffer_, 0, header.length);
+  }
+
+  auto it = streams_.find(header.stream_id);
+  if (it == streams_.end()) {
+    // Frames that were in flight when the stream was reset are ignored.
+    return util::ok;
+  }
+  stream& s = it->second;
+  if (!s.response_started) {
+    fail_stream(s.id, error::http::http2_protocol_error("DATA frame before response headers"),
+                error_code::protocol_error);
+    return util::ok;
+  }
+  if (s.body.size() + data.size() > components_.options.body_size_limit) {
+    fail_stream(s.id, error::http::body_size_too_large(), error_code::cancel);
+    return util::ok;
+  }
+  s.body.append(data);
+
+  if (header.has_flag(frame_flags::end_stream)) {
+    complete_stream(s.id);
+  } else if (header.length > 0) {
+    write_window_update(send_buffer_, s.id, header.length);
+  }
+  return util::ok;
+}
+
+result<void> client_session::handle_headers(const frame_header& header, std::string_view payload) {
+  if (header.stream_id == 0) {
+    return error::http::http2_protocol_error("HEADERS frame on stream 0");
+  }
+  ASSIGN_OR_RETURN(std::string_view fragment, remove_padding(header, payload));
+  if (header.has_flag(frame_flags::priority)) {
+    if (fragment.size() < 5) {
+      return error::http::http2_frame_size_error("HEADERS frame is too short for its priority");
+    }
+    fragment.remove_prefix(5);
+  }
+
+  header_block_.assign(fragment);
+  continuation_end_stream_ = header.has_flag(frame_flags::end_stream);
+  if (header.has_flag(frame_flags::end_headers)) {
+    return handle_header_block(header.stream_id, continuation_end_stream_);
+  }
+  continuation_stream_id_ = header.stream_id;
+  return util::ok;
+}
+
+result<void> client_session::handle_continuation(const frame_header& header, std::string_view payload) {
+  if (continuation_stream_id_ == 0 || header.stream_id != continuation_stream_id_) {
+    return error::http::http2_protocol_error("Unexpected CONTINUATION frame");
+  }
+  header_block_.append(payload);
+  if (header_block_.size() > components_.options.header_size_limit) {
+    return error::http::header_size_too_large();
+  }
+  if (header.has_flag(frame_flags::end_headers)) {
+    std::uint32_t stream_id = std::exchange(continuation_stream_id_, 0);
+    return handle_header_block(stream_id, continuation_end_stream_);
+  }
+  return util::ok;
+}
+
+result<void> client_session::handle_header_block(std::uint32_t stream_id, bool end_stream) {
+  // Every block is decoded, even for streams that were canceled, to keep the compression state in sync.
+  result<std::vector<hpack::header_field>> decoded =
+      decoder_.decode(header_block_, components_.options.header_size_limit);
+  header_block_.clear();
+  std::vector<hpack::header_field> fields;
+  bool too_large = false;
+  if (decoded.is_ok()) {
+    fields = std::move(decoded).ok();
+  } else if (decoded.err().proxy_error() == errc::header_size_too_large) {
+    too_large = true;
+  } else {
+    return std::move(decoded).err();
+  }
+
+  auto it = streams_.find(stream_id);
+  if (it == streams_.end()) {
+    return util::ok;
+  }
+  stream& s = it->second;
+  if (too_large) {
+    fail_stream(s.id, error::http::header_size_too_large(), error_code::cancel);
+    return util::ok;
+  }
+
+  if (s.response_started) {
+    // A second header block carries trailers, which end the response.
+    //
+    // Trailers are not passed on, because the response is handed back with a known length.
+    if (!end_stream) {
+      fail_stream(s.id, error::http::http2_protocol_error("Trailers must end the stream"), error_code::protocol_error);
+    } else {
+      complete_stream(s.id);
+    }
+    return util::ok;
+  }
+
+  std::optional<int> code;
+  for (const hpack::header_field& field : fields) {
+    if (field.name == ":status") {
+      int value = 0;
+      auto [end, error] = std::from_chars(field.value.data(), field.value.data() + field.value.size(), value);
+      if (error == std::errc() && end == field.value.data() + field.value.size()) {
+        code = value;
+      }
+    } else if (!field.name.empty() && field.name.front() == ':') {
+      fail_stream(s.id, error::http::invalid_header(out::string::stream("Unknown pseudo-header ", field.name)),
+                  error_code::protocol_error);
+      return util::ok;
+    }
+  }
+  if (!code.has_value() || code.value() < 100 || code.value() > 999) {
+    fail_stream(s.id, error::http::invalid_status("Missing or invalid :status pseudo-header"),
+                error_code::protocol_error);
+    return util::ok;
+  }
+  if (code.value() < 200) {
+    // Interim responses are not passed on, because the whole request has already been sent.
+    if (end_stream) {
+      fail_stream(s.id, error::http::http2_protocol_error("Interim response ended the stream"),
+                  error_code::protocol_error);
+    }
+    return util::ok;
+  }
+
+  s.res.set_status(static_cast<status>(code.value()));
+  for (const hpack::header_field& field : fields) {
+    if (field.name.empty() || field.name.front() != ':') {
+      s.res.add_header(field.name, field.value);
+    }
+  }
+  s.response_started = true;
+  if (end_stream) {
+    complete_stream(s.id);
+  }
+  return util::ok;
+}
+
+void client_session::complete_stream(std::uint32_t stream_id) {
+  auto node = streams_.extract(stream_id);
+  if (node.empty()) {
+    return;
+  }
+  stream& s = node.mapped();
+  response& res = s.res;
+
+  // The response is handed back as if it came over HTTP/1.1, with its length known up front.
+  res.set_version(version::http1_1);
+  bool has_body = !s.head_request && res.status() != status::no_content && res.status() != status::not_modified;
+  res.set_body(std::move(s.body));
+  if (has_body) {
+    res.remove_header(header_id::content_length);
+    res.set_content_length();
+  }
+
+  on_stream_closed();
+  flush();
+  s.handler(std::move(res));
+}
+
+void client_session::fail_stream(std::uint32_t stream_id, const error::error_state& error,
+                                 std::optional<error_code> reset) {
+  auto node = streams_.extract(stream_id);
+  if (node.empty()) {
+    return;
+  }
+  if (reset.has_value() && state_ != state::closed) {
+    write_rst_stream(send_buffer_, stream_id, reset.value());
+  }
+  on_stream_closed();
+  flush();
+  node.mapped().handler(error);
+}
+
+void client_session::on_stream_closed() {
+  if (state_ == state::draining && streams_.empty()) {
+    go_away();
+  } else if (state_ == state::ready) {
+    open_streams();
+  } else {
+    update_timer();
+  }
+}
+
+result<void> client_session::handle_rst_stream(const frame_header& header, std::string_view payload) {
+  if (header.stream_id == 0 || header.stream_id >= next_stream_id_) {
+    return error::http::http2_protocol_error("RST_STREAM frame on an idle stream");
+  }
+  if (payload.size() != 4) {
+    return error::http::http2_frame_size_error("RST_STREAM frame must be 4 bytes");
+  }
+  auto code = static_cast<error_code>(read_uint(payload.data(), 4));
+  if (code == error_code::refused_stream) {
+    // The server did not process the request at all, so it is safe to send it again.
+    fail_stream(header.stream_id, error::http::http2_stream_refused());
+  } else {
+    fail_stream(header.stream_id,
+                error::http::http2_stream_reset(
+                    out::string::stream("Server reset the stream with error code ", static_cast<std::uint32_t>(code))));
+  }
+  return util::ok;
+}
+
+result<void> client_session::handle_settings(const frame_header& header, std::string_view payload) {
+  if (header.stream_id != 0) {
+    return error::http::http2_protocol_error("SETTINGS frame on a stream");
+  }
+  if (header.has_flag(frame_flags::ack)) {
+    if (!payload.empty()) {
+      return error::http::http2_frame_size_error("SETTINGS acknowledgement must be empty");
+    }
+    return util::ok;
+  }
+  if (payload.size() % 6 != 0) {
+    return error::http::http2_frame_size_error("SETTINGS frame length must be a multiple of 6");
+  }
+
+  for (std::size_t offset = 0; offset < payload.size(); offset += 6) {
+    auto setting = static_cast<setting_id>(read_uint(payload.data() + offset, 2));
+    std::uint32_t value = read_uint(payload.data() + offset + 2, 4);
+    switch (setting) {
+      case setting_id::header_table_size:
+        encoder_.set_max_table_size(value);
+        break;
+      case setting_id::enable_push:
+        return error::http::http2_protocol_error("Servers cannot send SETTINGS_ENABLE_PUSH");
+      case setting_id::max_concurrent_streams:
+        peer_max_concurrent_streams_ = value;
+        break;
+      case setting_id::initial_window_size: {
+        if (value > max_window_size) {
+          return error::http::http2_flow_control_error("SETTINGS_INITIAL_WINDOW_SIZE is too large");
+        }
+        // The change applies to every open stream.
+        std::int64_t delta = static_cast<std::int64_t>(value) - static_cast<std::int64_t>(peer_initial_window_size_);
+        peer_initial_window_size_ = value;
+        for (auto& [stream_id, s] : streams_) {
+          s.send_window += delta;
+          if (s.send_window > max_window_size) {
+            return error::http::http2_flow_control_error("Stream window is too large");
+          }
+          queue_data(s);
+        }
+        break;
+      }
+      case setting_id::max_frame_size:
+        if (value < default_max_frame_size || value > max_allowed_frame_size) {
+          return error::http::http2_protocol_error("SETTINGS_MAX_FRAME_SIZE is out of range");
+        }
+        peer_max_frame_size_ = value;
+        break;
+      default:
+        // Unknown settings must be ignored.
+        break;
+    }
+  }
+
+  write_settings_ack(send_buffer_);
+  // The server may allow more streams than were assumed.
+  if (state_ == state::ready) {
+    open_streams();
+  }
+  return util::ok;
+}
+
+result<void> client_session::handle_ping(const frame_header& header, std::string_view payload) {
+  if (header.stream_id != 0) {
+    return error::http::http2_protocol_error("PING frame on a stream");
+  }
+  if (payload.size() != 8) {
+    return error::http::http2_frame_size_error("PING frame must be 8 bytes");
+  }
+  if (!header.has_flag(frame_flags::ack)) {
+    write_ping_ack(send_buffer_, payload);
+  }
+  return util::ok;
+}
+
+result<void> client_session::handle_goaway(const frame_header& header, std::string_view payload) {
+  if (header.stream_id != 0) {
+    return error::http::http2_protocol_error("GOAWAY frame on a stream");
+  }
+  if (payload.size() < 8) {
+    return error::http::http2_frame_size_error("GOAWAY frame is too short");
+  }
+  std::uint32_t last_stream_id = read_uint(payload.data(), 4) & 0x7fffffff;
+
+  // Streams after the last one the server processed were never seen, so their requests can be sent again.
+  std::vector<std::uint32_t> refused;
+  for (const auto& [stream_id, s] : streams_) {
+    if (stream_id > last_stream_id) {
+      refused.push_back(stream_id);
+    }
+  }
+  drain();
+  for (std::uint32_t stream_id : refused) {
+    fail_stream(stream_id, error::http::http2_stream_refused());
+  }
+  if (streams_.empty()) {
+    go_away();
+  }
+  return util::ok;
+}
+
+result<void> client_session::handle_window_update(const frame_header& header, std::string_view payload) {
+  if (payload.size() != 4) {
+    return error::http::http2_frame_size_error("WINDOW_UPDATE frame must be 4 bytes");
+  }
+  std::uint32_t increment = read_uint(payload.data(), 4) & 0x7fffffff;
+
+  if (header.stream_id == 0) {
+    if (increment == 0) {
+      return error::http::http2_protocol_error("WINDOW_UPDATE frame with no increment");
+    }
+    connection_send_window_ += increment;
+    if (connection_send_window_ > max_window_size) {
+      return error::http::http2_flow_control_error("Connection window is too large");
+    }
+    send_data();
+    return util::ok;
+  }
+
+  auto it = streams_.find(header.stream_id);
+  if (it == streams_.end()) {
+    return util::ok;
+  }
+  stream& s = it->second;
+  if (increment == 0) {
+    fail_stream(s.id, error::http::http2_protocol_error("WINDOW_UPDATE frame with no increment"),
+                error_code::protocol_error);
+    return util::ok;
+  }
+  s.send_window += increment;
+  if (s.send_window > max_window_size) {
+    fail_stream(s.id, error::http::http2_flow_control_error("Stream window is too large"),
+                error_code::flow_control_error);
+    return util::ok;
+  }
+  queue_data(s);
+  send_data();
+  return util::ok;
+}
+
+void client_session::queue_data(stream& s) {
+  if (!s.queued && s.pending_offset < s.pending_data.size()) {
+    s.queued = true;
+    send_queue_.push_back(s.id);
+  }
+}
+
+void client_session::send_data() {
+  // Streams take turns sending one frame at a time, so one large request cannot hold up the others.
+  while (!send_queue_.empty() && connection_send_window_ > 0 && send_buffer_.size() < max_send_buffer_size) {
+    std::uint32_t stream_id = send_queue_.front();
+    send_queue_.pop_front();
+    auto it = streams_.find(stream_id);
+    if (it == streams_.end()) {
+      continue;
+    }
+    stream& s = it->second;
+    s.queued = false;
+    if (s.send_window <= 0) {
+      // Queued again by the server's next WINDOW_UPDATE for the stream.
+      continue;
+    }
+
+    std::int64_t remaining = static_cast<std::int64_t>(s.pending_data.size() - s.pending_offset);
+    std::int64_t size = std::min<std::int64_t>(
+        {remaining, s.send_window, connection_send_window_, static_cast<std::int64_t>(peer_max_frame_size_)});
+    bool end_stream = size == remaining;
+    write_data(send_buffer_, s.id,
+               std::string_view(s.pending_data).substr(s.pending_offset, static_cast<std::size_t>(size)), end_stream);
+    s.pending_offset += static_cast<std::size_t>(size);
+    s.send_window -= size;
+    connection_send_window_ -= size;
+
+    if (end_stream) {
+      // The request body is no longer needed while waiting for the response.
+      s.pending_data = std::string();
+      s.pending_offset = 0;
+    } else {
+      queue_data(s);
+    }
+  }
+}
+
+void client_session::drain() {
+  if (state_ != state::connecting && state_ != state::ready) {
+    return;
+  }
+  state_ = state::draining;
+  components_.http2_sessions.remove(ioc_, *this);
+
+  std::deque<waiting_request> waiting = std::move(waiting_);
+  waiting_.clear();
+  for (waiting_request& request : waiting) {
+    fail_later(request.id, std::move(request.handler), error::http::http2_stream_refused());
+  }
+}
+
+void client_session::connection_error(const error::error_state& error) {
+  if (state_ == state::closed) {
+    return;
+  }
+  write_goaway(send_buffer_, 0, to_http2_error(error));
+  flush();
+  close(error);
+}
+
+void client_session::go_away() {
+  if (state_ == state::closed) {
+    return;
+  }
+  write_goaway(send_buffer_, 0, error_code::no_error);
+  flush();
+  close(error::http::http2_stream_refused());
+}
+
+void client_session::close(const error::error_state& error) {
+  if (state_ == state::closed) {
+    return;
+  }
+  state_ = state::closed;
+  components_.http2_sessions.remove(ioc_, *this);
+  timer_.cancel();
+
+  // Handlers may send requests again, which go to a new session now that this one is closed.
+  std::deque<waiting_request> waiting = std::move(waiting_);
+  waiting_.clear();
+  std::unordered_map<std::uint32_t, stream> streams = std::move(streams_);
+  streams_.clear();
+  send_queue_.clear();
+
+  // A write in progress closes the connection once it finishes, so a final GOAWAY still reaches the server.
+  if (!writing_) {
+    server_.disconnect();
+  }
+
+  for (waiting_request& request : waiting) {
+    request.handler(error);
+  }
+  for (auto& [stream_id, s] : streams) {
+    s.handler(error);
+  }
+}
+
+void client_session::flush() {
+  if (writing_ || send_buffer_.empty()) {
+    return;
+  }
+  server_ << send_buffer_;
+  send_buffer_.clear();
+  writing_ = true;
+  server_.write_untimed_async(std::bind_front(&client_session::on_flush, shared_from_this()));
+}
+
+void client_session::on_flush(const boost::system::error_code& error, std::size_t bytes_transferred) {
+  writing_ = false;
+  if (state_ == state::closed) {
+    server_.disconnect();
+  } else if (error != boost::system::errc::success) {
+    close(from_boost_error(error));
+  } else {
+    // Flow control may have held back data that fits now that the buffer is empty.
+    send_data();
+    flush();
+  }
+}
+
+void client_session::update_timer() {
+  if (state_ == state::closed) {
+    return;
+  }
+  timer_.expires_from_now(streams_.empty() && waiting_.empty() ? components_.options.upstream_idle_timeout
+                                                               : components_.options.timeout);
+  timer_.async_wait(std::bind_front(&client_session::on_timeout, shared_from_this()));
+}
+
+void client_session::on_timeout(const boost::system::error_code& error) {
+  if (error == boost::asio::error::operation_aborted || state_ == state::closed) {
+    return;
+  }
+  if (streams_.empty() && waiting_.empty()) {
+    go_away();
+  } else {
+    // Timeouts are reported the same way as timeouts of ordinary server connections.
+    close(from_boost_error(boost::asio::error::operation_aborted));
+  }
+}
+
+}  // namespace proxy::http::http2
@@ -0,0 +1,234 @@
+/*********************************************
+
+  Copyright (c) Jackson Nestelroad 2020
+  jackson.nestelroad.com
+
+*********************************************/
+
+#pragma once
+
+#include <boost/asio.hpp>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+#include "aether/proxy/connection/server_connection.hpp"
+#include "aether/proxy/error/error.hpp"
+#include "aether/proxy/http/http2/frame.hpp"
+#include "aether/proxy/http/http2/hpack.hpp"
+#include "aether/proxy/http/message/request.hpp"
+#include "aether/proxy/http/message/response.hpp"
+#include "aether/proxy/tls/openssl/ssl_context.hpp"
+#include "aether/proxy/types.hpp"
+#include "aether/util/any_invocable.hpp"
+
+namespace proxy {
+class server_components;
+}
+
+namespace proxy::http::http2 {
+
+// A single HTTP/2 connection to a server that carries requests from many flows at once.
+//
+// Sessions are shared through the session pool, so a session is only ever used on the io_context it was created on.
+// Requests are queued until the connection is ready and a stream is free, and each response is read in full before it
+// is handed back, so callers see an ordinary HTTP/1.1 response.
+class client_session : public std::enable_shared_from_this<client_session> {
+ public:
+  using response_handler_t = util::any_invocable<void(result<response>)>;
+
+  client_session(boost::asio::io_context& ioc, server_components& components, std::string key, std::string host,
+                 port_t port);
+  client_session() = delete;
+  ~client_session() = default;
+  client_session(const client_session& other) = delete;
+  client_session& operator=(const client_session& other) = delete;
+  client_session(client_session&& other) noexcept = delete;
+  client_session& operator=(client_session&& other) noexcept = delete;
+
+  // Connects to the server and negotiates HTTP/2.
+  void start();
+
+  // Sends a request on its own stream, calling the handler once the whole response has been received.
+  //
+  // The handler is never called before this method returns. Returns an identifier for canceling the request.
+  std::uint64_t send_request(const request& req, response_handler_t handler);
+
+  // Cancels a request, so its handler is never called.
+  void cancel(std::uint64_t request_id);
+
+  // Checks if the session accepts new requests.
+  inline bool usable() const { return state_ == state::connecting || state_ == state::ready; }
+
+  inline std::string_view key() const { return key_; }
+
+ private:
+  enum class state {
+    connecting,
+    ready,
+    // The server sent GOAWAY or stream identifiers ran out, so only open streams are finished.
+    draining,
+    closed,
+  };
+
+  struct waiting_request {
+    std::uint64_t id;
+    request req;
+    response_handler_t handler;
+  };
+
+  // State of a single stream, which carries one request and its response.
+  struct stream {
+    std::uint64_t request_id = 0;
+    std::uint32_t id = 0;
+    bool head_request = false;
+    response_handler_t handler;
+
+    response res;
+    std::string body;
+
+    // The response head has been received, so only the body and trailers are left.
+    bool response_started = false;
+
+    // The request body still to be sent in DATA frames.
+    std::string pending_data;
+    std::size_t pending_offset = 0;
+
+    // The stream is waiting in the send queue.
+    bool queued = false;
+
+    // How many more bytes the server allows to be sent on the stream.
+    std::int64_t send_window = 0;
+  };
+
+  // Methods are quite split up because socket operations are asynchronous.
+
+  void on_connect(const boost::system::error_code& error);
+  void on_establish_tls(const boost::system::error_code& error);
+
+  // Opens streams for waiting requests for as long as the server allows more streams.
+  void open_streams();
+  void open_stream(waiting_request waiting);
+
+  void read_frames();
+  result<void> read_frames_impl();
+  void on_read_frames(const boost::system::error_code& error, std::size_t bytes_transferred);
+
+  result<void> handle_frame(const frame_header& header, std::string_view payload);
+  result<void> handle_data(const frame_header& header, std::string_view payload);
+  result<void> handle_headers(const frame_header& header, std::string_view payload);
+  result<void> handle_continuation(const frame_header& header, std::string_view payload);
+  result<void> handle_rst_stream(const frame_header& header, std::string_view payload);
+  result<void> handle_settings(const frame_header& header, std::string_view payload);
+  result<void> handle_ping(const frame_header& header, std::string_view payload);
+  result<void> handle_goaway(const frame_header& header, std::string_view payload);
+  result<void> handle_window_update(const frame_header& header, std::string_view payload);
+
+  // Decodes a complete header block, which carries the response head or trailers of a stream.
+  result<void> handle_header_block(std::uint32_t stream_id, bool end_stream);
+
+  // Hands the complete response of a stream to its handler.
+  void complete_stream(std::uint32_t stream_id);
+
+  // Fails a single stream, sending RST_STREAM with the given code first if the server should stop sending on it.
+  void fail_stream(std::uint32_t stream_id, const error::error_state& error,
+                   std::optional<error_code> reset = std::nullopt);
+
+  // Called whenever a stream closes, which may make room for a waiting request or let a draining session close.
+  void on_stream_closed();
+
+  // Stops accepting new requests, failing the ones that are still waiting so they can be retried elsewhere.
+  void drain();
+
+  // Ends the connection with GOAWAY because of an error that affects every stream.
+  void connection_error(const error::error_state& error);
+
+  // Ends the connection gracefully once no streams are left.
+  void go_away();
+
+  // Fails every request and closes the connection once all buffered frames are written.
+  void close(const error::error_state& error);
+
+  // Adds the stream to the send queue if it has request data left to send.
+  void queue_data(stream& s);
+
+  // Moves as much queued request data into DATA frames as the flow control windows allow.
+  void send_data();
+
+  // Writes all buffered frames to the server if no write is already in progress.
+  void flush();
+  void on_flush(const boost::system::error_code& error, std::size_t bytes_transferred);
+
+  // Times out the whole session, using the upstream idle timeout if no streams are open.
+  void update_timer();
+  void on_timeout(const boost::system::error_code& error);
+
+  // Fails a request outside of the current call stack, unless it is canceled first.
+  void fail_later(std::uint64_t request_id, response_handler_t handler, error::error_state error);
+
+  // Receive window advertised to the server for every stream, which is larger than the default so a single response
+  // does not stall waiting for WINDOW_UPDATE frames.
+  static constexpr std::uint32_t local_stream_window_size = 1024 * 1024;
+
+  // Receive window advertised to the server for the whole connection.
+  static constexpr std::uint32_t local_connection_window_size = 16 * 1024 * 1024;
+
+  // Limit on buffered but unwritten request data before DATA frames wait for the server to catch up.
+  static constexpr std::size_t max_send_buffer_size = 64 * 1024;
+
+  // Highest stream identifier a client may open.
+  static constexpr std::uint32_t max_stream_id = 0x7fffffff;
+
+  boost::asio::io_context& ioc_;
+  server_components& components_;
+  std::string key_;
+  std::string host_;
+  port_t port_;
+
+  connection::server_connection server_;
+  tls::openssl::ssl_context_args tls_args_;
+  state state_ = state::connecting;
+
+  hpack::decoder decoder_;
+  hpack::encoder encoder_;
+
+  // Requests waiting for the connection to be ready or for a stream to be free.
+  std::deque<waiting_request> waiting_;
+  std::uint64_t next_request_id_ = 1;
+
+  // Requests whose failure is about to be reported.
+  std::unordered_map<std::uint64_t, response_handler_t> failing_;
+
+  std::unordered_map<std::uint32_t, stream> streams_;
+  std::uint32_t next_stream_id_ = 1;
+
+  // Streams with request data waiting to be sent, served in turn.
+  std::deque<std::uint32_t> send_queue_;
+
+  // Header block being collected across CONTINUATION frames, or 0 if none.
+  std::uint32_t continuation_stream_id_ = 0;
+  bool continuation_end_stream_ = false;
+  std::string header_block_;
+
+  // Settings the server sent.
+  //
+  // Servers usually allow at least 100 streams, which is assumed until their first SETTINGS frame arrives.
+  std::uint32_t peer_max_concurrent_streams_ = 100;
+  std::uint32_t peer_initial_window_size_ = default_initial_window_size;
+  std::uint32_t peer_max_frame_size_ = default_max_frame_size;
+
+  // How many more bytes the server allows to be sent on the connection.
+  std::int64_t connection_send_window_ = default_initial_window_size;
+
+  // Frames waiting to be written to the server.
+  std::string send_buffer_;
+  bool writing_ = false;
+
+  boost::asio::deadline_timer timer_;
+};
+
+}  // namespace proxy::http::http2
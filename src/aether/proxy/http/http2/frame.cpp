@@ -0,0 +1,127 @@
+/*********************************************
+
+  Copyright (c) Jackson Nestelroad 2020
+  jackson.nestelroad.com
+
+*********************************************/
+
+#include "frame.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace proxy::http::http2 {
+
+namespace {
+
+void write_uint(std::string& out, std::uint32_t value, std::size_t bytes) {
+  for (std::size_t i = bytes; i > 0; --i) {
+    out.push_back(static_cast<char>((value >> ((i - 1) * 8)) & 0xff));
+  }
+}
+
+}  // namespace
+
+std::uint32_t read_uint(const char* data, std::size_t bytes) {
+  std::uint32_t value = 0;
+  for (std::size_t i = 0; i < bytes; ++i) {
+    value = (value << 8) | static_cast<std::uint8_t>(data[i]);
+  }
+  return value;
+}
+
+result<std::string_view> remove_padding(const frame_header& header, std::string_view payload) {
+  if (!header.has_flag(frame_flags::padded)) {
+    return payload;
+  }
+  if (payload.empty()) {
+    return error::http::http2_protocol_error("Padded frame has no padding length");
+  }
+  std::size_t padding = static_cast<std::uint8_t>(payload.front());
+  payload.remove_prefix(1);
+  if (padding > payload.size()) {
+    return error::http::http2_protocol_error("Padding is longer than the frame");
+  }
+  payload.remove_suffix(padding);
+  return payload;
+}
+
+frame_header parse_frame_header(const char* data) {
+  frame_header header;
+  header.length = read_uint(data, 3);
+  header.type = static_cast<frame_type>(data[3]);
+  header.flags = static_cast<std::uint8_t>(data[4]);
+  // The reserved bit is ignored.
+  header.stream_id = read_uint(data + 5, 4) & 0x7fffffff;
+  return header;
+}
+
+void write_frame_header(std::string& out, const frame_header& header) {
+  write_uint(out, header.length, 3);
+  out.push_back(static_cast<char>(header.type));
+  out.push_back(static_cast<char>(header.flags));
+  write_uint(out, header.stream_id & 0x7fffffff, 4);
+}
+
+void write_settings(std::string& out, const std::vector<std::pair<setting_id, std::uint32_t>>& settings) {
+  write_frame_header(out, {static_cast<std::uint32_t>(settings.size() * 6), frame_type::settings, 0, 0});
+  for (const auto& [id, value] : settings) {
+    write_uint(out, static_cast<std::uint16_t>(id), 2);
+    write_uint(out, value, 4);
+  }
+}
+
+void write_settings_ack(std::string& out) { write_frame_header(out, {0, frame_type::settings, frame_flags::ack, 0}); }
+
+void write_ping_ack(std::string& out, std::string_view opaque_data) {
+  write_frame_header(out, {static_cast<std::uint32_t>(opaque_data.size()), frame_type::ping, frame_flags::ack, 0});
+  out.append(opaque_data);
+}
+
+void write_window_update(std::string& out, std::uint32_t stream_id, std::uint32_t increment) {
+  write_frame_header(out, {4, frame_type::window_update, 0, stream_id});
+  write_uint(out, increment & 0x7fffffff, 4);
+}
+
+void write_rst_stream(std::string& out, std::uint32_t stream_id, error_code code) {
+  write_frame_header(out, {4, frame_type::rst_stream, 0, stream_id});
+  write_uint(out, static_cast<std::uint32_t>(code), 4);
+}
+
+void write_goaway(std::string& out, std::uint32_t last_stream_id, error_code code) {
+  write_frame_header(out, {8, frame_type::goaway, 0, 0});
+  write_uint(out, last_stream_id & 0x7fffffff, 4);
+  write_uint(out, static_cast<std::uint32_t>(code), 4);
+}
+
+void write_data(std::string& out, std::uint32_t stream_id, std::string_view data, bool end_stream) {
+  write_frame_header(out, {static_cast<std::uint32_t>(data.size()), frame_type::data,
+                           end_stream ? frame_flags::end_stream : std::uint8_t(0), stream_id});
+  out.append(data);
+}
+
+void write_headers(std::string& out, std::uint32_t stream_id, std::string_view header_block, bool end_stream,
+                   std::uint32_t max_frame_size) {
+  frame_type type = frame_type::headers;
+  do {
+    std::string_view fragment = header_block.substr(0, std::min<std::size_t>(header_block.size(), max_frame_size));
+    header_block.remove_prefix(fragment.size());
+
+    std::uint8_t flags = 0;
+    if (type == frame_type::headers && end_stream) {
+      flags |= frame_flags::end_stream;
+    }
+    if (header_block.empty()) {
+      flags |= frame_flags::end_headers;
+    }
+    write_frame_header(out, {static_cast<std::uint32_t>(fragment.size()), type, flags, stream_id});
+    out.append(fragment);
+    type = frame_type::continuation;
+  } while (!header_block.empty());
+}
+
+}  // namespace proxy::http::http2
@@ -0,0 +1,137 @@
+/*********************************************
+
+  Copyright (c) Jackson Nestelroad 2020
+  jackson.nestelroad.com
+
+*********************************************/
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "aether/proxy/error/error.hpp"
+
+#define HTTP2_FRAME_TYPES(X) \
+  X(0x0, data)               \
+  X(0x1, headers)            \
+  X(0x2, priority)           \
+  X(0x3, rst_stream)         \
+  X(0x4, settings)           \
+  X(0x5, push_promise)       \
+  X(0x6, ping)               \
+  X(0x7, goaway)             \
+  X(0x8, window_update)      \
+  X(0x9, continuation)
+
+#define HTTP2_ERROR_CODES(X)   \
+  X(0x0, no_error)             \
+  X(0x1, protocol_error)       \
+  X(0x2, internal_error)       \
+  X(0x3, flow_control_error)   \
+  X(0x4, settings_timeout)     \
+  X(0x5, stream_closed)        \
+  X(0x6, frame_size_error)     \
+  X(0x7, refused_stream)       \
+  X(0x8, cancel)               \
+  X(0x9, compression_error)    \
+  X(0xa, connect_error)        \
+  X(0xb, enhance_your_calm)    \
+  X(0xc, inadequate_security)  \
+  X(0xd, http_1_1_required)
+
+#define HTTP2_SETTINGS(X)         \
+  X(0x1, header_table_size)       \
+  X(0x2, enable_push)             \
+  X(0x3, max_concurrent_streams)  \
+  X(0x4, initial_window_size)     \
+  X(0x5, max_frame_size)          \
+  X(0x6, max_header_list_size)
+
+namespace proxy::http::http2 {
+
+// The first bytes a client sends on an HTTP/2 connection.
+constexpr std::string_view connection_preface = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+
+constexpr std::size_t frame_header_size = 9;
+constexpr std::uint32_t default_max_frame_size = 16384;
+constexpr std::uint32_t max_allowed_frame_size = 16777215;
+constexpr std::uint32_t default_initial_window_size = 65535;
+constexpr std::uint32_t max_window_size = 0x7fffffff;
+constexpr std::uint32_t default_header_table_size = 4096;
+
+// Header names that are specific to a single HTTP/1.x connection, which HTTP/2 does not allow.
+constexpr std::array<std::string_view, 5> connection_specific_headers = {"connection", "keep-alive", "proxy-connection",
+                                                                        "transfer-encoding", "upgrade"};
+
+// Enumeration type for HTTP/2 frame types.
+//
+// Frames of unknown types must be ignored, so any value can be held.
+enum class frame_type : std::uint8_t {
+#define X(num, name) name = num,
+  HTTP2_FRAME_TYPES(X)
+#undef X
+};
+
+// Flags that can be set on a frame, whose meaning depends on the frame type.
+namespace frame_flags {
+constexpr std::uint8_t end_stream = 0x1;
+constexpr std::uint8_t ack = 0x1;
+constexpr std::uint8_t end_headers = 0x4;
+constexpr std::uint8_t padded = 0x8;
+constexpr std::uint8_t priority = 0x20;
+}  // namespace frame_flags
+
+// Enumeration type for the error codes carried by RST_STREAM and GOAWAY frames.
+enum class error_code : std::uint32_t {
+#define X(num, name) name = num,
+  HTTP2_ERROR_CODES(X)
+#undef X
+};
+
+// Enumeration type for the parameters of a SETTINGS frame.
+enum class setting_id : std::uint16_t {
+#define X(num, name) name = num,
+  HTTP2_SETTINGS(X)
+#undef X
+};
+
+// The fixed-size header that starts every frame.
+struct frame_header {
+  std::uint32_t length = 0;
+  frame_type type = frame_type::data;
+  std::uint8_t flags = 0;
+  std::uint32_t stream_id = 0;
+
+  inline bool has_flag(std::uint8_t flag) const { return (flags & flag) != 0; }
+};
+
+// Reads a big-endian integer of the given number of bytes.
+std::uint32_t read_uint(const char* data, std::size_t bytes);
+
+// Parses a frame header from exactly frame_header_size bytes.
+frame_header parse_frame_header(const char* data);
+
+// Removes padding from the payload of a frame that may be padded.
+result<std::string_view> remove_padding(const frame_header& header, std::string_view payload);
+
+// Functions for serializing frames, which append the frame to the output string.
+
+void write_frame_header(std::string& out, const frame_header& header);
+void write_settings(std::string& out, const std::vector<std::pair<setting_id, std::uint32_t>>& settings);
+void write_settings_ack(std::string& out);
+void write_ping_ack(std::string& out, std::string_view opaque_data);
+void write_window_update(std::string& out, std::uint32_t stream_id, std::uint32_t increment);
+void write_rst_stream(std::string& out, std::uint32_t stream_id, error_code code);
+void write_goaway(std::string& out, std::uint32_t last_stream_id, error_code code);
+void write_data(std::string& out, std::uint32_t stream_id, std::string_view data, bool end_stream);
+
+// Writes a header block, split into a HEADERS frame and as many CONTINUATION frames as the maximum frame size needs.
+void write_headers(std::string& out, std::uint32_t stream_id, std::string_view header_block, bool end_stream,
+                   std::uint32_t max_frame_size);
+
+}  // namespace proxy::http::http2
@@ -0,0 +1,472 @@
+/*********************************************
+
+  Copyright (c) Jackson Nestelroad 2020
+  jackson.nestelroad.com
+
+*********************************************/
+
+#include "hpack.hpp"
+
+#include <array>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "aether/proxy/error/error.hpp"
+#include "aether/util/result_macros.hpp"
+
+namespace proxy::http::http2::hpack {
+
+namespace {
+
+constexpr std::size_t num_symbols = 257;
+constexpr std::size_t eos_symbol = 256;
+constexpr std::size_t max_code_length = 30;
+
+// Huffman code lengths from RFC 7541, Appendix B, indexed by symbol.
+//
+// The code is canonical, so the codes themselves are derived from the lengths.
+constexpr std::array<std::uint8_t, num_symbols> code_lengths = {
+    13, 23, 28, 28, 28, 28, 28, 28, 28, 24, 30, 28, 28, 30, 28, 28,
+    28, 28, 28, 28, 28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28, 28,
+    6, 10, 10, 12, 13, 6, 8, 11, 10, 10, 8, 11, 8, 6, 6, 6,
+    5, 5, 5, 6, 6, 6, 6, 6, 6, 6, 7, 8, 15, 6, 12, 10,
+    13, 6, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 7, 8, 7, 8, 13, 19, 13, 14, 6,
+    15, 5, 6, 5, 6, 5, 6, 6, 6, 5, 7, 7, 6, 6, 6, 5,
+    6, 7, 6, 5, 5, 6, 7, 7, 7, 7, 7, 15, 11, 14, 13, 28,
+    20, 22, 20, 20, 22, 22, 22, 23, 22, 23, 23, 23, 23, 23, 24, 23,
+    24, 24, 22, 23, 24, 23, 23, 23, 23, 21, 22, 23, 22, 23, 23, 24,
+    22, 21, 20, 22, 22, 23, 23, 21, 23, 22, 22, 24, 21, 22, 23, 23,
+    21, 21, 22, 21, 23, 22, 23, 23, 20, 22, 22, 22, 23, 22, 22, 23,
+    26, 26, 20, 19, 22, 23, 22, 25, 26, 26, 26, 27, 27, 26, 24, 25,
+    19, 21, 26, 27, 27, 26, 27, 24, 21, 21, 26, 26, 28, 27, 27, 27,
+    20, 24, 20, 21, 22, 21, 21, 23, 22, 22, 25, 25, 24, 24, 26, 23,
+    26, 27, 26, 26, 27, 27, 27, 27, 27, 28, 27, 27, 27, 27, 27, 26,
+    30,
+};
+
+struct huffman_table {
+  std::array<std::uint32_t, num_symbols> codes{};
+  // Symbols ordered by code.
+  std::array<std::uint16_t, num_symbols> sorted_symbols{};
+  // For each code length, the first code of that length, how many codes have that length, and where their symbols
+  // start in sorted_symbols.
+  std::array<std::uint32_t, max_code_length + 1> first_code{};
+  std::array<std::uint16_t, max_code_length + 1> count{};
+  std::array<std::uint16_t, max_code_length + 1> first_index{};
+};
+
+constexpr huffman_table build_huffman_table() {
+  huffman_table table;
+  std::size_t sorted = 0;
+  for (std::size_t length = 1; length <= max_code_length; ++length) {
+    for (std::size_t symbol = 0; symbol < num_symbols; ++symbol) {
+      if (code_lengths[symbol] == length) {
+        table.sorted_symbols[sorted++] = static_cast<std::uint16_t>(symbol);
+        ++table.count[length];
+      }
+    }
+  }
+
+  // Codes of the same length are consecutive, and each length starts just after the previous length's codes.
+  std::uint32_t code = 0;
+  std::uint16_t index = 0;
+  for (std::size_t length = 1; length <= max_code_length; ++length) {
+    table.first_code[length] = code;
+    table.first_index[length] = index;
+    for (std::uint16_t i = 0; i < table.count[length]; ++i) {
+      table.codes[table.sorted_symbols[index + i]] = code + i;
+    }
+    code = (code + table.count[length]) << 1;
+    index += table.count[length];
+  }
+  return table;
+}
+
+constexpr huffman_table huffman = build_huffman_table();
+
+// The static table from RFC 7541, Appendix A.
+//
+// Index 0 is unused, so the array can be indexed directly.
+const std::array<header_field, 62> static_table = {{
+    {"", ""},
+    {":authority", ""},
+    {":method", "GET"},
+    {":method", "POST"},
+    {":path", "/"},
+    {":path", "/index.html"},
+    {":scheme", "http"},
+    {":scheme", "https"},
+    {":status", "200"},
+    {":status", "204"},
+    {":status", "206"},
+    {":status", "304"},
+    {":status", "400"},
+    {":status", "404"},
+    {":status", "500"},
+    {"accept-charset", ""},
+    {"accept-encoding", "gzip, deflate"},
+    {"accept-language", ""},
+    {"accept-ranges", ""},
+    {"accept", ""},
+    {"access-control-allow-origin", ""},
+    {"age", ""},
+    {"allow", ""},
+    {"authorization", ""},
+    {"cache-control", ""},
+    {"content-disposition", ""},
+    {"content-encoding", ""},
+    {"content-language", ""},
+    {"content-length", ""},
+    {"content-location", ""},
+    {"content-range", ""},
+    {"content-type", ""},
+    {"cookie", ""},
+    {"date", ""},
+    {"etag", ""},
+    {"expect", ""},
+    {"expires", ""},
+    {"from", ""},
+    {"host", ""},
+    {"if-match", ""},
+    {"if-modified-since", ""},
+    {"if-none-match", ""},
+    {"if-range", ""},
+    {"if-unmodified-since", ""},
+    {"last-modified", ""},
+    {"link", ""},
+    {"location", ""},
+    {"max-forwards", ""},
+    {"proxy-authenticate", ""},
+    {"proxy-authorization", ""},
+    {"range", ""},
+    {"referer", ""},
+    {"refresh", ""},
+    {"retry-after", ""},
+    {"server", ""},
+    {"set-cookie", ""},
+    {"strict-transport-security", ""},
+    {"transfer-encoding", ""},
+    {"user-agent", ""},
+    {"vary", ""},
+    {"via", ""},
+    {"www-authenticate", ""},
+}};
+
+constexpr std::size_t static_table_count = static_table.size() - 1;
+
+// Appends an integer with an N-bit prefix, where the first byte keeps the given high bits.
+void encode_integer(std::uint64_t value, std::uint8_t prefix_bits, std::uint8_t first_byte, std::string& out) {
+  std::uint64_t max_prefix = (std::uint64_t(1) << prefix_bits) - 1;
+  if (value < max_prefix) {
+    out.push_back(static_cast<char>(first_byte | value));
+    return;
+  }
+  out.push_back(static_cast<char>(first_byte | max_prefix));
+  value -= max_prefix;
+  while (value >= 128) {
+    out.push_back(static_cast<char>((value & 0x7f) | 0x80));
+    value >>= 7;
+  }
+  out.push_back(static_cast<char>(value));
+}
+
+void encode_string(std::string_view str, std::string& out) {
+  std::size_t huffman_size = huffman_encoded_size(str);
+  if (huffman_size < str.size()) {
+    encode_integer(huffman_size, 7, 0x80, out);
+    huffman_encode(str, out);
+  } else {
+    encode_integer(str.size(), 7, 0, out);
+    out.append(str);
+  }
+}
+
+// Reads an integer with an N-bit prefix, advancing the input past it.
+result<std::uint64_t> decode_integer(std::string_view& in, std::uint8_t prefix_bits) {
+  if (in.empty()) {
+    return error::http::hpack_decoding_error("Header block ended inside an integer");
+  }
+  std::uint64_t max_prefix = (std::uint64_t(1) << prefix_bits) - 1;
+  std::uint64_t value = static_cast<std::uint8_t>(in.front()) & max_prefix;
+  in.remove_prefix(1);
+  if (value < max_prefix) {
+    return value;
+  }
+
+  // Limiting the shift keeps the value well within 64 bits.
+  for (std::size_t shift = 0; shift <= 28; shift += 7) {
+    if (in.empty()) {
+      return error::http::hpack_decoding_error("Header block ended inside an integer");
+    }
+    std::uint8_t byte = static_cast<std::uint8_t>(in.front());
+    in.remove_prefix(1);
+    value += static_cast<std::uint64_t>(byte & 0x7f) << shift;
+    if ((byte & 0x80) == 0) {
+      return value;
+    }
+  }
+  return error::http::hpack_decoding_error("Integer is too large");
+}
+
+// Reads a string literal, advancing the input past it.
+result<std::string> decode_string(std::string_view& in) {
+  if (in.empty()) {
+    return error::http::hpack_decoding_error("Header block ended before a string");
+  }
+  bool huffman_coded = (static_cast<std::uint8_t>(in.front()) & 0x80) != 0;
+  ASSIGN_OR_RETURN(std::uint64_t length, decode_integer(in, 7));
+  if (length > in.size()) {
+    return error::http::hpack_decoding_error("String is longer than the header block");
+  }
+
+  std::string_view raw = in.substr(0, length);
+  in.remove_prefix(length);
+  if (!huffman_coded) {
+    return std::string(raw);
+  }
+  std::string decoded;
+  decoded.reserve(raw.size() * 8 / 5);
+  RETURN_IF_ERROR(huffman_decode(raw, decoded));
+  return decoded;
+}
+
+}  // namespace
+
+std::size_t huffman_encoded_size(std::string_view in) {
+  std::size_t bits = 0;
+  for (char c : in) {
+    bits += code_lengths[static_cast<std::uint8_t>(c)];
+  }
+  return (bits + 7) / 8;
+}
+
+void huffman_encode(std::string_view in, std::string& out) {
+  // At most 7 bits are left over between symbols, so a 30-bit code always fits.
+  std::uint64_t bits = 0;
+  std::size_t bit_count = 0;
+  for (char c : in) {
+    std::uint8_t symbol = static_cast<std::uint8_t>(c);
+    bits = (bits << code_lengths[symbol]) | huffman.codes[symbol];
+    bit_count += code_lengths[symbol];
+    while (bit_count >= 8) {
+      bit_count -= 8;
+      out.push_back(static_cast<char>(bits >> bit_count));
+    }
+    bits &= (std::uint64_t(1) << bit_count) - 1;
+  }
+
+  // Padding is the most significant bits of the EOS code, which are all ones.
+  if (bit_count > 0) {
+    std::size_t padding = 8 - bit_count;
+    out.push_back(static_cast<char>((bits << padding) | ((1 << padding) - 1)));
+  }
+}
+
+result<void> huffman_decode(std::string_view in, std::string& out) {
+  std::uint32_t code = 0;
+  std::size_t length = 0;
+  for (char c : in) {
+    std::uint8_t byte = static_cast<std::uint8_t>(c);
+    for (int bit = 7; bit >= 0; --bit) {
+      code = (code << 1) | ((byte >> bit) & 1);
+      ++length;
+
+      // Canonical codes of a single length are consecutive, so the code is complete if it falls in that range.
+      std::uint32_t offset = code - huffman.first_code[length];
+      if (code >= huffman.first_code[length] && offset < huffman.count[length]) {
+        std::uint16_t symbol = huffman.sorted_symbols[huffman.first_index[length] + offset];
+        if (symbol == eos_symbol) {
+          return error::http::hpack_decoding_error("Huffman-coded string contains EOS");
+        }
+        out.push_back(static_cast<char>(symbol));
+        code = 0;
+        length = 0;
+      } else if (length == max_code_length) {
+        return error::http::hpack_decoding_error("Invalid Huffman code");
+      }
+    }
+  }
+
+  // Anything left over must be padding, which is shorter than a byte and all ones.
+  if (length > 7 || code != (std::uint32_t(1) << length) - 1) {
+    return error::http::hpack_decoding_error("Invalid Huffman padding");
+  }
+  return util::ok;
+}
+
+dynamic_table::dynamic_table(std::size_t max_size) : size_(0), max_size_(max_size) {}
+
+void dynamic_table::add(std::string name, std::string value) {
+  std::size_t entry_size = name.size() + value.size() + entry_overhead;
+  if (entry_size > max_size_) {
+    evict(max_size_);
+    return;
+  }
+  evict(entry_size);
+  size_ += entry_size;
+  entries_.push_front({std::move(name), std::move(value)});
+}
+
+void dynamic_table::set_max_size(std::size_t max_size) {
+  max_size_ = max_size;
+  evict(0);
+}
+
+void dynamic_table::evict(std::size_t needed) {
+  while (!entries_.empty() && size_ + needed > max_size_) {
+    const header_field& oldest = entries_.back();
+    size_ -= oldest.name.size() + oldest.value.size() + entry_overhead;
+    entries_.pop_back();
+  }
+}
+
+decoder::decoder(std::size_t max_table_size) : max_table_size_(max_table_size), table_(max_table_size) {}
+
+result<const header_field*> decoder::lookup(std::uint64_t index) const {
+  if (index == 0) {
+    return error::http::hpack_decoding_error("Index 0 is not used");
+  }
+  if (index <= static_table_count) {
+    return &static_table[index];
+  }
+  std::uint64_t dynamic_index = index - static_table_count - 1;
+  if (dynamic_index >= table_.count()) {
+    return error::http::hpack_decoding_error("Index is past the end of the dynamic table");
+  }
+  return &table_.at(dynamic_index);
+}
+
+result<std::vector<header_field>> decoder::decode(std::string_view block, std::size_t max_list_size) {
+  std::vector<header_field> headers;
+  std::size_t list_size = 0;
+  bool headers_started = false;
+
+  while (!block.empty()) {
+    std::uint8_t first = static_cast<std::uint8_t>(block.front());
+    header_field field;
+
+    if ((first & 0x80) != 0) {
+      // Indexed header field.
+      ASSIGN_OR_RETURN(std::uint64_t index, decode_integer(block, 7));
+      ASSIGN_OR_RETURN(const header_field* entry, lookup(index));
+      field = *entry;
+    } else if ((first & 0xe0) == 0x20) {
+      // Dynamic table size update, which must come before any headers.
+      if (headers_started) {
+        return error::http::hpack_decoding_error("Dynamic table size update after a header");
+      }
+      ASSIGN_OR_RETURN(std::uint64_t new_size, decode_integer(block, 5));
+      if (new_size > max_table_size_) {
+        return error::http::hpack_decoding_error("Dynamic table size update exceeds the advertised limit");
+      }
+      table_.set_max_size(new_size);
+      continue;
+    } else {
+      // Literal header field, with incremental indexing (01), without indexing (0000), or never indexed (0001).
+      bool add_to_table = (first & 0xc0) == 0x40;
+      std::uint8_t prefix_bits = add_to_table ? 6 : 4;
+      ASSIGN_OR_RETURN(std::uint64_t name_index, decode_integer(block, prefix_bits));
+      if (name_index == 0) {
+        ASSIGN_OR_RETURN(field.name, decode_string(block));
+      } else {
+        ASSIGN_OR_RETURN(const header_field* entry, lookup(name_index));
+        field.name = entry->name;
+      }
+      ASSIGN_OR_RETURN(field.value, decode_string(block));
+      if (add_to_table) {
+        table_.add(field.name, field.value);
+      }
+    }
+
+    headers_started = true;
+    list_size += field.name.size() + field.value.size() + dynamic_table::entry_overhead;
+    // The rest of the block is still decoded, so the dynamic table stays in sync with the peer's encoder.
+    if (list_size <= max_list_size) {
+      headers.push_back(std::move(field));
+    }
+  }
+  if (list_size > max_list_size) {
+    return error::http::header_size_too_large();
+  }
+  return headers;
+}
+
+encoder::encoder() : table_(default_header_table_size) {}
+
+void encoder::set_max_table_size(std::size_t max_size) {
+  // The encoder is free to use less than the peer allows, so the table never grows past the default.
+  std::size_t new_size = std::min<std::size_t>(max_size, default_header_table_size);
+  if (new_size != table_.max_size()) {
+    table_.set_max_size(new_size);
+    pending_size_update_ = new_size;
+  }
+}
+
+void encoder::begin_block(std::string& out) {
+  if (pending_size_update_.has_value()) {
+    encode_integer(pending_size_update_.value(), 5, 0x20, out);
+    pending_size_update_.reset();
+  }
+}
+
+void encoder::find(std::string_view name, std::string_view value, std::optional<std::size_t>& exact,
+                   std::optional<std::size_t>& name_only) const {
+  for (std::size_t i = 1; i <= static_table_count; ++i) {
+    const header_field& entry = static_table[i];
+    if (entry.name == name) {
+      if (entry.value == value) {
+        exact = i;
+        return;
+      }
+      if (!name_only.has_value()) {
+        name_only = i;
+      }
+    }
+  }
+  for (std::size_t i = 0; i < table_.count(); ++i) {
+    const header_field& entry = table_.at(i);
+    if (entry.name == name) {
+      if (entry.value == value) {
+        exact = static_table_count + 1 + i;
+        return;
+      }
+      if (!name_only.has_value()) {
+        name_only = static_table_count + 1 + i;
+      }
+    }
+  }
+}
+
+void encoder::encode(std::string_view name, std::string_view value, std::string& out, bool sensitive) {
+  std::optional<std::size_t> exact;
+  std::optional<std::size_t> name_only;
+  find(name, value, exact, name_only);
+
+  if (exact.has_value() && !sensitive) {
+    encode_integer(exact.value(), 7, 0x80, out);
+    return;
+  }
+
+  // Large values are unlikely to repeat, and would push many small entries out of the table.
+  bool add_to_table = !sensitive && name.size() + value.size() + dynamic_table::entry_overhead <= table_.max_size() / 2;
+  if (add_to_table) {
+    encode_integer(name_only.value_or(0), 6, 0x40, out);
+  } else {
+    encode_integer(name_only.value_or(0), 4, sensitive ? 0x10 : 0x00, out);
+  }
+  if (!name_only.has_value()) {
+    encode_string(name, out);
+  }
+  encode_string(value, out);
+
+  if (add_to_table) {
+    table_.add(std::string(name), std::string(value));
+  }
+}
+
+}  // namespace proxy::http::http2::hpack
@@ -0,0 +1,118 @@
+/*********************************************
+
+  Copyright (c) Jackson Nestelroad 2020
+  jackson.nestelroad.com
+
+*********************************************/
+
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "aether/proxy/error/error.hpp"
+#include "aether/proxy/http/http2/frame.hpp"
+
+namespace proxy::http::http2::hpack {
+
+// A single header as it is sent in an HTTP/2 header block.
+struct header_field {
+  std::string name;
+  std::string value;
+};
+
+// Returns the number of bytes the string takes after Huffman coding.
+std::size_t huffman_encoded_size(std::string_view in);
+
+// Appends the Huffman coding of the string to the output.
+void huffman_encode(std::string_view in, std::string& out);
+
+// Appends the decoded form of a Huffman-coded string to the output.
+result<void> huffman_decode(std::string_view in, std::string& out);
+
+// Table of recently used headers, shared by an encoder and decoder on either end of a connection.
+//
+// New entries are added to the front, and the oldest entries are evicted once the table is too large.
+class dynamic_table {
+ public:
+  // Every entry is counted as 32 bytes larger than its name and value.
+  static constexpr std::size_t entry_overhead = 32;
+
+  dynamic_table(std::size_t max_size);
+
+  // Adds an entry, evicting as many entries as needed to make room.
+  //
+  // An entry larger than the whole table empties the table and is not added.
+  void add(std::string name, std::string value);
+
+  // Changes the maximum size, evicting entries as needed.
+  void set_max_size(std::size_t max_size);
+
+  // Returns the entry at the index, where 0 is the newest entry.
+  inline const header_field& at(std::size_t index) const { return entries_[index]; }
+
+  inline std::size_t count() const { return entries_.size(); }
+  inline std::size_t size() const { return size_; }
+  inline std::size_t max_size() const { return max_size_; }
+
+ private:
+  void evict(std::size_t needed);
+
+  std::deque<header_field> entries_;
+  std::size_t size_;
+  std::size_t max_size_;
+};
+
+// Decoder for header blocks received from the peer.
+class decoder {
+ public:
+  // The maximum table size is the value advertised to the peer in SETTINGS_HEADER_TABLE_SIZE.
+  decoder(std::size_t max_table_size = default_header_table_size);
+
+  // Decodes a complete header block.
+  //
+  // Fails if the decoded headers would take more than max_list_size bytes, counted like SETTINGS_MAX_HEADER_LIST_SIZE.
+  // The whole block is decoded either way, so such a failure does not break the connection's compression state.
+  result<std::vector<header_field>> decode(std::string_view block, std::size_t max_list_size);
+
+ private:
+  // Looks up a header by its index in the combined static and dynamic table.
+  result<const header_field*> lookup(std::uint64_t index) const;
+
+  std::size_t max_table_size_;
+  dynamic_table table_;
+};
+
+// Encoder for header blocks sent to the peer.
+class encoder {
+ public:
+  encoder();
+
+  // Changes the maximum table size to what the peer advertised in SETTINGS_HEADER_TABLE_SIZE.
+  //
+  // The change is signaled at the start of the next header block.
+  void set_max_table_size(std::size_t max_size);
+
+  // Starts a new header block.
+  void begin_block(std::string& out);
+
+  // Appends a header to the current header block.
+  //
+  // Names must already be lowercase. Sensitive headers are never added to a table, by this encoder or any
+  // intermediary.
+  void encode(std::string_view name, std::string_view value, std::string& out, bool sensitive = false);
+
+ private:
+  // Finds the index of an exact match, and, failing that, of an entry with the same name.
+  void find(std::string_view name, std::string_view value, std::optional<std::size_t>& exact,
+            std::optional<std::size_t>& name_only) const;
+
+  dynamic_table table_;
+  std::optional<std::size_t> pending_size_update_;
+};
+
+}  // namespace proxy::http::http2::hpack
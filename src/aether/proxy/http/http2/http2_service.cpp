@@ -0,0 +1,1042 @@
+/*********************************************
+
+  Copyright (c) Jackson Nestelroad 2020
+  jackson.nestelroad.com
+
+*********************************************/
+
+#include "http2_service.hpp"
+
+#include <algorithm>
+#include <boost/asio.hpp>
+#include <functional>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "aether/proxy/connection_handler.hpp"
+#include "aether/proxy/constants/server_constants.hpp"
+#include "aether/proxy/error/error.hpp"
+#include "aether/proxy/server_components.hpp"
+#include "aether/proxy/tls/tls_service.hpp"
+#include "aether/util/result_macros.hpp"
+#include "aether/util/string.hpp"
+
+namespace proxy::http::http2 {
+
+namespace {
+
+// Picks the HTTP/2 error code sent in GOAWAY for an error that ends the connection.
+error_code to_http2_error(const error::error_state& error) {
+  if (error.proxy_error() == errc::http2_frame_size_error) {
+    return error_code::frame_size_error;
+  } else if (error.proxy_error() == errc::http2_flow_control_error) {
+    return error_code::flow_control_error;
+  } else if (error.proxy_error() == errc::hpack_decoding_error) {
+    return error_code::compression_error;
+  }
+  return error_code::protocol_error;
+}
+
+bool has_uppercase(std::string_view str) {
+  return std::any_of(str.begin(), str.end(), [](char c) { return c >= 'A' && c <= 'Z'; });
+}
+
+}  // namespace
+
+http2_service::stream::stream(std::uint32_t stream_id, boost::asio::io_context& ioc, server_components& components,
+                              std::int64_t initial_send_window)
+    : id(stream_id),
+      exchange(),
+      parser(exchange, components),
+      server(ioc, components),
+      send_window(initial_send_window) {}
+
+http2_service::http2_service(connection::connection_flow& flow, connection_handler& owner,
+                             server_components& components)
+    : base_service(flow, owner, components),
+      decoder_(),
+      encoder_(),
+      idle_timer_(ioc_) {}
+
+http2_service::~http2_service() {
+  // Server operations still in progress finish on their own once they see their stream has no service.
+  for (auto& [stream_id, s] : streams_) {
+    s->service = nullptr;
+    s->server.disconnect();
+    if (s->session != nullptr) {
+      s->session->cancel(s->session_request_id);
+    }
+  }
+}
+
+void http2_service::start() {
+  // Every stream uses the same TLS settings that were negotiated with the server for the client's handshake.
+  if (flow_.server.tls_args().has_value()) {
+    server_tls_args_ = flow_.server.tls_args().value();
+  } else {
+    server_tls_args_ = tls::tls_service::make_server_context_args(options_, components_.client_store());
+    server_tls_args_.alpn_protos.emplace_back(tls::tls_service::default_alpn);
+  }
+
+  // Requests are sent on server connections of their own, so the connection opened for the handshake is left in the
+  // pool for the first of them to pick up.
+  flow_.server.set_reusable(true);
+  flow_.server.release();
+
+  // Streams may wait on their servers for a long time, so the client connection is timed by the idle timer instead.
+  flow_.client.set_mode(connection::base_connection::io_mode::no_timeout);
+
+  write_settings(send_buffer_,
+                 {
+                     {setting_id::max_concurrent_streams,
+                      static_cast<std::uint32_t>(
+                          std::min<std::size_t>(options_.http2_max_concurrent_streams, max_window_size))},
+                     {setting_id::enable_push, 0},
+                     {setting_id::max_header_list_size,
+                      static_cast<std::uint32_t>(std::min<std::size_t>(options_.header_size_limit, max_window_size))},
+                 });
+  update_idle_timer();
+  read_frames();
+}
+
+void http2_service::read_frames() {
+  if (result<void> res = read_frames_impl(); !res.is_ok()) {
+    connection_error(std::move(res).err());
+  }
+}
+
+result<void> http2_service::read_frames_impl() {
+  streambuf& input = flow_.client.input_buffer();
+
+  if (!preface_received_) {
+    std::string_view data = input.string_view();
+    std::size_t size = std::min(data.size(), connection_preface.size());
+    if (data.substr(0, size) != connection_preface.substr(0, size)) {
+      return error::http::http2_protocol_error("Invalid connection preface");
+    }
+    if (size == connection_preface.size()) {
+      input.consume(size);
+      preface_received_ = true;
+    }
+  }
+
+  // Frames are handled straight out of the input buffer, and each one is consumed once it is handled.
+  while (preface_received_ && !closing_ && input.size() >= frame_header_size) {
+    std::string_view data = input.string_view();
+    frame_header header = parse_frame_header(data.data());
+    if (header.length > default_max_frame_size) {
+      return error::http::http2_frame_size_error("Frame is larger than the maximum frame size");
+    }
+    if (data.size() < frame_header_size + header.length) {
+      break;
+    }
+    RETURN_IF_ERROR(handle_frame(header, data.substr(frame_header_size, header.length)));
+    input.consume(frame_header_size + header.length);
+  }
+
+  flush();
+  if (!closing_) {
+    reading_ = true;
+    flow_.client.read_async(std::bind_front(&http2_service::on_read_frames, this));
+  }
+  return util::ok;
+}
+
+void http2_service::on_read_frames(const boost::system::error_code& error, std::size_t bytes_transferred) {
+  reading_ = false;
+  if (closing_) {
+    finish();
+  } else if (error != boost::system::errc::success) {
+    // The client closed the connection, which ends all of its streams.
+    flow_.error.set_boost_error(error);
+    finish();
+  } else {
+    read_frames();
+  }
+}
+
+result<void> http2_service::handle_frame(const frame_header& header, std::string_view payload) {
+  // A header block must arrive in one piece, with no other frames in between.
+  if (continuation_stream_id_ != 0 && header.type != frame_type::continuation) {
+    return error::http::http2_protocol_error("Expected CONTINUATION frame");
+  }
+
+  switch (header.type) {
+    case frame_type::data:
+      return handle_data(header, payload);
+    case frame_type::headers:
+      return handle_headers(header, payload);
+    case frame_type::continuation:
+      return handle_continuation(header, payload);
+    case frame_type::rst_stream:
+      return handle_rst_stream(header, payload);
+    case frame_type::settings:
+      return handle_settings(header, payload);
+    case frame_type::ping:
+      return handle_ping(header, payload);
+    case frame_type::goaway:
+      return handle_goaway(header, payload);
+    case frame_type::window_update:
+      return handle_window_update(header, payload);
+    case frame_type::push_promise:
+      return error::http::http2_protocol_error("Clients cannot push streams");
+    case frame_type::priority:
+      // Prioritization is only advisory, and every response is sent as soon as it is ready anyway.
+      if (header.stream_id == 0) {
+        return error::http::http2_protocol_error("PRIORITY frame on stream 0");
+      }
+      return util::ok;
+    default:
+      // Frames of unknown types must be ignored.
+      return util::ok;
+  }
+}
+
+result<void> http2_service::handle_data(const frame_header& header, std::string_view payload) {
+  if (header.stream_id == 0) {
+    return error::http::http2_protocol_error("DATA frame on stream 0");
+  }
+  if (header.stream_id > last_stream_id_) {
+    return error::http::http2_protocol_error("DATA frame on an idle stream");
+  }
+  ASSIGN_OR_RETURN(std::string_view data, remove_padding(header, payload));
+
+  // The whole frame counts against the connection window, which is given back right away.
+  if (header.length > 0) {
+    write_window_update(send_buffer_, 0, header.length);
+  }
+
+  auto it = streams_.find(header.stream_id);
+  if (it == streams_.end()) {
+    // Frames that were in flight when the stream was reset are ignored.
+    return util::ok;
+  }
+  std::shared_ptr<stream> s = it->second;
+  if (s->request_complete) {
+    reset_stream(s->id, error_code::stream_closed);
+    return util::ok;
+  }
+
+  bool end_stream = header.has_flag(frame_flags::end_stream);
+  if (!s->request_handled) {
+    if (s->request_body.size() + data.size() > options_.body_size_limit) {
+      send_error_response(s, status::payload_too_large, "Request body exceeds size limit");
+      return util::ok;
+    }
+    s->request_body.append(data);
+  }
+
+  if (end_stream) {
+    s->request_complete = true;
+    if (!s->request_handled) {
+      handle_request(s);
+    }
+  } else if (header.length > 0) {
+    write_window_update(send_buffer_, s->id, header.length);
+  }
+  return util::ok;
+}
+
+result<void> http2_service::handle_headers(const frame_header& header, std::string_view payload) {
+  if (header.stream_id == 0) {
+    return error::http::http2_protocol_error("HEADERS frame on stream 0");
+  }
+  ASSIGN_OR_RETURN(std::string_view fragment, remove_padding(header, payload));
+  if (header.has_flag(frame_flags::priority)) {
+    // Stream dependency and weight, which are ignored like PRIORITY frames.
+    if (fragment.size() < 5) {
+      return error::http::http2_frame_size_error("HEADERS frame is too short for its priority");
+    }
+    fragment.remove_prefix(5);
+  }
+
+  header_block_.assign(fragment);
+  continuation_end_stream_ = header.has_flag(frame_flags::end_stream);
+  if (header.has_flag(frame_flags::end_headers)) {
+    return handle_header_block(header.stream_id, continuation_end_stream_);
+  }
+  continuation_stream_id_ = header.stream_id;
+  return util::ok;
+}
+
+result<void> http2_service::handle_continuation(const frame_header& header, std::string_view payload) {
+  if (continuation_stream_id_ == 0 || header.stream_id != continuation_stream_id_) {
+    return error::http::http2_protocol_error("Unexpected CONTINUATION frame");
+  }
+  header_block_.append(payload);
+  if (header_block_.size() > options_.header_size_limit) {
+    return error::http::header_size_too_large();
+  }
+  if (header.has_flag(frame_flags::end_headers)) {
+    std::uint32_t stream_id = std::exchange(continuation_stream_id_, 0);
+    return handle_header_block(stream_id, continuation_end_stream_);
+  }
+  return util::ok;
+}
+
+result<void> http2_service::handle_header_block(std::uint32_t stream_id, bool end_stream) {
+  // Every block is decoded, even for streams that are refused, to keep the compression state in sync.
+  result<std::vector<hpack::header_field>> decoded = decoder_.decode(header_block_, options_.header_size_limit);
+  header_block_.clear();
+  std::vector<hpack::header_field> fields;
+  bool too_large = false;
+  if (decoded.is_ok()) {
+    fields = std::move(decoded).ok();
+  } else if (decoded.err().proxy_error() == errc::header_size_too_large) {
+    too_large = true;
+  } else {
+    return std::move(decoded).err();
+  }
+
+  if (auto it = streams_.find(stream_id); it != streams_.end()) {
+    // A second header block on a stream carries trailers, which end the request.
+    //
+    // Trailers are not forwarded, because the request is sent to the server with a known length.
+    std::shared_ptr<stream> s = it->second;
+    if (s->request_complete) {
+      reset_stream(s->id, error_code::stream_closed);
+    } else if (!end_stream) {
+      reset_stream(s->id, error_code::protocol_error);
+    } else {
+      s->request_complete = true;
+      if (!s->request_handled) {
+        handle_request(s);
+      }
+    }
+    return util::ok;
+  }
+
+  if (stream_id <= last_stream_id_) {
+    // The stream was already closed.
+    return util::ok;
+  }
+  if (stream_id % 2 == 0) {
+    return error::http::http2_protocol_error("Clients must open streams with odd identifiers");
+  }
+  last_stream_id_ = stream_id;
+
+  if (client_going_away_ || streams_.size() >= options_.http2_max_concurrent_streams) {
+    reset_stream(stream_id, error_code::refused_stream);
+    return util::ok;
+  }
+
+  auto s = std::make_shared<stream>(stream_id, ioc_, components_, peer_initial_window_size_);
+  s->service = this;
+  s->request_complete = end_stream;
+  streams_.emplace(stream_id, s);
+  update_idle_timer();
+
+  if (too_large) {
+    send_error_response(s, status::request_header_fields_too_large, "Header block size exceeds limit");
+    return util::ok;
+  }
+  if (result<void> res = build_request(*s, fields); !res.is_ok()) {
+    // A malformed request only affects its own stream.
+    reset_stream(stream_id, error_code::protocol_error);
+    return util::ok;
+  }
+  if (end_stream) {
+    handle_request(s);
+  }
+  return util::ok;
+}
+
+result<void> http2_service::build_request(stream& s, std::vector<hpack::header_field>& fields) {
+  request& req = s.exchange.request();
+  // The request is forwarded over HTTP/1.1, so interceptors see it as such.
+  req.set_version(version::http1_1);
+
+  std::string_view method_name;
+  std::string_view scheme;
+  std::string_view authority;
+  std::string_view path;
+  std::string cookies;
+  bool regular_headers_started = false;
+
+  for (const hpack::header_field& field : fields) {
+    if (has_uppercase(field.name)) {
+      return error::http::invalid_header("Header names must be lowercase");
+    }
+
+    if (!field.name.empty() && field.name.front() == ':') {
+      // Pseudo-headers take the place of the request line, and they must come first.
+      if (regular_headers_started) {
+        return error::http::invalid_header("Pseudo-header after regular header");
+      }
+      std::string_view* destination = nullptr;
+      if (field.name == ":method") {
+        destination = &method_name;
+      } else if (field.name == ":scheme") {
+        destination = &scheme;
+      } else if (field.name == ":authority") {
+        destination = &authority;
+      } else if (field.name == ":path") {
+        destination = &path;
+      } else {
+        return error::http::invalid_header(out::string::stream("Unknown pseudo-header ", field.name));
+      }
+      if (!destination->empty()) {
+        return error::http::invalid_header(out::string::stream("Repeated pseudo-header ", field.name));
+      }
+      *destination = field.value;
+      continue;
+    }
+
+    regular_headers_started = true;
+    if (std::find(connection_specific_headers.begin(), connection_specific_headers.end(), field.name) !=
+        connection_specific_headers.end()) {
+      return error::http::invalid_header(out::string::stream("Connection-specific header ", field.name));
+    }
+    if (field.name == "te" && field.value != "trailers") {
+      return error::http::invalid_header("TE header may only contain trailers");
+    }
+    if (field.name == "cookie") {
+      // Cookies may be split into separate headers to compress better, but HTTP/1.1 expects a single header.
+      if (!cookies.empty()) {
+        cookies += "; ";
+      }
+      cookies += field.value;
+      continue;
+    }
+    req.add_header(field.name, field.value);
+  }
+
+  if (!cookies.empty()) {
+    req.add_header(header_id::cookie, cookies);
+  }
+
+  if (method_name.empty()) {
+    return error::http::invalid_request_line("Missing :method pseudo-header");
+  }
+  ASSIGN_OR_RETURN(method verb, string_to_method(method_name));
+  req.set_method(verb);
+
+  if (verb == method::CONNECT) {
+    // Tunnels are not supported over HTTP/2, which is reported once the request is handled.
+    if (authority.empty()) {
+      return error::http::invalid_target_host("CONNECT request has no :authority pseudo-header");
+    }
+    ASSIGN_OR_RETURN(url target, url::parse_authority_form(authority));
+    req.set_target(std::move(target));
+    return util::ok;
+  }
+
+  if (scheme.empty() || path.empty()) {
+    return error::http::invalid_request_line("Missing :scheme or :path pseudo-header");
+  }
+
+  url target = url::parse_origin_form(path);
+  target.scheme = std::string(scheme);
+  if (!authority.empty()) {
+    target.netloc = url::parse_netloc(authority);
+    if (!req.has_header(header_id::host)) {
+      req.set_header_to_value(header_id::host, authority);
+    }
+  } else if (std::optional<std::string_view> host = req.get_optional_header(header_id::host); host.has_value()) {
+    target.netloc = url::parse_netloc(host.value());
+  } else {
+    return error::http::invalid_target_host("No host given.");
+  }
+  if (!target.netloc.has_port()) {
+    target.netloc.port = target.scheme == "https" ? 443 : 80;
+  }
+  req.set_target(std::move(target));
+  return util::ok;
+}
+
+void http2_service::handle_request(const std::shared_ptr<stream>& s) {
+  s->request_handled = true;
+  request& req = s->exchange.request();
+
+  req.set_body(std::move(s->request_body));
+  if (!req.body().empty() || req.has_header(header_id::content_length)) {
+    req.remove_header(header_id::content_length);
+    req.set_content_length();
+  }
+
+  // Errors from setting up the connection are reported on every stream.
+  if (flow_.error.has_proxy_error()) {
+    send_error_response(s, status::bad_gateway, flow_.error.get_message_or_proxy());
+    return;
+  }
+  if (req.method() == method::CONNECT) {
+    send_error_response(s, status::not_implemented, "CONNECT is not supported over HTTP/2");
+    return;
+  }
+
+  interceptors_.http.run(intercept::http_event::any_request, flow_, s->exchange);
+
+  // Insert Via header.
+  req.add_header(header_id::via, out::string::stream("2 ", constants::lowercase_name));
+
+  // The whole body has already been received.
+  req.remove_header(header_id::expect);
+
+  interceptors_.http.run(intercept::http_event::request, flow_, s->exchange);
+
+  // Response set by an interceptor.
+  if (s->exchange.has_response()) {
+    send_response(s);
+  } else if (is_self_connect(req.host_name(), req.host_port())) {
+    send_error_response(s, status::bad_request, error::self_connect().message());
+  } else {
+    send_request(s);
+  }
+}
+
+void http2_service::send_request(const std::shared_ptr<stream>& s) {
+  if (options_.http2_upstream && s->exchange.request().target().scheme == "https") {
+    send_request_on_session(s);
+  } else {
+    connect_server(s);
+  }
+}
+
+void http2_service::send_request_on_session(const std::shared_ptr<stream>& s) {
+  const request& req = s->exchange.request();
+  s->session = components_.http2_sessions.acquire(ioc_, components_, std::string(req.host_name()), req.host_port());
+  if (s->session == nullptr) {
+    // The server is known to only speak HTTP/1.1.
+    connect_server(s);
+    return;
+  }
+  s->session_request_id = s->session->send_request(req, [s](result<response> res) {
+    if (s->service != nullptr) {
+      s->service->on_session_response(s, std::move(res));
+    }
+  });
+}
+
+void http2_service::on_session_response(const std::shared_ptr<stream>& s, result<response> res) {
+  s->session.reset();
+  if (res.is_ok()) {
+    s->exchange.make_response() = std::move(res).ok();
+    handle_response(s);
+    return;
+  }
+
+  error::error_state error = std::move(res).err();
+  if (error.proxy_error() == errc::http2_not_negotiated) {
+    connect_server(s);
+  } else if (error.proxy_error() == errc::http2_stream_refused && !s->retried) {
+    // The server did not process the request, so it is safe to send again on a new session.
+    s->retried = true;
+    send_request_on_session(s);
+  } else if (error.boost_error() == boost::asio::error::operation_aborted) {
+    send_error_response(s, status::gateway_timeout, error.message());
+  } else {
+    send_error_response(s, status::bad_gateway, error.message());
+  }
+}
+
+void http2_service::connect_server(const std::shared_ptr<stream>& s) {
+  const request& req = s->exchange.request();
+  s->server.connect_async(std::string(req.host_name()), req.host_port(),
+                          [s](const boost::system::error_code& error) {
+                            if (s->service != nullptr) {
+                              s->service->on_connect_server(s, error);
+                            }
+                          });
+}
+
+void http2_service::on_connect_server(const std::shared_ptr<stream>& s, const boost::system::error_code& error) {
+  if (error != boost::system::errc::success) {
+    on_server_error(s, error);
+  } else if (s->exchange.request().target().scheme != "https" || s->server.secured()) {
+    forward_request(s);
+  } else if (result<void> res = s->server.establish_tls_async(server_tls_args_,
+                                                              [s](const boost::system::error_code& error) {
+                                                                if (s->service != nullptr) {
+                                                                  s->service->on_establish_tls(s, error);
+                                                                }
+                                                              });
+             !res.is_ok()) {
+    send_error_response(s, status::bad_gateway, res.err().message());
+  }
+}
+
+void http2_service::on_establish_tls(const std::shared_ptr<stream>& s, const boost::system::error_code& error) {
+  if (error != boost::system::errc::success) {
+    on_server_error(s, error);
+  } else {
+    forward_request(s);
+  }
+}
+
+void http2_service::forward_request(const std::shared_ptr<stream>& s) {
+  // The connection is in use until the response is fully read.
+  s->server.set_reusable(false);
+  s->server << s->exchange.request();
+  s->server.write_async([s](const boost::system::error_code& error, std::size_t bytes_transferred) {
+    if (s->service != nullptr) {
+      s->service->on_forward_request(s, error);
+    }
+  });
+}
+
+void http2_service::on_forward_request(const std::shared_ptr<stream>& s, const boost::system::error_code& error) {
+  if (error != boost::system::errc::success) {
+    on_server_error(s, error);
+  } else {
+    s->exchange.make_response();
+    read_response_head(s);
+  }
+}
+
+void http2_service::read_response_head(const std::shared_ptr<stream>& s) {
+  if (result<void> res = read_response_head_impl(s); !res.is_ok()) {
+    send_error_response(s, status::bad_gateway, res.err().message());
+  }
+}
+
+result<void> http2_service::read_response_head_impl(const std::shared_ptr<stream>& s) {
+  ASSIGN_OR_RETURN(bool done, s->parser.read_response_head(s->server.input_buffer()));
+  if (!done) {
+    // Need more data from the socket.
+    s->server.read_async([s](const boost::system::error_code& error, std::size_t bytes_transferred) {
+      if (s->service != nullptr) {
+        s->service->on_read_response_head(s, error);
+      }
+    });
+  } else if (s->exchange.response().status() == status::switching_protocols) {
+    return error::http::invalid_response_line("Protocol upgrades are not supported over HTTP/2");
+  } else if (s->exchange.response().is_1xx()) {
+    // Interim responses are not passed on, because the whole request has already been sent.
+    s->exchange.make_response();
+    return read_response_head_impl(s);
+  } else {
+    read_response_body(s);
+  }
+  return util::ok;
+}
+
+void http2_service::on_read_response_head(const std::shared_ptr<stream>& s, const boost::system::error_code& error) {
+  if (error != boost::system::errc::success) {
+    on_server_error(s, error);
+  } else {
+    // Go back to parsing the head with the new data.
+    read_response_head(s);
+  }
+}
+
+void http2_service::read_response_body(const std::shared_ptr<stream>& s, bool eof) {
+  if (result<void> res = read_response_body_impl(s, eof); !res.is_ok()) {
+    send_error_response(s, status::bad_gateway, res.err().message());
+  }
+}
+
+result<void> http2_service::read_response_body_impl(const std::shared_ptr<stream>& s, bool eof) {
+  std::istream input = s->server.input_stream();
+  ASSIGN_OR_RETURN(bool done, s->parser.read_body(input, http1::http_parser::message_mode::response));
+  if (done) {
+    handle_response(s);
+  } else if (eof) {
+    // Body is not finished, and nothing more to read.
+    error::error_state err;
+    err.set_boost_error(boost::asio::error::eof);
+    err.set_proxy_error(errc::malformed_response_body);
+    return err;
+  } else {
+    // Need more data from the socket.
+    s->server.read_async([s](const boost::system::error_code& error, std::size_t bytes_transferred) {
+      if (s->service != nullptr) {
+        s->service->on_read_response_body(s, error, bytes_transferred);
+      }
+    });
+  }
+  return util::ok;
+}
+
+void http2_service::on_read_response_body(const std::shared_ptr<stream>& s, const boost::system::error_code& error,
+                                          std::size_t bytes_transferred) {
+  if (error == boost::asio::error::eof) {
+    // This may be desired if reading body until end of stream.
+    read_response_body(s, true);
+  } else if (error != boost::system::errc::success) {
+    on_server_error(s, error);
+  } else {
+    read_response_body(s, bytes_transferred == 0);
+  }
+}
+
+void http2_service::handle_response(const std::shared_ptr<stream>& s) {
+  response& res = s->exchange.response();
+  res.set_header_to_value(out::string::stream(proxy::constants::server_name, "-Connection-Id"),
+                          flow_.id().to_string());
+  interceptors_.http.run(intercept::http_event::response, flow_, s->exchange);
+
+  // The server connection can carry another request, from this connection or from another flow.
+  s->server.set_reusable(!s->exchange.request().should_close_connection() && !res.should_close_connection());
+  s->server.release();
+
+  send_response(s);
+}
+
+void http2_service::on_server_error(const std::shared_ptr<stream>& s, const boost::system::error_code& error) {
+  if (error == boost::asio::error::operation_aborted) {
+    send_error_response(s, status::gateway_timeout, error.message());
+  } else {
+    send_error_response(s, status::bad_gateway, error.message());
+  }
+}
+
+void http2_service::send_response(const std::shared_ptr<stream>& s) {
+  if (s->service == nullptr || s->response_started) {
+    return;
+  }
+  s->response_started = true;
+
+  response& res = s->exchange.response();
+  bool head_request = s->exchange.request().method() == method::HEAD;
+
+  // A body that was sent in chunks has been decoded, so its length is known now.
+  if (res.has_header(header_id::transfer_encoding) && !head_request) {
+    res.remove_header(header_id::content_length);
+    res.set_content_length();
+  }
+
+  std::string block;
+  encoder_.begin_block(block);
+  encoder_.encode(":status", std::to_string(static_cast<int>(res.status())), block);
+  for (const header_collection::entry& header : res.all_headers()) {
+    std::string name = util::string::lowercase(header.name());
+    if (std::find(connection_specific_headers.begin(), connection_specific_headers.end(), name) !=
+        connection_specific_headers.end()) {
+      continue;
+    }
+    encoder_.encode(name, header.value(), block, header.id() == header_id::set_cookie);
+  }
+
+  std::string_view body = head_request ? std::string_view() : res.body();
+  write_headers(send_buffer_, s->id, block, body.empty(), peer_max_frame_size_);
+  if (body.empty()) {
+    finish_stream(s);
+  } else {
+    s->pending_data = std::string(body);
+    queue_data(s);
+    send_data();
+  }
+  flush();
+}
+
+void http2_service::send_error_response(const std::shared_ptr<stream>& s, status response_status,
+                                        std::string_view msg) {
+  if (s->service == nullptr || s->response_started) {
+    return;
+  }
+
+  response& res = s->exchange.make_response();
+  res.set_status(response_status);
+
+  std::string_view reason = "Unknown status code";
+  if (result<std::string_view> res = status_to_reason(response_status); res.is_ok()) {
+    reason = std::move(res).ok();
+  }
+
+  // A small hint of server-side rendering.
+  std::stringstream content;
+  content << "<html><head>";
+  content << "<title>" << response_status << ' ' << reason << "</title>";
+  content << "</head><body>";
+  content << "<h1>" << response_status << ' ' << reason << "</h1>";
+  content << "<p>" << msg << "</p>";
+  content << "</body></html>";
+  res.set_body(content.str());
+
+  res.add_header(header_id::server, constants::full_server_name.data());
+  res.add_header(header_id::content_type, "text/html");
+  res.set_content_length();
+
+  interceptors_.http.run(intercept::http_event::error, flow_, s->exchange);
+  send_response(s);
+}
+
+void http2_service::queue_data(const std::shared_ptr<stream>& s) {
+  if (!s->queued && s->pending_offset < s->pending_data.size()) {
+    s->queued = true;
+    send_queue_.push_back(s);
+  }
+}
+
+void http2_service::send_data() {
+  // Streams take turns sending one frame at a time, so one large response cannot hold up the others.
+  while (!send_queue_.empty() && connection_send_window_ > 0 && send_buffer_.size() < max_send_buffer_size) {
+    std::shared_ptr<stream> s = std::move(send_queue_.front());
+    send_queue_.pop_front();
+    s->queued = false;
+    if (s->service == nullptr) {
+      continue;
+    }
+    if (s->send_window <= 0) {
+      // Queued again by the client's next WINDOW_UPDATE for the stream.
+      continue;
+    }
+
+    std::int64_t remaining = static_cast<std::int64_t>(s->pending_data.size() - s->pending_offset);
+    std::int64_t size = std::min<std::int64_t>(
+        {remaining, s->send_window, connection_send_window_, static_cast<std::int64_t>(peer_max_frame_size_)});
+    bool end_stream = size == remaining;
+    write_data(send_buffer_, s->id,
+               std::string_view(s->pending_data).substr(s->pending_offset, static_cast<std::size_t>(size)),
+               end_stream);
+    s->pending_offset += static_cast<std::size_t>(size);
+    s->send_window -= size;
+    connection_send_window_ -= size;
+
+    if (end_stream) {
+      finish_stream(s);
+    } else {
+      queue_data(s);
+    }
+  }
+}
+
+void http2_service::reset_stream(std::uint32_t stream_id, error_code code) {
+  write_rst_stream(send_buffer_, stream_id, code);
+  if (auto it = streams_.find(stream_id); it != streams_.end()) {
+    close_stream(it->second);
+  }
+}
+
+void http2_service::finish_stream(const std::shared_ptr<stream>& s) {
+  // The response did not wait for the whole request, so the client is told to stop sending it.
+  if (!s->request_complete) {
+    write_rst_stream(send_buffer_, s->id, error_code::no_error);
+  }
+  close_stream(s);
+}
+
+void http2_service::close_stream(const std::shared_ptr<stream>& s) {
+  s->service = nullptr;
+  // Cancels any server operations still in progress. A server connection that was released is unaffected.
+  s->server.disconnect();
+  if (s->session != nullptr) {
+    s->session->cancel(s->session_request_id);
+    s->session.reset();
+  }
+  streams_.erase(s->id);
+  update_idle_timer();
+  if (client_going_away_ && streams_.empty()) {
+    go_away(error_code::no_error);
+  }
+}
+
+result<void> http2_service::handle_rst_stream(const frame_header& header, std::string_view payload) {
+  if (header.stream_id == 0 || header.stream_id > last_stream_id_) {
+    return error::http::http2_protocol_error("RST_STREAM frame on an idle stream");
+  }
+  if (payload.size() != 4) {
+    return error::http::http2_frame_size_error("RST_STREAM frame must be 4 bytes");
+  }
+  if (auto it = streams_.find(header.stream_id); it != streams_.end()) {
+    close_stream(it->second);
+  }
+  return util::ok;
+}
+
+result<void> http2_service::handle_settings(const frame_header& header, std::string_view payload) {
+  if (header.stream_id != 0) {
+    return error::http::http2_protocol_error("SETTINGS frame on a stream");
+  }
+  if (header.has_flag(frame_flags::ack)) {
+    if (!payload.empty()) {
+      return error::http::http2_frame_size_error("SETTINGS acknowledgement must be empty");
+    }
+    return util::ok;
+  }
+  if (payload.size() % 6 != 0) {
+    return error::http::http2_frame_size_error("SETTINGS frame length must be a multiple of 6");
+  }
+
+  for (std::size_t offset = 0; offset < payload.size(); offset += 6) {
+    auto setting = static_cast<setting_id>(read_uint(payload.data() + offset, 2));
+    std::uint32_t value = read_uint(payload.data() + offset + 2, 4);
+    switch (setting) {
+      case setting_id::header_table_size:
+        encoder_.set_max_table_size(value);
+        break;
+      case setting_id::enable_push:
+        if (value > 1) {
+          return error::http::http2_protocol_error("SETTINGS_ENABLE_PUSH must be 0 or 1");
+        }
+        break;
+      case setting_id::initial_window_size: {
+        if (value > max_window_size) {
+          return error::http::http2_flow_control_error("SETTINGS_INITIAL_WINDOW_SIZE is too large");
+        }
+        // The change applies to every open stream.
+        std::int64_t delta = static_cast<std::int64_t>(value) - static_cast<std::int64_t>(peer_initial_window_size_);
+        peer_initial_window_size_ = value;
+        for (auto& [stream_id, s] : streams_) {
+          s->send_window += delta;
+          if (s->send_window > max_window_size) {
+            return error::http::http2_flow_control_error("Stream window is too large");
+          }
+          queue_data(s);
+        }
+        break;
+      }
+      case setting_id::max_frame_size:
+        if (value < default_max_frame_size || value > max_allowed_frame_size) {
+          return error::http::http2_protocol_error("SETTINGS_MAX_FRAME_SIZE is out of range");
+        }
+        peer_max_frame_size_ = value;
+        break;
+      default:
+        // The remaining settings only limit what the proxy does not do, and unknown settings must be ignored.
+        break;
+    }
+  }
+
+  write_settings_ack(send_buffer_);
+  send_data();
+  return util::ok;
+}
+
+result<void> http2_service::handle_ping(const frame_header& header, std::string_view payload) {
+  if (header.stream_id != 0) {
+    return error::http::http2_protocol_error("PING frame on a stream");
+  }
+  if (payload.size() != 8) {
+    return error::http::http2_frame_size_error("PING frame must be 8 bytes");
+  }
+  if (!header.has_flag(frame_flags::ack)) {
+    write_ping_ack(send_buffer_, payload);
+  }
+  return util::ok;
+}
+
+result<void> http2_service::handle_goaway(const frame_header& header, std::string_view payload) {
+  if (header.stream_id != 0) {
+    return error::http::http2_protocol_error("GOAWAY frame on a stream");
+  }
+  if (payload.size() < 8) {
+    return error::http::http2_frame_size_error("GOAWAY frame is too short");
+  }
+  // Streams already open are finished, but no new ones are accepted.
+  client_going_away_ = true;
+  if (streams_.empty()) {
+    go_away(error_code::no_error);
+  }
+  return util::ok;
+}
+
+result<void> http2_service::handle_window_update(const frame_header& header, std::string_view payload) {
+  if (payload.size() != 4) {
+    return error::http::http2_frame_size_error("WINDOW_UPDATE frame must be 4 bytes");
+  }
+  std::uint32_t increment = read_uint(payload.data(), 4) & 0x7fffffff;
+
+  if (header.stream_id == 0) {
+    if (increment == 0) {
+      return error::http::http2_protocol_error("WINDOW_UPDATE frame with no increment");
+    }
+    connection_send_window_ += increment;
+    if (connection_send_window_ > max_window_size) {
+      return error::http::http2_flow_control_error("Connection window is too large");
+    }
+    send_data();
+    return util::ok;
+  }
+
+  if (header.stream_id > last_stream_id_) {
+    return error::http::http2_protocol_error("WINDOW_UPDATE frame on an idle stream");
+  }
+  auto it = streams_.find(header.stream_id);
+  if (it == streams_.end()) {
+    return util::ok;
+  }
+  std::shared_ptr<stream> s = it->second;
+  if (increment == 0) {
+    reset_stream(s->id, error_code::protocol_error);
+    return util::ok;
+  }
+  s->send_window += increment;
+  if (s->send_window > max_window_size) {
+    reset_stream(s->id, error_code::flow_control_error);
+    return util::ok;
+  }
+  queue_data(s);
+  send_data();
+  return util::ok;
+}
+
+void http2_service::connection_error(const error::error_state& error) {
+  flow_.error = error;
+  go_away(to_http2_error(error));
+}
+
+void http2_service::go_away(error_code code) {
+  if (closing_) {
+    return;
+  }
+  write_goaway(send_buffer_, last_stream_id_, code);
+  closing_ = true;
+  idle_timer_.cancel();
+  flush();
+}
+
+void http2_service::flush() {
+  if (writing_ || send_buffer_.empty()) {
+    return;
+  }
+  flow_.client << send_buffer_;
+  send_buffer_.clear();
+  writing_ = true;
+  flow_.client.write_untimed_async(std::bind_front(&http2_service::on_flush, this));
+}
+
+void http2_service::on_flush(const boost::system::error_code& error, std::size_t bytes_transferred) {
+  writing_ = false;
+  if (error != boost::system::errc::success) {
+    flow_.error.set_boost_error(error);
+    send_buffer_.clear();
+    finish();
+  } else if (closing_) {
+    finish();
+  } else {
+    // Flow control may have held back data that fits now that the buffer is empty.
+    send_data();
+    flush();
+  }
+}
+
+void http2_service::finish() {
+  closing_ = true;
+  // The service can only stop once no operation on the client connection is left to call back into it.
+  flush();
+  if (writing_) {
+    return;
+  }
+  if (reading_) {
+    boost::system::error_code ignored;
+    flow_.client.socket().cancel(ignored);
+    return;
+  }
+  stop();
+}
+
+void http2_service::update_idle_timer() {
+  if (streams_.empty() && !closing_) {
+    idle_timer_.expires_from_now(options_.timeout);
+    idle_timer_.async_wait(std::bind_front(&http2_service::on_idle_timeout, this));
+  } else {
+    idle_timer_.cancel();
+  }
+}
+
+void http2_service::on_idle_timeout(const boost::system::error_code& error) {
+  // The timer is canceled when the service is destroyed, so nothing else may be touched in that case.
+  if (error == boost::asio::error::operation_aborted) {
+    return;
+  }
+  if (streams_.empty()) {
+    go_away(error_code::no_error);
+  }
+}
+
+}  // namespace proxy::http::http2
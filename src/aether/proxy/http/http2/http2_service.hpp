@@ -0,0 +1,228 @@
+/*********************************************
+
+  Copyright (c) Jackson Nestelroad 2020
+  jackson.nestelroad.com
+
+*********************************************/
+
+#pragma once
+
+#include <array>
+#include <boost/asio.hpp>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "aether/proxy/base_service.hpp"
+#include "aether/proxy/connection/connection_flow.hpp"
+#include "aether/proxy/connection/server_connection.hpp"
+#include "aether/proxy/http/exchange.hpp"
+#include "aether/proxy/http/http1/http_parser.hpp"
+#include "aether/proxy/http/http2/client_session.hpp"
+#include "aether/proxy/http/http2/frame.hpp"
+#include "aether/proxy/http/http2/hpack.hpp"
+#include "aether/proxy/tls/openssl/ssl_context.hpp"
+#include "aether/proxy/types.hpp"
+
+namespace proxy::http::http2 {
+
+// Service for handling HTTP/2 connections from clients.
+//
+// Every stream the client opens is its own HTTP exchange. Requests are run through the same HTTP interceptors as
+// HTTP/1.x requests and forwarded to the server over HTTP/1.1, each on a server connection of its own taken from the
+// server connection pool when possible, or as streams of a shared HTTP/2 session if enabled. Responses are sent back on
+// their stream as soon as they are complete, so a slow response never holds up the others.
+class http2_service : public base_service {
+ public:
+  http2_service(connection::connection_flow& flow, connection_handler& owner, server_components& components);
+  ~http2_service() override;
+  void start() override;
+
+ private:
+  // State of a single stream, which carries one request and its response.
+  //
+  // Streams are shared with the callbacks of their server connection, which may outlive the service.
+  struct stream {
+    stream(std::uint32_t stream_id, boost::asio::io_context& ioc, server_components& components,
+           std::int64_t initial_send_window);
+    stream() = delete;
+    ~stream() = default;
+    stream(const stream& other) = delete;
+    stream& operator=(const stream& other) = delete;
+    stream(stream&& other) noexcept = delete;
+    stream& operator=(stream&& other) noexcept = delete;
+
+    std::uint32_t id;
+    http::exchange exchange;
+    http1::http_parser parser;
+    connection::server_connection server;
+
+    // The service the stream belongs to, cleared once the stream is closed or the service is destroyed.
+    http2_service* service = nullptr;
+
+    // The request body received so far.
+    std::string request_body;
+
+    // The client has sent the whole request, with END_STREAM.
+    bool request_complete = false;
+
+    // The request has been handed to the interceptors, so the stream is waiting on its response.
+    bool request_handled = false;
+
+    // The response head has been sent, so the stream is only waiting for its body to be sent.
+    bool response_started = false;
+
+    // The response body still to be sent in DATA frames.
+    std::string pending_data;
+    std::size_t pending_offset = 0;
+
+    // The stream is waiting in the send queue.
+    bool queued = false;
+
+    // How many more bytes the client allows to be sent on the stream.
+    std::int64_t send_window;
+
+    // The shared HTTP/2 session the request is waiting on, if any.
+    std::shared_ptr<client_session> session;
+    std::uint64_t session_request_id = 0;
+
+    // The request has already been sent again after its session refused it.
+    bool retried = false;
+  };
+
+  // Methods are quite split up because socket operations are asynchronous.
+
+  void read_frames();
+  result<void> read_frames_impl();
+  void on_read_frames(const boost::system::error_code& error, std::size_t bytes_transferred);
+
+  result<void> handle_frame(const frame_header& header, std::string_view payload);
+  result<void> handle_data(const frame_header& header, std::string_view payload);
+  result<void> handle_headers(const frame_header& header, std::string_view payload);
+  result<void> handle_continuation(const frame_header& header, std::string_view payload);
+  result<void> handle_rst_stream(const frame_header& header, std::string_view payload);
+  result<void> handle_settings(const frame_header& header, std::string_view payload);
+  result<void> handle_ping(const frame_header& header, std::string_view payload);
+  result<void> handle_goaway(const frame_header& header, std::string_view payload);
+  result<void> handle_window_update(const frame_header& header, std::string_view payload);
+
+  // Decodes a complete header block and starts a stream or finishes a request with it.
+  result<void> handle_header_block(std::uint32_t stream_id, bool end_stream);
+
+  // Builds the request of a new stream from its decoded headers.
+  //
+  // An error means the request is malformed, which only resets the stream.
+  result<void> build_request(stream& s, std::vector<hpack::header_field>& fields);
+
+  void handle_request(const std::shared_ptr<stream>& s);
+  void send_request(const std::shared_ptr<stream>& s);
+  void send_request_on_session(const std::shared_ptr<stream>& s);
+  void on_session_response(const std::shared_ptr<stream>& s, result<response> res);
+  void connect_server(const std::shared_ptr<stream>& s);
+  void on_connect_server(const std::shared_ptr<stream>& s, const boost::system::error_code& error);
+  void on_establish_tls(const std::shared_ptr<stream>& s, const boost::system::error_code& error);
+  void forward_request(const std::shared_ptr<stream>& s);
+  void on_forward_request(const std::shared_ptr<stream>& s, const boost::system::error_code& error);
+  void read_response_head(const std::shared_ptr<stream>& s);
+  result<void> read_response_head_impl(const std::shared_ptr<stream>& s);
+  void on_read_response_head(const std::shared_ptr<stream>& s, const boost::system::error_code& error);
+  void read_response_body(const std::shared_ptr<stream>& s, bool eof = false);
+  result<void> read_response_body_impl(const std::shared_ptr<stream>& s, bool eof);
+  void on_read_response_body(const std::shared_ptr<stream>& s, const boost::system::error_code& error,
+                             std::size_t bytes_transferred);
+  void handle_response(const std::shared_ptr<stream>& s);
+
+  // Sends the response of the exchange on its stream.
+  void send_response(const std::shared_ptr<stream>& s);
+
+  // Sends an HTML error response on the stream.
+  //
+  // Overwrites any previous response data in the HTTP exchange.
+  void send_error_response(const std::shared_ptr<stream>& s, status response_code,
+                           std::string_view msg = "No message given");
+
+  // Sends an error response for a failed server operation.
+  void on_server_error(const std::shared_ptr<stream>& s, const boost::system::error_code& error);
+
+  // Closes a single stream with RST_STREAM.
+  void reset_stream(std::uint32_t stream_id, error_code code);
+
+  // Closes a stream whose response has been sent in full.
+  void finish_stream(const std::shared_ptr<stream>& s);
+
+  // Forgets a stream that has finished or been reset.
+  void close_stream(const std::shared_ptr<stream>& s);
+
+  // Ends the connection with GOAWAY because of an error that affects every stream.
+  void connection_error(const error::error_state& error);
+
+  // Sends GOAWAY, after which the service stops once all frames are written.
+  void go_away(error_code code);
+
+  // Stops the service once no operation on the client connection is in progress.
+  void finish();
+
+  // Adds the stream to the send queue if it has response data left to send.
+  void queue_data(const std::shared_ptr<stream>& s);
+
+  // Moves as much queued response data into DATA frames as the flow control windows allow.
+  void send_data();
+
+  // Writes all buffered frames to the client if no write is already in progress.
+  void flush();
+  void on_flush(const boost::system::error_code& error, std::size_t bytes_transferred);
+
+  // Starts the idle timer if no streams are open, or cancels it otherwise.
+  void update_idle_timer();
+  void on_idle_timeout(const boost::system::error_code& error);
+
+  // Limit on buffered but unwritten response data before DATA frames wait for the client to catch up.
+  static constexpr std::size_t max_send_buffer_size = 64 * 1024;
+
+  // Settings for securing the server connections of streams.
+  tls::openssl::ssl_context_args server_tls_args_;
+
+  hpack::decoder decoder_;
+  hpack::encoder encoder_;
+
+  std::unordered_map<std::uint32_t, std::shared_ptr<stream>> streams_;
+
+  // Streams with response data waiting to be sent, served in turn.
+  std::deque<std::shared_ptr<stream>> send_queue_;
+
+  // Highest stream identifier the client has opened.
+  std::uint32_t last_stream_id_ = 0;
+
+  // Header block being collected across CONTINUATION frames, or 0 if none.
+  std::uint32_t continuation_stream_id_ = 0;
+  bool continuation_end_stream_ = false;
+  std::string header_block_;
+
+  bool preface_received_ = false;
+
+  // Settings the client sent.
+  std::uint32_t peer_initial_window_size_ = default_initial_window_size;
+  std::uint32_t peer_max_frame_size_ = default_max_frame_size;
+
+  // How many more bytes the client allows to be sent on the connection.
+  std::int64_t connection_send_window_ = default_initial_window_size;
+
+  // Frames waiting to be written to the client.
+  std::string send_buffer_;
+  bool writing_ = false;
+  bool reading_ = false;
+
+  // GOAWAY has been sent, so the service stops once all frames are written.
+  bool closing_ = false;
+
+  // The client has sent GOAWAY, so the service stops once all open streams finish.
+  bool client_going_away_ = false;
+
+  boost::asio::deadline_timer idle_timer_;
+};
+
+}  // namespace proxy::http::http2
@@ -0,0 +1,110 @@
+/*********************************************
+
+  Copyright (c) Jackson Nestelroad 2020
+  jackson.nestelroad.com
+
+*********************************************/
+
+#include "session_pool.hpp"
+
+#include <boost/asio.hpp>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "aether/proxy/concurrent/io_context_pool.hpp"
+#include "aether/proxy/http/http2/client_session.hpp"
+#include "aether/util/console.hpp"
+
+namespace proxy::http::http2 {
+
+namespace {
+
+// How long a server that did not negotiate HTTP/2 is skipped.
+const boost::posix_time::time_duration unsupported_duration = boost::posix_time::minutes(10);
+
+// Bound on remembered servers per io_context, so many distinct hosts cannot grow the map forever.
+constexpr std::size_t max_unsupported_per_shard = 1024;
+
+}  // namespace
+
+session_pool::session_pool(concurrent::io_context_pool& io_contexts) : multiplexed_count_(0) {
+  for (std::size_t i = 0; i < io_contexts.size(); ++i) {
+    shards_.emplace(&io_contexts.get_io_context(i), std::make_unique<shard>());
+  }
+}
+
+session_pool::shard* session_pool::get_shard(boost::asio::io_context& ioc) {
+  auto it = shards_.find(&ioc);
+  return it == shards_.end() ? nullptr : it->second.get();
+}
+
+std::shared_ptr<client_session> session_pool::acquire(boost::asio::io_context& ioc, server_components& components,
+                                                      const std::string& host, port_t port) {
+  shard* sh = get_shard(ioc);
+  if (sh == nullptr) {
+    return nullptr;
+  }
+
+  std::string key = out::string::stream(host, ':', port);
+  std::shared_ptr<client_session> session;
+  {
+    std::lock_guard<std::mutex> lock(sh->mutex);
+    if (auto it = sh->unsupported.find(key); it != sh->unsupported.end()) {
+      if (boost::asio::deadline_timer::traits_type::now() < it->second) {
+        return nullptr;
+      }
+      sh->unsupported.erase(it);
+    }
+
+    if (auto it = sh->sessions.find(key); it != sh->sessions.end() && it->second->usable()) {
+      multiplexed_count_.fetch_add(1, std::memory_order_relaxed);
+      return it->second;
+    }
+
+    session = std::make_shared<client_session>(ioc, components, key, host, port);
+    sh->sessions[key] = session;
+  }
+
+  // Starting the session outside of the lock keeps the critical section to the map operations.
+  session->start();
+  return session;
+}
+
+void session_pool::remove(boost::asio::io_context& ioc, const client_session& session) {
+  shard* sh = get_shard(ioc);
+  if (sh == nullptr) {
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(sh->mutex);
+  // A newer session may already have taken the key.
+  if (auto it = sh->sessions.find(std::string(session.key()));
+      it != sh->sessions.end() && it->second.get() == &session) {
+    sh->sessions.erase(it);
+  }
+}
+
+void session_pool::mark_unsupported(boost::asio::io_context& ioc, const std::string& key) {
+  shard* sh = get_shard(ioc);
+  if (sh == nullptr) {
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(sh->mutex);
+  if (sh->unsupported.size() >= max_unsupported_per_shard && !sh->unsupported.contains(key)) {
+    sh->unsupported.erase(sh->unsupported.begin());
+  }
+  sh->unsupported[key] = boost::asio::deadline_timer::traits_type::now() + unsupported_duration;
+}
+
+std::size_t session_pool::session_count() const {
+  std::size_t count = 0;
+  for (const auto& [ioc, sh] : shards_) {
+    std::lock_guard<std::mutex> lock(sh->mutex);
+    count += sh->sessions.size();
+  }
+  return count;
+}
+
+}  // namespace proxy::http::http2
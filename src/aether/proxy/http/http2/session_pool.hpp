@@ -0,0 +1,77 @@
+/*********************************************
+
+  Copyright (c) Jackson Nestelroad 2020
+  jackson.nestelroad.com
+
+*********************************************/
+
+#pragma once
+
+#include <atomic>
+#include <boost/asio.hpp>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "aether/proxy/concurrent/io_context_pool.hpp"
+#include "aether/proxy/types.hpp"
+
+namespace proxy {
+class server_components;
+}
+
+namespace proxy::http::http2 {
+
+class client_session;
+
+// Pool of HTTP/2 sessions to servers, shared by every flow on the same io_context.
+//
+// Each io_context has at most one session per server, which carries all requests sent to that server from the
+// io_context at once. Servers that did not negotiate HTTP/2 are remembered for a while, so requests to them go straight
+// to connections of their own.
+class session_pool {
+ public:
+  session_pool(concurrent::io_context_pool& io_contexts);
+  session_pool() = delete;
+  ~session_pool() = default;
+  session_pool(const session_pool& other) = delete;
+  session_pool& operator=(const session_pool& other) = delete;
+  session_pool(session_pool&& other) noexcept = delete;
+  session_pool& operator=(session_pool&& other) noexcept = delete;
+
+  // Returns the session for the server, starting a new one if there is no usable session.
+  //
+  // Returns nullptr if the server is known not to support HTTP/2.
+  std::shared_ptr<client_session> acquire(boost::asio::io_context& ioc, server_components& components,
+                                          const std::string& host, port_t port);
+
+  // Forgets a session that no longer accepts new requests.
+  void remove(boost::asio::io_context& ioc, const client_session& session);
+
+  // Remembers that a server did not negotiate HTTP/2.
+  void mark_unsupported(boost::asio::io_context& ioc, const std::string& key);
+
+  // Returns the number of sessions across all io_contexts.
+  std::size_t session_count() const;
+
+  // Returns the number of requests sent on a session that was already open.
+  inline std::size_t multiplexed_request_count() const { return multiplexed_count_.load(std::memory_order_relaxed); }
+
+ private:
+  // Sessions for a single io_context.
+  struct shard {
+    mutable std::mutex mutex;
+    std::unordered_map<std::string, std::shared_ptr<client_session>> sessions;
+    std::unordered_map<std::string, boost::posix_time::ptime> unsupported;
+  };
+
+  shard* get_shard(boost::asio::io_context& ioc);
+
+  // Built once at construction and never modified, so lookups do not need a lock.
+  std::unordered_map<boost::asio::io_context*, std::unique_ptr<shard>> shards_;
+
+  std::atomic<std::size_t> multiplexed_count_;
+};
+
+}  // namespace proxy::http::http2
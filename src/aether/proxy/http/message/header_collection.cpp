@@ -0,0 +1,110 @@
+/*********************************************
+
+  Copyright (c) Jackson Nestelroad 2020
+  jackson.nestelroad.com
+
+*********************************************/
+
+#include "header_collection.hpp"
+
+#include <algorithm>
+#include <iterator>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "aether/util/string.hpp"
+
+namespace proxy::http {
+
+namespace {
+
+// Indexed by header ID.
+constexpr std::string_view known_header_names[] = {
+    "",
+#define X(name, str) str,
+    HTTP_KNOWN_HEADERS(X)
+#undef X
+};
+
+static_assert(std::size(known_header_names) <= 64, "Well-known header IDs must fit in a 64-bit mask");
+
+}  // namespace
+
+header_id string_to_header_id(std::string_view name) {
+  // Comparing lengths first rejects almost every candidate without looking at characters.
+  for (std::size_t i = 1; i < std::size(known_header_names); ++i) {
+    std::string_view known = known_header_names[i];
+    if (known.size() == name.size() && util::string::iequals_fn(known, name)) {
+      return static_cast<header_id>(i);
+    }
+  }
+  return header_id::other;
+}
+
+std::string_view header_id_to_string(header_id id) { return known_header_names[static_cast<std::size_t>(id)]; }
+
+header_collection::entry::entry(header_id id, std::string_view name, std::string_view value)
+    : id_(id), name_size_(static_cast<std::uint32_t>(name.size())) {
+  data_.reserve(name.size() + value.size());
+  data_.append(name);
+  data_.append(value);
+}
+
+header_collection::header_collection(std::initializer_list<std::pair<std::string_view, std::string_view>> headers) {
+  entries_.reserve(headers.size());
+  for (const auto& [name, value] : headers) {
+    add(name, value);
+  }
+}
+
+bool header_collection::matches(const entry& header, const header_key& key) {
+  if (key.id() != header_id::other) {
+    return header.id() == key.id();
+  }
+  return header.id() == header_id::other && util::string::iequals_fn(header.name(), key.name());
+}
+
+void header_collection::add(header_key key, std::string_view value) {
+  entries_.emplace_back(key.id(), key.name(), value);
+  if (key.id() != header_id::other) {
+    known_present_ |= bit(key.id());
+  }
+}
+
+void header_collection::remove(header_key key) {
+  if (!maybe_contains(key)) {
+    return;
+  }
+  std::erase_if(entries_, [&key](const entry& header) { return matches(header, key); });
+  if (key.id() != header_id::other) {
+    known_present_ &= ~bit(key.id());
+  }
+}
+
+bool header_collection::contains(header_key key) const { return find(key) != nullptr; }
+
+const header_collection::entry* header_collection::find(header_key key) const {
+  if (!maybe_contains(key)) {
+    return nullptr;
+  }
+  auto it =
+      std::find_if(entries_.begin(), entries_.end(), [&key](const entry& header) { return matches(header, key); });
+  return it == entries_.end() ? nullptr : &*it;
+}
+
+std::vector<std::string_view> header_collection::get_all(header_key key) const {
+  std::vector<std::string_view> out;
+  any_of(key, [&out](std::string_view value) {
+    out.push_back(value);
+    return false;
+  });
+  return out;
+}
+
+void header_collection::clear() {
+  entries_.clear();
+  known_present_ = 0;
+}
+
+}  // namespace proxy::http
@@ -0,0 +1,186 @@
+/*********************************************
+
+  Copyright (c) Jackson Nestelroad 2020
+  jackson.nestelroad.com
+
+*********************************************/
+
+#pragma once
+
+#include <cstdint>
+#include <initializer_list>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#define HTTP_KNOWN_HEADERS(X)                             \
+  X(accept_encoding, "Accept-Encoding")                   \
+  X(age, "Age")                                           \
+  X(authorization, "Authorization")                       \
+  X(cache_control, "Cache-Control")                       \
+  X(connection, "Connection")                             \
+  X(content_encoding, "Content-Encoding")                 \
+  X(content_length, "Content-Length")                     \
+  X(content_type, "Content-Type")                         \
+  X(cookie, "Cookie")                                     \
+  X(date, "Date")                                         \
+  X(etag, "ETag")                                         \
+  X(expect, "Expect")                                     \
+  X(expires, "Expires")                                   \
+  X(host, "Host")                                         \
+  X(if_modified_since, "If-Modified-Since")               \
+  X(if_none_match, "If-None-Match")                       \
+  X(keep_alive, "Keep-Alive")                             \
+  X(last_modified, "Last-Modified")                       \
+  X(location, "Location")                                 \
+  X(origin, "Origin")                                     \
+  X(pragma, "Pragma")                                     \
+  X(proxy_authorization, "Proxy-Authorization")           \
+  X(proxy_connection, "Proxy-Connection")                 \
+  X(referer, "Referer")                                   \
+  X(sec_websocket_accept, "Sec-WebSocket-Accept")         \
+  X(sec_websocket_extensions, "Sec-WebSocket-Extensions") \
+  X(sec_websocket_key, "Sec-WebSocket-Key")               \
+  X(sec_websocket_protocol, "Sec-WebSocket-Protocol")     \
+  X(sec_websocket_version, "Sec-WebSocket-Version")       \
+  X(server, "Server")                                     \
+  X(set_cookie, "Set-Cookie")                             \
+  X(te, "TE")                                             \
+  X(trailer, "Trailer")                                   \
+  X(transfer_encoding, "Transfer-Encoding")               \
+  X(upgrade, "Upgrade")                                   \
+  X(user_agent, "User-Agent")                             \
+  X(vary, "Vary")                                         \
+  X(via, "Via")
+
+namespace proxy::http {
+
+// Enumeration type for headers the proxy recognizes.
+//
+// Well-known headers are resolved to an ID once, when they are added or looked up by name, so that later operations
+// compare small integers instead of case-insensitive strings.
+enum class header_id : std::uint8_t {
+  other,
+#define X(name, str) name,
+  HTTP_KNOWN_HEADERS(X)
+#undef X
+};
+
+// Converts a header name to its well-known ID, or header_id::other if the header is not well known.
+//
+// Comparison is case-insensitive.
+header_id string_to_header_id(std::string_view name);
+
+// Converts a well-known header ID to its canonical name.
+//
+// Returns an empty string for header_id::other.
+std::string_view header_id_to_string(header_id id);
+
+// A resolved header name used for looking up headers.
+//
+// Implicitly constructible from a header name or a well-known header ID.
+class header_key {
+ public:
+  template <typename S, std::enable_if_t<std::is_convertible_v<const S&, std::string_view>, int> = 0>
+  header_key(const S& name) : header_key(std::string_view(name)) {}
+  header_key(std::string_view name) : id_(string_to_header_id(name)), name_(name) {}
+  header_key(header_id id) : id_(id), name_(header_id_to_string(id)) {}
+
+  inline header_id id() const { return id_; }
+  inline std::string_view name() const { return name_; }
+
+ private:
+  header_id id_;
+  std::string_view name_;
+};
+
+// Class for owning the headers of a single HTTP message.
+//
+// Headers are kept in insertion order in a contiguous vector. Each header's name and value share a single string, and
+// well-known headers are tagged with their ID. A bitmask of the well-known headers present allows most lookups for
+// missing headers to return without scanning.
+class header_collection {
+ public:
+  // A single header.
+  class entry {
+   public:
+    entry(header_id id, std::string_view name, std::string_view value);
+
+    inline header_id id() const { return id_; }
+    inline std::string_view name() const { return std::string_view(data_).substr(0, name_size_); }
+    inline std::string_view value() const { return std::string_view(data_).substr(name_size_); }
+
+   private:
+    header_id id_;
+    std::uint32_t name_size_;
+    std::string data_;
+  };
+
+  using const_iterator = std::vector<entry>::const_iterator;
+
+  header_collection() = default;
+  header_collection(std::initializer_list<std::pair<std::string_view, std::string_view>> headers);
+  ~header_collection() = default;
+  header_collection(const header_collection& other) = default;
+  header_collection& operator=(const header_collection& other) = default;
+  header_collection(header_collection&& other) noexcept = default;
+  header_collection& operator=(header_collection&& other) noexcept = default;
+
+  // Adds a header at the end of the collection.
+  void add(header_key key, std::string_view value);
+
+  // Removes all values for the given header.
+  void remove(header_key key);
+
+  // Checks if the header exists.
+  bool contains(header_key key) const;
+
+  // Returns the first entry for the given header, or nullptr if it does not exist.
+  const entry* find(header_key key) const;
+
+  // Returns views to all of the values for the given header.
+  //
+  // The views are invalidated when the collection is modified.
+  std::vector<std::string_view> get_all(header_key key) const;
+
+  // Calls the function for every value of the given header until it returns true.
+  //
+  // Returns if any call returned true.
+  template <typename Predicate>
+  bool any_of(header_key key, Predicate&& pred) const {
+    if (!maybe_contains(key)) {
+      return false;
+    }
+    for (const entry& header : entries_) {
+      if (matches(header, key) && pred(header.value())) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  inline std::size_t size() const { return entries_.size(); }
+  inline bool empty() const { return entries_.empty(); }
+  inline void reserve(std::size_t n) { entries_.reserve(n); }
+  void clear();
+
+  inline const_iterator begin() const { return entries_.begin(); }
+  inline const_iterator end() const { return entries_.end(); }
+
+ private:
+  static constexpr std::uint64_t bit(header_id id) { return std::uint64_t(1) << static_cast<std::uint8_t>(id); }
+
+  // Returns false only if the header definitely does not exist.
+  inline bool maybe_contains(const header_key& key) const {
+    return key.id() == header_id::other || (known_present_ & bit(key.id())) != 0;
+  }
+
+  static bool matches(const entry& header, const header_key& key);
+
+  std::vector<entry> entries_;
+  std::uint64_t known_present_ = 0;
+};
+
+}  // namespace proxy::http
@@ -9,13 +9,13 @@
 
 #include <initializer_list>
 #include <iostream>
-#include <map>
 #include <optional>
 #include <string>
 #include <string_view>
 #include <utility>
 #include <vector>
 
+#include "aether/proxy/http/message/header_collection.hpp"
 #include "aether/proxy/http/message/version.hpp"
 #include "aether/proxy/types.hpp"
 #include "aether/util/string.hpp"
@@ -31,8 +31,7 @@ class message {
   static constexpr std::string_view CRLF_CRLF = "\r\n\r\n";
   static constexpr char SP = ' ';
 
-  using header_pair_t = std::pair<const std::string, std::string>;
-  using headers_map_t = std::multimap<std::string, std::string, util::string::iless>;
+  using header_pair_t = std::pair<std::string_view, std::string_view>;
 
  public:
   message();
@@ -48,41 +47,43 @@ class message {
   inline std::string_view body() const { return body_; }
   inline void set_body(std::string body) { body_ = std::move(body); }
   inline std::size_t content_length() const { return body_.length(); }
-  inline const headers_map_t& all_headers() const { return headers_; }
+  inline const header_collection& all_headers() const { return headers_; }
 
-  void add_header(std::string_view name, std::string_view value = "");
+  // Header methods accept either a header name or a well-known header_id. Using the ID skips resolving the name.
+
+  void add_header(header_key name, std::string_view value = "");
 
   // Sets a header to a single value.
   //
   // All previous headers of the same name are removed.
-  void set_header_to_value(std::string_view name, std::string_view value);
+  void set_header_to_value(header_key name, std::string_view value);
 
   // Removes all values for the given header.
-  void remove_header(std::string_view name);
+  void remove_header(header_key name);
 
-  bool has_header(std::string_view name) const;
+  bool has_header(header_key name) const;
 
   // Checks if header has any value except an empty string.
-  bool header_is_nonempty(std::string_view name) const;
+  bool header_is_nonempty(header_key name) const;
 
   // Checks if a header was given the value exactly.
-  bool header_has_value(std::string_view name, std::string_view value, bool case_insensitive = false) const;
+  bool header_has_value(header_key name, std::string_view value, bool case_insensitive = false) const;
 
   // Checks if a header was given the value in a comma-separated list.
-  bool header_has_token(std::string_view name, std::string_view value, bool case_insensitive = false) const;
+  bool header_has_token(header_key name, std::string_view value, bool case_insensitive = false) const;
 
   // Gets the first value for a given header, failing if it does not exist.
   //
   // Since headers can be duplicated, it is safer to use get_all_of_header.
-  result<std::string_view> get_header(std::string_view name) const;
+  result<std::string_view> get_header(header_key name) const;
 
   // Gets the first value for an optional header.
-  std::optional<std::string_view> get_optional_header(std::string_view name) const;
+  std::optional<std::string_view> get_optional_header(header_key name) const;
 
-  // Returns a vector of all the values for a given header.
+  // Returns views to all the values for a given header.
   //
-  // Will be empty if header does not exist.
-  std::vector<std::string> get_all_of_header(std::string_view name) const;
+  // Will be empty if header does not exist. The views are invalidated when the headers are modified.
+  std::vector<std::string_view> get_all_of_header(header_key name) const;
 
   // Calculates content length and sets the Content-Length header accordingly.
   //
@@ -92,8 +93,14 @@ class message {
   bool should_close_connection() const;
 
  protected:
+  // Writes the headers and the empty line that ends the message head.
+  void write_headers(std::ostream& out) const;
+
+  // Writes the body, framed in chunked encoding if the message uses it.
+  void write_body(std::ostream& out) const;
+
   http::version version_;
-  headers_map_t headers_;
+  header_collection headers_;
   std::string body_;
 
   friend std::ostream& operator<<(std::ostream& out, const message& msg);
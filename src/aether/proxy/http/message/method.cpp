@@ -49,6 +49,20 @@ result<method> string_to_method(std::string_view str) {
   return ptr->second;
 }
 
+bool is_idempotent(method m) {
+  switch (m) {
+    case method::GET:
+    case method::HEAD:
+    case method::OPTIONS:
+    case method::PUT:
+    case method::DELETE:
+    case method::TRACE:
+      return true;
+    default:
+      return false;
+  }
+}
+
 std::ostream& operator<<(std::ostream& output, method m) {
   output << method_to_string(m);
   return output;
@@ -76,6 +76,9 @@ result<std::string_view> method_to_string(method m);
 // Converts a string to an HTTP method.
 result<method> string_to_method(std::string_view str);
 
+// Checks if repeating a request with the given method has the same effect as sending it once.
+bool is_idempotent(method m);
+
 std::ostream& operator<<(std::ostream& output, method m);
 
 }  // namespace proxy::http
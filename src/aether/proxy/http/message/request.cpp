@@ -27,43 +27,45 @@ request::request(http::method met, url target, http::version version, std::initi
 
 void request::update_target(url target) {
   target_ = std::move(target);
-  set_header_to_value("Host", target_.netloc.host);
+  set_header_to_value(header_id::host, target_.netloc.host);
 }
 
 void request::update_host(std::string_view host) {
   target_.netloc.host = host;
   target_.netloc.port = std::nullopt;
-  set_header_to_value("Host", target_.netloc.host);
+  set_header_to_value(header_id::host, target_.netloc.host);
 }
 
 void request::update_host(std::string_view host, port_t port) {
   target_.netloc.host = host;
   target_.netloc.port = port;
-  set_header_to_value("Host", target_.netloc.host);
+  set_header_to_value(header_id::host, target_.netloc.host);
 }
 
 void request::update_host(url::network_location host) {
   target_.netloc = std::move(host);
-  set_header_to_value("Host", target_.netloc.host);
+  set_header_to_value(header_id::host, target_.netloc.host);
 }
 
 void request::update_origin_and_referer(std::string_view origin) {
-  set_header_to_value("Origin", origin);
-  set_header_to_value("Referer", origin);
+  set_header_to_value(header_id::origin, origin);
+  set_header_to_value(header_id::referer, origin);
 }
 
 void request::update_origin_and_referer(const url& origin) {
-  set_header_to_value("Origin", origin.origin_string());
-  set_header_to_value("Referer", origin.absolute_string());
+  set_header_to_value(header_id::origin, origin.origin_string());
+  set_header_to_value(header_id::referer, origin.absolute_string());
 }
 
-bool request::has_cookies() const { return has_header("Cookie"); }
+bool request::has_cookies() const { return has_header(header_id::cookie); }
 
 cookie_collection request::get_cookies() const {
-  return cookie_collection::parse_request_header(get_header("Cookie").ok_or(""));
+  return cookie_collection::parse_request_header(get_header(header_id::cookie).ok_or(""));
 }
 
-void request::set_cookies(const cookie_collection& cookies) { set_header_to_value("Cookie", cookies.request_string()); }
+void request::set_cookies(const cookie_collection& cookies) {
+  set_header_to_value(header_id::cookie, cookies.request_string());
+}
 
 std::string request::request_line_string() const {
   std::stringstream out;
@@ -81,12 +83,17 @@ std::string request::absolute_request_line_string() const {
   return out.str();
 }
 
+void request::write_head(std::ostream& out) const {
+  out << method_ << ' ';
+  out << target_ << ' ';
+  out << version_;
+  out << CRLF;
+  write_headers(out);
+}
+
 std::ostream& operator<<(std::ostream& out, const request& req) {
-  out << req.method_ << ' ';
-  out << req.target_ << ' ';
-  out << req.version_;
-  out << message::CRLF;
-  out << static_cast<const message&>(req);
+  req.write_head(out);
+  req.write_body(out);
   return out;
 }
 
@@ -79,6 +79,11 @@ class request : public message {
   inline std::string_view host_name() const { return target_.netloc.host; }
   inline port_t host_port() const { return target_.port_or_default(80); }
 
+  // Writes the start line and headers, without the body.
+  //
+  // Used when the body is streamed separately.
+  void write_head(std::ostream& out) const;
+
  private:
   http::method method_;
   url target_;
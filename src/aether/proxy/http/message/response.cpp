@@ -32,10 +32,10 @@ bool response::is_4xx() const { return static_cast<std::size_t>(status_) / 100 =
 
 bool response::is_5xx() const { return static_cast<std::size_t>(status_) / 100 == 5; }
 
-bool response::has_cookies() const { return has_header("Set-Cookie"); }
+bool response::has_cookies() const { return has_header(header_id::set_cookie); }
 
 cookie_collection response::get_cookies() const {
-  std::vector<std::string> cookie_headers = get_all_of_header("Set-Cookie");
+  std::vector<std::string_view> cookie_headers = get_all_of_header(header_id::set_cookie);
   cookie_collection cookies;
   for (std::string_view header : cookie_headers) {
     auto parsed = cookie::parse_set_header(header);
@@ -47,18 +47,23 @@ cookie_collection response::get_cookies() const {
 }
 
 void response::set_cookies(const cookie_collection& cookies) {
-  remove_header("Set-Cookie");
+  remove_header(header_id::set_cookie);
   for (const auto& [name, cookie] : cookies) {
-    add_header("Set-Cookie", cookie.response_string());
+    add_header(header_id::set_cookie, cookie.response_string());
   }
 }
 
+void response::write_head(std::ostream& out) const {
+  out << version_ << ' ';
+  out << status_ << ' ';
+  out << status_to_reason(status_);
+  out << CRLF;
+  write_headers(out);
+}
+
 std::ostream& operator<<(std::ostream& out, const response& res) {
-  out << res.version_ << ' ';
-  out << res.status_ << ' ';
-  out << status_to_reason(res.status_);
-  out << message::CRLF;
-  out << static_cast<const message&>(res);
+  res.write_head(out);
+  res.write_body(out);
   return out;
 }
 
@@ -49,6 +49,11 @@ class response : public message {
   // Any previous cookie headers will be deleted.
   void set_cookies(const cookie_collection& cookies);
 
+  // Writes the start line and headers, without the body.
+  //
+  // Used when the body is streamed separately.
+  void write_head(std::ostream& out) const;
+
  private:
   http::status status_;
 
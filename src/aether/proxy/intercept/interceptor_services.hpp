@@ -44,7 +44,10 @@
   X(any_request, 4, other1, other2)         \
   X(websocket_handshake, 5, other1, other2) \
   X(response, 6, other1, other2)            \
-  X(error, 7, other1, other2)
+  X(error, 7, other1, other2)               \
+  X(request_head, 18, other1, other2)       \
+  X(response_head, 19, other1, other2)      \
+  X(body_chunk, 20, other1, other2)
 
 #define TLS_EVENTS(X, other1, other2) \
   X(established, 8, other1, other2)   \
@@ -66,7 +69,7 @@
   X(create, 17, other1, other2)
 
 // Make sure this value is larger than all of the numbers above.
-#define MAX_EVENT_ENUM 18
+#define MAX_EVENT_ENUM 21
 
 namespace proxy::intercept {
 
@@ -41,10 +41,10 @@ server::server(program::options options)
 
 server::~server() { stop(); }
 
-void run_io_context(boost::asio::io_context& ioc) {
+void run_io_context(concurrent::io_context_pool& pool, boost::asio::io_context& ioc) {
   while (true) {
     try {
-      ioc.run();
+      pool.run_io_context(ioc);
       break;
     } catch (const std::exception& ex) {
       out::safe_error::log("Unexpected exception running io_context instance:", ex.what());
@@ -63,7 +63,7 @@ result<void> server::start() {
 
   ASSIGN_OR_RETURN(acc_, acceptor::create(components_));
   acc_->start();
-  components_.io_contexts.run(run_io_context);
+  components_.io_contexts.run(std::bind_front(run_io_context, std::ref(components_.io_contexts)));
 
   return util::ok;
 }
@@ -136,6 +136,60 @@ boost::asio::io_context& server::get_io_context() { return components_.io_contex
 
 size_t server::num_connections() const { return components_.connection_manager.total_connection_count(); }
 
+size_t server::num_pending_connections() const { return components_.connection_manager.pending_connection_count(); }
+
+size_t server::num_rejected_connections() const { return components_.connection_manager.rejected_connection_count(); }
+
+size_t server::concurrency_limit() const { return components_.connection_manager.limiter().limit(); }
+
 size_t server::num_ssl_certificates() const { return components_.server_store().num_certificates(); }
 
+size_t server::num_idle_upstream_connections() const {
+  return components_.server_connection_pool.idle_connection_count();
+}
+
+size_t server::num_reused_upstream_connections() const {
+  return components_.server_connection_pool.reused_connection_count();
+}
+
+size_t server::num_dns_cache_hits() const {
+  return components_.dns_cache.hit_count() + components_.dns_cache.stale_hit_count();
+}
+
+size_t server::num_dns_cache_misses() const { return components_.dns_cache.miss_count(); }
+
+size_t server::num_http2_upstream_sessions() const { return components_.http2_sessions.session_count(); }
+
+size_t server::num_multiplexed_upstream_requests() const {
+  return components_.http2_sessions.multiplexed_request_count();
+}
+
+size_t server::num_cache_hits() const { return components_.response_cache.hit_count(); }
+
+size_t server::num_cache_misses() const { return components_.response_cache.miss_count(); }
+
+size_t server::num_cache_revalidations() const { return components_.response_cache.revalidation_count(); }
+
+size_t server::num_collapsed_requests() const { return components_.request_coalescer.collapsed_count(); }
+
+size_t server::buffer_pool_used_bytes() const { return components_.buffer_pools.used_bytes(); }
+
+size_t server::buffer_pool_reserved_bytes() const { return components_.buffer_pools.reserved_bytes(); }
+
+size_t server::memory_used_bytes() const { return components_.memory_budget.used_bytes(); }
+
+size_t server::memory_limit() const { return components_.memory_budget.limit(); }
+
+size_t server::num_shed_connections() const { return components_.memory_budget.shed_count(); }
+
+size_t server::num_idle_connections() const { return components_.idle_connections.size(); }
+
+size_t server::num_evicted_idle_connections() const { return components_.idle_connections.closed_count(); }
+
+size_t server::num_threads() const { return components_.io_contexts.size(); }
+
+concurrent::io_context_pool::context_stats server::thread_stats(size_t index) const {
+  return components_.io_contexts.stats(index);
+}
+
 }  // namespace proxy
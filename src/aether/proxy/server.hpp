@@ -53,12 +53,37 @@ class server {
   boost::asio::io_context& get_io_context();
 
   size_t num_connections() const;
+  size_t num_pending_connections() const;
+  size_t num_rejected_connections() const;
+  size_t concurrency_limit() const;
   size_t num_ssl_certificates() const;
+  size_t num_idle_upstream_connections() const;
+  size_t num_reused_upstream_connections() const;
+  size_t num_dns_cache_hits() const;
+  size_t num_dns_cache_misses() const;
+  size_t num_http2_upstream_sessions() const;
+  size_t num_multiplexed_upstream_requests() const;
+  size_t num_cache_hits() const;
+  size_t num_cache_misses() const;
+  size_t num_cache_revalidations() const;
+  size_t num_collapsed_requests() const;
+  size_t buffer_pool_used_bytes() const;
+  size_t buffer_pool_reserved_bytes() const;
+  size_t memory_used_bytes() const;
+  size_t memory_limit() const;
+  size_t num_shed_connections() const;
+  size_t num_idle_connections() const;
+  size_t num_evicted_idle_connections() const;
+  size_t num_threads() const;
+  concurrent::io_context_pool::context_stats thread_stats(size_t index) const;
 
   // Expose interceptors so methods and hubs can be attached from the outside world.
   inline intercept::interceptor_manager& interceptors() { return components_.interceptors; }
   inline const program::options& options() const { return components_.options; }
 
+  // Expose the DNS cache so a different resolver can be used before the server starts.
+  inline connection::dns_cache& dns_cache() { return components_.dns_cache; }
+
  private:
   server_components components_;
 
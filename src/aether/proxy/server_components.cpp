@@ -13,7 +13,20 @@ namespace proxy {
 
 server_components::server_components(program::options options)
     : options(std::move(options)),
-      io_contexts(concurrent::io_context_pool::create(options.thread_pool_size).ok()),
+      io_contexts(concurrent::io_context_pool::create(this->options.thread_pool_size,
+                                                    this->options.io_context_selection, this->options.pin_threads,
+                                                    this->options.single_threaded_contexts)
+                      .ok()),
+      memory_budget(this->options),
+      buffer_pools(io_contexts, this->options),
+      timing_wheels(io_contexts),
+      idle_connections(io_contexts),
+      server_connection_pool(io_contexts, this->options),
+      dns_cache(this->options),
+      endpoint_stats(this->options),
+      http2_sessions(io_contexts),
+      response_cache(this->options),
+      request_coalescer(),
       interceptors(),
       connection_manager(*this) {
   if (!options.ssl_passthrough_strict) {
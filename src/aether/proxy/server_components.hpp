@@ -11,7 +11,17 @@
 
 #include "aether/program/options.hpp"
 #include "aether/proxy/concurrent/io_context_pool.hpp"
+#include "aether/proxy/connection/buffer_pools.hpp"
 #include "aether/proxy/connection/connection_manager.hpp"
+#include "aether/proxy/connection/dns_cache.hpp"
+#include "aether/proxy/connection/endpoint_stats.hpp"
+#include "aether/proxy/connection/idle_connections.hpp"
+#include "aether/proxy/connection/memory_budget.hpp"
+#include "aether/proxy/connection/server_connection_pool.hpp"
+#include "aether/proxy/connection/timing_wheels.hpp"
+#include "aether/proxy/http/cache/request_coalescer.hpp"
+#include "aether/proxy/http/cache/response_cache.hpp"
+#include "aether/proxy/http/http2/session_pool.hpp"
 #include "aether/proxy/intercept/interceptor_services.hpp"
 #include "aether/proxy/tls/x509/client_store.hpp"
 #include "aether/proxy/tls/x509/server_store.hpp"
@@ -37,6 +47,16 @@ class server_components {
 
   program::options options;
   concurrent::io_context_pool io_contexts;
+  connection::memory_budget memory_budget;
+  connection::buffer_pools buffer_pools;
+  connection::timing_wheels timing_wheels;
+  connection::idle_connections idle_connections;
+  connection::server_connection_pool server_connection_pool;
+  connection::dns_cache dns_cache;
+  connection::endpoint_stats endpoint_stats;
+  http::http2::session_pool http2_sessions;
+  http::cache::response_cache response_cache;
+  http::cache::request_coalescer request_coalescer;
   intercept::interceptor_manager interceptors;
   util::uuid_factory uuid_factory;
   connection::connection_manager connection_manager;
@@ -48,6 +48,8 @@ result<std::unique_ptr<boost::asio::ssl::context>> create_ssl_context(ssl_contex
   }
 
   SSL_CTX_set_mode(ctx->native_handle(), SSL_MODE_AUTO_RETRY);
+  // Idle sessions give their read and write buffers back instead of holding them until the next record.
+  SSL_CTX_set_mode(ctx->native_handle(), SSL_MODE_RELEASE_BUFFERS);
 
   // SSL_CTX_set_security_level(ctx->native_handle(), 1);
 
@@ -20,6 +20,7 @@
 #include "aether/proxy/connection_handler.hpp"
 #include "aether/proxy/error/error.hpp"
 #include "aether/proxy/http/http1/http_service.hpp"
+#include "aether/proxy/http/http2/http2_service.hpp"
 #include "aether/proxy/server_components.hpp"
 #include "aether/proxy/tls/handshake/client_hello.hpp"
 #include "aether/proxy/tls/handshake/handshake_reader.hpp"
@@ -100,6 +101,14 @@ void tls_service::on_connect_server(const boost::system::error_code& error) {
   }
 }
 
+openssl::ssl_context_args tls_service::make_server_context_args(const program::options& options,
+                                                               const x509::client_store& client_store) {
+  auto method = options.ssl_server_method;
+  return openssl::ssl_context_args{options.ssl_verify, method,
+                                   openssl::ssl_context_args::get_options_for_method(method),
+                                   std::string(client_store.cert_file())};
+}
+
 void tls_service::establish_tls_with_server() {
   if (result<void> res = establish_tls_with_server_impl(); !res.is_ok()) {
     flow_.error = std::move(res).err();
@@ -112,17 +121,15 @@ result<void> tls_service::establish_tls_with_server_impl() {
     return error::tls::tls_service_error("Must parse Client Hello message before establishing TLS with server");
   }
 
-  auto method = options_.ssl_server_method;
-  ssl_client_context_args_ = std::make_unique<openssl::ssl_context_args>(
-      openssl::ssl_context_args{options_.ssl_verify, method, openssl::ssl_context_args::get_options_for_method(method),
-                                std::string(client_store_.cert_file())});
+  ssl_client_context_args_ =
+      std::make_unique<openssl::ssl_context_args>(make_server_context_args(options_, client_store_));
 
   if (client_hello_msg_->has_alpn_extension() && !options_.ssl_negotiate_alpn) {
     // Remove unsupported protocols to be sure the server picks one we can read.
     std::copy_if(client_hello_msg_->alpn.begin(), client_hello_msg_->alpn.end(),
                  std::back_inserter(ssl_client_context_args_->alpn_protos),
                  [](const std::string& protocol) { return !((protocol.rfind("h2-") == 0) || (protocol == "SPDY")); });
-    // TODO: Remove this line once HTTP 2 is supported.
+    // Servers are always spoken to over HTTP/1.1, even when the client speaks HTTP/2 with the proxy.
     ssl_client_context_args_->alpn_protos.erase(
         std::remove(ssl_client_context_args_->alpn_protos.begin(), ssl_client_context_args_->alpn_protos.end(), "h2"),
         ssl_client_context_args_->alpn_protos.end());
@@ -203,6 +210,18 @@ void tls_service::establish_tls_with_client() {
 
 result<void> tls_service::establish_tls_with_client_impl() {
   ASSIGN_OR_RETURN(std::shared_ptr<x509::memory_certificate> cert, get_certificate_for_client());
+
+  // Use the ALPN negotiated with the server, unless the client can speak HTTP/2 with the proxy instead.
+  std::optional<std::string> selected_alpn =
+      flow_.server.secured() ? std::string(flow_.server.alpn()) : std::optional<std::string>{};
+  if (options_.http2 && (!selected_alpn.has_value() || selected_alpn.value().empty() ||
+                         selected_alpn.value() == tls_service::default_alpn)) {
+    if (std::find(client_hello_msg_->alpn.begin(), client_hello_msg_->alpn.end(), "h2") !=
+        client_hello_msg_->alpn.end()) {
+      selected_alpn = "h2";
+    }
+  }
+
   auto method = options_.ssl_client_method;
   ssl_server_context_args_ = std::make_unique<openssl::ssl_server_context_args>(openssl::ssl_server_context_args{
       openssl::ssl_context_args{
@@ -214,7 +233,7 @@ result<void> tls_service::establish_tls_with_client_impl() {
           std::vector<handshake::cipher_suite_name>(default_client_ciphers.begin(), default_client_ciphers.end()),
           {},
           alpn_select_callback,
-          flow_.server.secured() ? std::string(flow_.server.alpn()) : std::optional<std::string>{}},
+          std::move(selected_alpn)},
       cert->cert, cert->pkey, server_store_.dhpkey()});
 
   if (options_.ssl_supply_server_chain_to_client && flow_.server.connected() && flow_.server.secured()) {
@@ -290,6 +309,9 @@ void tls_service::on_establish_tls_with_client(const boost::system::error_code&
     if (alpn == "http/1.1" || alpn.empty()) {
       // Any TLS errors are reported to the client by the HTTP service.
       owner_.switch_service<http::http1::http_service>();
+    } else if (alpn == "h2") {
+      // Errors are also reported to the client by the HTTP/2 service, on every stream.
+      owner_.switch_service<http::http2::http2_service>();
     } else if (!flow_.error.has_error()) {
       owner_.switch_service<tunnel::tunnel_service>();
     } else {
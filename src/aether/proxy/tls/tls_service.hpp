@@ -12,6 +12,7 @@
 #include <memory>
 #include <string_view>
 
+#include "aether/program/options.hpp"
 #include "aether/proxy/base_service.hpp"
 #include "aether/proxy/error/error.hpp"
 #include "aether/proxy/tls/handshake/client_hello.hpp"
@@ -62,6 +63,10 @@ class tls_service : public base_service {
 
   tls_service(connection::connection_flow& flow, connection_handler& owner, server_components& components);
 
+  // Returns the settings for securing a server connection that do not depend on any client.
+  static openssl::ssl_context_args make_server_context_args(const program::options& options,
+                                                            const x509::client_store& client_store);
+
   void start() override;
 
  private:
@@ -7,7 +7,12 @@
 
 #include "tunnel_loop.hpp"
 
+#include <fcntl.h>
+#include <unistd.h>
+
 #include <boost/system/error_code.hpp>
+#include <algorithm>
+#include <cerrno>
 #include <functional>
 
 #include "aether/proxy/connection/base_connection.hpp"
@@ -16,49 +21,210 @@
 
 namespace proxy::tunnel {
 
-tunnel_loop::tunnel_loop(connection::base_connection& source, connection::base_connection& destination)
-    : source_(source), destination_(destination) {}
+namespace {
+
+// Largest number of bytes moved into the pipe at once, which the pipe's capacity limits further.
+constexpr std::size_t splice_size = 1024 * 1024;
+
+}  // namespace
+
+tunnel_loop::tunnel_loop(connection::base_connection& source, connection::base_connection& destination,
+                         bool zero_copy)
+    : source_(source),
+      destination_(destination),
+      finished_(false),
+      reading_(false),
+      writing_(false),
+      paused_(false),
+      source_closed_(false),
+      destination_failed_(false),
+      zero_copy_(zero_copy),
+      pipe_{-1, -1},
+      piped_(0) {}
+
+tunnel_loop::~tunnel_loop() { close_pipe(); }
 
 void tunnel_loop::start(callback_t handler) {
   on_finished_ = std::move(handler);
   finished_ = false;
   source_.set_mode(connection::base_connection::io_mode::tunnel);
-  // We write first in case something is waiting to be sent before any reads can occur If there is no data to send, the
-  // write method returns immediately.
-  write();
+  if (zero_copy_ && !source_.secured() && destination_.kernel_writes()) {
+    flush_before_splice();
+  } else {
+    // Something may be waiting to be sent before any reads can occur, which is written first.
+    pump();
+  }
 }
 
-void tunnel_loop::read() { source_.read_async(std::bind_front(&tunnel_loop::on_read, this)); }
+std::size_t tunnel_loop::buffered() { return source_.input_buffer().size() + destination_.output_buffer().size(); }
 
-void tunnel_loop::on_read(const boost::system::error_code& error, std::size_t) {
-  if (error != boost::system::errc::success) {
+void tunnel_loop::pump() {
+  if (!writing_ && !destination_failed_ && source_.input_buffer().size() > 0) {
+    destination_.output_stream() << source_.input_stream().rdbuf();
+    writing_ = true;
+    // No timeout because there is a timeout on the read operation already.
+    //
+    // Timeout cancels ALL socket operations. Attempting to use the same timeout service will cause the latter
+    // operation to never timeout.
+    destination_.write_untimed_async(std::bind_front(&tunnel_loop::on_write, this));
+  }
+
+  if (paused_ && buffered() <= low_watermark()) {
+    paused_ = false;
+  } else if (!paused_ && buffered() >= high_watermark()) {
+    paused_ = true;
+  }
+
+  if (!reading_ && !paused_ && !source_closed_ && !destination_failed_) {
+    reading_ = true;
+    if (buffered() == 0) {
+      // Nothing is in flight, so the tunnel may be quiet for a while.
+      source_.read_when_ready_async(std::bind_front(&tunnel_loop::on_read, this));
+    } else {
+      source_.read_async(std::bind_front(&tunnel_loop::on_read, this));
+    }
+  }
+
+  // Operations still in flight call back into the loop, so it only finishes once they are all done.
+  if (!reading_ && !writing_ && (destination_failed_ || (source_closed_ && source_.input_buffer().size() == 0))) {
     finish();
-  } else {
-    write();
   }
 }
 
-void tunnel_loop::write() {
-  destination_.output_stream() << source_.input_stream().rdbuf();
-  // No timeout because there is a timeout on the read operation already.
-  //
-  // Timeout cancels ALL socket operations. Attempting to use the same timeout service will cause the latter operation
-  // to never timeout.
-  destination_.write_untimed_async(std::bind_front(&tunnel_loop::on_write, this));
+void tunnel_loop::on_read(const boost::system::error_code& error, std::size_t) {
+  reading_ = false;
+  if (error != boost::system::errc::success) {
+    source_closed_ = true;
+  }
+  pump();
 }
 
 void tunnel_loop::on_write(const boost::system::error_code& error, std::size_t) {
+  writing_ = false;
   if (error != boost::system::errc::success) {
-    finish();
-  } else {
-    read();
+    destination_failed_ = true;
+    // Nothing more can be relayed, so the pending read is canceled rather than left to time out.
+    if (reading_) {
+      boost::system::error_code cancel_error;
+      source_.socket().cancel(cancel_error);
+    }
   }
+  pump();
 }
 
 void tunnel_loop::finish() {
+  close_pipe();
   source_.set_mode(connection::base_connection::io_mode::regular);
   finished_ = true;
   on_finished_();
 }
 
+void tunnel_loop::flush_before_splice() {
+  destination_.output_stream() << source_.input_stream().rdbuf();
+  writing_ = true;
+  destination_.write_untimed_async(std::bind_front(&tunnel_loop::on_flushed, this));
+}
+
+void tunnel_loop::on_flushed(const boost::system::error_code& error, std::size_t) {
+  writing_ = false;
+  if (error != boost::system::errc::success) {
+    finish();
+  } else if (open_pipe()) {
+    // Everything buffered before the tunnel started has been written, so the rest can bypass the buffers. The other
+    // loop of the tunnel uses the other two buffers of the connections, which may still have operations pending.
+    source_.input_buffer().release_if_empty();
+    destination_.output_buffer().release_if_empty();
+    wait_source();
+  } else {
+    pump();
+  }
+}
+
+bool tunnel_loop::open_pipe() {
+#ifdef __linux__
+  if (::pipe2(pipe_.data(), O_NONBLOCK | O_CLOEXEC) != 0) {
+    pipe_ = {-1, -1};
+    return false;
+  }
+  // Splicing to and from the sockets must never block the thread.
+  boost::system::error_code error;
+  source_.socket().native_non_blocking(true, error);
+  if (error == boost::system::errc::success) {
+    destination_.socket().native_non_blocking(true, error);
+  }
+  if (error != boost::system::errc::success) {
+    close_pipe();
+    return false;
+  }
+  return true;
+#else
+  return false;
+#endif
+}
+
+void tunnel_loop::close_pipe() {
+  for (int& fd : pipe_) {
+    if (fd >= 0) {
+      ::close(fd);
+      fd = -1;
+    }
+  }
+  piped_ = 0;
+}
+
+void tunnel_loop::wait_source() {
+  source_.wait_readable_async(std::bind_front(&tunnel_loop::on_source_readable, this));
+}
+
+void tunnel_loop::on_source_readable(const boost::system::error_code& error) {
+  if (error != boost::system::errc::success) {
+    finish();
+    return;
+  }
+#ifdef __linux__
+  ssize_t spliced = ::splice(source_.socket().native_handle(), nullptr, pipe_[1], nullptr, splice_size,
+                             SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+  if (spliced > 0) {
+    piped_ += static_cast<std::size_t>(spliced);
+    drain_pipe();
+  } else if (spliced < 0 && (errno == EAGAIN || errno == EINTR)) {
+    wait_source();
+  } else {
+    // End of stream, or the socket failed.
+    source_.set_connected(false);
+    finish();
+  }
+#endif
+}
+
+void tunnel_loop::drain_pipe() {
+#ifdef __linux__
+  while (piped_ > 0) {
+    ssize_t spliced = ::splice(pipe_[0], nullptr, destination_.socket().native_handle(), nullptr, piped_,
+                               SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    if (spliced > 0) {
+      piped_ -= static_cast<std::size_t>(spliced);
+    } else if (spliced < 0 && errno == EAGAIN) {
+      destination_.wait_writable_untimed_async(std::bind_front(&tunnel_loop::on_destination_writable, this));
+      return;
+    } else if (spliced < 0 && errno == EINTR) {
+      continue;
+    } else {
+      destination_.set_connected(false);
+      finish();
+      return;
+    }
+  }
+#endif
+  wait_source();
+}
+
+void tunnel_loop::on_destination_writable(const boost::system::error_code& error) {
+  if (error != boost::system::errc::success) {
+    finish();
+  } else {
+    drain_pipe();
+  }
+}
+
 }  // namespace proxy::tunnel
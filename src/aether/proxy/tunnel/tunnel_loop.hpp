@@ -7,6 +7,8 @@
 
 #pragma once
 
+#include <algorithm>
+#include <array>
 #include <boost/system/error_code.hpp>
 
 #include "aether/proxy/connection/base_connection.hpp"
@@ -15,26 +17,81 @@
 
 namespace proxy::tunnel {
 
-// Implements an asynchronous read/write loop from one connection to another.
+// Implements an asynchronous, pipelined read/write loop from one connection to another.
+//
+// The source's input buffer and the destination's output buffer are used as a double buffer: the next read into the
+// input buffer is issued while the previous data is still being written from the output buffer. Reads pause while the
+// bytes waiting in both buffers are above the high watermark, and resume once the writes bring them under the low
+// watermark. The source sizes its reads to its traffic, so fast connections are read in larger pieces, and the
+// watermarks grow with them, up to the destination's memory budget.
+//
+// When neither connection has TLS terminated by the proxy, the bytes are never looked at, so the loop may relay them
+// inside the kernel instead. The same goes for a destination whose records the kernel encrypts. Data is spliced from
+// the source socket into a pipe owned by the loop, and from the pipe into the destination socket, without ever being
+// copied through the proxy.
 //
 // Connections must outlive any tunnel loop it is connected to.
 class tunnel_loop {
  public:
-  tunnel_loop(connection::base_connection& source, connection::base_connection& destination);
+  tunnel_loop(connection::base_connection& source, connection::base_connection& destination, bool zero_copy = false);
+  ~tunnel_loop();
+  tunnel_loop(const tunnel_loop& other) = delete;
+  tunnel_loop& operator=(const tunnel_loop& other) = delete;
+  tunnel_loop(tunnel_loop&& other) noexcept = delete;
+  tunnel_loop& operator=(tunnel_loop&& other) noexcept = delete;
 
   void start(callback_t handler);
   inline bool finished() const { return finished_; }
 
  private:
-  void read();
+  // Starts every operation the state of the loop allows, or finishes the loop once nothing is left to do.
+  void pump();
+
   void on_read(const boost::system::error_code& error, std::size_t bytes_transferred);
-  void write();
   void on_write(const boost::system::error_code& error, std::size_t bytes_transferred);
   void finish();
 
+  // Returns the bytes read from the source that have not been written to the destination.
+  std::size_t buffered();
+
+  inline std::size_t high_watermark() const {
+    return std::min(source_.read_size() * 4, destination_.buffer_high_watermark());
+  }
+  inline std::size_t low_watermark() const {
+    return std::min(source_.read_size(), destination_.buffer_low_watermark());
+  }
+
+  // Writes the data buffered before the tunnel started, so the rest of the tunnel can be spliced.
+  void flush_before_splice();
+  void on_flushed(const boost::system::error_code& error, std::size_t bytes_transferred);
+
+  // Opens the pipe for splicing, returning false if the tunnel must be relayed by copying.
+  bool open_pipe();
+  void close_pipe();
+
+  void wait_source();
+  void on_source_readable(const boost::system::error_code& error);
+
+  // Splices everything in the pipe into the destination, waiting for it to become writable as needed.
+  void drain_pipe();
+  void on_destination_writable(const boost::system::error_code& error);
+
   connection::base_connection& source_;
   connection::base_connection& destination_;
   callback_t on_finished_;
   bool finished_;
+
+  bool reading_;
+  bool writing_;
+  bool paused_;
+
+  // The source has no more data, or the destination failed, so no more reads are issued.
+  bool source_closed_;
+  bool destination_failed_;
+
+  // Splicing is tried once the buffered data has been written.
+  bool zero_copy_;
+  std::array<int, 2> pipe_;
+  std::size_t piped_;
 };
 }  // namespace proxy::tunnel
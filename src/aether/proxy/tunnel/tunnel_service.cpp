@@ -19,9 +19,9 @@ tunnel_service::tunnel_service(connection::connection_flow& flow, connection_han
                                server_components& components)
     : base_service(flow, owner, components),
       upstream_(static_cast<connection::base_connection&>(flow.client),
-                static_cast<connection::base_connection&>(flow.server)),
+                static_cast<connection::base_connection&>(flow.server), components.options.splice_tunnels),
       downstream_(static_cast<connection::base_connection&>(flow.server),
-                  static_cast<connection::base_connection&>(flow.client)) {}
+                  static_cast<connection::base_connection&>(flow.client), components.options.splice_tunnels) {}
 
 void tunnel_service::start() {
   if (!flow_.server.connected()) {
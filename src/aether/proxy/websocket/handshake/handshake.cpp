@@ -19,23 +19,28 @@
 namespace proxy::websocket::handshake {
 
 bool is_handshake(const http::request& req) {
-  return req.header_has_token("Connection", "Upgrade", true) && req.header_has_token("Upgrade", "websocket", true) &&
-         req.header_has_value("Sec-WebSocket-Version", "13") && req.header_is_nonempty("Sec-WebSocket-Key");
+  return req.header_has_token(http::header_id::connection, "Upgrade", true) &&
+         req.header_has_token(http::header_id::upgrade, "websocket", true) &&
+         req.header_has_value(http::header_id::sec_websocket_version, "13") &&
+         req.header_is_nonempty(http::header_id::sec_websocket_key);
 }
 
 bool is_handshake(const http::response& res) {
-  return res.header_has_token("Connection", "Upgrade", true) && res.header_has_token("Upgrade", "websocket", true) &&
-         res.header_is_nonempty("Sec-WebSocket-Accept");
+  return res.header_has_token(http::header_id::connection, "Upgrade", true) &&
+         res.header_has_token(http::header_id::upgrade, "websocket", true) &&
+         res.header_is_nonempty(http::header_id::sec_websocket_accept);
 }
 
-std::string_view get_client_key(const http::message& msg) { return msg.get_header("Sec-WebSocket-Key").ok_or(""); }
+std::string_view get_client_key(const http::message& msg) {
+  return msg.get_header(http::header_id::sec_websocket_key).ok_or("");
+}
 
 std::string_view get_server_accept(const http::message& msg) {
-  return msg.get_header("Sec-WebSocket-Accept").ok_or("");
+  return msg.get_header(http::header_id::sec_websocket_accept).ok_or("");
 }
 
 std::optional<std::string_view> get_protocol(const http::message& msg) {
-  return msg.get_optional_header("Sec-WebSocket-Protocol");
+  return msg.get_optional_header(http::header_id::sec_websocket_protocol);
 }
 
 std::vector<extension_data> get_extensions(const http::message& msg) {
@@ -47,7 +52,7 @@ std::vector<extension_data> get_extensions(const http::message& msg) {
   // OR
   //
   // Sec-WebSocket-Extensions: deflate-stream, mux; max-channels=4; flow-control, deflate-stream, private-extension
-  const auto& extension_headers = msg.get_all_of_header("Sec-WebSocket-Extensions");
+  const auto& extension_headers = msg.get_all_of_header(http::header_id::sec_websocket_extensions);
   std::vector<extension_data> extensions;
   for (const auto& extension_list : extension_headers) {
     const auto& extension_strings = util::string::split_trim(extension_list, ',');
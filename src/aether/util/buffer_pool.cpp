@@ -0,0 +1,126 @@
+/*********************************************
+
+  Copyright (c) Jackson Nestelroad 2020
+  jackson.nestelroad.com
+
+*********************************************/
+
+#include "buffer_pool.hpp"
+
+#include <sys/mman.h>
+
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <mutex>
+#include <new>
+
+namespace util::buffer {
+
+buffer_pool::buffer_pool(bool huge_pages, std::size_t arena_size)
+    : huge_pages_(huge_pages), arena_{nullptr, 0, false}, arena_used_(0), reserved_bytes_(0), used_bytes_(0) {
+  if (arena_size > 0) {
+    arena_ = allocate_slab(arena_size);
+    reserved_bytes_.fetch_add(arena_size, std::memory_order_relaxed);
+  }
+}
+
+buffer_pool::~buffer_pool() {
+  for (const slab& s : slabs_) {
+    free_slab(s);
+  }
+  if (arena_.data != nullptr) {
+    free_slab(arena_);
+  }
+}
+
+std::size_t buffer_pool::size_class(std::size_t size) {
+  std::size_t rounded = std::bit_ceil(std::max(size, min_chunk_size));
+  return static_cast<std::size_t>(std::countr_zero(rounded) - std::countr_zero(min_chunk_size));
+}
+
+buffer_pool::chunk buffer_pool::acquire(std::size_t size) {
+  if (size > max_chunk_size) {
+    reserved_bytes_.fetch_add(size, std::memory_order_relaxed);
+    used_bytes_.fetch_add(size, std::memory_order_relaxed);
+    return {static_cast<char*>(::operator new(size)), size};
+  }
+
+  std::size_t index = size_class(size);
+  std::size_t chunk_size = min_chunk_size << index;
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (free_[index].empty()) {
+    add_slab(index);
+  }
+  char* data = free_[index].back();
+  free_[index].pop_back();
+  used_bytes_.fetch_add(chunk_size, std::memory_order_relaxed);
+  return {data, chunk_size};
+}
+
+void buffer_pool::release(chunk c) {
+  if (c.data == nullptr) {
+    return;
+  }
+  used_bytes_.fetch_sub(c.size, std::memory_order_relaxed);
+  if (c.size > max_chunk_size) {
+    reserved_bytes_.fetch_sub(c.size, std::memory_order_relaxed);
+    ::operator delete(c.data);
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  free_[size_class(c.size)].push_back(c.data);
+}
+
+void buffer_pool::add_slab(std::size_t index) {
+  std::size_t chunk_size = min_chunk_size << index;
+  std::size_t size = std::max(huge_pages_ ? huge_slab_size : slab_size, chunk_size);
+  char* data;
+  if (arena_.size - arena_used_ >= size) {
+    data = static_cast<char*>(arena_.data) + arena_used_;
+    arena_used_ += size;
+  } else {
+    slab s = allocate_slab(size);
+    slabs_.push_back(s);
+    reserved_bytes_.fetch_add(size, std::memory_order_relaxed);
+    data = static_cast<char*>(s.data);
+  }
+
+  free_[index].reserve(free_[index].size() + size / chunk_size);
+  for (std::size_t offset = 0; offset + chunk_size <= size; offset += chunk_size) {
+    free_[index].push_back(data + offset);
+  }
+}
+
+buffer_pool::slab buffer_pool::allocate_slab(std::size_t size) {
+  if (huge_pages_) {
+    void* data = MAP_FAILED;
+#ifdef MAP_HUGETLB
+    data = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+    if (data == MAP_FAILED) {
+      // No huge pages are reserved, so transparent huge pages are the best that can be done.
+      data = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+#ifdef MADV_HUGEPAGE
+      if (data != MAP_FAILED) {
+        ::madvise(data, size, MADV_HUGEPAGE);
+      }
+#endif
+    }
+    if (data != MAP_FAILED) {
+      return {data, size, true};
+    }
+  }
+  return {::operator new(size), size, false};
+}
+
+void buffer_pool::free_slab(const slab& s) {
+  if (s.mapped) {
+    ::munmap(s.data, s.size);
+  } else {
+    ::operator delete(s.data);
+  }
+}
+
+}  // namespace util::buffer
@@ -0,0 +1,103 @@
+/*********************************************
+
+  Copyright (c) Jackson Nestelroad 2020
+  jackson.nestelroad.com
+
+*********************************************/
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+#include <vector>
+
+namespace util::buffer {
+
+// Pool of fixed-size buffer chunks carved out of large slabs.
+//
+// Chunk sizes are powers of two, so a buffer that keeps growing doubles in size and always finds a chunk of its new
+// size. Released chunks go back to a free list for their size and are handed out again before any new slab is
+// allocated. Slabs are only returned to the system when the pool is destroyed.
+//
+// Requests larger than the biggest chunk size are allocated on their own and freed as soon as they are released.
+//
+// The pool may allocate a single arena up front, which slabs are carved out of until it runs out. The arena is one
+// contiguous region, so it can be registered with the kernel once and used for fixed-buffer I/O.
+class buffer_pool {
+ public:
+  // A single buffer handed out by the pool.
+  struct chunk {
+    char* data = nullptr;
+    std::size_t size = 0;
+  };
+
+  static constexpr std::size_t min_chunk_size = 4 * 1024;
+  static constexpr std::size_t max_chunk_size = 1024 * 1024;
+
+  // Slabs are allocated with huge pages if requested, falling back to regular pages if none are available.
+  buffer_pool(bool huge_pages = false, std::size_t arena_size = 0);
+  ~buffer_pool();
+  buffer_pool(const buffer_pool& other) = delete;
+  buffer_pool& operator=(const buffer_pool& other) = delete;
+  buffer_pool(buffer_pool&& other) noexcept = delete;
+  buffer_pool& operator=(buffer_pool&& other) noexcept = delete;
+
+  // Returns a chunk of at least the given size.
+  chunk acquire(std::size_t size);
+
+  // Returns a chunk to the pool.
+  void release(chunk c);
+
+  // Returns the bytes allocated from the system, whether handed out or not.
+  inline std::size_t reserved_bytes() const { return reserved_bytes_.load(std::memory_order_relaxed); }
+
+  // Returns the bytes currently handed out.
+  inline std::size_t used_bytes() const { return used_bytes_.load(std::memory_order_relaxed); }
+
+  // Returns the arena allocated up front, which is empty if there is none.
+  inline chunk arena() const { return {static_cast<char*>(arena_.data), arena_.size}; }
+
+  // Checks if the memory lies within the arena.
+  inline bool in_arena(const void* data) const {
+    const char* base = static_cast<const char*>(arena_.data);
+    return base != nullptr && data >= base && static_cast<const char*>(data) < base + arena_.size;
+  }
+
+ private:
+  struct slab {
+    void* data;
+    std::size_t size;
+    // The slab was mapped directly rather than allocated from the heap.
+    bool mapped;
+  };
+
+  // Chunk sizes from min_chunk_size to max_chunk_size.
+  static constexpr std::size_t num_size_classes = 9;
+
+  static constexpr std::size_t slab_size = 256 * 1024;
+  static constexpr std::size_t huge_slab_size = 2 * 1024 * 1024;
+
+  static std::size_t size_class(std::size_t size);
+
+  // Allocates a new slab and adds all of its chunks to the free list of the size class.
+  void add_slab(std::size_t index);
+
+  slab allocate_slab(std::size_t size);
+  static void free_slab(const slab& s);
+
+  bool huge_pages_;
+
+  slab arena_;
+  std::size_t arena_used_;
+
+  std::mutex mutex_;
+  std::array<std::vector<char*>, num_size_classes> free_;
+  std::vector<slab> slabs_;
+
+  std::atomic<std::size_t> reserved_bytes_;
+  std::atomic<std::size_t> used_bytes_;
+};
+
+}  // namespace util::buffer
@@ -0,0 +1,80 @@
+/*********************************************
+
+  Copyright (c) Jackson Nestelroad 2020
+  jackson.nestelroad.com
+
+*********************************************/
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <utility>
+
+namespace util::buffer {
+
+// Running total of memory held by objects that charge it, shared by any number of threads.
+class memory_account {
+ public:
+  // Memory charged to an account for as long as it is held.
+  //
+  // The charge can be resized, and whatever is left is refunded when the reservation is destroyed.
+  class reservation {
+   public:
+    reservation() = default;
+    explicit reservation(std::shared_ptr<memory_account> account, std::size_t bytes = 0)
+        : account_(std::move(account)) {
+      set(bytes);
+    }
+    ~reservation() { set(0); }
+    reservation(const reservation& other) = delete;
+    reservation& operator=(const reservation& other) = delete;
+    reservation(reservation&& other) noexcept
+        : account_(std::move(other.account_)), bytes_(std::exchange(other.bytes_, 0)) {}
+    reservation& operator=(reservation&& other) noexcept {
+      if (this != &other) {
+        set(0);
+        account_ = std::move(other.account_);
+        bytes_ = std::exchange(other.bytes_, 0);
+      }
+      return *this;
+    }
+
+    // Changes the charge to the given number of bytes.
+    void set(std::size_t bytes) {
+      if (account_ != nullptr) {
+        if (bytes > bytes_) {
+          account_->charge(bytes - bytes_);
+        } else {
+          account_->refund(bytes_ - bytes);
+        }
+      }
+      bytes_ = bytes;
+    }
+
+    inline std::size_t bytes() const { return bytes_; }
+
+   private:
+    std::shared_ptr<memory_account> account_;
+    std::size_t bytes_ = 0;
+  };
+
+  memory_account() : bytes_(0) {}
+  ~memory_account() = default;
+  memory_account(const memory_account& other) = delete;
+  memory_account& operator=(const memory_account& other) = delete;
+  memory_account(memory_account&& other) noexcept = delete;
+  memory_account& operator=(memory_account&& other) noexcept = delete;
+
+  inline void charge(std::size_t bytes) { bytes_.fetch_add(bytes, std::memory_order_relaxed); }
+  inline void refund(std::size_t bytes) { bytes_.fetch_sub(bytes, std::memory_order_relaxed); }
+
+  // Returns the bytes currently charged.
+  inline std::size_t bytes() const { return bytes_.load(std::memory_order_relaxed); }
+
+ private:
+  std::atomic<std::size_t> bytes_;
+};
+
+}  // namespace util::buffer
@@ -11,6 +11,7 @@
 
 #include <algorithm>
 #include <boost/asio/buffer.hpp>
+#include <limits>
 #include <memory>
 #include <stdexcept>
 #include <streambuf>
@@ -19,7 +20,9 @@
 #include <utility>
 #include <vector>
 
+#include "aether/util/buffer_pool.hpp"
 #include "aether/util/console.hpp"
+#include "aether/util/memory_account.hpp"
 
 namespace util::buffer {
 
@@ -70,27 +73,44 @@ using const_buffer_sequence = std::vector<const_buffer>;
 // Uses logic from boost::asio::streambuf with a few minor tweaks and additions:
 // - Move semantics.
 // - std::string_view support.
+// - Storage from a shared buffer pool, which grows geometrically and can be given back while the buffer is empty.
+// - Accounting of the storage held against a shared memory account.
+//
+// Storage is allocated lazily, so an unused buffer holds no memory.
 template <typename Allocator = std::allocator<char>>
 class basic_streambuf : public std::streambuf {
  public:
   explicit basic_streambuf(std::size_t max_size = std::numeric_limits<std::size_t>::max(),
                            const Allocator& allocator = Allocator())
-      : max_size_(max_size), buffer_(allocator) {
-    std::size_t pend = std::min<std::size_t>(max_size_, buffer_delta);
-    buffer_.resize(std::max<std::size_t>(pend, 1));
-    setg(&buffer_[0], &buffer_[0], &buffer_[0]);
-    setp(&buffer_[0], &buffer_[0] + pend);
+      : max_size_(max_size), allocator_(allocator) {
+    setg(nullptr, nullptr, nullptr);
+    setp(nullptr, nullptr);
   }
 
-  basic_streambuf(basic_streambuf&& other) noexcept { this->operator=(std::move(other)); }
+  ~basic_streambuf() { deallocate(); }
+
+  basic_streambuf(basic_streambuf&& other) noexcept : max_size_(other.max_size_), allocator_(other.allocator_) {
+    this->operator=(std::move(other));
+  }
 
   basic_streambuf& operator=(basic_streambuf&& other) noexcept {
     if (this != &other) {
+      deallocate();
       max_size_ = other.max_size_;
-      buffer_ = std::move(other.buffer_);
-
-      // Update internal pointers
-      swap(other);
+      allocator_ = other.allocator_;
+      pool_ = other.pool_;
+      storage_pool_ = std::move(other.storage_pool_);
+      account_ = other.account_;
+      storage_account_ = std::move(other.storage_account_);
+      data_ = std::exchange(other.data_, nullptr);
+      capacity_ = std::exchange(other.capacity_, 0);
+
+      // Take over the internal pointers.
+      setg(other.eback(), other.gptr(), other.egptr());
+      setp(other.pbase(), other.epptr());
+      pbump(static_cast<int>(other.pptr() - other.pbase()));
+      other.setg(nullptr, nullptr, nullptr);
+      other.setp(nullptr, nullptr);
     }
     return *this;
   }
@@ -104,11 +124,32 @@ class basic_streambuf : public std::streambuf {
     }
   }
 
+  // Sets the pool new storage is taken from, or the allocator if nullptr.
+  //
+  // Storage already held goes back to where it came from.
+  void set_pool(std::shared_ptr<buffer_pool> pool) { pool_ = std::move(pool); }
+
+  // Sets the account new storage is charged to, or none if nullptr.
+  //
+  // Storage already held stays charged to the account it was charged to.
+  void set_account(std::shared_ptr<memory_account> account) { account_ = std::move(account); }
+
   // Clears all data from the input sequence.
   void reset() { consume(size()); }
 
-  // Reinitializes this object to the initial state.
-  void make_new() { this->operator=(basic_streambuf{}); }
+  // Reinitializes this object to the initial state, giving back its storage.
+  void make_new() {
+    deallocate();
+    setg(nullptr, nullptr, nullptr);
+    setp(nullptr, nullptr);
+  }
+
+  // Gives back the storage if the buffer holds no data, so an idle buffer holds no memory.
+  void release_if_empty() {
+    if (size() == 0) {
+      make_new();
+    }
+  }
 
   // Returns the size of the input sequence.
   std::size_t size() const noexcept { return pptr() - gptr(); }
@@ -117,7 +158,7 @@ class basic_streambuf : public std::streambuf {
   std::size_t max_size() const noexcept { return max_size_; }
 
   // Returns the current capacity of the buffer.
-  std::size_t capacity() const noexcept { return buffer_.capacity(); }
+  std::size_t capacity() const noexcept { return capacity_; }
 
   // Returns a constant view of the input sequence.
   const_buffer data() const noexcept { return {gptr(), size() * sizeof(char_type)}; }
@@ -151,7 +192,7 @@ class basic_streambuf : public std::streambuf {
   // Removes characters from the input sequence.
   void consume(std::size_t n) {
     if (egptr() < pptr()) {
-      setg(&buffer_[0], gptr(), pptr());
+      setg(data_, gptr(), pptr());
     }
     if (gptr() + n > pptr()) {
       n = size();
@@ -173,7 +214,7 @@ class basic_streambuf : public std::streambuf {
 
   int_type underflow() {
     if (gptr() < pptr()) {
-      setg(&buffer_[0], gptr(), pptr());
+      setg(data_, gptr(), pptr());
       return traits_type::to_int_type(*gptr());
     } else {
       return traits_type::eof();
@@ -201,9 +242,9 @@ class basic_streambuf : public std::streambuf {
 
   void reserve(std::size_t n) {
     // Get current stream positions as offsets.
-    std::size_t gnext = gptr() - &buffer_[0];
-    std::size_t pnext = pptr() - &buffer_[0];
-    std::size_t pend = epptr() - &buffer_[0];
+    std::size_t gnext = gptr() - data_;
+    std::size_t pnext = pptr() - data_;
+    std::size_t pend = epptr() - data_;
 
     // Check if there is already enough space in the put area.
     if (n <= pend - pnext) {
@@ -213,27 +254,92 @@ class basic_streambuf : public std::streambuf {
     // Shift get area to the start of buffer.
     if (gnext > 0) {
       pnext -= gnext;
-      std::memmove(&buffer_[0], &buffer_[0] + gnext, pnext);
+      std::memmove(data_, data_ + gnext, pnext);
     }
 
     // Ensure buffer is large enough to hold at least the specified size.
     if (n > pend - pnext) {
       if (n <= max_size_ && pnext <= max_size_ - n) {
-        pend = pnext + n;
-        buffer_.resize(std::max<std::size_t>(pend, 1));
+        if (pnext + n > capacity_) {
+          grow(pnext, pnext + n);
+        }
+        // The whole capacity is made available, so small writes do not have to come back here.
+        pend = std::min(capacity_, max_size_);
       } else {
         throw std::length_error{"streambuf too long"};
       }
     }
 
     // Update stream positions
-    setg(&buffer_[0], &buffer_[0], &buffer_[0] + pnext);
-    setp(&buffer_[0] + pnext, &buffer_[0] + pend);
+    setg(data_, data_, data_ + pnext);
+    setp(data_ + pnext, data_ + pend);
   }
 
  private:
+  // Moves the first used bytes into new storage of at least the required size.
+  //
+  // Capacity at least doubles, so a buffer written to piece by piece is only copied a logarithmic number of times.
+  void grow(std::size_t used, std::size_t required) {
+    std::size_t wanted = std::max({required, capacity_ * 2, buffer_delta});
+    char_type* data = nullptr;
+    std::size_t capacity = 0;
+    if (pool_) {
+      buffer_pool::chunk c = pool_->acquire(wanted);
+      data = c.data;
+      capacity = c.size;
+    } else {
+      data = std::allocator_traits<Allocator>::allocate(allocator_, wanted);
+      capacity = wanted;
+    }
+    if (used > 0) {
+      std::memcpy(data, data_, used);
+    }
+    deallocate();
+    data_ = data;
+    capacity_ = capacity;
+    storage_pool_ = pool_;
+    storage_account_ = account_;
+    if (storage_account_) {
+      storage_account_->charge(capacity_);
+    }
+  }
+
+  // Gives back the storage to the pool or allocator it came from.
+  void deallocate() {
+    if (data_ == nullptr) {
+      return;
+    }
+    if (storage_pool_) {
+      storage_pool_->release({data_, capacity_});
+    } else {
+      std::allocator_traits<Allocator>::deallocate(allocator_, data_, capacity_);
+    }
+    if (storage_account_) {
+      storage_account_->refund(capacity_);
+    }
+    storage_pool_.reset();
+    storage_account_.reset();
+    data_ = nullptr;
+    capacity_ = 0;
+  }
+
   std::size_t max_size_;
-  std::vector<std::streambuf::char_type, Allocator> buffer_;
+  Allocator allocator_;
+
+  // Pool new storage is taken from.
+  std::shared_ptr<buffer_pool> pool_;
+
+  // Pool the current storage was taken from, which keeps the pool alive while the storage is held.
+  std::shared_ptr<buffer_pool> storage_pool_;
+
+  // Account new storage is charged to.
+  std::shared_ptr<memory_account> account_;
+
+  // Account the current storage was charged to.
+  std::shared_ptr<memory_account> storage_account_;
+
+  char_type* data_ = nullptr;
+  std::size_t capacity_ = 0;
 
   basic_streambuf(const basic_streambuf& other) = delete;
   basic_streambuf& operator=(const basic_streambuf& other) = delete;
@@ -0,0 +1,164 @@
+/*********************************************
+
+  Copyright (c) Jackson Nestelroad 2020
+  jackson.nestelroad.com
+
+*********************************************/
+
+#include "timing_wheel.hpp"
+
+#include <algorithm>
+#include <boost/asio.hpp>
+#include <chrono>
+#include <cstdint>
+#include <utility>
+
+namespace util {
+
+timing_wheel::entry::~entry() {
+  if (wheel_ != nullptr) {
+    wheel_->cancel(*this);
+  }
+}
+
+timing_wheel::timing_wheel(boost::asio::io_context& ioc, std::chrono::milliseconds resolution)
+    : timer_(ioc),
+      epoch_(std::chrono::steady_clock::now()),
+      resolution_(resolution),
+      now_(0),
+      size_(0),
+      ticking_(false) {}
+
+timing_wheel::~timing_wheel() {
+  // Entries may outlive the wheel, so they are detached without calling their handlers.
+  for (std::array<node, num_slots>& level : slots_) {
+    for (node& slot : level) {
+      while (slot.next != &slot) {
+        entry& e = static_cast<entry&>(*slot.next);
+        unlink(e);
+        e.wheel_ = nullptr;
+        e.handler_ = nullptr;
+      }
+    }
+  }
+}
+
+void timing_wheel::link(node& slot, node& n) {
+  n.prev = slot.prev;
+  n.next = &slot;
+  slot.prev->next = &n;
+  slot.prev = &n;
+}
+
+void timing_wheel::unlink(node& n) {
+  n.prev->next = n.next;
+  n.next->prev = n.prev;
+  n.prev = &n;
+  n.next = &n;
+}
+
+std::uint64_t timing_wheel::current_tick() const {
+  return static_cast<std::uint64_t>((std::chrono::steady_clock::now() - epoch_) / resolution_);
+}
+
+void timing_wheel::schedule(entry& e, std::chrono::milliseconds delay, callback_t handler) {
+  if (e.wheel_ != nullptr) {
+    cancel(e);
+  }
+  if (!ticking_) {
+    // Nothing is scheduled, so the wheel can skip straight to the current time.
+    now_ = current_tick();
+  }
+
+  // The current tick has partly passed, so one more tick makes sure the entry does not fire early.
+  std::uint64_t ticks = static_cast<std::uint64_t>((delay + resolution_ - std::chrono::nanoseconds(1)) / resolution_);
+  e.expiry_ = std::min(current_tick() + 1 + ticks, now_ + max_ticks);
+  e.handler_ = std::move(handler);
+  e.wheel_ = this;
+  place(e);
+  ++size_;
+
+  if (!ticking_) {
+    ticking_ = true;
+    schedule_tick();
+  }
+}
+
+void timing_wheel::cancel(entry& e) {
+  if (e.wheel_ != this) {
+    return;
+  }
+  unlink(e);
+  e.wheel_ = nullptr;
+  e.handler_ = nullptr;
+  --size_;
+}
+
+void timing_wheel::place(entry& e) {
+  std::uint64_t remaining = e.expiry_ - now_;
+  std::size_t level = 0;
+  while (level + 1 < num_levels && remaining >= (std::uint64_t(1) << (slot_bits * (level + 1)))) {
+    ++level;
+  }
+  link(slots_[level][(e.expiry_ >> (slot_bits * level)) & (num_slots - 1)], e);
+}
+
+void timing_wheel::advance() {
+  ++now_;
+
+  // Higher levels move down first, since their entries may land in slots of lower levels that are due now.
+  std::size_t due_levels = 1;
+  while (due_levels < num_levels && (now_ & ((std::uint64_t(1) << (slot_bits * due_levels)) - 1)) == 0) {
+    ++due_levels;
+  }
+  for (std::size_t level = due_levels - 1; level > 0; --level) {
+    cascade(level);
+  }
+
+  // Handlers may schedule or cancel other entries, so the slot is emptied one entry at a time.
+  node& slot = slots_[0][now_ & (num_slots - 1)];
+  while (slot.next != &slot) {
+    entry& e = static_cast<entry&>(*slot.next);
+    unlink(e);
+    e.wheel_ = nullptr;
+    --size_;
+    callback_t handler = std::move(e.handler_);
+    handler();
+  }
+}
+
+void timing_wheel::cascade(std::size_t level) {
+  // Entries of the slot are now closer than the span of one slot of this level, so none of them come back to it.
+  node& slot = slots_[level][(now_ >> (slot_bits * level)) & (num_slots - 1)];
+  while (slot.next != &slot) {
+    entry& e = static_cast<entry&>(*slot.next);
+    unlink(e);
+    place(e);
+  }
+}
+
+void timing_wheel::schedule_tick() {
+  timer_.expires_at(epoch_ + resolution_ * (now_ + 1));
+  timer_.async_wait([this](const boost::system::error_code& error) { on_tick(error); });
+}
+
+void timing_wheel::on_tick(const boost::system::error_code& error) {
+  // The timer is canceled when the wheel is destroyed, so the wheel must not be touched.
+  if (error == boost::asio::error::operation_aborted) {
+    return;
+  }
+
+  // A late tick catches up on every tick it missed.
+  std::uint64_t target = current_tick();
+  while (now_ < target && size_ > 0) {
+    advance();
+  }
+
+  if (size_ > 0) {
+    schedule_tick();
+  } else {
+    ticking_ = false;
+  }
+}
+
+}  // namespace util
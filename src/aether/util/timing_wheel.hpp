@@ -0,0 +1,120 @@
+/*********************************************
+
+  Copyright (c) Jackson Nestelroad 2020
+  jackson.nestelroad.com
+
+*********************************************/
+
+#pragma once
+
+#include <array>
+#include <boost/asio.hpp>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+#include "aether/util/any_invocable.hpp"
+
+namespace util {
+
+// Hierarchical timing wheel for coarse timeouts on a single io_context.
+//
+// Time advances in ticks of a fixed resolution. Each level of the wheel has 64 slots, and each slot of a level spans
+// all 64 slots of the level below it. Timers are kept in intrusive lists, so scheduling and canceling are constant-time
+// pointer operations that never allocate. Timers on a higher level move down a level as their slot comes up.
+//
+// A single timer on the io_context drives the wheel, and only runs while timers are scheduled. Timers fire up to one
+// tick late, but never early.
+//
+// Not thread-safe. The wheel must only be used on the thread running its io_context.
+class timing_wheel {
+ public:
+  using callback_t = util::any_invocable<void()>;
+
+ private:
+  // Link in a circular, doubly-linked list. Each slot has one that is never removed.
+  struct node {
+    node* prev;
+    node* next;
+
+    node() : prev(this), next(this) {}
+  };
+
+ public:
+  // A single timer, owned by the caller.
+  //
+  // Cancels itself when destroyed.
+  class entry : private node {
+   public:
+    entry() = default;
+    ~entry();
+    entry(const entry& other) = delete;
+    entry& operator=(const entry& other) = delete;
+    entry(entry&& other) noexcept = delete;
+    entry& operator=(entry&& other) noexcept = delete;
+
+    inline bool scheduled() const { return wheel_ != nullptr; }
+
+   private:
+    timing_wheel* wheel_ = nullptr;
+    std::uint64_t expiry_ = 0;
+    callback_t handler_;
+
+    friend class timing_wheel;
+  };
+
+  timing_wheel(boost::asio::io_context& ioc, std::chrono::milliseconds resolution);
+  ~timing_wheel();
+  timing_wheel(const timing_wheel& other) = delete;
+  timing_wheel& operator=(const timing_wheel& other) = delete;
+  timing_wheel(timing_wheel&& other) noexcept = delete;
+  timing_wheel& operator=(timing_wheel&& other) noexcept = delete;
+
+  // Schedules the entry to call the handler once the delay has passed, replacing any earlier schedule.
+  void schedule(entry& e, std::chrono::milliseconds delay, callback_t handler);
+
+  // Cancels the entry, so its handler is never called.
+  void cancel(entry& e);
+
+  // Returns the number of scheduled entries.
+  inline std::size_t size() const { return size_; }
+
+ private:
+  static constexpr std::size_t slot_bits = 6;
+  static constexpr std::size_t num_slots = 1 << slot_bits;
+  static constexpr std::size_t num_levels = 4;
+
+  // Entries further out than every level can hold are clamped to the last slot of the last level.
+  static constexpr std::uint64_t max_ticks = (std::uint64_t(1) << (slot_bits * num_levels)) - 1;
+
+  static void link(node& slot, node& n);
+  static void unlink(node& n);
+
+  // Returns the tick the current time falls in.
+  std::uint64_t current_tick() const;
+
+  // Places a scheduled entry in the slot for its expiry.
+  void place(entry& e);
+
+  // Advances the wheel by one tick, moving entries down a level and firing expired entries.
+  void advance();
+
+  // Moves every entry of a slot down to the level it now belongs to.
+  void cascade(std::size_t level);
+
+  void schedule_tick();
+  void on_tick(const boost::system::error_code& error);
+
+  boost::asio::steady_timer timer_;
+  std::chrono::steady_clock::time_point epoch_;
+  std::chrono::steady_clock::duration resolution_;
+
+  std::array<std::array<node, num_slots>, num_levels> slots_;
+
+  // The last tick the wheel has advanced to.
+  std::uint64_t now_;
+  std::size_t size_;
+  bool ticking_;
+};
+
+}  // namespace util